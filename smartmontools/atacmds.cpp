@@ -15,6 +15,7 @@
 #define __STDC_FORMAT_MACROS 1 // enable PRI* for C++
 
 #include <inttypes.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
@@ -144,6 +145,49 @@ const char * const map_old_vendor_opts[][2] = {
 
 const unsigned num_old_vendor_opts = sizeof(map_old_vendor_opts)/sizeof(map_old_vendor_opts[0]);
 
+bool ata_vendor_attr_defs::entry::operator==(const entry & x) const
+{
+  return (   name == x.name && raw_format == x.raw_format
+          && priority == x.priority && flags == x.flags
+          && !strcmp(byteorder, x.byteorder));
+}
+
+ata_vendor_attr_defs::ata_vendor_attr_defs()
+{
+  // All default tables share one empty table
+  static const std::shared_ptr<table> empty_table = std::make_shared<table>();
+  m_defs = empty_table;
+}
+
+bool ata_vendor_attr_defs::operator==(const ata_vendor_attr_defs & x) const
+{
+  if (m_defs == x.m_defs)
+    return true;
+  for (int id = 0; id < 256; id++) {
+    if (!(m_defs->e[id] == x.m_defs->e[id]))
+      return false;
+  }
+  return true;
+}
+
+void ata_vendor_attr_defs::detach()
+{
+  if (m_defs.use_count() > 1)
+    m_defs = std::make_shared<table>(*m_defs);
+}
+
+void ata_intern_attr_defs(ata_vendor_attr_defs & defs,
+                          std::vector<ata_vendor_attr_defs> & pool)
+{
+  for (const ata_vendor_attr_defs & d : pool) {
+    if (d == defs) {
+      defs = d;
+      return;
+    }
+  }
+  pool.push_back(defs);
+}
+
 // Parse vendor attribute display def (-v option).
 // Return false on error.
 bool parse_attribute_def(const char * opt, ata_vendor_attr_defs & defs,
@@ -425,6 +469,32 @@ static void prettyprint(const unsigned char *p, const char *name){
   pout("===== [%s] DATA END (512 Bytes) =====\n\n", name);
 }
 
+// Call ATA pass-through and record command statistics.
+// Returns duration in '*duration_usec' if specified.
+static bool ata_pass_through_stats(ata_device * device, const ata_cmd_in & in,
+  ata_cmd_out & out, long long * duration_usec = nullptr)
+{
+  unsigned char cmd = in.in_regs.command;
+  unsigned opcode = (cmd << 8) | (cmd == ATA_SMART_CMD ? (unsigned char)in.in_regs.features : 0);
+
+  pout_flush();
+  long long start_usec = get_timer_usec();
+  bool ok = device->ata_pass_through(in, out);
+  long long duration = (start_usec >= 0 ? get_timer_usec() - start_usec : -1);
+
+  device->add_cmd_stats(smart_device::cmd_stats_key(smart_device::cmd_ata, opcode), ok, duration);
+  if (duration_usec)
+    *duration_usec = duration;
+  return ok;
+}
+
+// Version without output parameters.
+static bool ata_pass_through_stats(ata_device * device, const ata_cmd_in & in)
+{
+  ata_cmd_out out;
+  return ata_pass_through_stats(device, in, out);
+}
+
 // This function provides the pretty-print reporting for SMART
 // commands: it implements the various -r "reporting" options for ATA
 // ioctls.
@@ -563,15 +633,11 @@ int smartcommandhandler(ata_device * device, smart_command_set command, int sele
 
     ata_cmd_out out;
 
-    auto start_usec = (ata_debugmode ? get_timer_usec() : -1);
-
-    bool ok = device->ata_pass_through(in, out);
+    long long duration_usec = -1;
+    bool ok = ata_pass_through_stats(device, in, out, &duration_usec);
 
-    if (start_usec >= 0) {
-      auto duration_usec = get_timer_usec() - start_usec;
-      if (duration_usec > 0)
-        pout(" [Duration: %.6fs]\n", duration_usec / 1000000.0);
-    }
+    if (ata_debugmode && duration_usec > 0)
+      pout(" [Duration: %.6fs]\n", duration_usec / 1000000.0);
 
     if (ata_debugmode && out.out_regs.is_set())
       print_regs(" Output: ", out.out_regs);
@@ -792,7 +858,7 @@ bool ata_nodata_command(ata_device * device, unsigned char command,
   if (sector_count >= 0)
     in.in_regs.sector_count = sector_count;
 
-  return device->ata_pass_through(in);
+  return ata_pass_through_stats(device, in);
 }
 
 // Issue SET FEATURES command with optional sector count register value
@@ -805,7 +871,7 @@ bool ata_set_features(ata_device * device, unsigned char features,
   if (sector_count >= 0)
     in.in_regs.sector_count = sector_count;
 
-  return device->ata_pass_through(in);
+  return ata_pass_through_stats(device, in);
 }
 
 // Reads current Device Identity info (512 bytes) into buf.  Returns 0
@@ -1088,7 +1154,7 @@ bool ataWriteLogExt(ata_device * device, unsigned char logaddr,
   in.set_data_out(data, nsectors);
 
   ata_cmd_out out;
-  if (!device->ata_pass_through(in, out)) { // TODO: Debug output
+  if (!ata_pass_through_stats(device, in, out)) { // TODO: Debug output
     if (nsectors <= 1) {
       pout("ATA_WRITE_LOG_EXT (addr=0x%02x, page=%u, n=%u) failed: %s\n",
            logaddr, page, nsectors, device->get_errmsg());
@@ -1107,10 +1173,10 @@ bool ataWriteLogExt(ata_device * device, unsigned char logaddr,
   return true;
 }
 
-// Read GP Log page(s)
-bool ataReadLogExt(ata_device * device, unsigned char logaddr,
-                   unsigned char features, unsigned page,
-                   void * data, unsigned nsectors)
+// Read GP Log page(s) with one command
+static bool ataReadLogExt_1(ata_device * device, unsigned char logaddr,
+                            unsigned char features, unsigned page,
+                            void * data, unsigned nsectors)
 {
   ata_cmd_in in;
   in.in_regs.command      = ATA_READ_LOG_EXT;
@@ -1119,23 +1185,45 @@ bool ataReadLogExt(ata_device * device, unsigned char logaddr,
   in.in_regs.lba_low      = logaddr;
   in.in_regs.lba_mid_16   = page;
 
-  if (!device->ata_pass_through(in)) { // TODO: Debug output
-    if (nsectors <= 1) {
-      pout("ATA_READ_LOG_EXT (addr=0x%02x:0x%02x, page=%u, n=%u) failed: %s\n",
-           logaddr, features, page, nsectors, device->get_errmsg());
-      return false;
-    }
+  return ata_pass_through_stats(device, in); // TODO: Debug output
+}
 
-    // Recurse to retry with single sectors,
-    // multi-sector reads may not be supported by ioctl.
-    for (unsigned i = 0; i < nsectors; i++) {
-      if (!ataReadLogExt(device, logaddr,
-                         features, page + i,
-                         (char *)data + 512*i, 1))
-        return false;
+// Read GP Log page(s)
+bool ataReadLogExt(ata_device * device, unsigned char logaddr,
+                   unsigned char features, unsigned page,
+                   void * data, unsigned nsectors)
+{
+  // Limit number of sectors per command if a previous
+  // multi-sector read failed
+  unsigned max_ns = device->get_max_log_sectors(true);
+  unsigned i = 0, ns = 0;
+  while (i < nsectors) {
+    ns = nsectors - i;
+    if (max_ns && ns > max_ns)
+      ns = max_ns;
+    if (ataReadLogExt_1(device, logaddr, features, page + i, (char *)data + 512*i, ns)) {
+      i += ns;
+      continue;
     }
+    if (ns <= 1)
+      break;
+
+    // Retry with single sector, multi-sector reads may not be supported
+    // by ioctl or bridge.  If this works, remember a lower limit.
+    unsigned failed_ns = ns;
+    ns = 1;
+    if (!ataReadLogExt_1(device, logaddr, features, page + i, (char *)data + 512*i, ns))
+      break;
+    max_ns = failed_ns / 2;
+    device->set_max_log_sectors(true, max_ns);
+    i++;
   }
 
+  if (i < nsectors) {
+    pout("ATA_READ_LOG_EXT (addr=0x%02x:0x%02x, page=%u, n=%u) failed: %s\n",
+         logaddr, features, page + i, ns, device->get_errmsg());
+    return false;
+  }
   return true;
 }
 
@@ -1143,6 +1231,15 @@ bool ataReadLogExt(ata_device * device, unsigned char logaddr,
 bool ataReadSmartLog(ata_device * device, unsigned char logaddr,
                      void * data, unsigned nsectors)
 {
+  // SMART READ LOG always starts at first sector, so the read
+  // cannot be split if the number of sectors is limited
+  unsigned max_ns = device->get_max_log_sectors(false);
+  if (max_ns && nsectors > max_ns) {
+    device->set_err(ENOSYS, "Read of %u sectors not supported (max %u)", nsectors, max_ns);
+    pout("ATA_SMART_READ_LOG failed: %s\n", device->get_errmsg());
+    return false;
+  }
+
   ata_cmd_in in;
   in.in_regs.command  = ATA_SMART_CMD;
   in.in_regs.features = ATA_SMART_READ_LOG_SECTOR;
@@ -1151,7 +1248,15 @@ bool ataReadSmartLog(ata_device * device, unsigned char logaddr,
   in.in_regs.lba_mid  = SMART_CYL_LOW;
   in.in_regs.lba_low  = logaddr;
 
-  if (!device->ata_pass_through(in)) { // TODO: Debug output
+  if (!ata_pass_through_stats(device, in)) { // TODO: Debug output
+    if (nsectors > 1) {
+      // Check whether single sector read works, remember a lower limit if so
+      smart_device::error_info err = device->get_err();
+      in.set_data_in(data, 1);
+      if (ata_pass_through_stats(device, in))
+        device->set_max_log_sectors(false, nsectors / 2);
+      device->set_err(err);
+    }
     pout("ATA_SMART_READ_LOG failed: %s\n", device->get_errmsg());
     return false;
   }
@@ -1842,47 +1947,54 @@ ata_attr_state ata_get_attr_state(const ata_smart_attribute & attr,
   return ATTRSTATE_OK;
 }
 
-// Get attribute raw value.
-uint64_t ata_get_attr_raw_value(const ata_smart_attribute & attr,
-                                const ata_vendor_attr_defs & defs)
+// Return byte order string of attribute.
+static const char * get_attr_byteorder(const ata_vendor_attr_defs::entry & def)
 {
-  const ata_vendor_attr_defs::entry & def = defs[attr.id];
   // TODO: Allow Byteorder in DEFAULT entry
 
   // Use default byteorder if not specified
-  const char * byteorder = def.byteorder;
-  if (!*byteorder) {
-    switch (def.raw_format) {
-      case RAWFMT_RAW64:
-      case RAWFMT_HEX64:
-        byteorder = "543210wv"; break;
-      case RAWFMT_RAW56:
-      case RAWFMT_HEX56:
-      case RAWFMT_RAW24_DIV_RAW32:
-      case RAWFMT_MSEC24_HOUR32:
-        byteorder = "r543210"; break;
-      default:
-        byteorder = "543210"; break;
-    }
+  if (*def.byteorder)
+    return def.byteorder;
+  switch (def.raw_format) {
+    case RAWFMT_RAW64:
+    case RAWFMT_HEX64:
+      return "543210wv";
+    case RAWFMT_RAW56:
+    case RAWFMT_HEX56:
+    case RAWFMT_RAW24_DIV_RAW32:
+    case RAWFMT_MSEC24_HOUR32:
+      return "r543210";
+    default:
+      return "543210";
+  }
+}
+
+// Return offset of byte order character in ata_smart_attribute,
+// -1 for zero byte.
+static int get_attr_byte_offset(char c)
+{
+  switch (c) {
+    case '0': case '1': case '2': case '3': case '4': case '5':
+                return offsetof(ata_smart_attribute, raw) + (c - '0');
+    case 'r': return offsetof(ata_smart_attribute, reserv);
+    case 'v': return offsetof(ata_smart_attribute, current);
+    case 'w': return offsetof(ata_smart_attribute, worst);
+    default : return -1;
   }
+}
+
+// Get attribute raw value.
+uint64_t ata_get_attr_raw_value(const ata_smart_attribute & attr,
+                                const ata_vendor_attr_defs & defs)
+{
+  const char * byteorder = get_attr_byteorder(defs[attr.id]);
 
   // Build 64-bit value from selected bytes
+  const unsigned char * p = reinterpret_cast<const unsigned char *>(&attr);
   uint64_t rawvalue = 0;
   for (int i = 0; byteorder[i]; i++) {
-    unsigned char b;
-    switch (byteorder[i]) {
-      case '0': b = attr.raw[0];  break;
-      case '1': b = attr.raw[1];  break;
-      case '2': b = attr.raw[2];  break;
-      case '3': b = attr.raw[3];  break;
-      case '4': b = attr.raw[4];  break;
-      case '5': b = attr.raw[5];  break;
-      case 'r': b = attr.reserv;  break;
-      case 'v': b = attr.current; break;
-      case 'w': b = attr.worst;   break;
-      default : b = 0;            break;
-    }
-    rawvalue <<= 8; rawvalue |= b;
+    int offs = get_attr_byte_offset(byteorder[i]);
+    rawvalue <<= 8; rawvalue |= (offs >= 0 ? p[offs] : 0);
   }
 
   return rawvalue;
@@ -1916,13 +2028,25 @@ static bool check_temp_range(int t, unsigned char ut1, unsigned char ut2,
   return false;
 }
 
-// Format attribute raw value.
-std::string ata_format_attr_raw_value(const ata_smart_attribute & attr,
-                                      const ata_vendor_attr_defs & defs)
+// Return print format of attribute, never RAWFMT_DEFAULT.
+static ata_attr_raw_format get_attr_raw_format(unsigned char id,
+                                               const ata_vendor_attr_defs & defs)
 {
-  // Get 48 bit or 64 bit raw value
-  uint64_t rawvalue = ata_get_attr_raw_value(attr, defs);
+  ata_attr_raw_format format = defs[id].raw_format;
+  if (format == RAWFMT_DEFAULT) {
+     // Get format from DEFAULT entry
+     format = get_default_attr_defs()[id].raw_format;
+     if (format == RAWFMT_DEFAULT)
+       // Unknown Attribute
+       format = RAWFMT_RAW48;
+  }
+  return format;
+}
 
+// Format attribute raw value into buffer.
+static void format_attr_raw_value(char * buf, unsigned size, uint64_t rawvalue,
+                                  ata_attr_raw_format format)
+{
   // Split into bytes and words
   unsigned char raw[6];
   raw[0] = (unsigned char) rawvalue;
@@ -1936,71 +2060,64 @@ std::string ata_format_attr_raw_value(const ata_smart_attribute & attr,
   word[1] = raw[2] | (raw[3] << 8);
   word[2] = raw[4] | (raw[5] << 8);
 
-  // Get print format
-  ata_attr_raw_format format = defs[attr.id].raw_format;
-  if (format == RAWFMT_DEFAULT) {
-     // Get format from DEFAULT entry
-     format = get_default_attr_defs()[attr.id].raw_format;
-     if (format == RAWFMT_DEFAULT)
-       // Unknown Attribute
-       format = RAWFMT_RAW48;
-  }
-
   // Print
-  std::string s;
   switch (format) {
   case RAWFMT_RAW8:
-    s = strprintf("%d %d %d %d %d %d",
+    snprintf(buf, size, "%d %d %d %d %d %d",
       raw[5], raw[4], raw[3], raw[2], raw[1], raw[0]);
     break;
 
   case RAWFMT_RAW16:
-    s = strprintf("%u %u %u", word[2], word[1], word[0]);
+    snprintf(buf, size, "%u %u %u", word[2], word[1], word[0]);
     break;
 
   case RAWFMT_RAW48:
   case RAWFMT_RAW56:
   case RAWFMT_RAW64:
-    s = strprintf("%" PRIu64, rawvalue);
+    snprintf(buf, size, "%" PRIu64, rawvalue);
     break;
 
   case RAWFMT_HEX48:
-    s = strprintf("0x%012" PRIx64, rawvalue);
+    snprintf(buf, size, "0x%012" PRIx64, rawvalue);
     break;
 
   case RAWFMT_HEX56:
-    s = strprintf("0x%014" PRIx64, rawvalue);
+    snprintf(buf, size, "0x%014" PRIx64, rawvalue);
     break;
 
   case RAWFMT_HEX64:
-    s = strprintf("0x%016" PRIx64, rawvalue);
+    snprintf(buf, size, "0x%016" PRIx64, rawvalue);
     break;
 
   case RAWFMT_RAW16_OPT_RAW16:
-    s = strprintf("%u", word[0]);
     if (word[1] || word[2])
-      s += strprintf(" (%u %u)", word[2], word[1]);
+      snprintf(buf, size, "%u (%u %u)", word[0], word[2], word[1]);
+    else
+      snprintf(buf, size, "%u", word[0]);
     break;
 
   case RAWFMT_RAW16_OPT_AVG16:
-    s = strprintf("%u", word[0]);
     if (word[1])
-      s += strprintf(" (Average %u)", word[1]);
+      snprintf(buf, size, "%u (Average %u)", word[0], word[1]);
+    else
+      snprintf(buf, size, "%u", word[0]);
     break;
 
   case RAWFMT_RAW24_OPT_RAW8:
-    s = strprintf("%u", (unsigned)(rawvalue & 0x00ffffffULL));
     if (raw[3] || raw[4] || raw[5])
-      s += strprintf(" (%d %d %d)", raw[5], raw[4], raw[3]);
+      snprintf(buf, size, "%u (%d %d %d)", (unsigned)(rawvalue & 0x00ffffffULL),
+               raw[5], raw[4], raw[3]);
+    else
+      snprintf(buf, size, "%u", (unsigned)(rawvalue & 0x00ffffffULL));
     break;
 
   case RAWFMT_RAW24_DIV_RAW24:
-    s = strprintf("%u/%u",
+    snprintf(buf, size, "%u/%u",
       (unsigned)(rawvalue >> 24), (unsigned)(rawvalue & 0x00ffffffULL));
     break;
 
   case RAWFMT_RAW24_DIV_RAW32:
-    s = strprintf("%u/%u",
+    snprintf(buf, size, "%u/%u",
       (unsigned)(rawvalue >> 32), (unsigned)(rawvalue & 0xffffffffULL));
     break;
 
@@ -2010,9 +2127,10 @@ std::string ata_format_attr_raw_value(const ata_smart_attribute & attr,
       int64_t temp = word[0]+(word[1]<<16);
       int64_t tmp1 = temp/60;
       int64_t tmp2 = temp%60;
-      s = strprintf("%" PRIu64 "h+%02" PRIu64 "m", tmp1, tmp2);
       if (word[2])
-        s += strprintf(" (%u)", word[2]);
+        snprintf(buf, size, "%" PRIu64 "h+%02" PRIu64 "m (%u)", tmp1, tmp2, word[2]);
+      else
+        snprintf(buf, size, "%" PRIu64 "h+%02" PRIu64 "m", tmp1, tmp2);
     }
     break;
 
@@ -2022,7 +2140,7 @@ std::string ata_format_attr_raw_value(const ata_smart_attribute & attr,
       int64_t hours = rawvalue/3600;
       int64_t minutes = (rawvalue-3600*hours)/60;
       int64_t seconds = rawvalue%60;
-      s = strprintf("%" PRIu64 "h+%02" PRIu64 "m+%02" PRIu64 "s", hours, minutes, seconds);
+      snprintf(buf, size, "%" PRIu64 "h+%02" PRIu64 "m+%02" PRIu64 "s", hours, minutes, seconds);
     }
     break;
 
@@ -2031,7 +2149,7 @@ std::string ata_format_attr_raw_value(const ata_smart_attribute & attr,
       // 30-second counter
       int64_t hours = rawvalue/120;
       int64_t minutes = (rawvalue-120*hours)/2;
-      s += strprintf("%" PRIu64 "h+%02" PRIu64 "m", hours, minutes);
+      snprintf(buf, size, "%" PRIu64 "h+%02" PRIu64 "m", hours, minutes);
     }
     break;
 
@@ -2041,7 +2159,7 @@ std::string ata_format_attr_raw_value(const ata_smart_attribute & attr,
       unsigned hours = (unsigned)(rawvalue & 0xffffffffULL);
       unsigned milliseconds = (unsigned)(rawvalue >> 32);
       unsigned seconds = milliseconds / 1000;
-      s = strprintf("%uh+%02um+%02u.%03us",
+      snprintf(buf, size, "%uh+%02um+%02u.%03us",
         hours, seconds / 60, seconds % 60, milliseconds % 1000);
     }
     break;
@@ -2095,16 +2213,16 @@ std::string ata_format_attr_raw_value(const ata_smart_attribute & attr,
 
       switch (tformat) {
         case 0:
-          s = strprintf("%d", t);
+          snprintf(buf, size, "%d", t);
           break;
         case 1: case 2: case 3:
-          s = strprintf("%d (Min/Max %d/%d)", t, lo, hi);
+          snprintf(buf, size, "%d (Min/Max %d/%d)", t, lo, hi);
           break;
         case 4:
-          s = strprintf("%d (Min/Max %d/%d #%d)", t, lo, hi, word[2]);
+          snprintf(buf, size, "%d (Min/Max %d/%d #%d)", t, lo, hi, word[2]);
           break;
         default:
-          s = strprintf("%d (%d %d %d %d %d)", raw[0], raw[5], raw[4], raw[3], raw[2], raw[1]);
+          snprintf(buf, size, "%d (%d %d %d %d %d)", raw[0], raw[5], raw[4], raw[3], raw[2], raw[1]);
           break;
       }
     }
@@ -2112,15 +2230,37 @@ std::string ata_format_attr_raw_value(const ata_smart_attribute & attr,
 
   case RAWFMT_TEMP10X:
     // ten times temperature in Celsius
-    s = strprintf("%d.%d", word[0]/10, word[0]%10);
+    snprintf(buf, size, "%d.%d", word[0]/10, word[0]%10);
     break;
 
   default:
-    s = "?"; // Should not happen
+    snprintf(buf, size, "?"); // Should not happen
     break;
   }
+}
 
-  return s;
+// Format attribute raw value.
+std::string ata_format_attr_raw_value(const ata_smart_attribute & attr,
+                                      const ata_vendor_attr_defs & defs)
+{
+  char buf[64];
+  format_attr_raw_value(buf, sizeof(buf), ata_get_attr_raw_value(attr, defs),
+                        get_attr_raw_format(attr.id, defs));
+  return buf;
+}
+
+// Return attribute name, or placeholder if name is empty or DEFAULT
+// entry does not apply to this drive type.
+static const char * resolve_attr_name(const char * name, unsigned flags, int rpm)
+{
+  if (!*name)
+    return "Unknown_Attribute";
+  else if ((flags & ATTRFLAG_HDD_ONLY) && rpm == 1)
+    return "Unknown_SSD_Attribute";
+  else if ((flags & ATTRFLAG_SSD_ONLY) && rpm > 1)
+    return "Unknown_HDD_Attribute";
+  else
+    return name;
 }
 
 // Get attribute name
@@ -2131,15 +2271,76 @@ std::string ata_get_smart_attr_name(unsigned char id, const ata_vendor_attr_defs
     return defs[id].name;
   else {
      const ata_vendor_attr_defs::entry & def = get_default_attr_defs()[id];
-     if (def.name.empty())
-       return "Unknown_Attribute";
-     else if ((def.flags & ATTRFLAG_HDD_ONLY) && rpm == 1)
-       return "Unknown_SSD_Attribute";
-     else if ((def.flags & ATTRFLAG_SSD_ONLY) && rpm > 1)
-       return "Unknown_HDD_Attribute";
-     else
-       return def.name;
+     return resolve_attr_name(def.name.c_str(), def.flags, rpm);
+  }
+}
+
+ata_attr_decoder::ata_attr_decoder(const ata_vendor_attr_defs & defs)
+: m_defs(defs),
+  m_default_defs(get_default_attr_defs())
+{
+  // Use const access only, non-const operator[] would detach the tables
+  const ata_vendor_attr_defs & cdefs = m_defs, & cdefault_defs = m_default_defs;
+  for (int id = 0; id < 256; id++) {
+    const ata_vendor_attr_defs::entry & def = cdefs[id];
+    entry & e = m_entries[id];
+    if (!def.name.empty()) {
+      e.name = def.name.c_str();
+      e.name_flags = 0;
+    }
+    else {
+      const ata_vendor_attr_defs::entry & ddef = cdefault_defs[id];
+      e.name = ddef.name.c_str();
+      e.name_flags = (unsigned char)(ddef.flags & (ATTRFLAG_HDD_ONLY|ATTRFLAG_SSD_ONLY));
+    }
+    e.format = (unsigned char)get_attr_raw_format(id, m_defs);
+
+    const char * byteorder = get_attr_byteorder(def);
+    int n = 0;
+    while (n < (int)sizeof(e.bytes) && byteorder[n]) {
+      e.bytes[n] = (signed char)get_attr_byte_offset(byteorder[n]);
+      n++;
+    }
+    e.num_bytes = (unsigned char)n;
+  }
+}
+
+uint64_t ata_attr_decoder::get_raw_value(const ata_smart_attribute & attr) const
+{
+  const entry & e = m_entries[attr.id];
+  const unsigned char * p = reinterpret_cast<const unsigned char *>(&attr);
+  uint64_t rawvalue = 0;
+  for (int i = 0; i < e.num_bytes; i++) {
+    int offs = e.bytes[i];
+    rawvalue <<= 8; rawvalue |= (offs >= 0 ? p[offs] : 0);
   }
+  return rawvalue;
+}
+
+const char * ata_attr_decoder::format_raw_value(const ata_smart_attribute & attr,
+                                                char * buf, unsigned size) const
+{
+  format_attr_raw_value(buf, size, get_raw_value(attr),
+                        (ata_attr_raw_format)m_entries[attr.id].format);
+  return buf;
+}
+
+const char * ata_attr_decoder::get_name(unsigned char id, int rpm /* = 0 */) const
+{
+  const entry & e = m_entries[id];
+  return resolve_attr_name(e.name, e.name_flags, rpm);
+}
+
+std::shared_ptr<const ata_attr_decoder> ata_get_attr_decoder(
+  const ata_vendor_attr_defs & defs,
+  std::vector<std::shared_ptr<const ata_attr_decoder>> & pool)
+{
+  for (const auto & decoder : pool) {
+    if (decoder->is_for(defs))
+      return decoder;
+  }
+  pool.push_back(std::make_shared<const ata_attr_decoder>(defs));
+  return pool.back();
 }
 
 // Find attribute index for attribute id, -1 if not found.
@@ -2183,6 +2384,168 @@ unsigned char ata_return_temperature_value(const ata_smart_values * data, const
   return 0;
 }
 
+// Device statistics (Log 0x04)
+
+// Section A.5 of T13/2161-D (ACS-3) Revision 5, October 28, 2013
+// Section 9.5 of T13/BSR INCITS 529 (ACS-4) Revision 20, October 26, 2017
+
+static const ata_devstat_entry_info devstat_info_0x00[] = {
+  {  2, "List of supported log pages" },
+  {  0, 0 }
+};
+
+static const ata_devstat_entry_info devstat_info_0x01[] = {
+  {  2, "General Statistics" },
+  {  4, "Lifetime Power-On Resets" },
+  {  4, "Power-on Hours" },
+  {  6, "Logical Sectors Written" },
+  {  6, "Number of Write Commands" },
+  {  6, "Logical Sectors Read" },
+  {  6, "Number of Read Commands" },
+  {  6, "Date and Time TimeStamp" }, // ACS-3
+  {  4, "Pending Error Count" }, // ACS-4
+  {  2, "Workload Utilization" }, // ACS-4
+  {  6, "Utilization Usage Rate" }, // ACS-4 (TODO: 47:40: Validity, 39:36 Basis, 7:0 Usage rate)
+  {  7, "Resource Availability" }, // ACS-4 (TODO: 55:16 Resources, 15:0 Fraction)
+  {  1, "Random Write Resources Used" }, // ACS-4
+  {  0, 0 }
+};
+
+static const ata_devstat_entry_info devstat_info_0x02[] = {
+  {  2, "Free-Fall Statistics" },
+  {  4, "Number of Free-Fall Events Detected" },
+  {  4, "Overlimit Shock Events" },
+  {  0, 0 }
+};
+
+static const ata_devstat_entry_info devstat_info_0x03[] = {
+  {  2, "Rotating Media Statistics" },
+  {  4, "Spindle Motor Power-on Hours" },
+  {  4, "Head Flying Hours" },
+  {  4, "Head Load Events" },
+  {  4, "Number of Reallocated Logical Sectors" },
+  {  4, "Read Recovery Attempts" },
+  {  4, "Number of Mechanical Start Failures" },
+  {  4, "Number of Realloc. Candidate Logical Sectors" }, // ACS-3
+  {  4, "Number of High Priority Unload Events" }, // ACS-3
+  {  0, 0 }
+};
+
+static const ata_devstat_entry_info devstat_info_0x04[] = {
+  {  2, "General Errors Statistics" },
+  {  4, "Number of Reported Uncorrectable Errors" },
+//{  4, "Number of Resets Between Command Acceptance and Command Completion" },
+  {  4, "Resets Between Cmd Acceptance and Completion" },
+  {  4, "Physical Element Status Changed" }, // ACS-4
+  {  0, 0 }
+};
+
+static const ata_devstat_entry_info devstat_info_0x05[] = {
+  {  2, "Temperature Statistics" },
+  { -1, "Current Temperature" },
+  { -1, "Average Short Term Temperature" },
+  { -1, "Average Long Term Temperature" },
+  { -1, "Highest Temperature" },
+  { -1, "Lowest Temperature" },
+  { -1, "Highest Average Short Term Temperature" },
+  { -1, "Lowest Average Short Term Temperature" },
+  { -1, "Highest Average Long Term Temperature" },
+  { -1, "Lowest Average Long Term Temperature" },
+  {  4, "Time in Over-Temperature" },
+  { -1, "Specified Maximum Operating Temperature" },
+  {  4, "Time in Under-Temperature" },
+  { -1, "Specified Minimum Operating Temperature" },
+  {  0, 0 }
+};
+
+static const ata_devstat_entry_info devstat_info_0x06[] = {
+  {  2, "Transport Statistics" },
+  {  4, "Number of Hardware Resets" },
+  {  4, "Number of ASR Events" },
+  {  4, "Number of Interface CRC Errors" },
+  {  0, 0 }
+};
+
+static const ata_devstat_entry_info devstat_info_0x07[] = {
+  {  2, "Solid State Device Statistics" },
+  {  1, "Percentage Used Endurance Indicator" },
+  {  0, 0 }
+};
+
+static const ata_devstat_entry_info * const devstat_infos[] = {
+  devstat_info_0x00,
+  devstat_info_0x01,
+  devstat_info_0x02,
+  devstat_info_0x03,
+  devstat_info_0x04,
+  devstat_info_0x05,
+  devstat_info_0x06,
+  devstat_info_0x07
+  // TODO: 0x08 Zoned Device Statistics (T13/f16136r7, January 2017)
+  // TODO: 0x09 Command Duration Limits Statistics (ACS-5 Revision 10, March 2021)
+};
+
+static const int num_devstat_infos = sizeof(devstat_infos)/sizeof(devstat_infos[0]);
+
+// Return table of known entries of a Device Statistics page.
+const ata_devstat_entry_info * ata_get_devstat_info(int page)
+{
+  return (0 <= page && page < num_devstat_infos ? devstat_infos[page] : nullptr);
+}
+
+// Return name of Device Statistics page.
+const char * ata_get_devstat_page_name(int page)
+{
+  if (0 <= page && page < num_devstat_infos)
+    return devstat_infos[page][0].name;
+  if (page == 0xff)
+    return "Vendor Specific Statistics"; // ACS-4
+  return "Unknown Statistics";
+}
+
+// Return name of Device Statistics entry, nullptr if unknown.
+const char * ata_get_devstat_entry_name(int page, int offset)
+{
+  const ata_devstat_entry_info * info = ata_get_devstat_info(page);
+  if (!(info && offset >= 8 && !(offset & 7)))
+    return nullptr;
+  for (int i = 1; info[i].size; i++) {
+    if (i == offset / 8)
+      return info[i].name;
+  }
+  return nullptr;
+}
+
+// Decode Device Statistics entry at 'offset' of page 'data'.
+// Return flags byte, 0 if not supported.  Set 'val' if valid.
+unsigned char ata_get_devstat_value(const unsigned char * data, int page, int offset,
+                                    int64_t & val)
+{
+  if (!(8 <= offset && offset <= 512-8 && !(offset & 7)) || data[2] != page)
+    return 0;
+  unsigned char flags = data[offset+7];
+  if (!(flags & 0x80))
+    return 0;
+  if (flags & 0x40) {
+    // Get value size, default to max if unknown
+    int size = 7;
+    const ata_devstat_entry_info * info = ata_get_devstat_info(page);
+    for (int i = 1; info && info[i].size; i++) {
+      if (i == offset / 8) {
+        size = info[i].size; break;
+      }
+    }
+    val = 0;
+    if (size < 0)
+      val = (signed char)data[offset];
+    else {
+      for (int j = 0; j < size; j++)
+        val |= (int64_t)data[offset+j] << (j*8);
+    }
+  }
+  return flags;
+}
+
 
 // Read SCT Status
 int ataReadSCTStatus(ata_device * device, ata_sct_status_response * sts)
@@ -2326,7 +2689,7 @@ static int ataGetSetSCTFeatureControl(ata_device * device, unsigned short featur
     in.out_needed.sector_count = in.out_needed.lba_low = true;
 
   ata_cmd_out out;
-  if (!device->ata_pass_through(in, out)) {
+  if (!ata_pass_through_stats(device, in, out)) {
     pout("Write SCT (%cet) Feature Control Command failed: %s\n",
       (!set ? 'G' : 'S'), device->get_errmsg());
     return -1;
@@ -2468,7 +2831,7 @@ static int ataGetSetSCTErrorRecoveryControltime(ata_device * device, unsigned ty
     in.out_needed.sector_count = in.out_needed.lba_low = true;
 
   ata_cmd_out out;
-  if (!device->ata_pass_through(in, out)) {
+  if (!ata_pass_through_stats(device, in, out)) {
     pout("Write SCT (%cet) Error Recovery Control Command failed: %s\n",
       (!set ? 'G' : 'S'), device->get_errmsg());
     return -1;
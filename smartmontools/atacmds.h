@@ -18,6 +18,9 @@
 #include "dev_interface.h" // ata_device
 #include "static_assert.h"
 
+#include <memory>
+#include <vector>
+
 // Add __attribute__((packed)) if compiler supports it
 // because some gcc versions (at least ARM) lack support of #pragma pack()
 #ifdef HAVE_ATTR_PACKED
@@ -678,7 +681,9 @@ enum {
   ATTRFLAG_SSD_ONLY    = 0x10, // DEFAULT setting for SSD only
 };
 
-// Vendor attribute display defs for all attribute ids
+// Vendor attribute display defs for all attribute ids.
+// Copies share the same table until one of them is modified
+// (copy on write).
 class ata_vendor_attr_defs
 {
 public:
@@ -695,18 +700,40 @@ public:
         priority(PRIOR_DEFAULT),
         flags(0)
       { byteorder[0] = 0; }
+
+    bool operator==(const entry & x) const;
   };
 
+  ata_vendor_attr_defs();
+
   entry & operator[](unsigned char id)
-    { return m_defs[id]; }
+    { detach(); return m_defs->e[id]; }
 
   const entry & operator[](unsigned char id) const
-    { return m_defs[id]; }
+    { return m_defs->e[id]; }
+
+  bool operator==(const ata_vendor_attr_defs & x) const;
+
+  bool operator!=(const ata_vendor_attr_defs & x) const
+    { return !operator==(x); }
+
+  // Return true if the table is shared with 'x'.
+  bool is_shared_with(const ata_vendor_attr_defs & x) const
+    { return (m_defs == x.m_defs); }
 
 private:
-  entry m_defs[256];
+  struct table { entry e[256]; };
+  std::shared_ptr<table> m_defs;
+
+  // Make table private before modification.
+  void detach();
 };
 
+// Share table of 'defs' with an equal table from 'pool' if any,
+// otherwise add it to 'pool'.
+void ata_intern_attr_defs(ata_vendor_attr_defs & defs,
+                          std::vector<ata_vendor_attr_defs> & pool);
+
 
 // Possible values for firmwarebugs
 enum firmwarebug_t {
@@ -928,6 +955,49 @@ std::string ata_get_smart_attr_name(unsigned char id,
                                     const ata_vendor_attr_defs & defs,
                                     int rpm = 0);
 
+// Precompiled attribute decoder. Byte orders, print formats and names
+// of all attribute ids are resolved from the definitions once.
+// Member functions return the same results as the functions above
+// without allocating memory.
+class ata_attr_decoder
+{
+public:
+  explicit ata_attr_decoder(const ata_vendor_attr_defs & defs);
+
+  // Get attribute raw value.
+  uint64_t get_raw_value(const ata_smart_attribute & attr) const;
+
+  // Format attribute raw value into buffer, return buffer.
+  const char * format_raw_value(const ata_smart_attribute & attr,
+                                char * buf, unsigned size) const;
+
+  // Get attribute name.
+  const char * get_name(unsigned char id, int rpm = 0) const;
+
+  // Return true if decoder was created from this table.
+  bool is_for(const ata_vendor_attr_defs & defs) const
+    { return m_defs.is_shared_with(defs); }
+
+private:
+  struct entry
+  {
+    const char * name;          // Name from defs or DEFAULT entry, may be empty
+    unsigned char name_flags;   // ATTRFLAG_*_ONLY if name is from DEFAULT entry
+    unsigned char format;       // ata_attr_raw_format, never RAWFMT_DEFAULT
+    unsigned char num_bytes;    // Length of byte order
+    signed char bytes[8];       // Offsets in ata_smart_attribute, -1 for zero
+  };
+
+  ata_vendor_attr_defs m_defs, m_default_defs; // Keep names valid
+  entry m_entries[256];
+};
+
+// Return decoder for the table of 'defs' from 'pool' if any, otherwise
+// create it and add it to 'pool'.  Use after ata_intern_attr_defs().
+std::shared_ptr<const ata_attr_decoder> ata_get_attr_decoder(
+  const ata_vendor_attr_defs & defs,
+  std::vector<std::shared_ptr<const ata_attr_decoder>> & pool);
+
 // External handler function, for when a checksum is not correct.  Can
 // simply return if no action is desired, or can print error messages
 // as needed, or exit.  Is passed a string with the name of the Data
@@ -941,6 +1011,29 @@ int ata_find_attr_index(unsigned char id, const ata_smart_values & smartval);
 // non-default interpretations. If the Attribute does not exist, return 0
 unsigned char ata_return_temperature_value(const ata_smart_values * data, const ata_vendor_attr_defs & defs);
 
+// Device Statistics (Log 0x04) entry info
+struct ata_devstat_entry_info
+{
+  short size; // #bytes of value, -1 for signed char
+  const char * name;
+};
+
+// Return table of known entries of a Device Statistics page, terminated
+// by size 0, nullptr if page is unknown.  First entry is the page header.
+const ata_devstat_entry_info * ata_get_devstat_info(int page);
+
+// Return name of Device Statistics page.
+const char * ata_get_devstat_page_name(int page);
+
+// Return name of Device Statistics entry, nullptr if unknown.
+const char * ata_get_devstat_entry_name(int page, int offset);
+
+// Decode Device Statistics entry at 'offset' of page 'data'.
+// Return flags byte (0x80: supported, 0x40: valid, 0x20: normalized,
+// 0x08: monitored condition met), 0 if not supported.  Set 'val' if valid.
+unsigned char ata_get_devstat_value(const unsigned char * data, int page, int offset,
+                                    int64_t & val);
+
 
 #define MAX_ATTRIBUTE_NUM 256
 
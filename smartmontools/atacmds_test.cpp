@@ -0,0 +1,169 @@
+/*
+ * atacmds_test.cpp
+ *
+ * Home page of code is: https://www.smartmontools.org
+ *
+ * Copyright (C) 2026 Smartmontools developers
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Unit tests of ATA attribute decoding, run by 'make check'.
+
+#include "config.h"
+
+#include "atacmds.h"
+#include "utility.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+static int num_failed = 0;
+
+#define TEST_CHECK(expr) \
+  do { \
+    if (!(expr)) { \
+      printf("%s:%d: FAILED: %s\n", __FILE__, __LINE__, #expr); \
+      num_failed++; \
+    } \
+  } while (0)
+
+// Required by library code, see smartctl.cpp and smartd.cpp
+unsigned char failuretest_permissive = 0;
+
+void pout(const char * fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  vprintf(fmt, ap);
+  va_end(ap);
+}
+
+void pout_flush()
+{
+  fflush(stdout);
+}
+
+void checksumwarning(const char * string)
+{
+  pout("Warning! %s error: invalid SMART checksum.\n", string);
+}
+
+// Decoders are shared between devices using the same interned table.
+static void test_attr_decoder_pool()
+{
+  ata_vendor_attr_defs defs1, defs2, defs3;
+  TEST_CHECK(parse_attribute_def("9,minutes", defs1, PRIOR_USER));
+  TEST_CHECK(parse_attribute_def("9,minutes", defs2, PRIOR_USER));
+  TEST_CHECK(parse_attribute_def("9,halfminutes", defs3, PRIOR_USER));
+
+  std::vector<ata_vendor_attr_defs> defs_pool;
+  ata_intern_attr_defs(defs1, defs_pool);
+  ata_intern_attr_defs(defs2, defs_pool);
+  ata_intern_attr_defs(defs3, defs_pool);
+  TEST_CHECK(defs_pool.size() == 2);
+  TEST_CHECK(defs1.is_shared_with(defs2));
+  TEST_CHECK(!defs1.is_shared_with(defs3));
+
+  ata_attr_decoder decoder(defs1);
+  TEST_CHECK(decoder.is_for(defs1));
+  TEST_CHECK(decoder.is_for(defs2));
+  TEST_CHECK(!decoder.is_for(defs3));
+  TEST_CHECK(!strcmp(decoder.get_name(9), ata_get_smart_attr_name(9, defs1).c_str()));
+
+  std::vector<std::shared_ptr<const ata_attr_decoder>> decoder_pool;
+  auto d1 = ata_get_attr_decoder(defs1, decoder_pool);
+  auto d2 = ata_get_attr_decoder(defs2, decoder_pool);
+  auto d3 = ata_get_attr_decoder(defs3, decoder_pool);
+  TEST_CHECK(d1 == d2);
+  TEST_CHECK(d1 != d3);
+  TEST_CHECK(decoder_pool.size() == 2);
+}
+
+// Pseudo random attribute data, zero bytes are frequent.
+static unsigned char random_byte()
+{
+  static uint32_t seed = 1;
+  seed = seed * 1103515245 + 12345;
+  unsigned r = seed >> 16;
+  return (unsigned char)(!(r & 0x3) ? 0 : r >> 4);
+}
+
+// Decoder returns the same values as the table based functions.
+static void check_attr_decoder(const ata_vendor_attr_defs & defs, unsigned char id)
+{
+  ata_attr_decoder decoder(defs);
+  for (int i = 0; i < 20; i++) {
+    ata_smart_attribute attr{};
+    attr.id = id;
+    attr.current = random_byte(); attr.worst = random_byte();
+    for (unsigned char & b : attr.raw)
+      b = random_byte();
+    attr.reserv = random_byte();
+
+    TEST_CHECK(decoder.get_raw_value(attr) == ata_get_attr_raw_value(attr, defs));
+    char buf[64];
+    TEST_CHECK(ata_format_attr_raw_value(attr, defs) == decoder.format_raw_value(attr, buf, sizeof(buf)));
+  }
+  for (int rpm : {0, 1, 7200})
+    TEST_CHECK(ata_get_smart_attr_name(id, defs, rpm) == decoder.get_name(id, rpm));
+}
+
+// Decoder is equivalent to ata_get_attr_raw_value() and
+// ata_format_attr_raw_value() for all raw formats and byte orders.
+static void test_attr_decoder_formats()
+{
+  // Default table
+  ata_vendor_attr_defs defs;
+  for (int id = 1; id <= 255; id++)
+    check_attr_decoder(defs, id);
+
+  // Format names from "\tN,FORMAT[:012345rvwz][,ATTR_NAME]" lines
+  std::vector<std::string> formats;
+  std::string list = create_vendor_attribute_arg_list();
+  for (size_t i = 0; (i = list.find("\tN,", i)) != std::string::npos; ) {
+    i += 3;
+    formats.push_back(list.substr(i, list.find('[', i) - i));
+  }
+  TEST_CHECK(formats.size() >= 19);
+
+  // Default byte order, each single byte, some longer orders
+  std::vector<std::string> byteorders = {"",
+    "0", "1", "2", "3", "4", "5", "r", "v", "w", "z",
+    "543210", "012345", "r543210", "wv543210", "vvwwzz10", "rzz10", "zz10r543"};
+  for (int i = 0; i < 20; i++) {
+    static const char chars[] = "012345rvwz";
+    std::string bo;
+    for (int n = 1 + random_byte() % 8; n > 0; n--)
+      bo += chars[random_byte() % (sizeof(chars) - 1)];
+    byteorders.push_back(bo);
+  }
+
+  int id = 1;
+  for (const std::string & fmt : formats) {
+    for (const std::string & bo : byteorders) {
+      std::string opt = strprintf("%d,%s%s%s", id, fmt.c_str(), (bo.empty() ? "" : ":"), bo.c_str());
+      ata_vendor_attr_defs defs2;
+      TEST_CHECK(parse_attribute_def(opt.c_str(), defs2, PRIOR_USER));
+      check_attr_decoder(defs2, id);
+      id = id % 255 + 1;
+    }
+  }
+}
+
+int main()
+{
+  test_attr_decoder_pool();
+  test_attr_decoder_formats();
+
+  if (num_failed) {
+    printf("atacmds_test: %d check(s) FAILED\n", num_failed);
+    return 1;
+  }
+  printf("atacmds_test: OK\n");
+  return 0;
+}
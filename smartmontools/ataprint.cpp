@@ -1183,9 +1183,21 @@ static void set_json_globals_from_smart_attrib(int id, const char * name,
   }
 }
 
+// Format normalized value, worst or threshold of attribute table entry.
+static void format_attr_byte(char (& buf)[8], bool valid, bool hex, unsigned char val)
+{
+  if (!valid)
+    snprintf(buf, sizeof(buf), "%s", (!hex ? "---" : "----"));
+  else if (!hex)
+    snprintf(buf, sizeof(buf), "%.3d", val);
+  else
+    snprintf(buf, sizeof(buf), "0x%02x", val);
+}
+
 // onlyfailed=0 : print all attribute values
 // onlyfailed=1:  just ones that are currently failed and have prefailure bit set
 // onlyfailed=2:  ones that are failed, or have failed with or without prefailure bit set
+
 static void PrintSmartAttribWithThres(const ata_smart_values * data,
                                       const ata_smart_thresholds_pvt * thresholds,
                                       const ata_vendor_attr_defs & defs, int rpm,
@@ -1195,6 +1207,7 @@ static void PrintSmartAttribWithThres(const ata_smart_values * data,
   bool hexid  = !!(format & ata_print_options::FMT_HEX_ID);
   bool hexval = !!(format & ata_print_options::FMT_HEX_VAL);
   bool needheader = true;
+  ata_attr_decoder decoder(defs);
 
   // step through all vendor attributes
   for (int i = 0, ji = 0; i < NUMBER_ATA_SMART_ATTRIBUTES; i++) {
@@ -1230,28 +1243,19 @@ static void PrintSmartAttribWithThres(const ata_smart_values * data,
     }
 
     // Format value, worst, threshold
-    std::string valstr, worstr, threstr;
-    if (state > ATTRSTATE_NO_NORMVAL)
-      valstr = (!hexval ? strprintf("%.3d",   attr.current)
-                        : strprintf("0x%02x", attr.current));
-    else
-      valstr = (!hexval ? "---" : "----");
-    if (!(defs[attr.id].flags & ATTRFLAG_NO_WORSTVAL))
-      worstr = (!hexval ? strprintf("%.3d",   attr.worst)
-                        : strprintf("0x%02x", attr.worst));
-    else
-      worstr = (!hexval ? "---" : "----");
-    if (state > ATTRSTATE_NO_THRESHOLD)
-      threstr = (!hexval ? strprintf("%.3d",   threshold)
-                         : strprintf("0x%02x", threshold));
-    else
-      threstr = (!hexval ? "---" : "----");
+    char valstr[8], worstr[8], threstr[8];
+    format_attr_byte(valstr, (state > ATTRSTATE_NO_NORMVAL), hexval, attr.current);
+    format_attr_byte(worstr, !(defs[attr.id].flags & ATTRFLAG_NO_WORSTVAL), hexval, attr.worst);
+    format_attr_byte(threstr, (state > ATTRSTATE_NO_THRESHOLD), hexval, threshold);
 
     // Print line for each valid attribute
-    std::string idstr = (!hexid ? strprintf("%3d",    attr.id)
-                                : strprintf("0x%02x", attr.id));
-    std::string attrname = ata_get_smart_attr_name(attr.id, defs, rpm);
-    std::string rawstr = ata_format_attr_raw_value(attr, defs);
+    char idstr[8], rawstr[64];
+    if (!hexid)
+      snprintf(idstr, sizeof(idstr), "%3d", attr.id);
+    else
+      snprintf(idstr, sizeof(idstr), "0x%02x", attr.id);
+    const char * attrname = decoder.get_name(attr.id, rpm);
+    decoder.format_raw_value(attr, rawstr, sizeof(rawstr));
 
     char flagstr[] = {
       (ATTRIBUTE_FLAGS_PREFAILURE(attr.flags)     ? 'P' : '-'),
@@ -1266,22 +1270,20 @@ static void PrintSmartAttribWithThres(const ata_smart_values * data,
 
     if (!brief)
       jout("%s %-24s0x%04x   %-4s  %-4s  %-4s   %-10s%-9s%-12s%s\n",
-           idstr.c_str(), attrname.c_str(), attr.flags,
-           valstr.c_str(), worstr.c_str(), threstr.c_str(),
+           idstr, attrname, attr.flags, valstr, worstr, threstr,
            (ATTRIBUTE_FLAGS_PREFAILURE(attr.flags) ? "Pre-fail" : "Old_age"),
            (ATTRIBUTE_FLAGS_ONLINE(attr.flags)     ? "Always"   : "Offline"),
            (state == ATTRSTATE_FAILED_NOW  ? "FAILING_NOW" :
             state == ATTRSTATE_FAILED_PAST ? "In_the_past"
                                            : "    -"        ) ,
-            rawstr.c_str());
+            rawstr);
     else
       jout("%s %-24s%s  %-4s  %-4s  %-4s   %-5s%s\n",
-           idstr.c_str(), attrname.c_str(), flagstr,
-           valstr.c_str(), worstr.c_str(), threstr.c_str(),
+           idstr, attrname, flagstr, valstr, worstr, threstr,
            (state == ATTRSTATE_FAILED_NOW  ? "NOW"  :
             state == ATTRSTATE_FAILED_PAST ? "Past"
                                            : "-"     ),
-            rawstr.c_str());
+            rawstr);
 
     if (!jglb.is_enabled())
       continue;
@@ -1312,11 +1314,11 @@ static void PrintSmartAttribWithThres(const ata_smart_values * data,
     if (ATTRIBUTE_FLAGS_OTHER(attr.flags))
       jreff["other"] = ATTRIBUTE_FLAGS_OTHER(attr.flags);
 
-    uint64_t rawval = ata_get_attr_raw_value(attr, defs);
+    uint64_t rawval = decoder.get_raw_value(attr);
     jref["raw"]["value"] = rawval;
     jref["raw"]["string"] = rawstr;
 
-    set_json_globals_from_smart_attrib(attr.id, attrname.c_str(), defs, rawval);
+    set_json_globals_from_smart_attrib(attr.id, attrname, defs, rawval);
   }
 
   if (!needheader) {
@@ -1639,122 +1641,6 @@ static void PrintLogPages(const char * type, const unsigned char * data,
 ///////////////////////////////////////////////////////////////////////
 // Device statistics (Log 0x04)
 
-// Section A.5 of T13/2161-D (ACS-3) Revision 5, October 28, 2013
-// Section 9.5 of T13/BSR INCITS 529 (ACS-4) Revision 20, October 26, 2017
-
-struct devstat_entry_info
-{
-  short size; // #bytes of value, -1 for signed char
-  const char * name;
-};
-
-const devstat_entry_info devstat_info_0x00[] = {
-  {  2, "List of supported log pages" },
-  {  0, 0 }
-};
-
-const devstat_entry_info devstat_info_0x01[] = {
-  {  2, "General Statistics" },
-  {  4, "Lifetime Power-On Resets" },
-  {  4, "Power-on Hours" },
-  {  6, "Logical Sectors Written" },
-  {  6, "Number of Write Commands" },
-  {  6, "Logical Sectors Read" },
-  {  6, "Number of Read Commands" },
-  {  6, "Date and Time TimeStamp" }, // ACS-3
-  {  4, "Pending Error Count" }, // ACS-4
-  {  2, "Workload Utilization" }, // ACS-4
-  {  6, "Utilization Usage Rate" }, // ACS-4 (TODO: 47:40: Validity, 39:36 Basis, 7:0 Usage rate)
-  {  7, "Resource Availability" }, // ACS-4 (TODO: 55:16 Resources, 15:0 Fraction)
-  {  1, "Random Write Resources Used" }, // ACS-4
-  {  0, 0 }
-};
-
-const devstat_entry_info devstat_info_0x02[] = {
-  {  2, "Free-Fall Statistics" },
-  {  4, "Number of Free-Fall Events Detected" },
-  {  4, "Overlimit Shock Events" },
-  {  0, 0 }
-};
-
-const devstat_entry_info devstat_info_0x03[] = {
-  {  2, "Rotating Media Statistics" },
-  {  4, "Spindle Motor Power-on Hours" },
-  {  4, "Head Flying Hours" },
-  {  4, "Head Load Events" },
-  {  4, "Number of Reallocated Logical Sectors" },
-  {  4, "Read Recovery Attempts" },
-  {  4, "Number of Mechanical Start Failures" },
-  {  4, "Number of Realloc. Candidate Logical Sectors" }, // ACS-3
-  {  4, "Number of High Priority Unload Events" }, // ACS-3
-  {  0, 0 }
-};
-
-const devstat_entry_info devstat_info_0x04[] = {
-  {  2, "General Errors Statistics" },
-  {  4, "Number of Reported Uncorrectable Errors" },
-//{  4, "Number of Resets Between Command Acceptance and Command Completion" },
-  {  4, "Resets Between Cmd Acceptance and Completion" },
-  {  4, "Physical Element Status Changed" }, // ACS-4
-  {  0, 0 }
-};
-
-const devstat_entry_info devstat_info_0x05[] = {
-  {  2, "Temperature Statistics" },
-  { -1, "Current Temperature" },
-  { -1, "Average Short Term Temperature" },
-  { -1, "Average Long Term Temperature" },
-  { -1, "Highest Temperature" },
-  { -1, "Lowest Temperature" },
-  { -1, "Highest Average Short Term Temperature" },
-  { -1, "Lowest Average Short Term Temperature" },
-  { -1, "Highest Average Long Term Temperature" },
-  { -1, "Lowest Average Long Term Temperature" },
-  {  4, "Time in Over-Temperature" },
-  { -1, "Specified Maximum Operating Temperature" },
-  {  4, "Time in Under-Temperature" },
-  { -1, "Specified Minimum Operating Temperature" },
-  {  0, 0 }
-};
-
-const devstat_entry_info devstat_info_0x06[] = {
-  {  2, "Transport Statistics" },
-  {  4, "Number of Hardware Resets" },
-  {  4, "Number of ASR Events" },
-  {  4, "Number of Interface CRC Errors" },
-  {  0, 0 }
-};
-
-const devstat_entry_info devstat_info_0x07[] = {
-  {  2, "Solid State Device Statistics" },
-  {  1, "Percentage Used Endurance Indicator" },
-  {  0, 0 }
-};
-
-const devstat_entry_info * devstat_infos[] = {
-  devstat_info_0x00,
-  devstat_info_0x01,
-  devstat_info_0x02,
-  devstat_info_0x03,
-  devstat_info_0x04,
-  devstat_info_0x05,
-  devstat_info_0x06,
-  devstat_info_0x07
-  // TODO: 0x08 Zoned Device Statistics (T13/f16136r7, January 2017)
-  // TODO: 0x09 Command Duration Limits Statistics (ACS-5 Revision 10, March 2021)
-};
-
-const int num_devstat_infos = sizeof(devstat_infos)/sizeof(devstat_infos[0]);
-
-static const char * get_device_statistics_page_name(int page)
-{
-  if (page < num_devstat_infos)
-    return devstat_infos[page][0].name;
-  if (page == 0xff)
-    return "Vendor Specific Statistics"; // ACS-4
-  return "Unknown Statistics";
-}
-
 static void set_json_globals_from_device_statistics(int page, int offset, int64_t val)
 {
   switch (page) {
@@ -1780,8 +1666,8 @@ static void set_json_globals_from_device_statistics(int page, int offset, int64_
 
 static void print_device_statistics_page(const json::ref & jref, const unsigned char * data, int page)
 {
-  const devstat_entry_info * info = (page < num_devstat_infos ? devstat_infos[page] : 0);
-  const char * name = get_device_statistics_page_name(page);
+  const ata_devstat_entry_info * info = ata_get_devstat_info(page);
+  const char * name = ata_get_devstat_page_name(page);
 
   // Check page number in header
   static const char line[] = "  =====  =               =  ===  == ";
@@ -1947,7 +1833,7 @@ static bool print_device_statistics(ata_device * device, unsigned nsectors,
     jout("Page  Description\n");
     for (i = 0; i < nentries; i++) {
       int page = page_0[8+1+i];
-      const char * name = get_device_statistics_page_name(page);
+      const char * name = ata_get_devstat_page_name(page);
       jout("0x%02x  %s\n", page, name);
       jref["supported_pages"][i]["number"] = page;
       jref["supported_pages"][i]["name"] = name;
@@ -13,6 +13,8 @@
 #include "dev_interface.h"
 #include "dev_tunnelled.h"
 #include "atacmds.h" // ATA_SMART_CMD/STATUS
+#include "atacmdnames.h" // look_up_ata_command()
+#include "nvmecmds.h" // nvme_admin_*
 #include "scsicmds.h" // scsi_cmnd_io
 #include "utility.h"
 
@@ -21,13 +23,21 @@
 #include <stdlib.h> // realpath()
 #include <stdexcept>
 
+#ifdef HAVE_STD_THREAD
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#endif
+
 const char * dev_interface_cpp_cvsid = "$Id$"
   DEV_INTERFACE_H_CVSID;
 
 /////////////////////////////////////////////////////////////////////////////
 // smart_device
 
-int smart_device::s_num_objects = 0;
+std::atomic<int> smart_device::s_num_objects(0);
 
 smart_device::smart_device(smart_interface * intf, const char * dev_name,
     const char * dev_type, const char * req_type)
@@ -95,6 +105,60 @@ void smart_device::release(const smart_device * /*dev*/)
 {
 }
 
+std::string smart_device::get_cmd_stats_name(unsigned key)
+{
+  unsigned opcode = cmd_stats_opcode(key);
+  switch (cmd_stats_protocol(key)) {
+    case cmd_ata:
+      return look_up_ata_command(opcode >> 8, opcode & 0xff);
+    case cmd_scsi: {
+      uint8_t cdb[16] = { (uint8_t)opcode, };
+      const char * name = scsi_get_opcode_name(cdb);
+      return (name ? name : "[unknown SCSI command]");
+    }
+    case cmd_nvme:
+      switch (opcode) {
+        case smartmontools::nvme_admin_get_log_page:  return "GET LOG PAGE";
+        case smartmontools::nvme_admin_identify:      return "IDENTIFY";
+        case smartmontools::nvme_admin_dev_self_test: return "DEVICE SELF-TEST";
+        default: return strprintf("[NVMe admin command 0x%02x]", opcode);
+      }
+    default:
+      return "[unknown protocol]";
+  }
+}
+
+long long smart_device::get_cmd_stats_bucket_limit(int i)
+{
+  if (!(0 <= i && i < cmd_stats::num_buckets - 1))
+    return -1;
+  long long limit = 100;
+  while (i-- > 0)
+    limit *= 10;
+  return limit;
+}
+
+void smart_device::add_cmd_stats(unsigned key, bool ok, long long duration_usec)
+{
+  cmd_stats & st = m_cmd_stats[key];
+  st.count++;
+  if (!ok)
+    st.errors++;
+  if (duration_usec < 0)
+    return;
+
+  st.total_usec += duration_usec;
+  if (st.min_usec < 0 || duration_usec < st.min_usec)
+    st.min_usec = duration_usec;
+  if (duration_usec > st.max_usec)
+    st.max_usec = duration_usec;
+
+  int i = 0;
+  while (i < cmd_stats::num_buckets - 1 && duration_usec >= get_cmd_stats_bucket_limit(i))
+    i++;
+  st.histogram[i]++;
+}
+
 
 /////////////////////////////////////////////////////////////////////////////
 // ata_device
@@ -204,7 +268,13 @@ bool scsi_device::scsi_pass_through_and_check(scsi_cmnd_io * iop,
   iop->timeout = SCSI_TIMEOUT_DEFAULT;
 
   // Run cmd
-  if (!scsi_pass_through(iop)) {
+  unsigned key = cmd_stats_key(cmd_scsi, (iop->cmnd_len > 0 ? iop->cmnd[0] : 0));
+  pout_flush();
+  long long start_usec = get_timer_usec();
+  bool ok = scsi_pass_through(iop);
+  long long duration_usec = (start_usec >= 0 ? get_timer_usec() - start_usec : -1);
+  if (!ok) {
+    add_cmd_stats(key, false, duration_usec);
     if (scsi_debugmode > 0)
       pout("%sscsi_pass_through() failed, errno=%d [%s]\n",
            msg, get_errno(), get_errmsg());
@@ -215,6 +285,7 @@ bool scsi_device::scsi_pass_through_and_check(scsi_cmnd_io * iop,
   scsi_sense_disect sinfo;
   scsi_do_sense_disect(iop, &sinfo);
   int err = scsiSimpleSenseFilter(&sinfo);
+  add_cmd_stats(key, !err, duration_usec);
   if (err) {
     if (scsi_debugmode > 0)
       pout("%sscsi error: %s\n", msg, scsiErrString(err));
@@ -324,6 +395,14 @@ bool smart_interface::disable_system_auto_standby(bool /*disable*/)
   return set_err(ENOSYS);
 }
 
+void smart_interface::nvme_pass_through_multi(nvme_cmd_request * reqs, unsigned num)
+{
+  for (unsigned i = 0; i < num; i++) {
+    nvme_cmd_request & req = reqs[i];
+    req.ok = req.device->nvme_pass_through(req.in, req.out);
+  }
+}
+
 bool smart_interface::set_err(int no, const char * msg, ...)
 {
   if (!msg)
@@ -399,6 +478,134 @@ bool smart_interface::is_raid_dev_type(const char * type) const
   return true;
 }
 
+std::string smart_interface::get_dev_scan_group(const smart_device * /*dev*/) const
+{
+  return "";
+}
+
+void smart_interface::autodetect_open_devices(smart_device_list & devlist,
+  unsigned max_threads, unsigned max_per_group)
+{
+  unsigned num_devs = devlist.size();
+  std::vector<smart_device *> devs(num_devs);
+  for (unsigned i = 0; i < num_devs; i++)
+    devs[i] = devlist.release(i);
+  devlist.clear();
+
+  // Interleave devices of different groups: A1 B1 C1 A2 B2 A3 ...
+  std::vector<std::string> group_names;
+  std::vector< std::vector<unsigned> > groups;
+  for (unsigned i = 0; i < num_devs; i++) {
+    if (!devs[i])
+      continue;
+    std::string name = (max_threads > 1 ? get_dev_scan_group(devs[i]) : "");
+    unsigned g;
+    for (g = 0; g < group_names.size() && group_names[g] != name; g++)
+      ;
+    if (g == group_names.size()) {
+      group_names.push_back(name);
+      groups.push_back(std::vector<unsigned>());
+    }
+    groups[g].push_back(i);
+  }
+  std::vector<unsigned> queue, queue_group;
+  for (unsigned j = 0; queue.size() < num_devs; j++) {
+    bool found = false;
+    for (unsigned g = 0; g < groups.size(); g++) {
+      if (j < groups[g].size()) {
+        queue.push_back(groups[g][j]); queue_group.push_back(g);
+        found = true;
+      }
+    }
+    if (!found)
+      break;
+  }
+
+#ifdef HAVE_STD_THREAD
+  unsigned num_jobs = queue.size();
+  if (max_threads > 1 && num_jobs > 1) {
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<unsigned> group_busy(groups.size());
+    std::vector<bool> taken(num_jobs);
+    unsigned first_job = 0;
+    std::exception_ptr error;
+
+    auto worker = [&]() {
+      std::unique_lock<std::mutex> lock(mutex);
+      for (;;) {
+        // Find next job whose group is below the limit
+        while (first_job < num_jobs && taken[first_job])
+          first_job++;
+        if (first_job >= num_jobs || error)
+          return;
+        unsigned j;
+        for (j = first_job; j < num_jobs; j++) {
+          if (!taken[j] && !(max_per_group && group_busy[queue_group[j]] >= max_per_group))
+            break;
+        }
+        if (j >= num_jobs) {
+          cond.wait(lock);
+          continue;
+        }
+        taken[j] = true;
+        group_busy[queue_group[j]]++;
+
+        lock.unlock();
+        smart_device * & dev = devs[queue[j]];
+        try {
+          dev = dev->autodetect_open();
+        }
+        catch (...) {
+          std::lock_guard<std::mutex> guard(mutex);
+          if (!error)
+            error = std::current_exception();
+        }
+        lock.lock();
+
+        group_busy[queue_group[j]]--;
+        cond.notify_all();
+      }
+    };
+
+    // Main thread is also a worker, continue with fewer threads on failure
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < max_threads && i < num_jobs; i++) {
+      try {
+        threads.emplace_back(worker);
+      }
+      catch (const std::system_error &) {
+        break;
+      }
+    }
+    worker();
+    for (auto & t : threads)
+      t.join();
+
+    for (unsigned i = 0; i < num_devs; i++)
+      devlist.push_back(devs[i]);
+    if (error)
+      std::rethrow_exception(error);
+    return;
+  }
+#endif
+
+  for (unsigned i = 0; i < num_devs; i++) {
+    if (devs[i]) {
+      try {
+        devs[i] = devs[i]->autodetect_open();
+      }
+      catch (...) {
+        for (unsigned k = 0; k < num_devs; k++)
+          devlist.push_back(devs[k]);
+        throw;
+      }
+    }
+  }
+  for (unsigned i = 0; i < num_devs; i++)
+    devlist.push_back(devs[i]);
+}
+
 
 /////////////////////////////////////////////////////////////////////////////
 // Default device factory
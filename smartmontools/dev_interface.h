@@ -15,6 +15,8 @@
 
 #include "utility.h"
 
+#include <atomic>
+#include <map>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -61,6 +63,23 @@ public:
     std::string msg; ///< Error message
   };
 
+  /// Command protocol for command statistics.
+  enum cmd_protocol { cmd_ata = 1, cmd_scsi, cmd_nvme };
+
+  /// Count, errors and latency of one command.
+  struct cmd_stats {
+    enum { num_buckets = 7 };
+    unsigned count = 0;          ///< Number of commands issued
+    unsigned errors = 0;         ///< Number of failed commands
+    long long total_usec = 0;    ///< Sum of durations
+    long long min_usec = -1;     ///< Shortest duration, -1 if none
+    long long max_usec = 0;      ///< Longest duration
+    unsigned histogram[num_buckets] = {}; ///< <100us, <1ms, ..., <10s, >=10s
+  };
+
+  /// Command statistics indexed by cmd_stats_key().
+  typedef std::map<unsigned, cmd_stats> cmd_stats_map;
+
 // Construction
 protected:
   /// Constructor to init interface and device info.
@@ -176,6 +195,34 @@ public:
   static int get_num_objects()
     { return s_num_objects; }
 
+  ///////////////////////////////////////////////
+  // Command statistics
+
+  /// Build key for command statistics from protocol and opcode.
+  /// The opcode may contain a subcommand (e.g. ATA SMART feature) in bits 0-7.
+  static unsigned cmd_stats_key(cmd_protocol protocol, unsigned opcode)
+    { return ((unsigned)protocol << 16) | (opcode & 0xffff); }
+  /// Get protocol from key.
+  static cmd_protocol cmd_stats_protocol(unsigned key)
+    { return (cmd_protocol)(key >> 16); }
+  /// Get opcode from key.
+  static unsigned cmd_stats_opcode(unsigned key)
+    { return key & 0xffff; }
+
+  /// Get printable name of command from key.
+  static std::string get_cmd_stats_name(unsigned key);
+
+  /// Get upper latency limit of histogram bucket, -1 if none.
+  static long long get_cmd_stats_bucket_limit(int i);
+
+  /// Record result and duration of a command.
+  /// Duration is ignored if negative (no timer available).
+  void add_cmd_stats(unsigned key, bool ok, long long duration_usec);
+
+  /// Get command statistics.
+  const cmd_stats_map & get_cmd_stats() const
+    { return m_cmd_stats; }
+
 // Operations
 public:
   ///////////////////////////////////////////////
@@ -232,6 +279,7 @@ private:
   smart_interface * m_intf;
   device_info m_info;
   error_info m_err;
+  cmd_stats_map m_cmd_stats;
 
   // Pointers for to_ata(), to_scsi(), to_nvme()
   // set by ATA/SCSI/NVMe interface classes.
@@ -243,7 +291,7 @@ private:
   nvme_device * m_nvme_ptr;
 
   // Number of objects.
-  static int s_num_objects;
+  static std::atomic<int> s_num_objects;
 
   // Prevent copy/assignment
   smart_device(const smart_device &);
@@ -528,6 +576,17 @@ public:
   /// Default implementation returns false.
   virtual bool ata_identify_is_cached() const;
 
+  /// Get max number of sectors per GP (gpl=true) or SMART log read
+  /// which is known to work, 0 if unknown.
+  unsigned get_max_log_sectors(bool gpl) const
+    { return (gpl ? m_max_gplog_sectors : m_max_smartlog_sectors); }
+
+  /// Set max number of sectors per GP (gpl=true) or SMART log read.
+  /// Set by ataReadLogExt() and ataReadSmartLog() if a multi-sector
+  /// read fails but a single sector read works.
+  void set_max_log_sectors(bool gpl, unsigned nsectors)
+    { (gpl ? m_max_gplog_sectors : m_max_smartlog_sectors) = nsectors; }
+
 protected:
   /// Flags for ata_cmd_is_supported().
   enum {
@@ -565,8 +624,13 @@ protected:
 
   /// Default constructor, registers device as ATA.
   ata_device()
-    : smart_device(never_called)
+    : smart_device(never_called),
+      m_max_gplog_sectors(0), m_max_smartlog_sectors(0)
     { hide_ata(false); }
+
+private:
+  unsigned m_max_gplog_sectors;
+  unsigned m_max_smartlog_sectors;
 };
 
 
@@ -711,6 +775,15 @@ public:
   unsigned get_nsid() const
     { return m_nsid; }
 
+  /// Get max data transfer size for multi-page commands, 0 if unknown.
+  unsigned get_max_xfer_size() const
+    { return m_max_xfer_size; }
+
+  /// Set max data transfer size for multi-page commands.
+  /// Set by nvme_read_id_ctrl() from MDTS and lowered if a transfer fails.
+  void set_max_xfer_size(unsigned size)
+    { m_max_xfer_size = size; }
+
 protected:
   /// Hide/unhide NVMe interface.
   void hide_nvme(bool hide = true)
@@ -719,7 +792,7 @@ protected:
   /// Constructor requires namespace ID, registers device as NVMe.
   explicit nvme_device(unsigned nsid)
     : smart_device(never_called),
-      m_nsid(nsid)
+      m_nsid(nsid), m_max_xfer_size(0)
     { hide_nvme(false); }
 
   /// Set namespace id.
@@ -733,6 +806,20 @@ protected:
 
 private:
   unsigned m_nsid;
+  unsigned m_max_xfer_size;
+};
+
+/// NVMe pass through request for smart_interface::nvme_pass_through_multi()
+struct nvme_cmd_request
+{
+  nvme_device * device; ///< Device, must be open
+  nvme_cmd_in in; ///< Input parameters
+  nvme_cmd_out out; ///< Output parameters
+  bool ok; ///< Result of the command
+
+  explicit nvme_cmd_request(nvme_device * dev = 0)
+    : device(dev), ok(false)
+    { }
 };
 
 
@@ -942,6 +1029,13 @@ public:
   /// Default implementation returns false.
   virtual bool disable_system_auto_standby(bool disable);
 
+  /// Run NVMe pass through commands for one or more devices.
+  /// The commands may be run in parallel.  The 'ok' field of each request
+  /// is set to the result of the command, errors are set in the device.
+  /// Default implementation calls nvme_device::nvme_pass_through()
+  /// sequentially.
+  virtual void nvme_pass_through_multi(nvme_cmd_request * reqs, unsigned num);
+
 
   ///////////////////////////////////////////////
   // Last error information
@@ -1026,6 +1120,20 @@ public:
   /// but not with 'sat,'.
   virtual bool is_raid_dev_type(const char * type) const;
 
+  /// Replace all devices in 'devlist' by the result of autodetect_open().
+  /// Up to 'max_threads' devices are opened concurrently, at most
+  /// 'max_per_group' (0: no limit) of these from the same scan group.
+  /// Devices are opened sequentially if 'max_threads' <= 1 or if threads
+  /// are not supported.  The order of 'devlist' is preserved.
+  /// Requires thread-safe autodetect_open() for distinct devices.
+  void autodetect_open_devices(smart_device_list & devlist,
+    unsigned max_threads = 16, unsigned max_per_group = 4);
+
+  /// Return scan group (e.g. host adapter) of a device found by
+  /// scan_smart_devices().  Used to balance concurrent autodetection.
+  /// Default implementation returns an empty string (single group).
+  virtual std::string get_dev_scan_group(const smart_device * dev) const;
+
 protected:
   /// Return standard ATA device.
   virtual ata_device * get_ata_device(const char * name, const char * type) = 0;
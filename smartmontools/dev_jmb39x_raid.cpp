@@ -25,6 +25,9 @@
 
 #include <errno.h>
 
+#include <map>
+#include <string>
+
 const char * dev_jmb39x_raid_cpp_svnid = "$Id$";
 
 static void jmbassert_failed(int line, const char * expr)
@@ -309,6 +312,22 @@ static bool scsi_write_lba8(scsi_device * scsidev,  uint8_t lba8, const uint8_t
 
 namespace jmb39x {
 
+// Controller session shared by all open ports of the same bridge.
+// The controller is woken up once by the first port opened and the
+// original sector is restored once when the last port is closed.
+struct jmb39x_session
+{
+  uint8_t version = 0;
+  bool blocked = false;
+  bool orig_write_back = false;
+  uint32_t cmd_id = 0;
+  unsigned num_open = 0;
+  uint8_t orig_data[512] = {0, };
+};
+
+// Open sessions, key is "TUNNEL_DEV_NAME,TUNNEL_DEV_TYPE,sLBA"
+static std::map<std::string, jmb39x_session> jmb_sessions;
+
 class jmb39x_device
 : public tunnelled_device<
   /*implements*/ ata_device,
@@ -334,15 +353,17 @@ private:
   bool m_force;
 
   bool m_blocked;
-  bool m_orig_write_back;
-  uint32_t m_cmd_id;
-  uint8_t m_orig_data[512];
+  std::string m_session_key;
+  jmb39x_session * m_session; ///< Non-null if open
 
   bool raw_read(uint8_t (& data)[512]);
   bool raw_write(const uint8_t (& data)[512]);
   bool run_jmb_command(const uint8_t * cmd, unsigned cmdsize, uint8_t (& response)[512]);
-  void report_orig_data_lost() const;
+  void report_orig_data_lost(const uint8_t (& data)[512]) const;
   bool restore_orig_data();
+  bool start_session(jmb39x_session & session);
+  bool leave_session();
+  void set_blocked();
 };
 
 jmb39x_device::jmb39x_device(smart_interface * intf, smart_device * smartdev, const char * req_type,
@@ -350,21 +371,28 @@ jmb39x_device::jmb39x_device(smart_interface * intf, smart_device * smartdev, co
 : smart_device(intf, smartdev->get_dev_name(), req_type, req_type),
   tunnelled_device<ata_device, smart_device>(smartdev),
   m_version(version), m_port(port), m_lba(lba), m_force(force),
-  m_blocked(false), m_orig_write_back(false), m_cmd_id(0)
+  m_blocked(false), m_session(nullptr)
 {
   set_info().info_name = strprintf("%s [jmb39x_disk_%u]", smartdev->get_info_name(), port);
-  memset(m_orig_data, 0, sizeof(m_orig_data));
 }
 
 jmb39x_device::~jmb39x_device()
 {
-  if (m_orig_write_back) try {
-    jmb39x_device::restore_orig_data();
+  if (m_session) try {
+    jmb39x_device::leave_session();
   } catch (...) {
     // ignore
   }
 }
 
+// Block this port and all other ports of the current session
+void jmb39x_device::set_blocked()
+{
+  m_blocked = true;
+  if (m_session)
+    m_session->blocked = true;
+}
+
 bool jmb39x_device::raw_read(uint8_t (& data)[512])
 {
   memset(data, 0, sizeof(data));
@@ -400,12 +428,13 @@ bool jmb39x_device::raw_write(const uint8_t (& data)[512])
 
 bool jmb39x_device::run_jmb_command(const uint8_t * cmd, unsigned cmdsize, uint8_t (& response)[512])
 {
+  jmbassert(m_session);
   // Set up request
   uint8_t request[512];
-  jmb_set_request_sector(request, m_version, m_cmd_id, cmd, cmdsize);
+  jmb_set_request_sector(request, m_version, m_session->cmd_id, cmd, cmdsize);
 
   if (ata_debugmode) {
-    pout("JMB39x: Write request sector #%d\n", m_cmd_id);
+    pout("JMB39x: Write request sector #%d\n", m_session->cmd_id);
     if (ata_debugmode > 1)
       dStrHex(request, sizeof(request), 0);
   }
@@ -413,7 +442,7 @@ bool jmb39x_device::run_jmb_command(const uint8_t * cmd, unsigned cmdsize, uint8
   // Write obfuscated request
   jmb_xor(request);
   if (!raw_write(request)) {
-    m_blocked = true;
+    set_blocked();
     return false;
   }
   jmb_xor(request);
@@ -421,98 +450,75 @@ bool jmb39x_device::run_jmb_command(const uint8_t * cmd, unsigned cmdsize, uint8
   // Read obfuscated response
   memset(response, 0, sizeof(response));
   if (!raw_read(response)) {
-    m_blocked = true;
+    set_blocked();
     return false;
   }
   jmb_xor(response);
 
   if (ata_debugmode) {
-    pout("JMB39x: Read response sector #%d\n", m_cmd_id);
+    pout("JMB39x: Read response sector #%d\n", m_session->cmd_id);
     if (ata_debugmode > 1)
       dStrHex(response, sizeof(response), 0);
   }
 
   // Check result
   if (!memcmp(request, response, sizeof(request))) { // regular I/O?
-    m_blocked = true;
+    set_blocked();
     return set_err(EIO, "No JMB39x response detected");
   }
   if (!jmb_check_crc(response)) {
-    m_blocked = true;
+    set_blocked();
     jmb_xor(response);
     return set_err(EIO, "%s", (!jmb_check_crc(response)
       ? "CRC error in JMB39x response"
       : "JMB39x response contains a wakeup sector"));
   }
   if (memcmp(request, response, 8)) { // code + id identical?
-    m_blocked = true;
+    set_blocked();
     return set_err(EIO, "Invalid header in JMB39x response");
   }
 
-  m_cmd_id++;
+  m_session->cmd_id++;
   return true;
 }
 
-void jmb39x_device::report_orig_data_lost() const
+void jmb39x_device::report_orig_data_lost(const uint8_t (& data)[512]) const
 {
-  bool zf = !nonempty(m_orig_data, sizeof(m_orig_data));
+  bool zf = !nonempty(data, sizeof(data));
   pout("JMB39x: WARNING: Data (%szero filled) at LBA %d lost\n", (zf ? "" : "not "), m_lba);
   if (!zf) // Dump lost data
-    dStrHex(m_orig_data, sizeof(m_orig_data), 0);
+    dStrHex(data, sizeof(data), 0);
 }
 
 bool jmb39x_device::restore_orig_data()
 {
+  const uint8_t (& orig_data)[512] = m_session->orig_data;
   if (ata_debugmode)
     pout("JMB39x: Restore original sector (%szero filled)\n",
-         (nonempty(m_orig_data, sizeof(m_orig_data)) ? "not " : ""));
-  if (!raw_write(m_orig_data)) {
-    report_orig_data_lost();
-    m_blocked = true;
+         (nonempty(orig_data, sizeof(orig_data)) ? "not " : ""));
+  if (!raw_write(orig_data)) {
+    report_orig_data_lost(orig_data);
+    set_blocked();
     return false;
   }
   return true;
 }
 
-bool jmb39x_device::open()
+// Read original data and wake up controller.
+bool jmb39x_device::start_session(jmb39x_session & session)
 {
-  m_orig_write_back = false;
-  if (m_blocked)
-    return set_err(EIO, "Device blocked due to previous errors");
-
-  if (!tunnelled_device<ata_device, smart_device>::open())
-    return false;
-
-  // Check SCSI LBA size (assume 512 if ATA)
-  if (get_tunnel_dev()->is_scsi()) {
-    int lba_size = scsi_get_lba_size(get_tunnel_dev()->to_scsi());
-    if (lba_size < 0) {
-      error_info err = get_tunnel_dev()->get_err();
-      tunnelled_device<ata_device, smart_device>::close();
-      return set_err(err.no, "SCSI READ CAPACITY failed: %s", err.msg.c_str());
-    }
-    if (lba_size != 512) {
-      tunnelled_device<ata_device, smart_device>::close();
-      return set_err(EINVAL, "LBA size is %d but must be 512", lba_size);
-    }
-  }
-
   // Read original data
   if (ata_debugmode)
     pout("JMB39x: Read original data at LBA %d\n", m_lba);
-  if (!raw_read(m_orig_data)) {
-    error_info err = get_err();
-    tunnelled_device<ata_device, smart_device>::close();
-    return set_err(err);
-  }
+  if (!raw_read(session.orig_data))
+    return false;
 
   // Check original data
-  if (nonempty(m_orig_data, sizeof(m_orig_data))) {
+  if (nonempty(session.orig_data, sizeof(session.orig_data))) {
     if (ata_debugmode > 1)
-      dStrHex(m_orig_data, sizeof(m_orig_data), 0);
-    int st = jmb_get_sector_type(m_orig_data);
+      dStrHex(session.orig_data, sizeof(session.orig_data), 0);
+    int st = jmb_get_sector_type(session.orig_data);
     if (!m_force) {
-      tunnelled_device<ata_device, smart_device>::close();
       m_blocked = true;
       return set_err(EINVAL, "Original sector at LBA %d %s", m_lba,
         (st == 0 ? "is not zero filled" :
@@ -523,7 +529,7 @@ bool jmb39x_device::open()
       // Zero fill to reset protocol state
       if (ata_debugmode)
         pout("JMB39x: Zero filling original data\n");
-      memset(m_orig_data, 0, sizeof(m_orig_data));
+      memset(session.orig_data, 0, sizeof(session.orig_data));
     }
   }
 
@@ -541,16 +547,86 @@ bool jmb39x_device::open()
     if (!raw_write(dataout)) {
         error_info err = get_err();
         if (id > 0)
-          report_orig_data_lost();
-        tunnelled_device<ata_device, smart_device>::close();
+          report_orig_data_lost(session.orig_data);
         m_blocked = true;
         return set_err(err.no, "Write of JMB39x wakeup sector #%d: %s", id + 1, err.msg.c_str());
     }
   }
-  m_orig_write_back = true;
 
   // start command sequence
-  m_cmd_id = 1;
+  session.version = m_version;
+  session.orig_write_back = true;
+  session.cmd_id = 1;
+  return true;
+}
+
+// Leave session, restore original data if this was the last open port.
+bool jmb39x_device::leave_session()
+{
+  jmbassert(m_session && m_session->num_open > 0);
+  bool ok = true;
+  if (--m_session->num_open == 0) {
+    if (m_session->orig_write_back)
+      ok = restore_orig_data();
+    jmb_sessions.erase(m_session_key);
+  }
+  else if (ata_debugmode)
+    pout("JMB39x: Leave session, %u port(s) still open\n", m_session->num_open);
+  m_session = nullptr;
+  return ok;
+}
+
+bool jmb39x_device::open()
+{
+  if (m_blocked)
+    return set_err(EIO, "Device blocked due to previous errors");
+
+  if (!tunnelled_device<ata_device, smart_device>::open())
+    return false;
+
+  // Check SCSI LBA size (assume 512 if ATA)
+  if (get_tunnel_dev()->is_scsi()) {
+    int lba_size = scsi_get_lba_size(get_tunnel_dev()->to_scsi());
+    if (lba_size < 0) {
+      error_info err = get_tunnel_dev()->get_err();
+      tunnelled_device<ata_device, smart_device>::close();
+      return set_err(err.no, "SCSI READ CAPACITY failed: %s", err.msg.c_str());
+    }
+    if (lba_size != 512) {
+      tunnelled_device<ata_device, smart_device>::close();
+      return set_err(EINVAL, "LBA size is %d but must be 512", lba_size);
+    }
+  }
+
+  // Join session of another open port of the same controller, if any
+  m_session_key = strprintf("%s,%s,s%d", get_tunnel_dev()->get_dev_name(),
+                            get_tunnel_dev()->get_dev_type(), m_lba);
+  auto it = jmb_sessions.find(m_session_key);
+  if (it != jmb_sessions.end()) {
+    const jmb39x_session & session = it->second;
+    const char * errmsg = nullptr;
+    if (session.blocked)
+      errmsg = "JMB39x session blocked due to previous errors";
+    else if (session.version != m_version)
+      errmsg = "JMB39x session uses another protocol version";
+    if (errmsg) {
+      tunnelled_device<ata_device, smart_device>::close();
+      return set_err(EIO, "%s", errmsg);
+    }
+    if (ata_debugmode)
+      pout("JMB39x: Join session, %u port(s) already open\n", session.num_open);
+  }
+  else {
+    jmb39x_session session;
+    if (!start_session(session)) {
+      error_info err = get_err();
+      tunnelled_device<ata_device, smart_device>::close();
+      return set_err(err);
+    }
+    it = jmb_sessions.insert(std::make_pair(m_session_key, session)).first;
+  }
+  m_session = &it->second;
+  m_session->num_open++;
 
   // Run JMB identify disk command
   uint8_t b = (m_version != 1 ? 0x02 : 0x01);
@@ -566,7 +642,7 @@ bool jmb39x_device::open()
     0x00, 0x00, 0x00, 0x00,
     0x00, 0x00, 0x00, 0x00
   };
-  uint8_t (& response)[512] = dataout;
+  uint8_t response[512];
   if (!run_jmb_command(cmd, sizeof(cmd), response)) {
     error_info err = get_err();
     close();
@@ -584,10 +660,8 @@ bool jmb39x_device::open()
 bool jmb39x_device::close()
 {
   bool ok = true;
-  if (m_orig_write_back) {
-    ok = restore_orig_data();
-    m_orig_write_back = false;
-  }
+  if (m_session)
+    ok = leave_session();
 
   if (!tunnelled_device<ata_device, smart_device>::close())
     return false;
@@ -620,8 +694,8 @@ static int is_supported_by_jmb(const ata_in_regs & r)
 
 bool jmb39x_device::ata_pass_through(const ata_cmd_in & in, ata_cmd_out & /* out */)
 {
-  jmbassert(is_open());
-  if (m_blocked)
+  jmbassert(is_open() && m_session);
+  if (m_blocked || m_session->blocked)
     return set_err(EIO, "Device blocked due to previous errors");
   if (in.direction == ata_cmd_in::no_data) // TODO: add to ata_cmd_is_supported() ?
     return set_err(ENOSYS, "NO DATA ATA commands not implemented [JMB39x]");
@@ -0,0 +1,726 @@
+/*
+ * dev_snapshot.cpp
+ *
+ * Home page of code is: https://www.smartmontools.org
+ *
+ * Copyright (C) 2026 Smartmontools developers
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include "dev_snapshot.h"
+#include "dev_tunnelled.h"
+#include "atacmds.h" // ata_debugmode
+#include "nvmecmds.h" // nvme_debugmode
+#include "scsicmds.h" // scsi_cmnd_io, scsi_debugmode
+#include "utility.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+const char * dev_snapshot_cpp_cvsid = "$Id$"
+  DEV_SNAPSHOT_H_CVSID;
+
+namespace snapshot {
+
+// Snapshot file format, all integers are little endian:
+//   "SMARTSNP", u32 format version, u64 capture time,
+//   u8 protocol ('A'=ATA, 'S'=SCSI, 'N'=NVMe), u8 flags, u32 NVMe namespace,
+//   str device name, str info name, str device type, str requested type,
+//   u32 number of records, each record: str command input, str command output,
+//   u32 CRC-32 of all preceding bytes.
+// A 'str' is a u32 length followed by the bytes.
+// The command input is used as key to find the output during replay.
+
+static const char file_magic[8] = {'S','M','A','R','T','S','N','P'};
+const unsigned file_version = 1;
+const unsigned max_file_size = 64 * 1024 * 1024;
+
+enum {
+  flag_ata_identify_is_cached = 0x01
+};
+
+// CRC-32 as used by zlib and Ethernet.
+static uint32_t crc32(const void * data, size_t size)
+{
+  const unsigned char * p = reinterpret_cast<const unsigned char *>(data);
+  uint32_t crc = 0xffffffff;
+  for (size_t i = 0; i < size; i++) {
+    crc ^= p[i];
+    for (int k = 0; k < 8; k++)
+      crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+  }
+  return ~crc;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Serialization
+
+class writer
+{
+public:
+  void put_u8(unsigned x)
+    { m_buf += (char)x; }
+  void put_u16(unsigned x)
+    { put_u8(x); put_u8(x >> 8); }
+  void put_u32(uint32_t x)
+    { put_u16(x); put_u16(x >> 16); }
+  void put_u64(uint64_t x)
+    { put_u32((uint32_t)x); put_u32((uint32_t)(x >> 32)); }
+
+  void put_bytes(const void * data, size_t size)
+    {
+      put_u32(size);
+      if (size)
+        m_buf.append(reinterpret_cast<const char *>(data), size);
+    }
+  void put_str(const std::string & s)
+    { put_bytes(s.data(), s.size()); }
+
+  const std::string & get() const
+    { return m_buf; }
+
+private:
+  std::string m_buf;
+};
+
+class reader
+{
+public:
+  explicit reader(const std::string & buf)
+    : m_buf(buf), m_pos(0), m_ok(true) { }
+
+  bool ok() const
+    { return m_ok; }
+  bool at_end() const
+    { return (m_pos >= m_buf.size()); }
+
+  unsigned get_u8()
+    { return (check(1) ? (unsigned char)m_buf[m_pos++] : 0); }
+  unsigned get_u16()
+    { unsigned lo = get_u8(); return lo | (get_u8() << 8); }
+  uint32_t get_u32()
+    { uint32_t lo = get_u16(); return lo | ((uint32_t)get_u16() << 16); }
+  uint64_t get_u64()
+    { uint64_t lo = get_u32(); return lo | ((uint64_t)get_u32() << 32); }
+
+  std::string get_str()
+    {
+      uint32_t size = get_u32();
+      if (!check(size))
+        return std::string();
+      std::string s(m_buf, m_pos, size);
+      m_pos += size;
+      return s;
+    }
+
+  // Copy bytes to buffer, zero-fill remaining space.
+  // Return number of bytes copied.
+  size_t get_bytes(void * data, size_t size)
+    {
+      std::string s = get_str();
+      size_t n = (s.size() < size ? s.size() : size);
+      if (n)
+        memcpy(data, s.data(), n);
+      if (n < size)
+        memset(reinterpret_cast<char *>(data) + n, 0, size - n);
+      return n;
+    }
+
+private:
+  const std::string & m_buf;
+  size_t m_pos;
+  bool m_ok;
+
+  bool check(size_t n)
+    {
+      if (!(m_ok && m_buf.size() - m_pos >= n))
+        m_ok = false;
+      return m_ok;
+    }
+};
+
+// Registers are stored with 'is_set()' flag in bit 8.
+static void put_reg(writer & w, const ata_register & r)
+{
+  w.put_u16((r.is_set() ? 0x100 : 0) | r.val());
+}
+
+static void get_reg(reader & rd, ata_register & r)
+{
+  unsigned x = rd.get_u16();
+  if (x & 0x100)
+    r = (unsigned char)x;
+}
+
+static void put_regs(writer & w, const ata_in_regs & r)
+{
+  put_reg(w, r.features); put_reg(w, r.sector_count);
+  put_reg(w, r.lba_low); put_reg(w, r.lba_mid); put_reg(w, r.lba_high);
+  put_reg(w, r.device); put_reg(w, r.command);
+}
+
+static void put_regs(writer & w, const ata_out_regs & r)
+{
+  put_reg(w, r.error); put_reg(w, r.sector_count);
+  put_reg(w, r.lba_low); put_reg(w, r.lba_mid); put_reg(w, r.lba_high);
+  put_reg(w, r.device); put_reg(w, r.status);
+}
+
+static void get_regs(reader & rd, ata_out_regs & r)
+{
+  get_reg(rd, r.error); get_reg(rd, r.sector_count);
+  get_reg(rd, r.lba_low); get_reg(rd, r.lba_mid); get_reg(rd, r.lba_high);
+  get_reg(rd, r.device); get_reg(rd, r.status);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Snapshot bundle
+
+struct record
+{
+  std::string in;  ///< Serialized command input
+  std::string out; ///< Serialized command output
+};
+
+struct bundle
+{
+  time_t time = 0;
+  char protocol = 0;
+  unsigned char flags = 0;
+  unsigned nsid = 0;
+  smart_device::device_info info;
+  std::vector<record> records;
+};
+
+static std::string format_bundle(const bundle & b)
+{
+  writer w;
+  for (char c : file_magic)
+    w.put_u8(c);
+  w.put_u32(file_version);
+  w.put_u64((uint64_t)b.time);
+  w.put_u8(b.protocol);
+  w.put_u8(b.flags);
+  w.put_u32(b.nsid);
+  w.put_str(b.info.dev_name);
+  w.put_str(b.info.info_name);
+  w.put_str(b.info.dev_type);
+  w.put_str(b.info.req_type);
+  w.put_u32(b.records.size());
+  for (const auto & rec : b.records) {
+    w.put_str(rec.in);
+    w.put_str(rec.out);
+  }
+  w.put_u32(crc32(w.get().data(), w.get().size()));
+  return w.get();
+}
+
+// Parse snapshot, return error message on failure.
+static const char * parse_bundle(const std::string & buf, bundle & b)
+{
+  if (buf.size() < sizeof(file_magic) + 4 || memcmp(buf.data(), file_magic, sizeof(file_magic)))
+    return "Not a device snapshot file";
+  size_t size = buf.size() - 4;
+  std::string crcbuf(buf, size);
+  reader rdcrc(crcbuf);
+  if (rdcrc.get_u32() != crc32(buf.data(), size))
+    return "Snapshot checksum error";
+
+  std::string data(buf, 0, size);
+  reader rd(data);
+  for (unsigned i = 0; i < sizeof(file_magic); i++)
+    rd.get_u8();
+  if (rd.get_u32() != file_version)
+    return "Unsupported snapshot version";
+  b.time = (time_t)rd.get_u64();
+  b.protocol = (char)rd.get_u8();
+  b.flags = rd.get_u8();
+  b.nsid = rd.get_u32();
+  b.info.dev_name = rd.get_str();
+  b.info.info_name = rd.get_str();
+  b.info.dev_type = rd.get_str();
+  b.info.req_type = rd.get_str();
+  uint32_t num = rd.get_u32();
+  for (uint32_t i = 0; i < num && rd.ok(); i++) {
+    record rec;
+    rec.in = rd.get_str();
+    rec.out = rd.get_str();
+    b.records.push_back(rec);
+  }
+  if (!(rd.ok() && rd.at_end()))
+    return "Snapshot format error";
+  if (!(b.protocol == 'A' || b.protocol == 'S' || b.protocol == 'N'))
+    return "Unknown protocol in snapshot";
+  return nullptr;
+}
+
+// Common command output fields.
+static void put_result(writer & w, bool ok, const smart_device::error_info & err)
+{
+  w.put_u8(ok);
+  w.put_u32(ok ? 0 : (uint32_t)err.no);
+  w.put_str(ok ? std::string() : err.msg);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Capture devices
+
+class capture_base
+{
+public:
+  virtual ~capture_base() { }
+
+  const bundle & get_bundle() const
+    { return m_bundle; }
+
+protected:
+  capture_base(char protocol, const smart_device * dev)
+    {
+      m_bundle.protocol = protocol;
+      m_bundle.info = dev->get_info();
+    }
+
+  void add_record(const writer & in, const writer & out)
+    {
+      record rec;
+      rec.in = in.get(); rec.out = out.get();
+      m_bundle.records.push_back(rec);
+    }
+
+  bundle m_bundle;
+};
+
+// ATA
+
+static void put_ata_cmd_in(writer & w, const ata_cmd_in & in)
+{
+  w.put_u8(in.direction);
+  w.put_u32(in.size);
+  put_regs(w, in.in_regs);
+  put_regs(w, in.in_regs.prev);
+  const ata_out_regs_flags & f = in.out_needed;
+  w.put_u8(  (f.error ? 0x01 : 0) | (f.sector_count ? 0x02 : 0)
+           | (f.lba_low ? 0x04 : 0) | (f.lba_mid ? 0x08 : 0) | (f.lba_high ? 0x10 : 0)
+           | (f.device ? 0x20 : 0) | (f.status ? 0x40 : 0)                             );
+  if (in.direction == ata_cmd_in::data_out)
+    w.put_bytes(in.buffer, in.size);
+}
+
+class ata_capture_device
+: public tunnelled_device<ata_device, ata_device>,
+  public capture_base
+{
+public:
+  ata_capture_device(smart_interface * intf, ata_device * atadev);
+
+  virtual bool ata_pass_through(const ata_cmd_in & in, ata_cmd_out & out) override;
+
+  virtual bool ata_identify_is_cached() const override;
+};
+
+ata_capture_device::ata_capture_device(smart_interface * intf, ata_device * atadev)
+: smart_device(intf, atadev->get_dev_name(), atadev->get_dev_type(), atadev->get_req_type()),
+  tunnelled_device<ata_device, ata_device>(atadev),
+  capture_base('A', atadev)
+{
+  set_info() = atadev->get_info();
+  if (atadev->ata_identify_is_cached())
+    m_bundle.flags |= flag_ata_identify_is_cached;
+}
+
+bool ata_capture_device::ata_pass_through(const ata_cmd_in & in, ata_cmd_out & out)
+{
+  ata_device * atadev = get_tunnel_dev();
+  bool ok = atadev->ata_pass_through(in, out);
+  if (!ok)
+    set_err(atadev->get_err());
+
+  writer win, wout;
+  put_ata_cmd_in(win, in);
+  put_result(wout, ok, get_err());
+  put_regs(wout, out.out_regs);
+  put_regs(wout, out.out_regs.prev);
+  if (in.direction == ata_cmd_in::data_in)
+    wout.put_bytes(in.buffer, in.size);
+  add_record(win, wout);
+  return ok;
+}
+
+bool ata_capture_device::ata_identify_is_cached() const
+{
+  return get_tunnel_dev()->ata_identify_is_cached();
+}
+
+// SCSI
+
+static void put_scsi_cmd_in(writer & w, const scsi_cmnd_io * iop)
+{
+  w.put_bytes(iop->cmnd, iop->cmnd_len);
+  w.put_u8(iop->dxfer_dir);
+  w.put_u32(iop->dxfer_len);
+  if (iop->dxfer_dir == DXFER_TO_DEVICE)
+    w.put_bytes(iop->dxferp, iop->dxfer_len);
+}
+
+class scsi_capture_device
+: public tunnelled_device<scsi_device, scsi_device>,
+  public capture_base
+{
+public:
+  scsi_capture_device(smart_interface * intf, scsi_device * scsidev);
+
+  virtual bool scsi_pass_through(scsi_cmnd_io * iop) override;
+};
+
+scsi_capture_device::scsi_capture_device(smart_interface * intf, scsi_device * scsidev)
+: smart_device(intf, scsidev->get_dev_name(), scsidev->get_dev_type(), scsidev->get_req_type()),
+  tunnelled_device<scsi_device, scsi_device>(scsidev),
+  capture_base('S', scsidev)
+{
+  set_info() = scsidev->get_info();
+}
+
+bool scsi_capture_device::scsi_pass_through(scsi_cmnd_io * iop)
+{
+  scsi_device * scsidev = get_tunnel_dev();
+  bool ok = scsidev->scsi_pass_through(iop);
+  if (!ok)
+    set_err(scsidev->get_err());
+
+  writer win, wout;
+  put_scsi_cmd_in(win, iop);
+  put_result(wout, ok, get_err());
+  wout.put_u8(iop->scsi_status);
+  wout.put_u32((uint32_t)iop->resid);
+  size_t sense_len = (iop->sensep ? iop->resp_sense_len : 0);
+  if (sense_len > iop->max_sense_len)
+    sense_len = iop->max_sense_len;
+  wout.put_bytes(iop->sensep, sense_len);
+  if (iop->dxfer_dir == DXFER_FROM_DEVICE)
+    wout.put_bytes(iop->dxferp, iop->dxfer_len);
+  add_record(win, wout);
+  return ok;
+}
+
+// NVMe
+
+static void put_nvme_cmd_in(writer & w, const nvme_cmd_in & in)
+{
+  w.put_u8(in.opcode);
+  w.put_u32(in.nsid);
+  w.put_u32(in.cdw10); w.put_u32(in.cdw11); w.put_u32(in.cdw12);
+  w.put_u32(in.cdw13); w.put_u32(in.cdw14); w.put_u32(in.cdw15);
+  w.put_u32(in.size);
+  if (in.direction() & nvme_cmd_in::data_out)
+    w.put_bytes(in.buffer, in.size);
+}
+
+class nvme_capture_device
+: public tunnelled_device<nvme_device, nvme_device>,
+  public capture_base
+{
+public:
+  nvme_capture_device(smart_interface * intf, nvme_device * nvmedev);
+
+  virtual bool nvme_pass_through(const nvme_cmd_in & in, nvme_cmd_out & out) override;
+};
+
+nvme_capture_device::nvme_capture_device(smart_interface * intf, nvme_device * nvmedev)
+: smart_device(intf, nvmedev->get_dev_name(), nvmedev->get_dev_type(), nvmedev->get_req_type()),
+  tunnelled_device<nvme_device, nvme_device>(nvmedev, nvmedev->get_nsid()),
+  capture_base('N', nvmedev)
+{
+  set_info() = nvmedev->get_info();
+  m_bundle.nsid = nvmedev->get_nsid();
+}
+
+bool nvme_capture_device::nvme_pass_through(const nvme_cmd_in & in, nvme_cmd_out & out)
+{
+  nvme_device * nvmedev = get_tunnel_dev();
+  bool ok = nvmedev->nvme_pass_through(in, out);
+  if (!ok)
+    set_err(nvmedev->get_err());
+
+  writer win, wout;
+  put_nvme_cmd_in(win, in);
+  put_result(wout, ok, get_err());
+  wout.put_u32(out.result);
+  wout.put_u16(out.status);
+  wout.put_u8(out.status_valid);
+  if (in.direction() & nvme_cmd_in::data_in)
+    wout.put_bytes(in.buffer, in.size);
+  add_record(win, wout);
+  return ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Replay devices
+
+class replay_base
+: virtual public /*implements*/ smart_device
+{
+protected:
+  explicit replay_base(const bundle & b)
+    : smart_device(never_called),
+      m_bundle(b), m_is_open(false), m_next(0), m_out_of_sync(false)
+    { }
+
+public:
+  virtual bool is_open() const override
+    { return m_is_open; }
+
+  virtual bool open() override
+    { m_is_open = true; m_next = 0; m_out_of_sync = false; return true; }
+
+  virtual bool close() override;
+
+  time_t get_time() const
+    { return m_bundle.time; }
+
+protected:
+  const bundle & get_bundle() const
+    { return m_bundle; }
+
+  /// Find output of command, try round-robin if out of sync.
+  /// Return nullptr and set error if not found.
+  const std::string * find_output(const writer & in);
+
+  /// Read common output fields, set device error if command failed.
+  bool get_result(reader & rd);
+
+private:
+  bundle m_bundle;
+  bool m_is_open;
+  unsigned m_next;
+  bool m_out_of_sync;
+};
+
+bool replay_base::close()
+{
+  if (m_out_of_sync && ata_debugmode + scsi_debugmode + nvme_debugmode)
+    pout("REPLAY-SNAPSHOT: Warning: commands replayed out of sync\n");
+  m_is_open = false;
+  return true;
+}
+
+const std::string * replay_base::find_output(const writer & in)
+{
+  unsigned num = m_bundle.records.size();
+  for (unsigned j = 0, i = m_next; j < num; j++) {
+    if (m_bundle.records[i].in == in.get()) {
+      m_next = (i + 1 < num ? i + 1 : 0);
+      return &m_bundle.records[i].out;
+    }
+    m_out_of_sync = true;
+    if (++i >= num)
+      i = 0;
+  }
+  set_err(ENOSYS, "Command not found in snapshot");
+  return nullptr;
+}
+
+bool replay_base::get_result(reader & rd)
+{
+  bool ok = !!rd.get_u8();
+  int no = (int)rd.get_u32();
+  std::string msg = rd.get_str();
+  if (!ok)
+    set_err(error_info(no, msg.c_str()));
+  return ok;
+}
+
+// ATA
+
+class ata_replay_device
+: public /*implements*/ ata_device,
+  public replay_base
+{
+public:
+  ata_replay_device(smart_interface * intf, const bundle & b);
+
+  virtual bool ata_pass_through(const ata_cmd_in & in, ata_cmd_out & out) override;
+
+  virtual bool ata_identify_is_cached() const override;
+};
+
+ata_replay_device::ata_replay_device(smart_interface * intf, const bundle & b)
+: smart_device(intf, b.info.dev_name.c_str(), b.info.dev_type.c_str(), b.info.req_type.c_str()),
+  replay_base(b)
+{
+  set_info() = b.info;
+}
+
+bool ata_replay_device::ata_pass_through(const ata_cmd_in & in, ata_cmd_out & out)
+{
+  writer win;
+  put_ata_cmd_in(win, in);
+  const std::string * recout = find_output(win);
+  if (!recout)
+    return false;
+
+  reader rd(*recout);
+  bool ok = get_result(rd);
+  get_regs(rd, out.out_regs);
+  get_regs(rd, out.out_regs.prev);
+  if (in.direction == ata_cmd_in::data_in)
+    rd.get_bytes(in.buffer, in.size);
+  return ok;
+}
+
+bool ata_replay_device::ata_identify_is_cached() const
+{
+  return !!(get_bundle().flags & flag_ata_identify_is_cached);
+}
+
+// SCSI
+
+class scsi_replay_device
+: public /*implements*/ scsi_device,
+  public replay_base
+{
+public:
+  scsi_replay_device(smart_interface * intf, const bundle & b);
+
+  virtual bool scsi_pass_through(scsi_cmnd_io * iop) override;
+};
+
+scsi_replay_device::scsi_replay_device(smart_interface * intf, const bundle & b)
+: smart_device(intf, b.info.dev_name.c_str(), b.info.dev_type.c_str(), b.info.req_type.c_str()),
+  replay_base(b)
+{
+  set_info() = b.info;
+}
+
+bool scsi_replay_device::scsi_pass_through(scsi_cmnd_io * iop)
+{
+  writer win;
+  put_scsi_cmd_in(win, iop);
+  const std::string * recout = find_output(win);
+  if (!recout)
+    return false;
+
+  reader rd(*recout);
+  bool ok = get_result(rd);
+  iop->scsi_status = (uint8_t)rd.get_u8();
+  iop->resid = (int)rd.get_u32();
+  if (iop->sensep)
+    iop->resp_sense_len = rd.get_bytes(iop->sensep, iop->max_sense_len);
+  else
+    rd.get_str();
+  if (iop->dxfer_dir == DXFER_FROM_DEVICE)
+    rd.get_bytes(iop->dxferp, iop->dxfer_len);
+  return ok;
+}
+
+// NVMe
+
+class nvme_replay_device
+: public /*implements*/ nvme_device,
+  public replay_base
+{
+public:
+  nvme_replay_device(smart_interface * intf, const bundle & b);
+
+  virtual bool nvme_pass_through(const nvme_cmd_in & in, nvme_cmd_out & out) override;
+};
+
+nvme_replay_device::nvme_replay_device(smart_interface * intf, const bundle & b)
+: smart_device(intf, b.info.dev_name.c_str(), b.info.dev_type.c_str(), b.info.req_type.c_str()),
+  nvme_device(b.nsid),
+  replay_base(b)
+{
+  set_info() = b.info;
+}
+
+bool nvme_replay_device::nvme_pass_through(const nvme_cmd_in & in, nvme_cmd_out & out)
+{
+  writer win;
+  put_nvme_cmd_in(win, in);
+  const std::string * recout = find_output(win);
+  if (!recout)
+    return false;
+
+  reader rd(*recout);
+  bool ok = get_result(rd);
+  out.result = rd.get_u32();
+  out.status = (unsigned short)rd.get_u16();
+  out.status_valid = !!rd.get_u8();
+  if (in.direction() & nvme_cmd_in::data_in)
+    rd.get_bytes(in.buffer, in.size);
+  return ok;
+}
+
+} // namespace snapshot
+
+using namespace snapshot;
+
+smart_device * get_snapshot_capture_device(smart_interface * intf, smart_device * dev)
+{
+  if (dev->is_ata())
+    return new ata_capture_device(intf, dev->to_ata());
+  if (dev->is_scsi())
+    return new scsi_capture_device(intf, dev->to_scsi());
+  if (dev->is_nvme())
+    return new nvme_capture_device(intf, dev->to_nvme());
+  return dev;
+}
+
+bool write_device_snapshot(smart_device * dev, const char * filename)
+{
+  const capture_base * cap = dynamic_cast<const capture_base *>(dev);
+  if (!cap)
+    return dev->set_err(EINVAL, "Device does not support snapshots");
+
+  bundle b = cap->get_bundle();
+  b.time = time(nullptr);
+  std::string buf = format_bundle(b);
+
+  FILE * f = fopen(filename, "wb");
+  if (!f)
+    return dev->set_err(errno, "%s: %s", filename, strerror(errno));
+  bool ok = (fwrite(buf.data(), 1, buf.size(), f) == buf.size());
+  if (fclose(f))
+    ok = false;
+  if (!ok)
+    return dev->set_err(EIO, "%s: Write error", filename);
+  return true;
+}
+
+smart_device * get_snapshot_replay_device(smart_interface * intf, const char * filename)
+{
+  FILE * f = fopen(filename, "rb");
+  if (!f)
+    return intf->set_err_np(errno, "%s", strerror(errno));
+  std::string buf;
+  char tmp[16*1024];
+  size_t nr;
+  while ((nr = fread(tmp, 1, sizeof(tmp), f)) > 0 && buf.size() <= max_file_size)
+    buf.append(tmp, nr);
+  fclose(f);
+  if (buf.size() > max_file_size)
+    return intf->set_err_np(EINVAL, "Snapshot file too large");
+
+  bundle b;
+  const char * errmsg = parse_bundle(buf, b);
+  if (errmsg)
+    return intf->set_err_np(EINVAL, "%s", errmsg);
+
+  switch (b.protocol) {
+    case 'A': return new ata_replay_device(intf, b);
+    case 'S': return new scsi_replay_device(intf, b);
+    default:  return new nvme_replay_device(intf, b);
+  }
+}
+
+time_t get_snapshot_time(const smart_device * dev)
+{
+  const replay_base * rep = dynamic_cast<const replay_base *>(dev);
+  return (rep ? rep->get_time() : 0);
+}
@@ -0,0 +1,41 @@
+/*
+ * dev_snapshot.h
+ *
+ * Home page of code is: https://www.smartmontools.org
+ *
+ * Copyright (C) 2026 Smartmontools developers
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef DEV_SNAPSHOT_H
+#define DEV_SNAPSHOT_H
+
+#define DEV_SNAPSHOT_H_CVSID "$Id$"
+
+#include "dev_interface.h"
+
+#include <time.h>
+
+// Device snapshots:
+// A capture device records all ATA, SCSI or NVMe pass-through commands
+// sent to an open device together with their results. The records are
+// saved into a checksummed binary file. A replay device reads this file
+// and answers the same command sequence without accessing any device.
+
+/// Return a device which forwards all commands to the open device 'dev'
+/// and records them. Takes ownership of 'dev'.
+smart_device * get_snapshot_capture_device(smart_interface * intf, smart_device * dev);
+
+/// Save commands recorded by a capture device to a snapshot file.
+/// Return false and set device error on failure.
+bool write_device_snapshot(smart_device * dev, const char * filename);
+
+/// Return a device which replays commands from a snapshot file.
+/// Return nullptr and set interface error on failure.
+smart_device * get_snapshot_replay_device(smart_interface * intf, const char * filename);
+
+/// Return the time the snapshot of a replay device was taken, 0 if none.
+time_t get_snapshot_time(const smart_device * dev);
+
+#endif // DEV_SNAPSHOT_H
@@ -0,0 +1,474 @@
+/*
+ * dev_status_cache.cpp
+ *
+ * Home page of code is: https://www.smartmontools.org
+ *
+ * Copyright (C) 2026 Smartmontools developers
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include "dev_status_cache.h"
+#include "atacmds.h"
+#include "nvmecmds.h"
+#include "utility.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const char * dev_status_cache_cpp_cvsid = "$Id$"
+  DEV_STATUS_CACHE_H_CVSID;
+
+namespace status_cache {
+
+// Status file format:
+//   "# smartd status file" line, "format = 1" line, "time = T" line,
+//   for each device a "device = UNIQUE_NAME" line followed by
+//   "KEY = VALUE" lines. Raw data is written as one line of hex digits.
+// Unknown keys are ignored.
+
+static const char file_header[] = "# smartd status file";
+const unsigned file_format = 1;
+const unsigned max_file_size = 16 * 1024 * 1024;
+
+static std::string to_hex(const std::string & data)
+{
+  static const char digits[] = "0123456789abcdef";
+  std::string s;
+  s.reserve(data.size() * 2);
+  for (unsigned char c : data) {
+    s += digits[c >> 4];
+    s += digits[c & 0xf];
+  }
+  return s;
+}
+
+static bool from_hex(const std::string & s, std::string & data)
+{
+  if (s.size() % 2)
+    return false;
+  data.clear();
+  data.reserve(s.size() / 2);
+  for (unsigned i = 0; i < s.size(); i += 2) {
+    char tmp[3] = { s[i], s[i+1], 0 };
+    char * end;
+    unsigned long v = strtoul(tmp, &end, 16);
+    if (end != tmp + 2)
+      return false;
+    data += (char)v;
+  }
+  return true;
+}
+
+// Append "KEY = VALUE" line, strprintf() would truncate long values.
+static void put_line(std::string & s, const char * key, const std::string & val)
+{
+  s += key; s += " = "; s += val; s += '\n';
+}
+
+static std::string format_status_file(time_t write_time,
+  const std::vector<dev_status_entry> & entries)
+{
+  std::string s = strprintf("%s\nformat = %u\ntime = %" PRId64 "\n",
+    file_header, file_format, (int64_t)write_time);
+
+  for (const dev_status_entry & e : entries) {
+    s += '\n';
+    put_line(s, "device", e.unique_name);
+    put_line(s, "dev-name", e.dev_name);
+    if (!e.dev_type.empty())
+      put_line(s, "dev-type", e.dev_type);
+    put_line(s, "info-name", e.info_name);
+    if (!e.idinfo.empty())
+      put_line(s, "idinfo", e.idinfo);
+    s += strprintf("protocol = %c\n", e.protocol);
+    if (e.nsid)
+      s += strprintf("nsid = 0x%x\n", e.nsid);
+    s += strprintf("check-time = %" PRId64 "\n", (int64_t)e.check_time);
+    s += strprintf("data-time = %" PRId64 "\n", (int64_t)e.data_time);
+    if (e.num_skipped)
+      s += strprintf("num-skipped = %d\npower-mode-skipped = %d\n",
+                     e.num_skipped, e.power_mode_skipped);
+    s += strprintf("health = %d\n", e.health);
+    if (e.temperature)
+      s += strprintf("temperature = %d\ntemp-min = %d\ntemp-max = %d\n",
+                     e.temperature, e.tempmin, e.tempmax);
+    if (e.selftest_errors >= 0)
+      s += strprintf("selftest-errors = %d\n", e.selftest_errors);
+    if (e.ata_errors >= 0)
+      s += strprintf("ata-errors = %d\n", e.ata_errors);
+    if (e.nvme_err_log_entries >= 0)
+      s += strprintf("nvme-err-log-entries = %" PRId64 "\n", e.nvme_err_log_entries);
+
+    static const struct {
+      const char * key;
+      std::string dev_status_entry::* data;
+    } blobs[] = {
+      { "ata-identify",     &dev_status_entry::ata_identify },
+      { "ata-smart-values", &dev_status_entry::ata_smart_values },
+      { "ata-smart-thres",  &dev_status_entry::ata_smart_thres },
+      { "nvme-id-ctrl",     &dev_status_entry::nvme_id_ctrl },
+      { "nvme-smart-log",   &dev_status_entry::nvme_smart_log },
+    };
+    for (const auto & b : blobs) {
+      const std::string & data = e.*b.data;
+      if (!data.empty())
+        put_line(s, b.key, to_hex(data));
+    }
+  }
+  return s;
+}
+
+// Set entry member from KEY = VALUE, return false on bad value.
+static bool parse_entry_value(dev_status_entry & e, const std::string & key,
+                              const std::string & val)
+{
+  const char * v = val.c_str();
+  char * end;
+  errno = 0;
+  long long n = strtoll(v, &end, 0);
+  bool num_ok = (*v && !*end && !errno);
+
+  if (key == "dev-name")
+    e.dev_name = val;
+  else if (key == "dev-type")
+    e.dev_type = val;
+  else if (key == "info-name")
+    e.info_name = val;
+  else if (key == "idinfo")
+    e.idinfo = val;
+  else if (key == "protocol") {
+    if (!(val == "A" || val == "S" || val == "N"))
+      return false;
+    e.protocol = val[0];
+  }
+  else if (key == "ata-identify")
+    return (from_hex(val, e.ata_identify) && e.ata_identify.size() == 512);
+  else if (key == "ata-smart-values")
+    return (from_hex(val, e.ata_smart_values) && e.ata_smart_values.size() == 512);
+  else if (key == "ata-smart-thres")
+    return (from_hex(val, e.ata_smart_thres) && e.ata_smart_thres.size() == 512);
+  else if (key == "nvme-id-ctrl")
+    return (from_hex(val, e.nvme_id_ctrl) && e.nvme_id_ctrl.size() == 4096);
+  else if (key == "nvme-smart-log")
+    return (from_hex(val, e.nvme_smart_log) && e.nvme_smart_log.size() == 512);
+  else if (!num_ok)
+    return false;
+  else if (key == "nsid")
+    e.nsid = (unsigned)n;
+  else if (key == "check-time")
+    e.check_time = (time_t)n;
+  else if (key == "data-time")
+    e.data_time = (time_t)n;
+  else if (key == "num-skipped")
+    e.num_skipped = (int)n;
+  else if (key == "power-mode-skipped")
+    e.power_mode_skipped = (int)n;
+  else if (key == "health")
+    e.health = (unsigned char)n;
+  else if (key == "temperature")
+    e.temperature = (unsigned char)n;
+  else if (key == "temp-min")
+    e.tempmin = (unsigned char)n;
+  else if (key == "temp-max")
+    e.tempmax = (unsigned char)n;
+  else if (key == "selftest-errors")
+    e.selftest_errors = (int)n;
+  else if (key == "ata-errors")
+    e.ata_errors = (int)n;
+  else if (key == "nvme-err-log-entries")
+    e.nvme_err_log_entries = n;
+  // else: ignore unknown keys from newer versions
+  return true;
+}
+
+// Parse status file, return error message or nullptr on success.
+static const char * parse_status_file(const std::string & buf, time_t & write_time,
+  std::vector<dev_status_entry> & entries)
+{
+  entries.clear();
+  write_time = 0;
+  bool header_ok = false, format_ok = false;
+
+  size_t pos = 0;
+  while (pos < buf.size()) {
+    size_t eol = buf.find('\n', pos);
+    if (eol == std::string::npos)
+      return "Truncated status file";
+    std::string line = buf.substr(pos, eol - pos);
+    pos = eol + 1;
+
+    if (!header_ok) {
+      if (line != file_header)
+        return "Not a smartd status file";
+      header_ok = true;
+      continue;
+    }
+    if (line.empty() || line[0] == '#')
+      continue;
+
+    size_t sep = line.find(" = ");
+    if (sep == std::string::npos || !sep)
+      return "Syntax error in status file";
+    std::string key = line.substr(0, sep), val = line.substr(sep + 3);
+
+    if (key == "format") {
+      if (atoi(val.c_str()) != (int)file_format)
+        return "Unsupported status file format";
+      format_ok = true;
+    }
+    else if (!format_ok)
+      return "Missing status file format";
+    else if (key == "time")
+      write_time = (time_t)strtoll(val.c_str(), nullptr, 10);
+    else if (key == "device") {
+      entries.push_back(dev_status_entry());
+      entries.back().unique_name = val;
+    }
+    else if (entries.empty())
+      continue;
+    else if (!parse_entry_value(entries.back(), key, val))
+      return "Invalid value in status file";
+  }
+
+  if (!format_ok)
+    return "Missing status file format";
+  return nullptr;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Status devices
+
+// SMART RETURN STATUS output registers
+#define SMART_CYL_LOW  0x4F
+#define SMART_CYL_HI   0xC2
+#define SRET_STATUS_HI_EXCEEDED 0x2C
+#define SRET_STATUS_MID_EXCEEDED 0xF4
+
+class status_base
+: virtual public /*implements*/ smart_device
+{
+protected:
+  explicit status_base(const dev_status_entry & e)
+    : smart_device(never_called),
+      m_entry(e), m_is_open(false)
+    { }
+
+public:
+  virtual bool is_open() const override
+    { return m_is_open; }
+
+  virtual bool open() override
+    { m_is_open = true; return true; }
+
+  virtual bool close() override
+    { m_is_open = false; return true; }
+
+protected:
+  const dev_status_entry & get_entry() const
+    { return m_entry; }
+
+  /// Copy cached data into command buffer, set error if not available.
+  bool get_data(const std::string & data, void * buffer, unsigned size);
+
+private:
+  dev_status_entry m_entry;
+  bool m_is_open;
+};
+
+bool status_base::get_data(const std::string & data, void * buffer, unsigned size)
+{
+  if (data.empty())
+    return set_err(ENOSYS, "Data not available in smartd status");
+  if (!(buffer && size <= data.size()))
+    return set_err(EINVAL, "Invalid buffer size %u", size);
+  memcpy(buffer, data.data(), size);
+  return true;
+}
+
+// ATA
+
+class ata_status_device
+: public /*implements*/ ata_device,
+  public status_base
+{
+public:
+  ata_status_device(smart_interface * intf, const dev_status_entry & e);
+
+  virtual bool ata_pass_through(const ata_cmd_in & in, ata_cmd_out & out) override;
+};
+
+ata_status_device::ata_status_device(smart_interface * intf, const dev_status_entry & e)
+: smart_device(intf, e.dev_name.c_str(), e.dev_type.c_str(), ""),
+  status_base(e)
+{
+  set_info().info_name = e.info_name;
+}
+
+bool ata_status_device::ata_pass_through(const ata_cmd_in & in, ata_cmd_out & out)
+{
+  const dev_status_entry & e = get_entry();
+  const std::string * data = nullptr;
+
+  switch (in.in_regs.command) {
+    case ATA_IDENTIFY_DEVICE:
+      data = &e.ata_identify;
+      break;
+
+    case ATA_CHECK_POWER_MODE:
+      // Report the mode which let smartd skip the last check(s)
+      if (!e.num_skipped) {
+        out.out_regs.sector_count = 0xff;
+        return true;
+      }
+      if (e.power_mode_skipped < 0)
+        return set_err(EIO, "Device was in SLEEP mode");
+      out.out_regs.sector_count = (unsigned char)e.power_mode_skipped;
+      return true;
+
+    case ATA_SMART_CMD:
+      switch (in.in_regs.features) {
+        case ATA_SMART_READ_VALUES:
+          data = &e.ata_smart_values;
+          break;
+        case ATA_SMART_READ_THRESHOLDS:
+          data = &e.ata_smart_thres;
+          break;
+        case ATA_SMART_STATUS:
+          if (e.health == dev_status_entry::health_passed) {
+            out.out_regs.lba_high = SMART_CYL_HI;
+            out.out_regs.lba_mid = SMART_CYL_LOW;
+            return true;
+          }
+          if (e.health == dev_status_entry::health_failed) {
+            out.out_regs.lba_high = SRET_STATUS_HI_EXCEEDED;
+            out.out_regs.lba_mid = SRET_STATUS_MID_EXCEEDED;
+            return true;
+          }
+          break;
+      }
+      break;
+  }
+
+  if (!data)
+    return set_err(ENOSYS, "Command not available in smartd status");
+  if (in.direction != ata_cmd_in::data_in)
+    return set_err(EINVAL, "Invalid data direction");
+  return get_data(*data, in.buffer, in.size);
+}
+
+// NVMe
+
+class nvme_status_device
+: public /*implements*/ nvme_device,
+  public status_base
+{
+public:
+  nvme_status_device(smart_interface * intf, const dev_status_entry & e);
+
+  virtual bool nvme_pass_through(const nvme_cmd_in & in, nvme_cmd_out & out) override;
+};
+
+nvme_status_device::nvme_status_device(smart_interface * intf, const dev_status_entry & e)
+: smart_device(intf, e.dev_name.c_str(), e.dev_type.c_str(), ""),
+  // Use broadcast NSID, Identify Namespace data is not cached
+  nvme_device(0xffffffff),
+  status_base(e)
+{
+  set_info().info_name = e.info_name;
+}
+
+bool nvme_status_device::nvme_pass_through(const nvme_cmd_in & in, nvme_cmd_out & /*out*/)
+{
+  const dev_status_entry & e = get_entry();
+  if (in.opcode == smartmontools::nvme_admin_identify && in.cdw10 == 0x01)
+    return get_data(e.nvme_id_ctrl, in.buffer, in.size);
+  if (in.opcode == smartmontools::nvme_admin_get_log_page && (in.cdw10 & 0xff) == 0x02
+      && in.nsid == 0xffffffff && !in.cdw12)
+    return get_data(e.nvme_smart_log, in.buffer, in.size);
+  return set_err(ENOSYS, "Command not available in smartd status");
+}
+
+} // namespace status_cache
+
+using namespace status_cache;
+
+bool write_dev_status_file(const char * filename, time_t write_time,
+  const std::vector<dev_status_entry> & entries, std::string & errmsg)
+{
+  std::string buf = format_status_file(write_time, entries);
+
+  // Write to temporary file and rename it, readers never see a partial file
+  std::string tmpname = filename; tmpname += ".tmp";
+  FILE * f = fopen(tmpname.c_str(), "w");
+  if (!f) {
+    errmsg = strprintf("%s: %s", tmpname.c_str(), strerror(errno));
+    return false;
+  }
+  bool ok = (fwrite(buf.data(), 1, buf.size(), f) == buf.size());
+  if (fclose(f))
+    ok = false;
+  if (!ok) {
+    errmsg = strprintf("%s: Write error", tmpname.c_str());
+    remove(tmpname.c_str());
+    return false;
+  }
+
+#ifdef _WIN32
+  // rename() does not replace existing files
+  remove(filename);
+#endif
+  if (rename(tmpname.c_str(), filename)) {
+    errmsg = strprintf("%s: %s", filename, strerror(errno));
+    remove(tmpname.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool read_dev_status_file(const char * filename, time_t & write_time,
+  std::vector<dev_status_entry> & entries, std::string & errmsg)
+{
+  FILE * f = fopen(filename, "r");
+  if (!f) {
+    errmsg = strprintf("%s: %s", filename, strerror(errno));
+    return false;
+  }
+  std::string buf;
+  char tmp[16*1024];
+  size_t nr;
+  while ((nr = fread(tmp, 1, sizeof(tmp), f)) > 0 && buf.size() <= max_file_size)
+    buf.append(tmp, nr);
+  fclose(f);
+  if (buf.size() > max_file_size) {
+    errmsg = strprintf("%s: Status file too large", filename);
+    return false;
+  }
+
+  const char * msg = parse_status_file(buf, write_time, entries);
+  if (msg) {
+    errmsg = strprintf("%s: %s", filename, msg);
+    return false;
+  }
+  return true;
+}
+
+smart_device * get_dev_status_device(smart_interface * intf,
+  const dev_status_entry & entry)
+{
+  // Cached data is in host byte order, the read functions would swap it again
+  if (isbigendian())
+    return intf->set_err_np(ENOSYS, "Rendering smartd status is not supported on big endian hosts");
+
+  switch (entry.protocol) {
+    case 'A': return new ata_status_device(intf, entry);
+    case 'N': return new nvme_status_device(intf, entry);
+    default:
+      return intf->set_err_np(ENOSYS, "Only summary available for SCSI devices");
+  }
+}
@@ -0,0 +1,77 @@
+/*
+ * dev_status_cache.h
+ *
+ * Home page of code is: https://www.smartmontools.org
+ *
+ * Copyright (C) 2026 Smartmontools developers
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef DEV_STATUS_CACHE_H
+#define DEV_STATUS_CACHE_H
+
+#define DEV_STATUS_CACHE_H_CVSID "$Id$"
+
+#include "dev_interface.h"
+
+#include <stdint.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+// Device status cache:
+// smartd publishes the latest readings of all monitored devices in a
+// status file ('-S FILE'). The file is replaced atomically after each
+// check cycle, so readers always see a complete snapshot. smartctl
+// renders this data with '--smartd-status=FILE' without accessing the
+// device.
+
+/// Cached status of one device.
+struct dev_status_entry
+{
+  std::string unique_name;      ///< From smart_interface::get_unique_dev_name()
+  std::string dev_name;         ///< Device name from smartd.conf
+  std::string dev_type;         ///< Device type, empty if autodetected
+  std::string info_name;        ///< Informal name used by smartd
+  std::string idinfo;           ///< Device identify info
+  char protocol = 0;            ///< 'A'=ATA, 'S'=SCSI, 'N'=NVMe
+  unsigned nsid = 0;            ///< NVMe namespace
+
+  time_t check_time = 0;        ///< Last check, also if skipped due to power mode
+  time_t data_time = 0;         ///< Last check which read data from device
+  int power_mode_skipped = 0;   ///< Power mode of skipped checks, if num_skipped
+  int num_skipped = 0;          ///< Number of checks skipped since data_time
+
+  enum { health_unknown, health_passed, health_failed };
+  unsigned char health = health_unknown;
+  unsigned char temperature = 0, tempmin = 0, tempmax = 0; ///< 0 if unknown
+
+  int selftest_errors = -1;     ///< -1 if unknown
+  int ata_errors = -1;          ///< -1 if unknown
+  int64_t nvme_err_log_entries = -1; ///< -1 if unknown
+
+  // Raw data in host byte order, empty if not available
+  std::string ata_identify;     ///< 512 bytes IDENTIFY DEVICE data
+  std::string ata_smart_values; ///< 512 bytes SMART READ DATA
+  std::string ata_smart_thres;  ///< 512 bytes SMART READ THRESHOLDS
+  std::string nvme_id_ctrl;     ///< 4096 bytes Identify Controller data
+  std::string nvme_smart_log;   ///< 512 bytes SMART/Health Information log
+};
+
+/// Write status file atomically. Return false and set errmsg on failure.
+bool write_dev_status_file(const char * filename, time_t write_time,
+  const std::vector<dev_status_entry> & entries, std::string & errmsg);
+
+/// Read status file. Return false and set errmsg on failure.
+bool read_dev_status_file(const char * filename, time_t & write_time,
+  std::vector<dev_status_entry> & entries, std::string & errmsg);
+
+/// Return an ATA or NVMe device which answers the commands needed to print
+/// identify info, health status and attributes from the cached data.
+/// Return nullptr and set interface error if not supported.
+smart_device * get_dev_status_device(smart_interface * intf,
+  const dev_status_entry & entry);
+
+#endif // DEV_STATUS_CACHE_H
@@ -805,6 +805,9 @@ void jwrn(const char* fmt, ...) { _PRINT_; }
 void jerr(const char* fmt, ...) { _PRINT_; }
 #undef _PRINT_
 
+void pout_flush() {
+}
+
 void jout_startup_datetime(const char* prefix) {
   (void) prefix;
 }
@@ -49,28 +49,37 @@ static void debug_hex_dump(const void * data, unsigned size)
     pout(" ...\n");
 }
 
-// Call NVMe pass-through and print debug info if requested.
-static bool nvme_pass_through(nvme_device * device, const nvme_cmd_in & in,
-  nvme_cmd_out & out)
+// Print debug info about NVMe command to be called.
+static void print_nvme_call(const nvme_cmd_in & in)
 {
-  if (nvme_debugmode) {
-    pout(" [NVMe call: opcode=0x%02x, size=0x%04x, nsid=0x%08x, cdw10=0x%08x",
-      in.opcode, in.size, in.nsid, in.cdw10);
-    if (in.cdw11 || in.cdw12 || in.cdw13 || in.cdw14 || in.cdw15)
-      pout(",\n  cdw1x=0x%08x, 0x%08x, 0x%08x, 0x%08x, 0x%08x",
-       in.cdw11, in.cdw12, in.cdw13, in.cdw14, in.cdw15);
-    pout("]\n");
-  }
+  pout(" [NVMe call: opcode=0x%02x, size=0x%04x, nsid=0x%08x, cdw10=0x%08x",
+    in.opcode, in.size, in.nsid, in.cdw10);
+  if (in.cdw11 || in.cdw12 || in.cdw13 || in.cdw14 || in.cdw15)
+    pout(",\n  cdw1x=0x%08x, 0x%08x, 0x%08x, 0x%08x, 0x%08x",
+     in.cdw11, in.cdw12, in.cdw13, in.cdw14, in.cdw15);
+  pout("]\n");
+}
 
-  auto start_usec = (nvme_debugmode ? get_timer_usec() : -1);
+// Return duration since start_usec, -1 if no timer available.
+static long long get_nvme_duration(long long start_usec)
+{
+  return (start_usec >= 0 ? get_timer_usec() - start_usec : -1);
+}
 
-  bool ok = device->nvme_pass_through(in, out);
+// Print call duration if requested.
+static void print_nvme_duration(long long duration_usec)
+{
+  if (nvme_debugmode && duration_usec > 0)
+    pout(" [Duration: %.6fs]\n", duration_usec / 1000000.0);
+}
 
-  if (start_usec >= 0) {
-    auto duration_usec = get_timer_usec() - start_usec;
-    if (duration_usec > 0)
-      pout(" [Duration: %.6fs]\n", duration_usec / 1000000.0);
-  }
+// Postprocess result of NVMe command, record command statistics
+// and print debug info if requested.
+static void finish_nvme_call(nvme_device * device, const nvme_cmd_in & in,
+  const nvme_cmd_out & out, bool ok, long long duration_usec)
+{
+  device->add_cmd_stats(smart_device::cmd_stats_key(smart_device::cmd_nvme, in.opcode),
+                        ok, duration_usec);
 
   if (   dont_print_serial_number && ok
       && in.opcode == nvme_admin_identify && in.cdw10 == 0x01) {
@@ -97,7 +106,23 @@ static bool nvme_pass_through(nvme_device * device, const nvme_cmd_in & in,
     }
     pout("]\n");
   }
+}
+
+// Call NVMe pass-through and print debug info if requested.
+static bool nvme_pass_through(nvme_device * device, const nvme_cmd_in & in,
+  nvme_cmd_out & out)
+{
+  if (nvme_debugmode)
+    print_nvme_call(in);
+
+  pout_flush();
+  long long start_usec = get_timer_usec();
+
+  bool ok = device->nvme_pass_through(in, out);
 
+  long long duration_usec = get_nvme_duration(start_usec);
+  print_nvme_duration(duration_usec);
+  finish_nvme_call(device, in, out, ok, duration_usec);
   return ok;
 }
 
@@ -122,40 +147,71 @@ static bool nvme_read_identify(nvme_device * device, unsigned nsid,
   return nvme_pass_through(device, in);
 }
 
+// Swap multi-byte fields of Identify Controller data structure.
+static void swap_id_ctrl(nvme_id_ctrl & id_ctrl)
+{
+  swapx(&id_ctrl.vid);
+  swapx(&id_ctrl.ssvid);
+  swapx(&id_ctrl.cntlid);
+  swapx(&id_ctrl.ver);
+  swapx(&id_ctrl.oacs);
+  swapx(&id_ctrl.wctemp);
+  swapx(&id_ctrl.cctemp);
+  swapx(&id_ctrl.mtfa);
+  swapx(&id_ctrl.hmpre);
+  swapx(&id_ctrl.hmmin);
+  swapx(&id_ctrl.rpmbs);
+  swapx(&id_ctrl.nn);
+  swapx(&id_ctrl.oncs);
+  swapx(&id_ctrl.fuses);
+  swapx(&id_ctrl.awun);
+  swapx(&id_ctrl.awupf);
+  swapx(&id_ctrl.acwu);
+  swapx(&id_ctrl.sgls);
+  for (int i = 0; i < 32; i++) {
+    swapx(&id_ctrl.psd[i].max_power);
+    swapx(&id_ctrl.psd[i].entry_lat);
+    swapx(&id_ctrl.psd[i].exit_lat);
+    swapx(&id_ctrl.psd[i].idle_power);
+    swapx(&id_ctrl.psd[i].active_power);
+  }
+}
+
+// Upper limit of transfer size for multi-page commands.
+// NUMDL of Get Log Page allows 256KiB without NUMDU.
+const unsigned nvme_max_xfer_limit = 0x40000;
+
+// Set max transfer size from MDTS if not yet known.
+static void set_max_xfer_size(nvme_device * device, const nvme_id_ctrl & id_ctrl)
+{
+  if (device->get_max_xfer_size())
+    return;
+  // MDTS is in units of the minimum memory page size (CAP.MPSMIN) which is
+  // not available via pass-through.  Assume 4KiB which is the lowest possible
+  // value, 0 means no limit.
+  unsigned max_xfer = nvme_max_xfer_limit;
+  if (id_ctrl.mdts && id_ctrl.mdts < 12 && (0x1000U << id_ctrl.mdts) < max_xfer)
+    max_xfer = 0x1000U << id_ctrl.mdts;
+  device->set_max_xfer_size(max_xfer);
+}
+
+// Return current max transfer size for multi-page commands.
+static unsigned get_max_xfer_size(const nvme_device * device)
+{
+  unsigned max_xfer = device->get_max_xfer_size();
+  return (max_xfer ? max_xfer : 0x1000);
+}
+
 // Read NVMe Identify Controller data structure.
 bool nvme_read_id_ctrl(nvme_device * device, nvme_id_ctrl & id_ctrl)
 {
   if (!nvme_read_identify(device, 0, 0x01, &id_ctrl, sizeof(id_ctrl)))
     return false;
 
-  if (isbigendian()) {
-    swapx(&id_ctrl.vid);
-    swapx(&id_ctrl.ssvid);
-    swapx(&id_ctrl.cntlid);
-    swapx(&id_ctrl.ver);
-    swapx(&id_ctrl.oacs);
-    swapx(&id_ctrl.wctemp);
-    swapx(&id_ctrl.cctemp);
-    swapx(&id_ctrl.mtfa);
-    swapx(&id_ctrl.hmpre);
-    swapx(&id_ctrl.hmmin);
-    swapx(&id_ctrl.rpmbs);
-    swapx(&id_ctrl.nn);
-    swapx(&id_ctrl.oncs);
-    swapx(&id_ctrl.fuses);
-    swapx(&id_ctrl.awun);
-    swapx(&id_ctrl.awupf);
-    swapx(&id_ctrl.acwu);
-    swapx(&id_ctrl.sgls);
-    for (int i = 0; i < 32; i++) {
-      swapx(&id_ctrl.psd[i].max_power);
-      swapx(&id_ctrl.psd[i].entry_lat);
-      swapx(&id_ctrl.psd[i].exit_lat);
-      swapx(&id_ctrl.psd[i].idle_power);
-      swapx(&id_ctrl.psd[i].active_power);
-    }
-  }
+  if (isbigendian())
+    swap_id_ctrl(id_ctrl);
 
+  set_max_xfer_size(device, id_ctrl);
   return true;
 }
 
@@ -185,7 +241,8 @@ bool nvme_read_id_ns(nvme_device * device, unsigned nsid, nvme_id_ns & id_ns)
 static bool nvme_read_log_page_1(nvme_device * device, unsigned nsid,
   unsigned char lid, void * data, unsigned size, unsigned offset = 0)
 {
-  if (!(4 <= size && size <= 0x1000 && !(size % 4) && !(offset % 4)))
+  if (!(   4 <= size && size <= get_max_xfer_size(device)
+        && !(size % 4) && !(offset % 4)                   ))
     return device->set_err(EINVAL, "Invalid NVMe log size %u or offset %u", size, offset);
 
   memset(data, 0, size);
@@ -209,18 +266,44 @@ unsigned nvme_read_log_page(nvme_device * device, unsigned nsid, unsigned char l
       break;
     }
 
-    // Limit transfer size to one page to avoid problems with
-    // limits of NVMe pass-through layer or too low MDTS values.
+    // Limit transfer size to MDTS or to one page if MDTS is unknown
+    // or a larger transfer failed before.
     bs = size - n;
-    if (bs > 0x1000)
-      bs = 0x1000;
+    unsigned max_bs = get_max_xfer_size(device);
+    if (bs > max_bs)
+      bs = max_bs;
+    if (nvme_read_log_page_1(device, nsid, lid, (char *)data + n, bs, offset + n))
+      continue;
+    if (bs <= 0x1000)
+      break;
+
+    // Retry with one page to avoid problems with limits of NVMe
+    // pass-through layer.  Remember the smaller size if this works.
+    bs = 0x1000;
     if (!nvme_read_log_page_1(device, nsid, lid, (char *)data + n, bs, offset + n))
       break;
+    if (nvme_debugmode)
+      pout(" [NVMe log transfer of 0x%x bytes failed, using 0x%x bytes]\n", max_bs, bs);
+    device->set_max_xfer_size(bs);
   }
 
   return n;
 }
 
+// Swap multi-byte fields of Error Information Log entries.
+static void swap_error_log(nvme_error_log_page * error_log, unsigned num_entries)
+{
+  for (unsigned i = 0; i < num_entries; i++) {
+    swapx(&error_log[i].error_count);
+    swapx(&error_log[i].sqid);
+    swapx(&error_log[i].cmdid);
+    swapx(&error_log[i].status_field);
+    swapx(&error_log[i].parm_error_location);
+    swapx(&error_log[i].lba);
+    swapx(&error_log[i].nsid);
+  }
+}
+
 // Read NVMe Error Information Log.
 unsigned nvme_read_error_log(nvme_device * device, nvme_error_log_page * error_log,
   unsigned num_entries, bool lpo_sup)
@@ -229,37 +312,40 @@ unsigned nvme_read_error_log(nvme_device * device, nvme_error_log_page * error_l
                                   num_entries * sizeof(*error_log), lpo_sup);
 
   unsigned read_entries = n / sizeof(*error_log);
-  if (isbigendian()) {
-    for (unsigned i = 0; i < read_entries; i++) {
-      swapx(&error_log[i].error_count);
-      swapx(&error_log[i].sqid);
-      swapx(&error_log[i].cmdid);
-      swapx(&error_log[i].status_field);
-      swapx(&error_log[i].parm_error_location);
-      swapx(&error_log[i].lba);
-      swapx(&error_log[i].nsid);
-    }
-  }
+  if (isbigendian())
+    swap_error_log(error_log, read_entries);
 
   return read_entries;
 }
 
+// Swap multi-byte fields of SMART/Health Information log.
+static void swap_smart_log(nvme_smart_log & smart_log)
+{
+  swapx(&smart_log.warning_temp_time);
+  swapx(&smart_log.critical_comp_time);
+  for (int i = 0; i < 8; i++)
+    swapx(&smart_log.temp_sensor[i]);
+}
+
 // Read NVMe SMART/Health Information log.
 bool nvme_read_smart_log(nvme_device * device, nvme_smart_log & smart_log)
 {
   if (!nvme_read_log_page_1(device, 0xffffffff, 0x02, &smart_log, sizeof(smart_log)))
     return false;
 
-  if (isbigendian()) {
-    swapx(&smart_log.warning_temp_time);
-    swapx(&smart_log.critical_comp_time);
-    for (int i = 0; i < 8; i++)
-      swapx(&smart_log.temp_sensor[i]);
-  }
+  if (isbigendian())
+    swap_smart_log(smart_log);
 
   return true;
 }
 
+// Swap multi-byte fields of Self-test Log.
+static void swap_self_test_log(nvme_self_test_log & self_test_log)
+{
+  for (int i = 0; i < 20; i++)
+    swapx(&self_test_log.results[i].nsid);
+}
+
 // Read NVMe Self-test Log.
 bool nvme_read_self_test_log(nvme_device * device, uint32_t nsid,
   smartmontools::nvme_self_test_log & self_test_log)
@@ -267,10 +353,8 @@ bool nvme_read_self_test_log(nvme_device * device, uint32_t nsid,
   if (!nvme_read_log_page_1(device, nsid, 0x06, &self_test_log, sizeof(self_test_log)))
     return false;
 
-  if (isbigendian()) {
-    for (int i = 0; i < 20; i++)
-      swapx(&self_test_log.results[i].nsid);
-  }
+  if (isbigendian())
+    swap_self_test_log(self_test_log);
 
   return true;
 }
@@ -284,3 +368,120 @@ bool nvme_self_test(nvme_device * device, uint8_t stc, uint32_t nsid)
   in.cdw10 = stc;
   return nvme_pass_through(device, in);
 }
+
+
+/////////////////////////////////////////////////////////////////////////////
+// nvme_cmd_batch
+
+unsigned nvme_cmd_batch::add_read_log_page(nvme_device * device, unsigned nsid,
+  unsigned char lid, void * data, unsigned size, data_type type)
+{
+  if (!(4 <= size && size <= get_max_xfer_size(device) && !(size % 4)))
+    throw std::logic_error("nvme_cmd_batch: invalid NVMe log size");
+
+  memset(data, 0, size);
+  nvme_cmd_request req(device);
+  req.in.set_data_in(nvme_admin_get_log_page, data, size);
+  req.in.nsid = nsid;
+  req.in.cdw10 = lid | (((size / 4) - 1) << 16);
+
+  m_reqs.push_back(req);
+  m_types.push_back(type);
+  return m_reqs.size() - 1;
+}
+
+unsigned nvme_cmd_batch::add_read_id_ctrl(nvme_device * device, nvme_id_ctrl & id_ctrl)
+{
+  memset(&id_ctrl, 0, sizeof(id_ctrl));
+  nvme_cmd_request req(device);
+  req.in.set_data_in(nvme_admin_identify, &id_ctrl, sizeof(id_ctrl));
+  req.in.cdw10 = 0x01;
+
+  m_reqs.push_back(req);
+  m_types.push_back(id_ctrl_data);
+  return m_reqs.size() - 1;
+}
+
+unsigned nvme_cmd_batch::add_read_smart_log(nvme_device * device, nvme_smart_log & smart_log)
+{
+  return add_read_log_page(device, 0xffffffff, 0x02, &smart_log, sizeof(smart_log),
+                           smart_log_data);
+}
+
+unsigned nvme_cmd_batch::add_read_error_log(nvme_device * device,
+  nvme_error_log_page * error_log, unsigned num_entries)
+{
+  return add_read_log_page(device, 0xffffffff, 0x01, error_log,
+                           num_entries * sizeof(*error_log), error_log_data);
+}
+
+unsigned nvme_cmd_batch::add_read_self_test_log(nvme_device * device, uint32_t nsid,
+  nvme_self_test_log & self_test_log)
+{
+  return add_read_log_page(device, nsid, 0x06, &self_test_log, sizeof(self_test_log),
+                           self_test_log_data);
+}
+
+unsigned nvme_cmd_batch::run()
+{
+  unsigned num = m_reqs.size();
+  if (!num)
+    return 0;
+
+  if (nvme_debugmode) {
+    for (const auto & req : m_reqs)
+      print_nvme_call(req.in);
+  }
+
+  pout_flush();
+  long long start_usec = get_timer_usec();
+
+  smi()->nvme_pass_through_multi(m_reqs.data(), num);
+
+  // Commands run concurrently, so each one is recorded with the
+  // duration of the whole batch.
+  long long duration_usec = get_nvme_duration(start_usec);
+  print_nvme_duration(duration_usec);
+
+  unsigned cnt = 0;
+  for (unsigned i = 0; i < num; i++) {
+    nvme_cmd_request & req = m_reqs[i];
+    finish_nvme_call(req.device, req.in, req.out, req.ok, duration_usec);
+    if (!req.ok)
+      continue;
+    cnt++;
+
+    if (m_types[i] == id_ctrl_data) {
+      nvme_id_ctrl & id_ctrl = *reinterpret_cast<nvme_id_ctrl *>(req.in.buffer);
+      if (isbigendian())
+        swap_id_ctrl(id_ctrl);
+      set_max_xfer_size(req.device, id_ctrl);
+      continue;
+    }
+
+    if (!isbigendian())
+      continue;
+    switch (m_types[i]) {
+      case smart_log_data:
+        swap_smart_log(*reinterpret_cast<nvme_smart_log *>(req.in.buffer));
+        break;
+      case error_log_data:
+        swap_error_log(reinterpret_cast<nvme_error_log_page *>(req.in.buffer),
+                       req.in.size / sizeof(nvme_error_log_page));
+        break;
+      case self_test_log_data:
+        swap_self_test_log(*reinterpret_cast<nvme_self_test_log *>(req.in.buffer));
+        break;
+      default:
+        break;
+    }
+  }
+
+  return cnt;
+}
+
+void nvme_cmd_batch::clear()
+{
+  m_reqs.clear();
+  m_types.clear();
+}
@@ -16,9 +16,11 @@
 
 #define NVMECMDS_H_CVSID "$Id$"
 
+#include "dev_interface.h" // nvme_device, nvme_cmd_request
 #include "static_assert.h"
 
 #include <stdint.h>
+#include <vector>
 
 // The code below was originally imported from <linux/nvme.h> include file from
 // Linux kernel sources.  Types from <linux/types.h> were replaced.
@@ -249,8 +251,6 @@ STATIC_ASSERT(sizeof(nvme_self_test_log) == 564);
 
 } // namespace smartmontools
 
-class nvme_device;
-
 // Print NVMe debug messages?
 extern unsigned char nvme_debugmode;
 
@@ -278,4 +278,55 @@ bool nvme_read_self_test_log(nvme_device * device, uint32_t nsid,
 // Start Self-test
 bool nvme_self_test(nvme_device * device, uint8_t stc, uint32_t nsid);
 
+// Batch of NVMe admin commands for one or more devices.
+// All commands are run by smart_interface::nvme_pass_through_multi()
+// which may submit them together and run them in parallel.
+// Devices must be open until run() returns.
+class nvme_cmd_batch
+{
+public:
+  // Queue read of Identify Controller data structure.
+  // Return index of the command.
+  unsigned add_read_id_ctrl(nvme_device * device, smartmontools::nvme_id_ctrl & id_ctrl);
+
+  // Queue read of SMART/Health Information log.
+  unsigned add_read_smart_log(nvme_device * device, smartmontools::nvme_smart_log & smart_log);
+
+  // Queue read of Error Information Log.
+  // Log size must not exceed the max transfer size of the device
+  // (64 entries if unknown).
+  unsigned add_read_error_log(nvme_device * device,
+    smartmontools::nvme_error_log_page * error_log, unsigned num_entries);
+
+  // Queue read of Self-test Log.
+  unsigned add_read_self_test_log(nvme_device * device, uint32_t nsid,
+    smartmontools::nvme_self_test_log & self_test_log);
+
+  // Return number of queued commands.
+  unsigned size() const
+    { return m_reqs.size(); }
+
+  // Run all queued commands.
+  // Return number of successful commands.
+  unsigned run();
+
+  // Return true if command with index I succeeded.
+  bool ok(unsigned i) const
+    { return m_reqs.at(i).ok; }
+
+  // Remove all commands.
+  void clear();
+
+private:
+  enum data_type {
+    id_ctrl_data, smart_log_data, error_log_data, self_test_log_data
+  };
+
+  std::vector<nvme_cmd_request> m_reqs;
+  std::vector<data_type> m_types;
+
+  unsigned add_read_log_page(nvme_device * device, unsigned nsid, unsigned char lid,
+    void * data, unsigned size, data_type type);
+};
+
 #endif // NVMECMDS_H
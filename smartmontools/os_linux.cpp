@@ -57,6 +57,11 @@
 #include <sys/uio.h>
 #include <sys/types.h>
 #include <dirent.h>
+#include <algorithm>
+#include <map>
+#include <system_error>
+#include <thread>
+#include <vector>
 #ifdef HAVE_SYS_SYSMACROS_H
 // glibc 2.25: The inclusion of <sys/sysmacros.h> by <sys/types.h> is
 // deprecated.  A warning is printed if major(), minor() or makedev()
@@ -66,6 +71,15 @@
 #ifdef HAVE_LIBSELINUX
 #include <selinux/selinux.h>
 #endif
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(IORING_SETUP_SQE128) && defined(__NR_io_uring_setup)
+// Kernel headers >= 5.19 provide IORING_OP_URING_CMD with 128 byte SQEs
+#define WITH_NVME_URING 1
+#endif
+#endif
 
 #include "atacmds.h"
 #include "os_linux.h"
@@ -82,7 +96,7 @@
 #include "dev_areca.h"
 
 // "include/uapi/linux/nvme_ioctl.h" from Linux kernel sources
-#include "linux_nvme_ioctl.h" // nvme_passthru_cmd, NVME_IOCTL_ADMIN_CMD
+#include "linux_nvme_ioctl.h" // nvme_passthru_cmd, NVME_IOCTL_ADMIN_CMD, nvme_uring_cmd
 
 #ifndef ENOTSUP
 #define ENOTSUP ENOSYS
@@ -489,6 +503,7 @@ int linux_ata_device::ata_command_interface(smart_command_set command, int selec
 #define MAX_DXFER_LEN 1024      /* can be increased if necessary */
 #define SEND_IOCTL_RESP_SENSE_LEN 16    /* ioctl limitation */
 #define SG_IO_RESP_SENSE_LEN 64 /* large enough see buffer */
+#define SG_DIO_MIN_LEN (64 * 1024) /* request direct I/O from this size */
 #define LSCSI_DRIVER_MASK  0xf /* mask out "suggestions" */
 #define LSCSI_DRIVER_SENSE  0x8 /* alternate CHECK CONDITION indication */
 #define LSCSI_DID_ERROR 0x7 /* Need to work around aacraid driver quirk */
@@ -604,6 +619,14 @@ static int sg_io_cmnd_io(int dev_fd, struct scsi_cmnd_io * iop, int report,
             return -EINVAL;
     }
 
+    /* Large transfers from or to page aligned buffers (see raw_buffer)
+     * may bypass the bounce buffer of the sg driver.  The sg driver only
+     * honors this if enabled by /proc/scsi/sg/allow_dio, otherwise it
+     * silently uses indirect I/O.  The block layer ignores the flag. */
+    if (iop->dxfer_len >= SG_DIO_MIN_LEN &&
+        !((uintptr_t)iop->dxferp & (io_buffer_align - 1)))
+        io_hdr_v3.flags |= SG_FLAG_DIRECT_IO;
+
     iop->resp_sense_len = 0;
     iop->scsi_status = 0;
     iop->resid = 0;
@@ -664,6 +687,12 @@ static int sg_io_cmnd_io(int dev_fd, struct scsi_cmnd_io * iop, int report,
     }
     if (sg_duration) { }	// silence warning
 
+    if (report > 1 && sg_io_ifc == SG_IO_USE_V3 &&
+        (io_hdr_v3.flags & SG_FLAG_DIRECT_IO))
+        pout("  %s I/O, len=%u\n",
+             ((sg_info & SG_INFO_DIRECT_IO_MASK) == SG_INFO_DIRECT_IO ?
+              "direct" : "indirect"), (unsigned)iop->dxfer_len);
+
 #if 0
     if (report > 0) {
         pout("  scsi_status=0x%x, sg_transport_status=0x%x, sg_driver_status=0x%x\n"
@@ -1066,13 +1095,92 @@ bool linux_aacraid_device::scsi_pass_through(scsi_cmnd_io *iop)
 /////////////////////////////////////////////////////////////////////////////
 /// LSI MegaRAID support
 
+// Create /dev/megaraid_sas_ioctl_node (or /dev/megadev0 if 'megadev')
+// from /proc/devices if missing.  Return false if no driver was found.
+static bool megaraid_mknod(bool megadev, int report)
+{
+  FILE * fp = fopen("/proc/devices", "r");
+  if (!fp)
+    return false;
+  bool found = false;
+  char line[128];
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    int mjr, n1 = 0;
+    if (sscanf(line, "%d megaraid_sas_ioctl%n", &mjr, &n1) == 1 && n1 == 22) {
+      found = true;
+      n1=mknod("/dev/megaraid_sas_ioctl_node", S_IFCHR|0600, makedev(mjr, 0));
+      if(report > 0)
+        pout("Creating /dev/megaraid_sas_ioctl_node = %d\n", n1 >= 0 ? 0 : errno);
+      if (n1 >= 0 || errno == EEXIST)
+        break;
+    }
+    else if (megadev && sscanf(line, "%d megadev%n", &mjr, &n1) == 1 && n1 == 11) {
+      found = true;
+      n1=mknod("/dev/megadev0", S_IFCHR|0600, makedev(mjr, 0));
+      if(report > 0)
+        pout("Creating /dev/megadev0 = %d\n", n1 >= 0 ? 0 : errno);
+      if (n1 >= 0 || errno == EEXIST)
+        break;
+    }
+  }
+  fclose(fp);
+  return found;
+}
+
+// Reference counted handle of /dev/megaraid_sas_ioctl_node.
+// The node serves all controllers, each ioctl selects the controller
+// by 'megasas_iocpacket::host_no'.  The handle is shared by the device
+// scan, megasas_dcmd_cmd() and all linux_megaraid_device objects, so a
+// scan with many disks opens the node only once.
+// acquire() and release() must only be called from the main thread.
+class linux_megasas_node
+{
+public:
+  // Open node or add reference.  Return fd, or -1 and set errno.
+  static int acquire();
+
+  // Remove reference, close node if last one.
+  static void release();
+
+  // Return fd, -1 if not open.
+  static int get_fd()
+    { return s_fd; }
+
+private:
+  static int s_fd;
+  static unsigned s_refcnt;
+};
+
+int linux_megasas_node::s_fd = -1;
+unsigned linux_megasas_node::s_refcnt = 0;
+
+int linux_megasas_node::acquire()
+{
+  if (s_fd < 0) {
+    if ((s_fd = ::open("/dev/megaraid_sas_ioctl_node", O_RDWR)) < 0)
+      return -1;
+  }
+  s_refcnt++;
+  return s_fd;
+}
+
+void linux_megasas_node::release()
+{
+  if (!s_refcnt || --s_refcnt)
+    return;
+  ::close(s_fd);
+  s_fd = -1;
+}
+
 class linux_megaraid_device
 : public /* implements */ scsi_device,
   public /* extends */ linux_smart_device
 {
 public:
+  // If 'hold_node' is set, a reference to linux_megasas_node is kept
+  // during the lifetime of the object.
   linux_megaraid_device(smart_interface *intf, const char *name, 
-    unsigned int tgt);
+    unsigned int tgt, bool hold_node = false);
 
   virtual ~linux_megaraid_device();
 
@@ -1087,6 +1195,7 @@ private:
   unsigned int m_disknum;
   unsigned int m_hba;
   int m_fd;
+  bool m_node_ref; // true if linux_megasas_node reference is held
 
   bool (linux_megaraid_device::*pt_cmd)(int cdblen, void *cdb, int dataLen, void *data,
     int senseLen, void *sense, int report, int direction);
@@ -1097,20 +1206,23 @@ private:
 };
 
 linux_megaraid_device::linux_megaraid_device(smart_interface *intf,
-  const char *dev_name, unsigned int tgt)
+  const char *dev_name, unsigned int tgt, bool hold_node /* = false */)
  : smart_device(intf, dev_name, "megaraid", "megaraid"),
    linux_smart_device(O_RDWR | O_NONBLOCK),
    m_disknum(tgt), m_hba(0),
-   m_fd(-1), pt_cmd(0)
+   m_fd(-1), m_node_ref(false), pt_cmd(0)
 {
   set_info().info_name = strprintf("%s [megaraid_disk_%02d]", dev_name, m_disknum);
   set_info().dev_type = strprintf("megaraid,%d", tgt);
+  if (hold_node)
+    m_node_ref = (linux_megasas_node::acquire() >= 0);
 }
 
 linux_megaraid_device::~linux_megaraid_device()
 {
-  if (m_fd >= 0)
-    ::close(m_fd);
+  close();
+  if (m_node_ref)
+    linux_megasas_node::release();
 }
 
 smart_device * linux_megaraid_device::autodetect_open()
@@ -1156,7 +1268,6 @@ smart_device * linux_megaraid_device::autodetect_open()
 
 bool linux_megaraid_device::open()
 {
-  int   mjr;
   int report = scsi_debugmode;
 
   if (sscanf(get_dev_name(), "/dev/bus/%u", &m_hba) == 0) {
@@ -1174,32 +1285,15 @@ bool linux_megaraid_device::open()
     } // we don't need this device anymore
     linux_smart_device::close();
   }
-  /* Perform mknod of device ioctl node */
-  FILE * fp = fopen("/proc/devices", "r");
-  if (fp) {
-    char line[128];
-    while (fgets(line, sizeof(line), fp) != NULL) {
-      int n1 = 0;
-      if (sscanf(line, "%d megaraid_sas_ioctl%n", &mjr, &n1) == 1 && n1 == 22) {
-        n1=mknod("/dev/megaraid_sas_ioctl_node", S_IFCHR|0600, makedev(mjr, 0));
-        if(report > 0)
-          pout("Creating /dev/megaraid_sas_ioctl_node = %d\n", n1 >= 0 ? 0 : errno);
-        if (n1 >= 0 || errno == EEXIST)
-          break;
-      }
-      else if (sscanf(line, "%d megadev%n", &mjr, &n1) == 1 && n1 == 11) {
-        n1=mknod("/dev/megadev0", S_IFCHR|0600, makedev(mjr, 0));
-        if(report > 0)
-          pout("Creating /dev/megadev0 = %d\n", n1 >= 0 ? 0 : errno);
-        if (n1 >= 0 || errno == EEXIST)
-          break;
-      }
-    }
-    fclose(fp);
-  }
-
-  /* Open Device IOCTL node */
-  if ((m_fd = ::open("/dev/megaraid_sas_ioctl_node", O_RDWR)) >= 0) {
+  /* Perform mknod of device ioctl node if not already open */
+  if (!m_node_ref && linux_megasas_node::get_fd() < 0)
+    megaraid_mknod(true, report);
+
+  /* Open Device IOCTL node, keep shared node until destruction */
+  if (!m_node_ref)
+    m_node_ref = (linux_megasas_node::acquire() >= 0);
+  if (m_node_ref) {
+    m_fd = linux_megasas_node::get_fd();
     pt_cmd = &linux_megaraid_device::megasas_cmd;
   }
   else if ((m_fd = ::open("/dev/megadev0", O_RDWR)) >= 0) {
@@ -1216,7 +1310,8 @@ bool linux_megaraid_device::open()
 
 bool linux_megaraid_device::close()
 {
-  if (m_fd >= 0)
+  // Shared megasas node is released in destructor
+  if (m_fd >= 0 && pt_cmd == &linux_megaraid_device::megadev_cmd)
     ::close(m_fd);
   m_fd = -1; m_hba = 0; pt_cmd = 0;
   set_fd(m_fd);
@@ -2697,13 +2792,33 @@ public:
   virtual bool open() override;
 
   virtual bool nvme_pass_through(const nvme_cmd_in & in, nvme_cmd_out & out) override;
+
+  /// Return filedesc for submission of commands via io_uring.
+  int get_nvme_fd() const
+    { return get_fd(); }
+
+  /// Set result of a command completed via io_uring.
+  /// RES is the CQE result: <0: -errno, >0: NVMe status.
+  bool set_uring_result(int res, unsigned result, nvme_cmd_out & out);
+
+  /// Return false if io_uring commands were rejected for this device.
+  bool uring_supported() const
+    { return !m_uring_unsupported; }
+
+  /// Use NVME_IOCTL_ADMIN_CMD for further commands to this device.
+  void set_uring_unsupported()
+    { m_uring_unsupported = true; }
+
+private:
+  bool m_uring_unsupported; ///< NVME_URING_CMD_ADMIN failed with EOPNOTSUPP or ENOTTY
 };
 
 linux_nvme_device::linux_nvme_device(smart_interface * intf, const char * dev_name,
   const char * req_type, unsigned nsid)
 : smart_device(intf, dev_name, "nvme", req_type),
   nvme_device(nsid),
-  linux_smart_device(O_RDONLY | O_NONBLOCK)
+  linux_smart_device(O_RDONLY | O_NONBLOCK),
+  m_uring_unsupported(false)
 {
 }
 
@@ -2752,6 +2867,298 @@ bool linux_nvme_device::nvme_pass_through(const nvme_cmd_in & in, nvme_cmd_out &
   return true;
 }
 
+bool linux_nvme_device::set_uring_result(int res, unsigned result, nvme_cmd_out & out)
+{
+  if (res < 0)
+    return set_err(-res, "NVME_URING_CMD_ADMIN: %s", strerror(-res));
+
+  if (res > 0)
+    return set_nvme_err(out, res);
+
+  out.result = result;
+  return true;
+}
+
+#ifdef WITH_NVME_URING
+
+/// io_uring instance for NVMe admin commands (IORING_OP_URING_CMD).
+/// Requires Linux kernel 6.0 or later with support of NVME_URING_CMD_ADMIN
+/// on the controller character device.
+class linux_nvme_uring
+{
+public:
+  linux_nvme_uring()
+    : m_fd(-1), m_disabled(false), m_entries(0), m_queued(0), m_inflight(0),
+      m_sq_ptr(MAP_FAILED), m_cq_ptr(MAP_FAILED), m_sqes(MAP_FAILED),
+      m_sq_size(0), m_cq_size(0), m_sqes_size(0),
+      m_sq_tail(0), m_sq_mask(0), m_sq_array(0),
+      m_cq_head(0), m_cq_tail(0), m_cq_mask(0), m_cqes(0)
+    { }
+
+  ~linux_nvme_uring()
+    { cleanup(); }
+
+  /// Setup ring on first call.
+  /// Return max number of commands per submission, 0 if io_uring is unusable.
+  unsigned init();
+
+  /// Disable io_uring usage permanently.
+  void disable()
+    { cleanup(); m_disabled = true; }
+
+  /// Queue command for device filedesc FD.
+  void queue(int fd, const nvme_cmd_in & in, uint64_t user_data);
+
+  /// Submit queued commands and wait for NUM completions.
+  /// Return false on error or if no completion was received within
+  /// 'timeout_sec' (errno = ETIME).  Queued commands are dropped if
+  /// submission fails.
+  bool submit_and_wait(unsigned num);
+
+  /// Get next completion, return false if none available.
+  bool reap(uint64_t & user_data, int & res, unsigned & result);
+
+  /// Cancel commands still in flight and discard their completions.
+  /// Return false if some commands did not complete.
+  bool drain();
+
+  /// Max time to wait for completions.  Exceeds default timeout for
+  /// NVMe admin commands of the kernel (nvme_core.admin_timeout=60).
+  static const unsigned timeout_sec = 90;
+
+private:
+  int m_fd; ///< io_uring filedesc, -1 if not setup
+  bool m_disabled; ///< true if io_uring is unusable
+  unsigned m_entries; ///< Number of SQ entries
+  unsigned m_queued; ///< Number of queued but not submitted SQEs
+  unsigned m_inflight; ///< Number of submitted SQEs without CQE
+
+  void * m_sq_ptr, * m_cq_ptr, * m_sqes; ///< mmap()ed areas
+  size_t m_sq_size, m_cq_size, m_sqes_size;
+
+  unsigned * m_sq_tail, * m_sq_mask, * m_sq_array;
+  unsigned * m_cq_head, * m_cq_tail, * m_cq_mask;
+  io_uring_cqe * m_cqes;
+
+  void cleanup();
+
+  /// Return cleared SQE at current SQ tail.
+  io_uring_sqe * prepare_sqe(unsigned & idx);
+  /// Make SQE returned by prepare_sqe() visible to the kernel.
+  void commit_sqe(unsigned idx);
+
+  // SQEs and CQEs are double sized (IORING_SETUP_SQE128, IORING_SETUP_CQE32)
+  io_uring_sqe * get_sqe(unsigned idx)
+    { return reinterpret_cast<io_uring_sqe *>(m_sqes) + 2 * idx; }
+  const io_uring_cqe * get_cqe(unsigned idx) const
+    { return m_cqes + 2 * idx; }
+};
+
+unsigned linux_nvme_uring::init()
+{
+  if (m_fd >= 0)
+    return m_entries;
+  if (m_disabled)
+    return 0;
+
+  io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  p.flags = IORING_SETUP_SQE128 | IORING_SETUP_CQE32;
+  m_fd = (int)syscall(__NR_io_uring_setup, 64, &p);
+  if (m_fd < 0) {
+    // ENOSYS: No io_uring support, EINVAL: Kernel < 5.19, EPERM: Disabled by sysctl
+    if (nvme_debugmode)
+      pout(" [io_uring_setup() failed: %s, using NVME_IOCTL_ADMIN_CMD]\n", strerror(errno));
+    disable();
+    return 0;
+  }
+  if (!(p.features & IORING_FEAT_EXT_ARG)) {
+    // Kernel < 5.11, no wait timeout
+    if (nvme_debugmode)
+      pout(" [io_uring: IORING_FEAT_EXT_ARG missing, using NVME_IOCTL_ADMIN_CMD]\n");
+    disable();
+    return 0;
+  }
+
+  m_sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  m_cq_size = p.cq_off.cqes + p.cq_entries * 2 * sizeof(io_uring_cqe);
+  bool single_mmap = !!(p.features & IORING_FEAT_SINGLE_MMAP);
+  if (single_mmap) {
+    if (m_sq_size < m_cq_size)
+      m_sq_size = m_cq_size;
+    m_cq_size = 0;
+  }
+
+  m_sq_ptr = mmap((void *)0, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  m_fd, IORING_OFF_SQ_RING);
+  if (m_sq_ptr != MAP_FAILED && !single_mmap)
+    m_cq_ptr = mmap((void *)0, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    m_fd, IORING_OFF_CQ_RING);
+  m_sqes_size = p.sq_entries * 2 * sizeof(io_uring_sqe);
+  m_sqes = mmap((void *)0, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                m_fd, IORING_OFF_SQES);
+  if (   m_sq_ptr == MAP_FAILED || m_sqes == MAP_FAILED
+      || (!single_mmap && m_cq_ptr == MAP_FAILED)) {
+    if (nvme_debugmode)
+      pout(" [io_uring mmap() failed: %s, using NVME_IOCTL_ADMIN_CMD]\n", strerror(errno));
+    disable();
+    return 0;
+  }
+
+  char * sq = static_cast<char *>(m_sq_ptr);
+  char * cq = static_cast<char *>(single_mmap ? m_sq_ptr : m_cq_ptr);
+  m_sq_tail  = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+  m_sq_mask  = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+  m_sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+  m_cq_head  = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+  m_cq_tail  = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+  m_cq_mask  = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+  m_cqes     = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+
+  m_entries = (p.sq_entries < p.cq_entries ? p.sq_entries : p.cq_entries);
+  m_queued = m_inflight = 0;
+  return m_entries;
+}
+
+void linux_nvme_uring::cleanup()
+{
+  if (m_sqes != MAP_FAILED)
+    munmap(m_sqes, m_sqes_size);
+  if (m_cq_ptr != MAP_FAILED)
+    munmap(m_cq_ptr, m_cq_size);
+  if (m_sq_ptr != MAP_FAILED)
+    munmap(m_sq_ptr, m_sq_size);
+  m_sq_ptr = m_cq_ptr = m_sqes = MAP_FAILED;
+  if (m_fd >= 0) {
+    ::close(m_fd);
+    m_fd = -1;
+  }
+  m_entries = 0;
+}
+
+io_uring_sqe * linux_nvme_uring::prepare_sqe(unsigned & idx)
+{
+  idx = *m_sq_tail & *m_sq_mask;
+  io_uring_sqe * sqe = get_sqe(idx);
+  memset(sqe, 0, 2 * sizeof(*sqe));
+  return sqe;
+}
+
+void linux_nvme_uring::commit_sqe(unsigned idx)
+{
+  m_sq_array[idx] = idx;
+  __atomic_store_n(m_sq_tail, *m_sq_tail + 1, __ATOMIC_RELEASE);
+  m_queued++;
+}
+
+void linux_nvme_uring::queue(int fd, const nvme_cmd_in & in, uint64_t user_data)
+{
+  unsigned idx;
+  io_uring_sqe * sqe = prepare_sqe(idx);
+  sqe->opcode = IORING_OP_URING_CMD;
+  sqe->fd = fd;
+  sqe->cmd_op = NVME_URING_CMD_ADMIN;
+  sqe->user_data = user_data;
+
+  nvme_uring_cmd * cmd = reinterpret_cast<nvme_uring_cmd *>(sqe->cmd);
+  cmd->opcode = in.opcode;
+  cmd->nsid = in.nsid;
+  cmd->addr = (uint64_t)in.buffer;
+  cmd->data_len = in.size;
+  cmd->cdw10 = in.cdw10;
+  cmd->cdw11 = in.cdw11;
+  cmd->cdw12 = in.cdw12;
+  cmd->cdw13 = in.cdw13;
+  cmd->cdw14 = in.cdw14;
+  cmd->cdw15 = in.cdw15;
+
+  commit_sqe(idx);
+}
+
+bool linux_nvme_uring::submit_and_wait(unsigned num)
+{
+  __kernel_timespec ts;
+  memset(&ts, 0, sizeof(ts));
+  ts.tv_sec = timeout_sec;
+  io_uring_getevents_arg arg;
+  memset(&arg, 0, sizeof(arg));
+  arg.ts = (uint64_t)&ts;
+
+  unsigned to_submit = m_queued;
+  for (;;) {
+    int rc = (int)syscall(__NR_io_uring_enter, m_fd, to_submit, num,
+                          IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                          &arg, sizeof(arg));
+    if (rc < 0) {
+      if (errno == EINTR)
+        continue;
+      if (to_submit) {
+        // Nothing submitted, remove SQEs not yet seen by the kernel
+        int err = errno;
+        __atomic_store_n(m_sq_tail, *m_sq_tail - to_submit, __ATOMIC_RELEASE);
+        m_queued = 0;
+        errno = err;
+      }
+      return false;
+    }
+    m_inflight += rc;
+    // Submission may be partial if out of kernel resources
+    if ((unsigned)rc >= to_submit)
+      break;
+    to_submit -= rc;
+  }
+  m_queued = 0;
+  return true;
+}
+
+bool linux_nvme_uring::reap(uint64_t & user_data, int & res, unsigned & result)
+{
+  unsigned head = *m_cq_head;
+  if (head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE))
+    return false;
+
+  const io_uring_cqe * cqe = get_cqe(head & *m_cq_mask);
+  user_data = cqe->user_data;
+  res = cqe->res;
+  // NVMe command result (DW0) is returned in the second half of the CQE
+  result = (unsigned)cqe->big_cqe[0];
+
+  __atomic_store_n(m_cq_head, head + 1, __ATOMIC_RELEASE);
+  if (m_inflight > 0)
+    m_inflight--;
+  return true;
+}
+
+bool linux_nvme_uring::drain()
+{
+  if (m_fd < 0 || !m_inflight)
+    return true;
+
+#ifdef IORING_ASYNC_CANCEL_ANY
+  // Kernel >= 6.0: Request cancellation of all commands, the NVMe driver
+  // may ignore this and complete the commands later
+  unsigned idx;
+  io_uring_sqe * sqe = prepare_sqe(idx);
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+  sqe->user_data = ~(uint64_t)0;
+  commit_sqe(idx);
+#endif
+
+  // The buffers of the commands are still in use, wait for completion
+  while (m_inflight > 0) {
+    uint64_t user_data; int res; unsigned result;
+    if (reap(user_data, res, result))
+      continue;
+    if (!submit_and_wait(1))
+      return false;
+  }
+  return true;
+}
+
+#endif // WITH_NVME_URING
+
 
 //////////////////////////////////////////////////////////////////////
 // USB bridge ID detection
@@ -2833,6 +3240,10 @@ public:
   virtual bool scan_smart_devices(smart_device_list & devlist,
     const smart_devtype_list & types, const char * pattern = 0) override;
 
+  virtual void nvme_pass_through_multi(nvme_cmd_request * reqs, unsigned num) override;
+
+  virtual std::string get_dev_scan_group(const smart_device * dev) const override;
+
 protected:
   virtual ata_device * get_ata_device(const char * name, const char * type) override;
 
@@ -2851,18 +3262,25 @@ private:
   static constexpr int devxy_to_n_max = 701; // "/dev/sdzz"
   static int devxy_to_n(const char * name, bool debug);
 
+  typedef std::map<std::string, std::string> dev_ids_map; // id -> dev_name
+
   void get_dev_list(smart_device_list & devlist, const char * pattern,
     bool scan_scsi, bool (* p_dev_sdxy_seen)[devxy_to_n_max+1],
-    bool scan_nvme, const char * req_type, bool autodetect);
+    bool scan_nvme, const char * req_type, bool autodetect,
+    dev_ids_map * p_dev_ids_seen = nullptr);
 
   bool get_dev_megasas(smart_device_list & devlist);
   smart_device * missing_option(const char * opt);
   int megasas_dcmd_cmd(int bus_no, uint32_t opcode, void *buf,
     size_t bufsize, uint8_t *mbox, size_t mboxlen, uint8_t *statusp);
-  int megasas_pd_add_list(int bus_no, smart_device_list & devlist);
+  bool megasas_pd_get_list(int bus_no, std::vector<unsigned> & device_ids);
   bool get_dev_sssraid(smart_device_list & devlist);
   int sssraid_pd_add_list(int bus_no, smart_device_list & devlist);
   int sssraid_pdlist_cmd(int bus_no, uint16_t start_idx, void *buf, size_t bufsize, uint8_t *statusp);
+
+#ifdef WITH_NVME_URING
+  linux_nvme_uring m_nvme_uring;
+#endif
 };
 
 std::string linux_smart_interface::get_os_version_str()
@@ -2920,9 +3338,72 @@ int linux_smart_interface::devxy_to_n(const char * name, bool debug)
   return (x - 'a' + 1) * ('z' - 'a' + 1) + (y - 'a');
 }
 
+// Read first line of a sysfs attribute, strip trailing spaces.
+static bool read_sysfs_attr(const std::string & path, std::string & value)
+{
+  FILE * f = fopen(path.c_str(), "r");
+  if (!f)
+    return false;
+  char buf[256];
+  bool ok = !!fgets(buf, sizeof(buf), f);
+  fclose(f);
+  if (!ok)
+    return false;
+  int n = strlen(buf);
+  while (n > 0 && (buf[n-1] == '\n' || buf[n-1] == ' '))
+    n--;
+  value.assign(buf, n);
+  return true;
+}
+
+// Get identity of a SCSI or NVMe device from sysfs without sending
+// any command.  'id' is set to a string which is unique for the device
+// or left empty if no reliable identity is available.
+// Return false if the device is not ready to accept commands.
+static bool get_sysfs_dev_id(const char * name, bool nvme, std::string & id)
+{
+  id.clear();
+  char * p = realpath(name, (char *)0);
+  if (!p)
+    return true;
+  const char * base = strrchr(p, '/');
+  std::string dir = (base ? base + 1 : p);
+  free(p);
+
+  std::string state;
+  if (nvme) {
+    // "/sys/class/nvme/nvmeN/{model,serial,firmware_rev,state}"
+    dir = "/sys/class/nvme/" + dir + '/';
+    if (read_sysfs_attr(dir + "state", state) && (state == "dead" || state == "deleting"))
+      return false;
+    // Same as identity check in smartd.cpp:NVMeDeviceScan()
+    std::string model, serial, firmware;
+    if (   read_sysfs_attr(dir + "model", model) && !model.empty()
+        && read_sysfs_attr(dir + "serial", serial) && !serial.empty()
+        && read_sysfs_attr(dir + "firmware_rev", firmware))
+      id = "nvme:" + model + '/' + serial + '/' + firmware;
+    return true;
+  }
+
+  // "/sys/block/sdX/device/{wwid,state}"
+  dir = "/sys/block/" + dir + "/device/";
+  if (read_sysfs_attr(dir + "state", state) && state.find("offline") != std::string::npos)
+    return false; // "offline" or "transport-offline"
+  // Use only designators which are unique for the LU.  Vendor specific
+  // "t10.VENDOR..." designators from USB bridges may be identical for
+  // different drives.
+  std::string wwid;
+  if (   read_sysfs_attr(dir + "wwid", wwid)
+      && (   str_starts_with(wwid, "naa.") || str_starts_with(wwid, "eui.")
+          || str_starts_with(wwid, "t10.ATA ")))
+    id = wwid;
+  return true;
+}
+
 void linux_smart_interface::get_dev_list(smart_device_list & devlist,
   const char * pattern, bool scan_scsi, bool (* p_dev_sdxy_seen)[devxy_to_n_max+1],
-  bool scan_nvme, const char * req_type, bool autodetect)
+  bool scan_nvme, const char * req_type, bool autodetect,
+  dev_ids_map * p_dev_ids_seen /* = nullptr */)
 {
   bool debug = (ata_debugmode || scsi_debugmode || nvme_debugmode);
 
@@ -2968,6 +3449,26 @@ void linux_smart_interface::get_dev_list(smart_device_list & devlist,
       (*p_dev_sdxy_seen)[dev_n] = true;
     }
 
+    if (p_dev_ids_seen) {
+      // Skip unavailable devices and other paths to the same device
+      std::string id;
+      if (!get_sysfs_dev_id(name, scan_nvme, id)) {
+        if (debug)
+          pout("%s: offline, ignored\n", name);
+        continue;
+      }
+      if (!id.empty()) {
+        dev_ids_map::const_iterator it = p_dev_ids_seen->find(id);
+        if (it != p_dev_ids_seen->end()) {
+          if (debug)
+            pout("%s: same identity (%s) as %s, ignored\n", name, id.c_str(),
+                 it->second.c_str());
+          continue;
+        }
+        (*p_dev_ids_seen)[id] = name;
+      }
+    }
+
     smart_device * dev;
     if (autodetect) {
       dev = autodetect_smart_device(name);
@@ -2992,30 +3493,12 @@ bool linux_smart_interface::get_dev_megasas(smart_device_list & devlist)
 {
   /* Scanning of disks on MegaRaid device */
   /* Perform mknod of device ioctl node */
-  int   mjr, n1;
-  char line[128];
-  bool scan_megasas = false;
-  FILE * fp = fopen("/proc/devices", "r");
-  if (!fp)
-    return false;
-  while (fgets(line, sizeof(line), fp) != NULL) {
-    n1=0;
-    if (sscanf(line, "%d megaraid_sas_ioctl%n", &mjr, &n1) == 1 && n1 == 22) {
-      scan_megasas = true;
-      n1=mknod("/dev/megaraid_sas_ioctl_node", S_IFCHR|0600, makedev(mjr, 0));
-      if(scsi_debugmode > 0)
-        pout("Creating /dev/megaraid_sas_ioctl_node = %d\n", n1 >= 0 ? 0 : errno);
-      if (n1 >= 0 || errno == EEXIST)
-        break;
-    }
-  }
-  fclose(fp);
-
-  if(!scan_megasas)
+  if (!megaraid_mknod(false, scsi_debugmode))
     return false;
 
   // getting bus numbers with megasas devices
   // we are using sysfs to get list of all scsi hosts
+  std::vector<int> hosts;
   DIR * dp = opendir ("/sys/class/scsi_host/");
   if (dp != NULL)
   {
@@ -3025,21 +3508,64 @@ bool linux_smart_interface::get_dev_megasas(smart_device_list & devlist)
       if (!sscanf(ep->d_name, "host%u", &host_no))
         continue;
       /* proc_name should be megaraid_sas */
-      char sysfsdir[256];
+      char sysfsdir[256], line[128];
       snprintf(sysfsdir, sizeof(sysfsdir) - 1,
         "/sys/class/scsi_host/host%u/proc_name", host_no);
-      if((fp = fopen(sysfsdir, "r")) == NULL)
+      FILE * fp = fopen(sysfsdir, "r");
+      if (!fp)
         continue;
       if(fgets(line, sizeof(line), fp) != NULL && !strncmp(line,"megaraid_sas",12)) {
-        megasas_pd_add_list(host_no, devlist);
+        hosts.push_back(host_no);
       }
       fclose(fp);
     }
     (void) closedir (dp);
+    // readdir() order is arbitrary
+    std::sort(hosts.begin(), hosts.end());
   } else { /* sysfs not mounted ? */
     for(unsigned i = 0; i <=16; i++) // trying to add devices on first 16 buses
-      megasas_pd_add_list(i, devlist);
+      hosts.push_back(i);
+  }
+
+  // Keep shared ioctl node open during scan
+  if (linux_megasas_node::acquire() < 0)
+    return false;
+
+  // Read PD lists of all controllers in parallel
+  unsigned num_hosts = hosts.size();
+  std::vector< std::vector<unsigned> > device_ids(num_hosts);
+  std::vector<std::thread> threads;
+  unsigned i;
+  for (i = 0; i < num_hosts && num_hosts > 1; i++) {
+    try {
+      threads.emplace_back([this, &hosts, &device_ids, i]() {
+        try {
+          megasas_pd_get_list(hosts[i], device_ids[i]);
+        }
+        catch (...) {
+          device_ids[i].clear();
+        }
+      });
+    }
+    catch (const std::system_error &) {
+      break; // Threads not available, continue below
+    }
   }
+  for (; i < num_hosts; i++)
+    megasas_pd_get_list(hosts[i], device_ids[i]);
+  for (auto & t : threads)
+    t.join();
+
+  // Add devices in controller order, each holds a reference to the ioctl node
+  for (i = 0; i < num_hosts; i++) {
+    for (unsigned id : device_ids[i]) {
+      char line[128];
+      snprintf(line, sizeof(line) - 1, "/dev/bus/%d", hosts[i]);
+      devlist.push_back(new linux_megaraid_device(this, line, id, true));
+    }
+  }
+
+  linux_megasas_node::release();
   return true;
 }
 
@@ -3115,6 +3641,9 @@ bool linux_smart_interface::scan_smart_devices(smart_device_list & devlist,
   if (type_ata)
     get_dev_list(devlist, "/dev/hd[a-t]", false, 0, false, type_ata, false);
 
+  // Identities from sysfs to skip multipath duplicates
+  dev_ids_map dev_ids_seen;
+
   if (type_scsi || type_sat) {
     // "sat" detection will be later handled in linux_scsi_device::autodetect_open()
     const char * type_scsi_sat = ((type_scsi && type_sat) ? "" // detect both
@@ -3126,12 +3655,14 @@ bool linux_smart_interface::scan_smart_devices(smart_device_list & devlist,
     if (by_id) {
       // Scan unique symlinks first
       get_dev_list(devlist, "/dev/disk/by-id/*", true, &dev_sdxy_seen, false,
-                   type_scsi_sat, autodetect);
+                   type_scsi_sat, autodetect, &dev_ids_seen);
       p_dev_sdxy_seen = &dev_sdxy_seen; // Check for duplicates below
     }
 
-    get_dev_list(devlist, "/dev/sd[a-z]", true, p_dev_sdxy_seen, false, type_scsi_sat, autodetect);
-    get_dev_list(devlist, "/dev/sd[a-z][a-z]", true, p_dev_sdxy_seen, false, type_scsi_sat, autodetect);
+    get_dev_list(devlist, "/dev/sd[a-z]", true, p_dev_sdxy_seen, false, type_scsi_sat, autodetect,
+                 &dev_ids_seen);
+    get_dev_list(devlist, "/dev/sd[a-z][a-z]", true, p_dev_sdxy_seen, false, type_scsi_sat, autodetect,
+                 &dev_ids_seen);
 
     // get device list from the megaraid device
     get_dev_megasas(devlist);
@@ -3140,13 +3671,50 @@ bool linux_smart_interface::scan_smart_devices(smart_device_list & devlist,
   }
 
   if (type_nvme) {
-    get_dev_list(devlist, "/dev/nvme[0-9]", false, 0, true, type_nvme, false);
-    get_dev_list(devlist, "/dev/nvme[1-9][0-9]", false, 0, true, type_nvme, false);
+    get_dev_list(devlist, "/dev/nvme[0-9]", false, 0, true, type_nvme, false, &dev_ids_seen);
+    get_dev_list(devlist, "/dev/nvme[1-9][0-9]", false, 0, true, type_nvme, false, &dev_ids_seen);
   }
 
   return true;
 }
 
+// Return sysfs path of the SCSI host or the parent device as scan group
+std::string linux_smart_interface::get_dev_scan_group(const smart_device * dev) const
+{
+  const char * name = dev->get_dev_name();
+  std::string sysdir;
+  unsigned host_no = 0; int n1 = -1;
+  if (sscanf(name, "/dev/bus/%u%n", &host_no, &n1) == 1 && n1 == (int)strlen(name))
+    // MegaRAID, SSSRAID
+    sysdir = strprintf("/sys/class/scsi_host/host%u/device", host_no);
+  else {
+    char * p = realpath(name, (char *)0);
+    if (!p)
+      return "";
+    const char * base = strrchr(p, '/');
+    base = (base ? base + 1 : p);
+    // "/dev/nvmeN" is a char device, "/dev/sdX" and "/dev/hdX" are block devices
+    sysdir = strprintf("/sys/class/%s/%s/device",
+                       (str_starts_with(base, "nvme") ? "nvme" : "block"), base);
+    free(p);
+  }
+
+  char * p = realpath(sysdir.c_str(), (char *)0);
+  if (!p)
+    return "";
+  std::string group = p;
+  free(p);
+
+  // ".../hostN/targetN:N:N/N:N:N:N" -> ".../hostN"
+  std::string::size_type i = group.find("/host");
+  if (i != std::string::npos) {
+    i = group.find('/', i + 1);
+    if (i != std::string::npos)
+      group.erase(i);
+  }
+  return group;
+}
+
 ata_device * linux_smart_interface::get_ata_device(const char * name, const char * type)
 {
   return new linux_ata_device(this, name, type);
@@ -3163,6 +3731,89 @@ nvme_device * linux_smart_interface::get_nvme_device(const char * name, const ch
   return new linux_nvme_device(this, name, type, nsid);
 }
 
+void linux_smart_interface::nvme_pass_through_multi(nvme_cmd_request * reqs, unsigned num)
+{
+#ifdef WITH_NVME_URING
+  // Single commands are not worth the io_uring overhead
+  unsigned max_entries = (num > 1 ? m_nvme_uring.init() : 0);
+  if (max_entries) {
+    std::vector<unsigned> pending; // requests to be completed via io_uring
+    std::vector<unsigned> retry; // requests to be run via ioctl()
+    for (unsigned i = 0; i < num; i++) {
+      linux_nvme_device * nvmedev = dynamic_cast<linux_nvme_device *>(reqs[i].device);
+      if (nvmedev && nvmedev->uring_supported())
+        pending.push_back(i);
+      else // e.g. sntjmicron
+        retry.push_back(i);
+    }
+
+    std::vector<bool> completed(num, false);
+    for (unsigned start = 0; start < pending.size(); start += max_entries) {
+      unsigned cnt = pending.size() - start;
+      if (cnt > max_entries)
+        cnt = max_entries;
+
+      for (unsigned j = start; j < start + cnt; j++) {
+        nvme_cmd_request & req = reqs[pending[j]];
+        m_nvme_uring.queue(static_cast<linux_nvme_device *>(req.device)->get_nvme_fd(),
+                           req.in, pending[j]);
+      }
+
+      unsigned done = 0;
+      while (done < cnt) {
+        uint64_t user_data; int res; unsigned result;
+        if (!m_nvme_uring.reap(user_data, res, result)) {
+          // Submit queued commands, wait for remaining completions
+          if (!m_nvme_uring.submit_and_wait(cnt - done))
+            break;
+          continue;
+        }
+        if (user_data >= num || completed[user_data])
+          continue; // Not from this batch
+        completed[user_data] = true;
+        done++;
+        nvme_cmd_request & req = reqs[user_data];
+        linux_nvme_device * nvmedev = static_cast<linux_nvme_device *>(req.device);
+        if (res == -EOPNOTSUPP || res == -ENOTTY) {
+          // NVME_URING_CMD_ADMIN not supported by kernel or device
+          nvmedev->set_uring_unsupported();
+          retry.push_back(user_data);
+          continue;
+        }
+        req.ok = nvmedev->set_uring_result(res, result, req.out);
+      }
+      if (done >= cnt)
+        continue;
+
+      int err = errno;
+      if (nvme_debugmode)
+        pout(" [io_uring_enter() failed: %s, using NVME_IOCTL_ADMIN_CMD]\n", strerror(err));
+      // Commands still in flight may write to their buffers
+      if (!m_nvme_uring.drain() || err != ETIME)
+        m_nvme_uring.disable();
+      for (unsigned j = start; j < pending.size(); j++) {
+        unsigned i = pending[j];
+        if (completed[i])
+          continue;
+        if (j < start + cnt && err == ETIME)
+          // Don't retry a command which did not complete in time
+          reqs[i].ok = reqs[i].device->set_err(ETIMEDOUT, "NVME_URING_CMD_ADMIN: %s",
+                                               strerror(ETIMEDOUT));
+        else
+          retry.push_back(i);
+      }
+      break;
+    }
+
+    for (unsigned i : retry)
+      reqs[i].ok = reqs[i].device->nvme_pass_through(reqs[i].in, reqs[i].out);
+    return;
+  }
+#endif // WITH_NVME_URING
+
+  smart_interface::nvme_pass_through_multi(reqs, num);
+}
+
 smart_device * linux_smart_interface::missing_option(const char * opt)
 {
   return set_err_np(EINVAL, "requires option '%s'", opt);
@@ -3203,13 +3854,14 @@ linux_smart_interface::megasas_dcmd_cmd(int bus_no, uint32_t opcode, void *buf,
     ioc.sgl[0].iov_len = bufsize;
   }
 
-  int fd;
-  if ((fd = ::open("/dev/megaraid_sas_ioctl_node", O_RDWR)) < 0) {
-    return (errno);
+  // Use shared handle, may be called from multiple threads during scan
+  int fd = linux_megasas_node::get_fd();
+  if (fd < 0) {
+    errno = EBADF;
+    return (-1);
   }
 
   int r = ioctl(fd, MEGASAS_IOC_FIRMWARE, &ioc);
-  ::close(fd);
   if (r < 0) {
     return (r);
   }
@@ -3225,8 +3877,10 @@ linux_smart_interface::megasas_dcmd_cmd(int bus_no, uint32_t opcode, void *buf,
   return (0);
 }
 
-int
-linux_smart_interface::megasas_pd_add_list(int bus_no, smart_device_list & devlist)
+// Get device ids of all disks of a controller.
+// Called from multiple threads during scan, must not access devlist.
+bool
+linux_smart_interface::megasas_pd_get_list(int bus_no, std::vector<unsigned> & device_ids)
 {
   /*
   * Keep fetching the list in a loop until we have a large enough
@@ -3242,7 +3896,7 @@ linux_smart_interface::megasas_pd_add_list(int bus_no, smart_device_list & devli
       NULL) < 0) 
     {
       free(list);
-      return (-1);
+      return false;
     }
     if (list->size <= list_size)
       break;
@@ -3253,13 +3907,10 @@ linux_smart_interface::megasas_pd_add_list(int bus_no, smart_device_list & devli
   for (unsigned i = 0; i < list->count; i++) {
     if(list->addr[i].scsi_dev_type)
       continue; /* non disk device found */
-    char line[128];
-    snprintf(line, sizeof(line) - 1, "/dev/bus/%d", bus_no);
-    smart_device * dev = new linux_megaraid_device(this, line, list->addr[i].device_id);
-    devlist.push_back(dev);
+    device_ids.push_back(list->addr[i].device_id);
   }
   free(list);
-  return (0);
+  return true;
 }
 
 int
@@ -84,13 +84,12 @@ scsi_device::query_cmd_support()
     bool res = true;
     int k, err, cd_len, bump;
     int r_len = 0;
-    uint8_t * rp = (uint8_t *)calloc(sizeof(uint8_t), RSOC_RESP_SZ);
+    raw_buffer rp_buf(RSOC_RESP_SZ);
+    uint8_t * rp = rp_buf.data();
     const uint8_t * last_rp;
     uint8_t * cmdp;
     static const int max_bytes_of_cmds = RSOC_RESP_SZ - 4;
 
-    if (nullptr == rp)
-        return false;
     rsoc_queried = true;
     /* request 'all commands' format: 4 bytes header, 20 bytes per command */
     err = scsiRSOCcmd(this, false /* rctd */, 0 /* 'all' format */, 0, 0,
@@ -165,7 +164,6 @@ scsi_device::query_cmd_support()
     }
 
 fini:
-    free(rp);
     return res;
 }
 
@@ -1535,6 +1533,24 @@ scsiReadDefect12(scsi_device * device, int req_plist, int req_glist,
     return scsiSimpleSenseFilter(&sinfo);
 }
 
+/* Call scsi_pass_through and record command statistics. Any status other
+ * than GOOD is counted as an error. */
+static bool
+scsi_pass_through_stats(scsi_device * device, scsi_cmnd_io * iop)
+{
+    unsigned key = smart_device::cmd_stats_key(smart_device::cmd_scsi,
+                                   (iop->cmnd_len > 0) ? iop->cmnd[0] : 0);
+    pout_flush();
+    long long start_usec = get_timer_usec();
+    bool ok = device->scsi_pass_through(iop);
+    long long duration_usec = (start_usec >= 0) ?
+                              get_timer_usec() - start_usec : -1;
+
+    device->add_cmd_stats(key, ok && (0 == iop->scsi_status),
+                          duration_usec);
+    return ok;
+}
+
 /* Call scsi_pass_through, and retry only if a UNIT_ATTENTION (UA) is raised.
  * When false returned, the caller should invoke device->get_error().
  * When true returned, the caller should check sinfo.
@@ -1566,7 +1582,7 @@ scsi_pass_through_yield_sense(scsi_device * device, scsi_cmnd_io * iop,
             dStrHexFp(iop->dxferp, iop->dxfer_len, -1, nullptr);
     }
 
-    if (! device->scsi_pass_through(iop))
+    if (! scsi_pass_through_stats(device, iop))
         return false; // this will be missing device, timeout, etc
 
     if (scsi_debugmode > 3) {
@@ -1597,7 +1613,7 @@ scsi_pass_through_yield_sense(scsi_device * device, scsi_cmnd_io * iop,
         if (scsi_debugmode > 0)
             pout("%s Unit Attention %d: asc/ascq=0x%x,0x%x, retrying\n",
                  __func__, k + 1, sinfo.asc, sinfo.ascq);
-        if (! device->scsi_pass_through(iop))
+        if (! scsi_pass_through_stats(device, iop))
             return false;
         scsi_do_sense_disect(iop, &sinfo);
     }
@@ -35,7 +35,8 @@ const char * scsiprint_c_cvsid = "$Id$"
 
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 
-uint8_t gBuf[GBUF_SIZE];
+// Page aligned to allow direct transfers by the OS
+alignas(io_buffer_align) uint8_t gBuf[GBUF_SIZE];
 #define LOG_RESP_LEN 252
 #define LOG_RESP_LONG_LEN ((62 * 256) + 252)
 #define LOG_RESP_TAPE_ALERT_LEN 0x144
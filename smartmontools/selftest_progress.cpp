@@ -0,0 +1,329 @@
+/*
+ * selftest_progress.cpp
+ *
+ * Home page of code is: https://www.smartmontools.org
+ *
+ * Copyright (C) 2026 Smartmontools developers
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include "selftest_progress.h"
+#include "atacmds.h"
+#include "nvmecmds.h"
+#include "scsicmds.h"
+#include "sg_unaligned.h"
+#include "utility.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef _WIN32
+#include <windows.h> // Sleep()
+#endif
+
+const char * selftest_progress_cpp_cvsid = "$Id$"
+  SELFTEST_PROGRESS_H_CVSID;
+
+using namespace smartmontools;
+
+static bool read_ata_progress(ata_device * device, selftest_sample & sample,
+  firmwarebug_defs firmwarebugs)
+{
+  ata_smart_values smartval;
+  if (ataReadSmartValues(device, &smartval))
+    return false;
+  unsigned char status = smartval.self_test_exec_status;
+  // Samsung firmware bug: 0xf0 is also reported after completion
+  if (firmwarebugs.is_set(BUG_SAMSUNG3) && status == 0xf0) {
+    sample.running = false;
+    return true;
+  }
+  sample.running = ((status >> 4) == 0xf);
+  if (sample.running) {
+    // Remaining percentage in 10% steps, reports 90% right after start
+    sample.remaining = (status & 0x0f) * 10;
+    sample.step = 10;
+    sample.rounded_down = true;
+  }
+  else
+    sample.result = (status >> 4);
+  return true;
+}
+
+static bool read_scsi_progress(scsi_device * device, selftest_sample & sample)
+{
+  unsigned char resp[LOG_RESP_SELF_TEST_LEN];
+  if (scsiLogSense(device, SELFTEST_RESULTS_LPAGE, 0, resp, sizeof(resp), 0))
+    return false;
+  if (!(   resp[0] == SELFTEST_RESULTS_LPAGE
+        && sg_get_unaligned_be16(resp + 2) == 0x190))
+    return device->set_err(EIO, "Invalid Self-test Results log page");
+
+  // First parameter holds most recent test
+  unsigned char res = resp[4 + 4] & 0x0f;
+  sample.running = (res == 0x0f);
+  if (!sample.running) {
+    sample.result = res;
+    return true;
+  }
+
+  // Progress indication is only available from sense data
+  scsi_sense_disect sinfo;
+  if (!scsiRequestSense(device, &sinfo) && sinfo.progress >= 0) {
+    sample.remaining = 100 - sinfo.progress * 100.0 / 65536;
+    sample.step = 100.0 / 65536;
+  }
+  return true;
+}
+
+static bool read_nvme_progress(nvme_device * device, selftest_sample & sample)
+{
+  nvme_self_test_log log;
+  if (!nvme_read_self_test_log(device, device->get_nsid(), log))
+    return false;
+  sample.running = !!(log.current_operation & 0x0f);
+  if (sample.running) {
+    sample.remaining = 100 - (log.current_completion & 0x7f);
+    sample.step = 1;
+  }
+  else if ((log.results[0].self_test_status & 0x0f) != 0x0f)
+    sample.result = log.results[0].self_test_status & 0x0f;
+  return true;
+}
+
+bool read_selftest_progress(smart_device * device, selftest_sample & sample,
+  firmwarebug_defs firmwarebugs)
+{
+  sample = selftest_sample();
+  if (device->is_ata())
+    return read_ata_progress(device->to_ata(), sample, firmwarebugs);
+  if (device->is_scsi())
+    return read_scsi_progress(device->to_scsi(), sample);
+  if (device->is_nvme())
+    return read_nvme_progress(device->to_nvme(), sample);
+  return device->set_err(ENOSYS);
+}
+
+void read_selftest_info(smart_device * device, char testtype,
+  uint64_t & capacity, int & nominal)
+{
+  capacity = 0; nominal = 0;
+  if (device->is_ata()) {
+    ata_device * atadev = device->to_ata();
+    ata_identify_device id;
+    if (!ata_read_identity(atadev, &id, false)) {
+      ata_size_info sizes;
+      ata_get_size_info(&id, sizes);
+      capacity = sizes.capacity;
+    }
+    ata_smart_values smartval;
+    if (!ataReadSmartValues(atadev, &smartval))
+      nominal = 60 * TestTime(&smartval, (testtype == 'L' ? EXTEND_SELF_TEST :
+                                          testtype == 'C' ? CONVEYANCE_SELF_TEST :
+                                                            SHORT_SELF_TEST    ));
+  }
+  else if (device->is_scsi()) {
+    scsi_device * scsidev = device->to_scsi();
+    capacity = scsiGetSize(scsidev, false, nullptr);
+    if (testtype == 'L') {
+      int secs = 0;
+      if (!scsiFetchExtendedSelfTestTime(scsidev, &secs, 0))
+        nominal = secs;
+    }
+    else if (testtype == 'S')
+      nominal = 2 * 60; // SPC: Short self-test completes within two minutes
+  }
+  else if (device->is_nvme()) {
+    nvme_id_ctrl id_ctrl;
+    if (nvme_read_id_ctrl(device->to_nvme(), id_ctrl)) {
+      // Ignore capacities >= 2^64
+      bool overflow = false;
+      for (int i = 8; i < 16; i++)
+        overflow |= !!id_ctrl.tnvmcap[i];
+      if (!overflow)
+        capacity = sg_get_unaligned_le64(id_ctrl.tnvmcap);
+      if (testtype == 'L')
+        nominal = 60 * id_ctrl.edstt;
+    }
+    if (testtype == 'S')
+      nominal = 2 * 60; // NVMe: Short self-test completes within two minutes
+  }
+}
+
+void sleep_until_next_sample(int secs)
+{
+#ifndef _WIN32
+  sleep(secs);
+#else
+  Sleep(secs * 1000);
+#endif
+}
+
+const char * format_selftest_secs(char * buf, int size, int secs)
+{
+  if (secs < 0)
+    snprintf(buf, size, "-");
+  else if (secs < 24*3600)
+    snprintf(buf, size, "%d:%02d:%02d", secs / 3600, secs / 60 % 60, secs % 60);
+  else
+    snprintf(buf, size, "%d+%02d:%02d:%02d", secs / (24*3600), secs / 3600 % 24,
+             secs / 60 % 60, secs % 60);
+  return buf;
+}
+
+selftest_progress::selftest_progress(time_t start_time, uint64_t capacity, int nominal)
+: m_start_time(start_time), m_capacity(capacity), m_nominal(nominal),
+  m_first_time(0), m_remaining(-1), m_step(0),
+  m_anchor_time(start_time), m_anchor_remaining(start_time ? 100 : 0),
+  m_change_time(0), m_change_remaining(0),
+  m_finished(false), m_finish_time(0), m_result(-1)
+{
+}
+
+bool selftest_progress::add_sample(time_t now, const selftest_sample & sample)
+{
+  if (m_finished)
+    return false;
+  if (!m_first_time)
+    m_first_time = now;
+
+  if (!sample.running) {
+    m_finished = true;
+    m_finish_time = now;
+    m_result = sample.result;
+    return true;
+  }
+  if (sample.remaining < 0)
+    return false;
+
+  double prev = m_remaining;
+  m_remaining = sample.remaining;
+  m_step = sample.step;
+  if (prev < 0)
+    return true;
+  if (!(sample.remaining < prev))
+    return false;
+
+  // Reported value has just changed, so the true remaining part is known
+  // at this point in time up to the sampling interval
+  double remaining = sample.remaining + (sample.rounded_down ? sample.step : 0);
+  if (remaining > 100)
+    remaining = 100;
+  if (!m_anchor_time) {
+    m_anchor_time = now;
+    m_anchor_remaining = remaining;
+  }
+  else {
+    m_change_time = now;
+    m_change_remaining = remaining;
+  }
+
+  return ((int)(prev / 10) != (int)(sample.remaining / 10));
+}
+
+double selftest_progress::get_rate() const
+{
+  if (   m_change_time > m_anchor_time
+      && m_change_remaining < m_anchor_remaining)
+    return (m_anchor_remaining - m_change_remaining) / (m_change_time - m_anchor_time);
+  if (m_nominal > 0)
+    return 100.0 / m_nominal;
+  return 0;
+}
+
+uint64_t selftest_progress::get_throughput() const
+{
+  return (uint64_t)(get_rate() * m_capacity / 100);
+}
+
+int selftest_progress::get_eta(time_t now) const
+{
+  if (m_finished)
+    return 0;
+  double rate = get_rate();
+  if (!(rate > 0))
+    return -1;
+
+  time_t ref_time; double ref_remaining;
+  if (m_change_time) {
+    ref_time = m_change_time; ref_remaining = m_change_remaining;
+  }
+  else if (m_anchor_time) {
+    ref_time = m_anchor_time; ref_remaining = m_anchor_remaining;
+  }
+  else if (m_remaining >= 0) {
+    // Start unknown, no change seen yet: assume middle of current step
+    ref_time = m_first_time; ref_remaining = m_remaining + m_step / 2;
+  }
+  else
+    return -1;
+
+  double eta = ref_remaining / rate - (now - ref_time);
+  return (eta > 0 ? (int)(eta + 0.5) : 0);
+}
+
+int selftest_progress::get_elapsed(time_t now) const
+{
+  return (int)(now - (m_start_time ? m_start_time : m_first_time));
+}
+
+int selftest_progress::get_duration() const
+{
+  if (!(m_finished && m_start_time))
+    return -1;
+  return (int)(m_finish_time - m_start_time);
+}
+
+int selftest_progress::get_poll_interval(time_t now, int min_secs, int max_secs) const
+{
+  double secs = max_secs;
+  double rate = get_rate();
+  if (rate > 0) {
+    // Sample about four times per expected change of the reported value
+    // or per 2.5% if finer grained, but more often close to completion
+    secs = (m_step > 2.5 ? m_step : 2.5) / rate / 4;
+    int eta = get_eta(now);
+    if (eta >= 0 && secs > eta / 2.0)
+      secs = eta / 2.0;
+  }
+  if (secs < min_secs)
+    return min_secs;
+  if (secs > max_secs)
+    return max_secs;
+  return (int)secs;
+}
+
+const char * selftest_progress::format_status(char * buf, int size, time_t now) const
+{
+  char remstr[16] = "?";
+  if (m_remaining >= 0)
+    snprintf(remstr, sizeof(remstr), "%.0f%%", m_remaining);
+
+  char elapsed[32];
+  format_selftest_secs(elapsed, sizeof(elapsed), get_elapsed(now));
+
+  char thrstr[64] = "";
+  uint64_t throughput = get_throughput();
+  if (throughput) {
+    char cap[32];
+    snprintf(thrstr, sizeof(thrstr), ", %s/s",
+             format_capacity(cap, sizeof(cap), throughput));
+  }
+
+  char etastr[48] = "";
+  int eta = get_eta(now);
+  if (eta >= 0) {
+    char secs[32];
+    snprintf(etastr, sizeof(etastr), ", ETA %s",
+             format_selftest_secs(secs, sizeof(secs), eta));
+  }
+
+  snprintf(buf, size, "%s remaining, %s elapsed%s%s", remstr, elapsed, thrstr, etastr);
+  return buf;
+}
@@ -0,0 +1,129 @@
+/*
+ * selftest_progress.h
+ *
+ * Home page of code is: https://www.smartmontools.org
+ *
+ * Copyright (C) 2026 Smartmontools developers
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef SELFTEST_PROGRESS_H
+#define SELFTEST_PROGRESS_H
+
+#define SELFTEST_PROGRESS_H_CVSID "$Id$"
+
+#include "atacmds.h" // firmwarebug_defs
+#include "dev_interface.h"
+
+#include <stdint.h>
+#include <time.h>
+
+// Self-test progress tracking:
+// The remaining part of a running self-test is sampled from the ATA
+// self-test execution status, the SCSI sense data progress indication
+// or the NVMe Device Self-test log. Scan rate, throughput and time of
+// completion are estimated from the points in time where the reported
+// value changes. The interval until the next sample adapts to the
+// expected time of the next change.
+
+/// One progress sample of a device.
+struct selftest_sample
+{
+  bool running = false;         ///< Self-test in progress
+  double remaining = -1;        ///< Percent of test remaining, -1 if unknown
+  double step = 0;              ///< Resolution of 'remaining' in percent
+  bool rounded_down = false;    ///< 'remaining' is rounded down (ATA)
+  int result = -1;              ///< If not running: 0 if last test completed
+                                ///< without error, -1 if unknown
+};
+
+/// Read self-test progress from an open ATA, SCSI or NVMe device.
+/// Firmware bugs are used for ATA devices only.
+/// Return false and set device error on failure.
+bool read_selftest_progress(smart_device * device, selftest_sample & sample,
+  firmwarebug_defs firmwarebugs = firmwarebug_defs());
+
+/// Read capacity in bytes and nominal duration in seconds of a 'S'hort,
+/// 'L'ong or 'C'onveyance self-test from an open device.
+/// Values are set to 0 if unknown.
+void read_selftest_info(smart_device * device, char testtype,
+  uint64_t & capacity, int & nominal);
+
+/// Progress of one self-test.
+class selftest_progress
+{
+public:
+  /// Start tracking. Start time is 0 if unknown. Capacity in bytes and
+  /// nominal duration in seconds are 0 if unknown.
+  explicit selftest_progress(time_t start_time = 0, uint64_t capacity = 0, int nominal = 0);
+
+  /// Add a sample taken at time 'now'. Return true on first sample, if
+  /// a new 10% step is reached or if the test has finished.
+  bool add_sample(time_t now, const selftest_sample & sample);
+
+  /// Return true if the test is no longer running.
+  bool is_finished() const
+    { return m_finished; }
+
+  /// Return result from last sample, see selftest_sample::result.
+  int get_result() const
+    { return m_result; }
+
+  /// Return last reported remaining percentage, -1 if unknown.
+  double get_remaining() const
+    { return m_remaining; }
+
+  /// Return capacity in bytes, 0 if unknown.
+  uint64_t get_capacity() const
+    { return m_capacity; }
+
+  /// Return nominal duration in seconds, 0 if unknown.
+  int get_nominal() const
+    { return m_nominal; }
+
+  /// Return estimated progress in percent per second, 0 if unknown.
+  double get_rate() const;
+
+  /// Return estimated throughput in bytes per second, 0 if unknown.
+  uint64_t get_throughput() const;
+
+  /// Return estimated seconds until completion, -1 if unknown.
+  int get_eta(time_t now) const;
+
+  /// Return seconds since start or first sample.
+  int get_elapsed(time_t now) const;
+
+  /// Return duration of finished test in seconds, -1 if unknown.
+  int get_duration() const;
+
+  /// Return seconds until next sample, limited to [min_secs, max_secs].
+  int get_poll_interval(time_t now, int min_secs, int max_secs) const;
+
+  /// Format "remaining, elapsed, throughput, ETA" summary of running test.
+  const char * format_status(char * buf, int size, time_t now) const;
+
+private:
+  time_t m_start_time;          // Start of test, 0 if unknown
+  uint64_t m_capacity;          // Bytes covered by test, 0 if unknown
+  int m_nominal;                // Nominal duration, 0 if unknown
+  time_t m_first_time;          // Time of first sample
+  double m_remaining;           // Last reported value, -1 if none
+  double m_step;                // Resolution of m_remaining
+  // Reference points (time, true remaining) for rate estimation
+  time_t m_anchor_time;         // First point, start of test if known
+  double m_anchor_remaining;
+  time_t m_change_time;         // Last change of reported value after anchor
+  double m_change_remaining;
+  bool m_finished;
+  time_t m_finish_time;
+  int m_result;
+};
+
+/// Sleep until next sample is due (used by smartctl only).
+void sleep_until_next_sample(int secs);
+
+/// Format seconds as "[D+]H:MM:SS".
+const char * format_selftest_secs(char * buf, int size, int secs);
+
+#endif // SELFTEST_PROGRESS_H
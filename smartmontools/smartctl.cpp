@@ -23,6 +23,10 @@
 #include <stdexcept>
 #include <getopt.h>
 
+#ifdef HAVE_STD_THREAD
+#include <thread>
+#endif
+
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
@@ -33,10 +37,13 @@
 
 #include "atacmds.h"
 #include "dev_interface.h"
+#include "dev_snapshot.h"
+#include "dev_status_cache.h"
 #include "ataprint.h"
 #include "knowndrives.h"
 #include "scsicmds.h"
 #include "scsiprint.h"
+#include "selftest_progress.h"
 #include "nvmeprint.h"
 #include "smartctl.h"
 #include "utility.h"
@@ -151,7 +158,13 @@ static void Usage()
 "  -r TYPE, --report=TYPE\n"
 "         Report transactions (see man page)\n\n"
 "  -n MODE[,STATUS[,STATUS2]], --nocheck=MODE[,STATUS[,STATUS2]] (ATA, SCSI)\n"
-"         No check if: never, sleep, standby, idle (see man page)\n\n",
+"         No check if: never, sleep, standby, idle (see man page)\n\n"
+"  --capture=FILE\n"
+"         Save all device commands and their results to snapshot FILE\n\n"
+"  --replay\n"
+"         Read results of device commands from snapshot file DEVICE\n\n"
+"  --smartd-status=FILE[,MAXAGE]\n"
+"         Print data of DEVICE from smartd status FILE (see man page)\n\n",
   getvalidarglist('d').c_str()); // TODO: Use this function also for other options ?
   pout(
 "============================== DEVICE FEATURE ENABLE/DISABLE COMMANDS =====\n\n"
@@ -209,7 +222,7 @@ static void Usage()
 "============================================ DEVICE SELF-TEST OPTIONS =====\n\n"
 "  -t TEST, --test=TEST\n"
 "        Run test. TEST: offline, short, long, conveyance, force, vendor,N,\n"
-"                        select,M-N, pending,N, afterselect,[on|off]\n\n"
+"                        select,M-N, pending,N, afterselect,[on|off], wait\n\n"
 "  -C, --captive\n"
 "        Do test in captive mode (along with -t)\n\n"
 "  -X, --abort\n"
@@ -221,7 +234,8 @@ static void Usage()
 }
 
 // Values for  --long only options, see parse_options()
-enum { opt_identify = 1000, opt_scan, opt_scan_open, opt_set, opt_smart };
+enum { opt_identify = 1000, opt_scan, opt_scan_open, opt_set, opt_smart,
+       opt_capture, opt_replay, opt_smartd_status };
 
 /* Returns a string containing a formatted list of the valid arguments
    to the option opt or empty on failure. Note 'v' case different */
@@ -238,6 +252,10 @@ static std::string getvalidarglist(int opt)
     return "warn, exit, ignore";
   case 'B':
     return "[+]<FILE_NAME>";
+  case opt_capture:
+    return "<FILE_NAME>";
+  case opt_smartd_status:
+    return "<FILE_NAME>[,<MAX_AGE_SECONDS>]";
   case 'r':
     return "ioctl[,N], ataioctl[,N], scsiioctl[,N], nvmeioctl[,N]";
   case opt_smart:
@@ -256,7 +274,7 @@ static std::string getvalidarglist(int opt)
     return "use, ignore, show, showall";
   case 't':
     return "offline, short, long, conveyance, force, vendor,N, select,M-N, "
-           "pending,N, afterselect,[on|off]";
+           "pending,N, afterselect,[on|off], wait";
   case 'F':
     return std::string(get_valid_firmwarebug_args()) + ", swapid";
   case 'n':
@@ -308,6 +326,17 @@ enum checksum_err_mode_t {
 
 static checksum_err_mode_t checksum_err_mode = CHECKSUM_ERR_WARN;
 
+// Snapshot file from '--capture=FILE', replay snapshot if '--replay'
+static const char * capture_file = nullptr;
+static bool replay_snapshot = false;
+
+// Status file and max age of data from '--smartd-status=FILE[,MAXAGE]'
+static std::string smartd_status_file;
+static int smartd_status_maxage = 3600;
+
+// Poll progress until self-test has finished if '-t wait'
+static bool selftest_wait = false;
+
 static void scan_devices(const smart_devtype_list & types, bool with_open, char ** argv);
 
 
@@ -355,6 +384,9 @@ static int parse_options(int argc, char** argv, const char * & type,
     { "set",             required_argument, 0, opt_set },
     { "scan",            no_argument,       0, opt_scan      },
     { "scan-open",       no_argument,       0, opt_scan_open },
+    { "capture",         required_argument, 0, opt_capture },
+    { "replay",          no_argument,       0, opt_replay },
+    { "smartd-status",   required_argument, 0, opt_smartd_status },
     { 0,                 0,                 0, 0   }
   };
 
@@ -816,6 +848,8 @@ static int parse_options(int argc, char** argv, const char * & type,
       } else if (!strcmp(optarg,"force")) {
         ataopts.smart_selftest_force = true;
         scsiopts.smart_selftest_force = true;
+      } else if (!strcmp(optarg,"wait")) {
+        selftest_wait = true;
       } else if (!strcmp(optarg,"afterselect,on")) {
         // scan remainder of disk after doing selected segment
         ataopts.smart_selective_args.scan_after_select = 2;
@@ -1129,8 +1163,36 @@ static int parse_options(int argc, char** argv, const char * & type,
       scan = optchar;
       break;
 
+    case opt_capture:
+      capture_file = optarg;
+      break;
+
+    case opt_replay:
+      replay_snapshot = true;
+      break;
+
+    case opt_smartd_status:
+      {
+        smartd_status_file = optarg;
+        size_t comma = smartd_status_file.rfind(',');
+        if (comma != std::string::npos) {
+          int n1 = -1, age = 0;
+          const char * s = smartd_status_file.c_str() + comma + 1;
+          if (!(sscanf(s, "%d%n", &age, &n1) == 1 && n1 == (int)strlen(s) && age > 0))
+            badarg = true;
+          else {
+            smartd_status_maxage = age;
+            smartd_status_file.erase(comma);
+          }
+        }
+        if (smartd_status_file.empty())
+          badarg = true;
+      }
+      break;
+
     case 'j':
       {
+        pout_flush();
         print_as_json = true;
         print_as_json_options.pretty = true;
         print_as_json_options.sorted = false;
@@ -1261,6 +1323,17 @@ static int parse_options(int argc, char** argv, const char * & type,
     return FAILCMD;
   }
 
+  // error message if user has asked to wait without starting a self-test
+  if (selftest_wait && (   testcnt != 1 || captive
+                        || ataopts.smart_selftest_type == ABORT_SELF_TEST
+                        || ataopts.smart_selftest_type == OFFLINE_FULL_SCAN)) {
+    printing_is_off = false;
+    printslogan();
+    jerr("\nERROR: smartctl -t wait must be used with a non-captive self-test.\n");
+    UsageSummary();
+    return FAILCMD;
+  }
+
   // If captive option was used, change test type if appropriate.
   if (captive)
     switch (ataopts.smart_selftest_type) {
@@ -1313,28 +1386,73 @@ static int parse_options(int argc, char** argv, const char * & type,
 
 // Printing functions
 
+// Output buffer:
+// Plain text output is collected here and written if the buffer is full,
+// before each device command (see pout_flush() calls in *cmds.cpp) and
+// on exit. This keeps the number of write calls low and still shows
+// progress if a command takes long.
+// With '--json', this holds the last incomplete line.
+static std::string pout_buf;
+
+// Write buffered plain text output if at least this size
+const size_t pout_buf_flush_size = 0x10000;
+
+#ifdef HAVE_STD_THREAD
+// Set during static initialization
+static const std::thread::id main_thread_id = std::this_thread::get_id();
+#endif
+
+void pout_flush()
+{
+#ifdef HAVE_STD_THREAD
+  // Device commands may run in worker threads during '--scan-open'
+  if (std::this_thread::get_id() != main_thread_id)
+    return;
+#endif
+  if (print_as_json || pout_buf.empty())
+    return;
+  fwrite(pout_buf.data(), 1, pout_buf.size(), stdout);
+  fflush(stdout);
+  pout_buf.clear();
+}
+
+// Append formatted string to buffer.
+__attribute_format_printf(2, 0)
+static void vappend(std::string & buf, const char * fmt, va_list ap)
+{
+  va_list ap2;
+  va_copy(ap2, ap);
+  char tmp[512];
+  int n = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+  if (0 <= n && n < (int)sizeof(tmp))
+    buf.append(tmp, n);
+  else if (n > 0) {
+    // Format again into the buffer
+    size_t pos = buf.size();
+    buf.resize(pos + n + 1);
+    vsnprintf(&buf[pos], n + 1, fmt, ap2);
+    buf.resize(pos + n);
+  }
+  va_end(ap2);
+}
+
 __attribute_format_printf(3, 0)
 static void vjpout(bool is_js_impl, const char * msg_severity,
                    const char *fmt, va_list ap)
 {
+  vappend(pout_buf, fmt, ap);
+
   if (!print_as_json) {
-    // Print out directly
-    vprintf(fmt, ap);
-    fflush(stdout);
+    if (pout_buf.size() >= pout_buf_flush_size)
+      pout_flush();
   }
   else {
     // Add lines to JSON output
-    static char buf[1024];
-    static char * bufnext = buf;
-    vsnprintf(bufnext, sizeof(buf) - (bufnext - buf), fmt, ap);
-    for (char * p = buf, *q; ; p = q) {
-      if (!(q = strchr(p, '\n'))) {
-        // Keep remaining line for next call
-        for (bufnext = buf; *p; bufnext++, p++)
-          *bufnext = *p;
-        break;
-      }
-      *q++ = 0; // '\n' -> '\0'
+    size_t start = 0;
+    for (size_t end; (end = pout_buf.find('\n', start)) != std::string::npos;
+         start = end + 1) {
+      pout_buf[end] = 0; // '\n' -> '\0'
+      const char * p = pout_buf.c_str() + start;
 
       static int lineno = 0;
       lineno++;
@@ -1357,10 +1475,14 @@ static void vjpout(bool is_js_impl, const char * msg_severity,
       if (   ( is_js_impl && print_as_json_impl  )
           || (!is_js_impl && print_as_json_unimpl)) {
         // Add (un)implemented non-empty lines to global object
-        jglb[strprintf("smartctl_%04d_%c", lineno,
-                     (is_js_impl ? 'i' : 'u')).c_str()] = p;
+        char key[32];
+        snprintf(key, sizeof(key), "smartctl_%04d_%c", lineno,
+                 (is_js_impl ? 'i' : 'u'));
+        jglb[key] = p;
       }
     }
+    // Keep remaining line for next call
+    pout_buf.erase(0, start);
   }
 }
 
@@ -1511,6 +1633,128 @@ static void js_device_info(const json::ref & jref, const smart_device * dev)
   jref["protocol"] = get_protocol_info(dev);
 }
 
+// Poll progress of the self-test started by '-t TEST' until it has
+// finished, print remaining part, throughput and estimated completion.
+static int wait_for_selftest(smart_device * device, char testtype,
+                             const ata_print_options & ataopts)
+{
+  // Firmware bugs from '-F' and drive database presets
+  firmwarebug_defs firmwarebugs = ataopts.firmwarebugs;
+  if (device->is_ata() && !ataopts.ignore_presets) {
+    ata_identify_device drive;
+    if (!ata_read_identity(device->to_ata(), &drive, ataopts.fix_swapped_id)) {
+      ata_vendor_attr_defs defs; std::string dbversion;
+      lookup_drive_apply_presets(&drive, defs, firmwarebugs, dbversion);
+    }
+  }
+
+  time_t start_time = time(nullptr);
+  uint64_t capacity; int nominal;
+  read_selftest_info(device, testtype, capacity, nominal);
+  selftest_progress progress(start_time, capacity, nominal);
+
+  pout("=== WAITING FOR SELF-TEST TO COMPLETE ===\n");
+  json::ref jref = jglb["self_test_progress"];
+  bool first = true;
+  for (;;) {
+    time_t now = time(nullptr);
+    selftest_sample sample;
+    if (!read_selftest_progress(device, sample, firmwarebugs)) {
+      jerr("Read self-test progress failed: %s\n\n", device->get_errmsg());
+      return FAILSMART;
+    }
+    if (first && !sample.running) {
+      jerr("No self-test in progress\n\n");
+      return FAILSMART;
+    }
+    first = false;
+
+    if (progress.add_sample(now, sample)) {
+      if (progress.is_finished())
+        break;
+      char buf[128];
+      pout("Self-test in progress: %s\n", progress.format_status(buf, sizeof(buf), now));
+    }
+    pout_flush();
+    // Poll faster than the ETA of the test, but at most every 10 seconds
+    sleep_until_next_sample(progress.get_poll_interval(now, 10, 300));
+  }
+
+  char buf[32];
+  int duration = progress.get_duration();
+  jout("Self-test finished after %s", format_selftest_secs(buf, sizeof(buf), duration));
+  if (nominal)
+    jout(" (drive estimate %s)", format_selftest_secs(buf, sizeof(buf), nominal));
+  jout("\n");
+  jref["duration_seconds"] = duration;
+  if (nominal)
+    jref["nominal_seconds"] = nominal;
+
+  if (capacity && duration > 0 && testtype == 'L') {
+    uint64_t throughput = capacity / duration;
+    jout("Average scan rate: %s/s\n", format_capacity(buf, sizeof(buf), throughput));
+    jref["bytes_per_second"] = throughput;
+  }
+
+  int result = progress.get_result();
+  if (result >= 0)
+    jref["status"] = result;
+  if (result > 0) {
+    jout("Self-test did not complete without error (status %d), see self-test log\n", result);
+    return FAILLOG;
+  }
+  jout("\n");
+  return 0;
+}
+
+// Add per-command count, errors and latency to JSON output
+static void js_cmd_stats(const json::ref & jref, const smart_device * dev)
+{
+  int i = 0;
+  for (const auto & entry : dev->get_cmd_stats()) {
+    unsigned key = entry.first;
+    const smart_device::cmd_stats & st = entry.second;
+    unsigned opcode = smart_device::cmd_stats_opcode(key);
+    json::ref jrefi = jref[i++];
+
+    switch (smart_device::cmd_stats_protocol(key)) {
+      case smart_device::cmd_ata:
+        jrefi["protocol"] = "ATA";
+        jrefi["opcode"] = opcode >> 8;
+        if (opcode & 0xff)
+          jrefi["feature"] = opcode & 0xff;
+        break;
+      case smart_device::cmd_scsi:
+        jrefi["protocol"] = "SCSI";
+        jrefi["opcode"] = opcode;
+        break;
+      case smart_device::cmd_nvme:
+        jrefi["protocol"] = "NVMe";
+        jrefi["opcode"] = opcode;
+        break;
+    }
+    jrefi["name"] = smart_device::get_cmd_stats_name(key);
+    jrefi["count"] = st.count;
+    jrefi["errors"] = st.errors;
+
+    if (st.min_usec < 0)
+      continue;
+    jrefi["latency_usec"] += {
+      {"min", st.min_usec},
+      {"max", st.max_usec},
+      {"average", st.total_usec / st.count},
+      {"total", st.total_usec}
+    };
+    for (int b = 0; b < smart_device::cmd_stats::num_buckets; b++) {
+      json::ref jrefb = jrefi["latency_histogram"][b];
+      long long limit = smart_device::get_cmd_stats_bucket_limit(b);
+      if (limit >= 0)
+        jrefb["below_usec"] = limit;
+      jrefb["count"] = st.histogram[b];
+    }
+  }
+}
+
 // Device scan
 // smartctl [-d type] --scan[-open] -- [PATTERN] [smartd directive ...]
 void scan_devices(const smart_devtype_list & types, bool with_open, char ** argv)
@@ -1532,11 +1776,20 @@ void scan_devices(const smart_devtype_list & types, bool with_open, char ** argv
     return;
   }
 
+  // Open all devices concurrently unless debug output is requested
+  bool parallel_open = (with_open && dont_print);
+  if (parallel_open) {
+    pout_flush();
+    printing_is_off = true;
+    smi()->autodetect_open_devices(devlist);
+    printing_is_off = false;
+  }
+
   for (unsigned i = 0; i < devlist.size(); i++) {
     smart_device_auto_ptr dev( devlist.release(i) );
     json::ref jref = jglb["devices"][i];
 
-    if (with_open) {
+    if (with_open && !parallel_open) {
       printing_is_off = dont_print;
       dev.replace ( dev->autodetect_open() );
       printing_is_off = false;
@@ -1566,6 +1819,154 @@ void scan_devices(const smart_devtype_list & types, bool with_open, char ** argv
   }
 }
 
+// Save snapshot if '--capture=FILE' is specified
+static void write_capture_file(smart_device * dev)
+{
+  if (capture_file && !write_device_snapshot(dev, capture_file))
+    jerr("Smartctl write snapshot failed: %s\n", dev->get_errmsg());
+}
+
+// Name of ATA power mode which let smartd skip checks
+static const char * get_skipped_power_mode_name(int mode)
+{
+  switch (mode) {
+    case -1:   return "SLEEP or STANDBY (OS)";
+    case 0x00: return "STANDBY";
+    case 0x01: return "STANDBY_Y";
+    case 0x80: return "IDLE";
+    case 0x81: return "IDLE_A";
+    case 0x82: return "IDLE_B";
+    case 0x83: return "IDLE_C";
+    default:   return "?";
+  }
+}
+
+// Find device in smartd status file, print summary and check age of data.
+// Return exit status or -1 to print further data from the cached entry.
+static int print_smartd_status(const char * name, const char * type,
+                               dev_status_entry & entry)
+{
+  const char * file = smartd_status_file.c_str();
+  time_t write_time = 0;
+  std::vector<dev_status_entry> entries;
+  std::string errmsg;
+  if (!read_dev_status_file(file, write_time, entries, errmsg)) {
+    jerr("Read smartd status failed: %s\n", errmsg.c_str());
+    return FAILDEV;
+  }
+
+  std::string unique_name = smi()->get_unique_dev_name(name, (type ? type : ""));
+  const dev_status_entry * e = nullptr;
+  for (const dev_status_entry & ei : entries) {
+    if (ei.unique_name == unique_name || ei.dev_name == name || ei.info_name == name) {
+      e = &ei;
+      break;
+    }
+  }
+  if (!e) {
+    jerr("%s: Device not found in smartd status file %s\n", name, file);
+    return FAILDEV;
+  }
+  entry = *e;
+
+  json::ref jref = jglb["smartd_status"];
+  jref["file"] = file;
+  jout("=== START OF SMARTD STATUS SECTION ===\n");
+  jout("Device:           %s%s%s\n", entry.info_name.c_str(),
+       (!entry.idinfo.empty() ? ", " : ""), entry.idinfo.c_str());
+
+  if (!entry.check_time) {
+    jerr("%s: Device not yet checked by smartd\n", name);
+    return FAILDEV;
+  }
+  char datebuf[DATEANDEPOCHLEN];
+  long age = (long)(time(nullptr) - entry.check_time);
+  dateandtimezoneepoch(datebuf, entry.check_time);
+  jout("Last Check:       %s (%ld seconds ago)\n", datebuf, age);
+  jref["check_time"] += { {"time_t", entry.check_time}, {"asctime", datebuf} };
+  jref["age_seconds"] = age;
+  jref["max_age_seconds"] = smartd_status_maxage;
+
+  if (entry.data_time && entry.data_time != entry.check_time) {
+    dateandtimezoneepoch(datebuf, entry.data_time);
+    jout("Last Data Read:   %s\n", datebuf);
+    jref["data_time"] += { {"time_t", entry.data_time}, {"asctime", datebuf} };
+  }
+  if (entry.num_skipped) {
+    const char * mode = get_skipped_power_mode_name(entry.power_mode_skipped);
+    jout("Skipped Checks:   %d (%s mode)\n", entry.num_skipped, mode);
+    jref["skipped_checks"] = entry.num_skipped;
+    jref["skipped_power_mode"] = mode;
+  }
+  if (entry.health != dev_status_entry::health_unknown) {
+    bool passed = (entry.health == dev_status_entry::health_passed);
+    jout("SMART Health:     %s\n", (passed ? "PASSED" : "FAILED!"));
+    jref["smart_status"]["passed"] = passed;
+  }
+  if (entry.temperature) {
+    jout("Temperature:      %d Celsius (Min/Max %d/%d)\n",
+         entry.temperature, entry.tempmin, entry.tempmax);
+    jref["temperature"] += { {"current", entry.temperature},
+                             {"min", entry.tempmin}, {"max", entry.tempmax} };
+  }
+  if (entry.selftest_errors >= 0) {
+    jout("Self-test Errors: %d\n", entry.selftest_errors);
+    jref["self_test_errors"] = entry.selftest_errors;
+  }
+  if (entry.ata_errors >= 0) {
+    jout("ATA Errors:       %d\n", entry.ata_errors);
+    jref["ata_errors"] = entry.ata_errors;
+  }
+  if (entry.nvme_err_log_entries >= 0) {
+    jout("Error Log Entries: %" PRId64 "\n", entry.nvme_err_log_entries);
+    jref["nvme_error_log_entries"] = entry.nvme_err_log_entries;
+  }
+  jout("\n");
+
+  if (age > smartd_status_maxage) {
+    jerr("%s: smartd status is too old (%ld seconds, limit %d)\n",
+         name, age, smartd_status_maxage);
+    return FAILDEV;
+  }
+
+  // Only the summary is available for SCSI devices
+  if (entry.protocol == 'S')
+    return (entry.health == dev_status_entry::health_failed ? FAILSTATUS : 0);
+  return -1;
+}
+
+// Restrict ATA options to output available from smartd status
+static ata_print_options get_smartd_status_options(const ata_print_options & opts)
+{
+  ata_print_options so;
+  so.drive_info = opts.drive_info;
+  so.identify_word_level = opts.identify_word_level;
+  so.identify_bit_level = opts.identify_bit_level;
+  so.smart_check_status = opts.smart_check_status;
+  so.smart_general_values = opts.smart_general_values;
+  so.smart_vendor_attrib = opts.smart_vendor_attrib;
+  so.output_format = opts.output_format;
+  so.firmwarebugs = opts.firmwarebugs;
+  so.attribute_defs = opts.attribute_defs;
+  so.ignore_presets = opts.ignore_presets;
+  so.show_presets = opts.show_presets;
+  so.powermode = opts.powermode;
+  so.powerexit = opts.powerexit;
+  so.powerexit_unsup = opts.powerexit_unsup;
+  return so;
+}
+
+// Restrict NVMe options to output available from smartd status
+static nvme_print_options get_smartd_status_options(const nvme_print_options & opts)
+{
+  nvme_print_options so;
+  so.drive_info = opts.drive_info;
+  so.drive_capabilities = opts.drive_capabilities;
+  so.smart_check_status = opts.smart_check_status;
+  so.smart_vendor_attrib = opts.smart_vendor_attrib;
+  return so;
+}
+
 // Main program without exception handling
 static int main_worker(int argc, char **argv)
 {
@@ -1609,6 +2010,30 @@ static int main_worker(int argc, char **argv)
     }
     dev = get_parsed_ata_device(smi(), name);
   }
+  else if (replay_snapshot) {
+    // Replay commands from snapshot file
+    if (type || print_type_only || capture_file) {
+      pout("-d and --capture options are not allowed in conjunction with --replay.\n");
+      UsageSummary();
+      return FAILCMD;
+    }
+    dev = get_snapshot_replay_device(smi(), name);
+  }
+  else if (!smartd_status_file.empty()) {
+    // Print data cached by smartd
+    if (print_type_only || capture_file) {
+      pout("-d test and --capture options are not allowed in conjunction with --smartd-status.\n");
+      UsageSummary();
+      return FAILCMD;
+    }
+    dev_status_entry entry;
+    int status = print_smartd_status(name, type, entry);
+    if (status >= 0)
+      return status;
+    dev = get_dev_status_device(smi(), entry);
+    ataopts = get_smartd_status_options(ataopts);
+    nvmeopts = get_smartd_status_options(nvmeopts);
+  }
   else
     // get device of appropriate type
     dev = smi()->get_smart_device(name, type);
@@ -1617,7 +2042,7 @@ static int main_worker(int argc, char **argv)
     jerr("%s: %s\n", name, smi()->get_errmsg());
     if (type)
       printvalidarglistmessage('d');
-    else
+    else if (!(replay_snapshot || !smartd_status_file.empty()))
       pout("Please specify device type with the -d option.\n");
     UsageSummary();
     return FAILCMD;
@@ -1652,23 +2077,55 @@ static int main_worker(int argc, char **argv)
     return FAILDEV;
   }
 
+  if (capture_file)
+    // Record all further commands
+    dev.replace( get_snapshot_capture_device(smi(), dev.get()) );
+  else if (replay_snapshot) {
+    // Use time of snapshot as local time
+    time_t snaptime = get_snapshot_time(dev.get());
+    dateandtimezoneepoch(startup_datetime_buf, snaptime);
+    jglb["local_time"] += { {"time_t", snaptime}, {"asctime", startup_datetime_buf} };
+  }
+
   // Add JSON info similar to --scan output
   js_device_info(jglb["device"], dev.get());
 
   // now call appropriate ATA or SCSI routine
   int retval = 0;
-  if (print_type_only)
-    jout("%s: Device of type '%s' [%s] opened\n",
-         dev->get_info_name(), dev->get_dev_type(), get_protocol_info(dev.get()));
-  else if (dev->is_ata())
-    retval = ataPrintMain(dev->to_ata(), ataopts);
-  else if (dev->is_scsi())
-    retval = scsiPrintMain(dev->to_scsi(), scsiopts);
-  else if (dev->is_nvme())
-    retval = nvmePrintMain(dev->to_nvme(), nvmeopts);
-  else
-    // we should never fall into this branch!
-    pout("%s: Neither ATA, SCSI nor NVMe device\n", dev->get_info_name());
+  try {
+    if (print_type_only)
+      jout("%s: Device of type '%s' [%s] opened\n",
+           dev->get_info_name(), dev->get_dev_type(), get_protocol_info(dev.get()));
+    else if (dev->is_ata())
+      retval = ataPrintMain(dev->to_ata(), ataopts);
+    else if (dev->is_scsi())
+      retval = scsiPrintMain(dev->to_scsi(), scsiopts);
+    else if (dev->is_nvme())
+      retval = nvmePrintMain(dev->to_nvme(), nvmeopts);
+    else
+      // we should never fall into this branch!
+      pout("%s: Neither ATA, SCSI nor NVMe device\n", dev->get_info_name());
+
+    // Wait only if the self-test was started
+    if (selftest_wait && !print_type_only && !(retval & FAILSMART)) {
+      char testtype;
+      switch (ataopts.smart_selftest_type) {
+        case SHORT_SELF_TEST:      testtype = 'S'; break;
+        case EXTEND_SELF_TEST:     testtype = 'L'; break;
+        case CONVEYANCE_SELF_TEST: testtype = 'C'; break;
+        default:                   testtype = 'n'; break; // Selective
+      }
+      retval |= wait_for_selftest(dev.get(), testtype, ataopts);
+    }
+  }
+  catch (int) {
+    // Save also commands which lead to failuretest() exit
+    write_capture_file(dev.get());
+    throw;
+  }
+
+  js_cmd_stats(jglb["command_statistics"], dev.get());
+  write_capture_file(dev.get());
 
   dev->close();
   return retval;
@@ -1690,6 +2147,7 @@ int main(int argc, char **argv)
       // Exit status from checksumwarning() and failuretest() arrives here
       status = ex;
     }
+    pout_flush();
     // Print JSON if enabled
     if (jglb.has_uint128_output())
       jglb["smartctl"]["uint128_precision_bits"] = uint128_to_str_precision_bits();
@@ -1698,11 +2156,13 @@ int main(int argc, char **argv)
   }
   catch (const std::bad_alloc & /*ex*/) {
     // Memory allocation failed (also thrown by std::operator new)
+    pout_flush();
     printf("Smartctl: Out of memory\n");
     status = FAILCMD;
   }
   catch (const std::exception & ex) {
     // Other fatal errors
+    pout_flush();
     printf("Smartctl: Exception: %s\n", ex.what());
     badcode = true;
     status = FAILCMD;
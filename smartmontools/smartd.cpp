@@ -26,10 +26,13 @@
 #include <errno.h>
 #include <time.h>
 #include <limits.h>
+#include <math.h>
 #include <getopt.h>
 
 #include <algorithm> // std::replace()
 #include <map>
+#include <memory>
+#include <set>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -38,6 +41,9 @@
 #ifndef _WIN32
 #include <sys/wait.h>
 #endif
+#ifdef HAVE_STD_THREAD
+#include <mutex>
+#endif
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
@@ -63,14 +69,19 @@ typedef int pid_t;
 
 #ifdef HAVE_LIBSYSTEMD
 #include <systemd/sd-daemon.h>
+#include <systemd/sd-journal.h>
 #endif // HAVE_LIBSYSTEMD
 
 // locally included files
 #include "atacmds.h"
 #include "dev_interface.h"
+#include "dev_status_cache.h"
 #include "knowndrives.h"
 #include "scsicmds.h"
 #include "nvmecmds.h"
+#include "selftest_progress.h"
+#include "smartd_sched.h"
+#include "smartd_state.h"
 #include "utility.h"
 
 #ifdef HAVE_POSIX_API
@@ -158,6 +169,9 @@ static constexpr int default_checktime = 1800;
 static int checktime = default_checktime;
 static int checktime_min = 0; // Minimum individual check time, 0 if none
 
+// command-line: max number of concurrently running tests, 0 if unlimited
+static int test_limit = 0;
+
 // command-line: name of PID file (empty for no pid file)
 static std::string pid_file;
 
@@ -168,6 +182,9 @@ static std::string state_path_prefix
 #endif
                                     ;
 
+// command-line: name of status file for 'smartctl --smartd-status', empty if none
+static std::string status_file;
+
 // command-line: path prefix of attribute log file, empty if no logs.
 static std::string attrlog_path_prefix
 #ifdef SMARTMONTOOLS_ATTRIBUTELOG
@@ -207,6 +224,11 @@ static bool quit_nodev0 = false;
 // command-line; this is the default syslog(3) log facility to use.
 static int facility=LOG_DAEMON;
 
+#ifdef HAVE_LIBSYSTEMD
+// command-line: log to systemd journal instead of syslog ('-l journal')
+static bool log_to_journal = false;
+#endif
+
 #ifndef _WIN32
 // command-line: fork into background?
 static bool do_fork=true;
@@ -230,6 +252,11 @@ static volatile int caughtsigHUP=0;
 // set to signal value if we catch INT, QUIT, or TERM
 static volatile int caughtsigEXIT=0;
 
+// Output of pout() is not buffered.
+void pout_flush()
+{
+}
+
 // This function prints either to stdout or to the syslog as needed.
 static void PrintOut(int priority, const char *fmt, ...)
                      __attribute_format_printf(2, 3);
@@ -380,8 +407,19 @@ private:
 };
 
 
+// Device Statistics value monitored by '-D' directive
+struct devstat_monitor
+{
+  unsigned char page{};                   // Device Statistics page
+  unsigned short offset{};                // Offset of value in page
+  int64_t limit{};                        // Warn if value >= limit, 0 if none
+  uint64_t diff{};                        // Report changes >= diff, 0 if none
+};
+
 /// Configuration data for a device. Read from smartd.conf.
 /// Supports copy & assignment and is compatible with STL containers.
+class test_schedule;
+
 struct dev_config
 {
   int lineno{};                           // Line number of entry in file
@@ -389,8 +427,10 @@ struct dev_config
   std::string dev_name;                   // Device name (plain, for SMARTD_DEVICE variable)
   std::string dev_type;                   // Device type argument from -d directive, empty if none
   std::string dev_idinfo;                 // Device identify info for warning emails
+  std::string dev_model, dev_serial;      // Model and serial number for log fields
   std::string state_file;                 // Path of the persistent state file, empty if none
   std::string attrlog_file;               // Path of the persistent attrlog file, empty if none
+  std::string scttemp_file;               // Path of the SCT temperature history file, empty if none
   int checktime{};                        // Individual check interval, 0 if none
   bool ignore{};                          // Ignore this entry
   bool id_is_unique{};                    // True if dev_idinfo is unique (includes S/N or WWN)
@@ -405,6 +445,7 @@ struct dev_config
   bool offlinests_ns{};                   // Disable auto standby if in progress
   bool selfteststs{};                     // Monitor changes in self-test execution status
   bool selfteststs_ns{};                  // Disable auto standby if in progress
+  bool scttemp_hist{};                    // Harvest SCT Temperature History ('-l scttemp')
   bool permissive{};                      // Ignore failed SMART commands
   char autosave{};                        // 1=disable, 2=enable Autosave Attributes
   char autoofflinetest{};                 // 1=disable, 2=enable Auto Offline Test
@@ -417,8 +458,17 @@ struct dev_config
   int powerskipmax{};                     // how many times can be check skipped
   unsigned char tempdiff{};               // Track Temperature changes >= this limit
   unsigned char tempinfo{}, tempcrit{};   // Track Temperatures >= these limits as LOG_INFO, LOG_CRIT+mail
+  bool trend{};                           // Track trends of attributes and error counts (-A)
+  unsigned short trend_days{};            // Warn if a limit is predicted within this many days
+  unsigned trend_rate{};                  // Warn if sector or error counts grow faster per day
+  unsigned char trend_window{};           // Smoothing window of trends in days
   regular_expression test_regex;          // Regex for scheduled testing
+  std::shared_ptr<test_schedule> test_sched; // Calendar built from test_regex
   unsigned test_offset_factor{};          // Factor for staggering of scheduled tests
+  std::string test_group;                 // Group for limit of concurrent tests ('-g')
+  int test_group_max{};                   // Max number of concurrent tests in group, 0 if none
+  int selective_plan_minutes{};           // Target duration of planned selective tests ('-x')
+  int selective_plan_days{};              // Max days to cover whole disk, 0 if unlimited
 
   // Configuration of email warning messages
   std::string emailcmdline;               // script to execute, empty if no messages
@@ -447,75 +497,81 @@ struct dev_config
 
   attribute_flags monitor_attr_flags;     // MONITOR_* flags for each attribute
 
-  ata_vendor_attr_defs attribute_defs;    // -v options
-};
-
-// Number of allowed mail message types
-static const int SMARTD_NMAIL = 13;
-// Type for '-M test' mails (state not persistent)
-static const int MAILTYPE_TEST = 0;
-// TODO: Add const or enum for all mail types.
+  ata_vendor_attr_defs attribute_defs;    // -v options, table is shared (copy on write)
+  std::shared_ptr<const ata_attr_decoder> attr_decoder; // Decoder for attribute_defs, ATA only
 
-struct mailinfo {
-  int logged{};         // number of times an email has been sent
-  time_t firstsent{};   // time first email was sent, as defined by time(2)
-  time_t lastsent{};    // time last email was sent, as defined by time(2)
+  std::vector<devstat_monitor> devstat_mons; // -D options
 };
 
-/// Persistent state data for a device.
-struct persistent_dev_state
+// Context of log messages, used for structured journal fields
+struct log_context
 {
-  unsigned char tempmin{}, tempmax{};     // Min/Max Temperatures
+  const dev_config * cfg = nullptr;       // Device currently checked, nullptr if none
+  int attr_id = 0;                        // ATA Attribute ID, 0 if none
+  const char * event = nullptr;           // Mail type of warning, nullptr if none
+};
 
-  unsigned char selflogcount{};           // total number of self-test errors
-  unsigned short selfloghour{};           // lifetime hours of last self-test error
+// Per thread, devices may be opened by worker threads during scan
+static thread_local log_context log_ctx;
 
-  time_t scheduled_test_next_check{};     // Time of next check for scheduled self-tests
+// Set log context for the lifetime of this object
+class log_context_scope
+{
+public:
+  explicit log_context_scope(const dev_config * cfg)
+    : m_prev(log_ctx)
+    { log_ctx.cfg = cfg; }
 
-  uint64_t selective_test_last_start{};   // Start LBA of last scheduled selective self-test
-  uint64_t selective_test_last_end{};     // End LBA of last scheduled selective self-test
+  log_context_scope(int attr_id, const char * event)
+    : m_prev(log_ctx)
+    { log_ctx.attr_id = attr_id; log_ctx.event = event; }
 
-  mailinfo maillog[SMARTD_NMAIL];         // log info on when mail sent
+  ~log_context_scope()
+    { log_ctx = m_prev; }
 
-  // ATA ONLY
-  int ataerrorcount{};                    // Total number of ATA errors
-
-  // Persistent part of ata_smart_values:
-  struct ata_attribute {
-    unsigned char id{};
-    unsigned char val{};
-    unsigned char worst{}; // Byte needed for 'raw64' attribute only.
-    uint64_t raw{};
-    unsigned char resvd{};
-  };
-  ata_attribute ata_attributes[NUMBER_ATA_SMART_ATTRIBUTES];
-  
-  // SCSI ONLY
+private:
+  log_context m_prev;
 
-  struct scsi_error_counter_t {
-    struct scsiErrorCounter errCounter{};
-    unsigned char found{};
-  };
-  scsi_error_counter_t scsi_error_counters[3];
+  log_context_scope(const log_context_scope &);
+  void operator=(const log_context_scope &);
+};
 
-  struct scsi_nonmedium_error_t {
-    struct scsiNonMediumError nme{};
-    unsigned char found{};
-  };
-  scsi_nonmedium_error_t scsi_nonmedium_error;
+// ATA SMART data, allocated for ATA devices only
+struct ata_smart_data
+{
+  ata_smart_values smartval{};            // SMART data
+  ata_smart_thresholds_pvt smartthres{};  // SMART thresholds
+};
 
-  // NVMe only
-  uint64_t nvme_err_log_entries{};
+// NVMe SMART/Health data, allocated for NVMe devices only
+struct nvme_smart_data
+{
+  nvme_smart_log smartval{};              // SMART/Health Information log
 };
 
+// Return 1 if capability is supported, 0 if not, -1 if not checked yet.
+static int get_cap(const persistent_dev_state & state, unsigned cap)
+{
+  if (!(state.caps.checked & cap))
+    return -1;
+  return !!(state.caps.supported & cap);
+}
+
+// Record result of capability check.
+static void set_cap(persistent_dev_state & state, unsigned cap, bool supported)
+{
+  state.caps.checked |= cap;
+  if (supported)
+    state.caps.supported |= cap;
+  else
+    state.caps.supported &= ~cap;
+}
+
 /// Non-persistent state data for a device.
 struct temp_dev_state
 {
   bool must_write{};                      // true if persistent part should be written
 
-  bool skip{};                            // skip during next check cycle
-  time_t wakeuptime{};                    // next wakeup time, 0 if unknown or global
-
   bool not_cap_offline{};                 // true == not capable of offline testing
   bool not_cap_conveyance{};
   bool not_cap_short{};
@@ -530,10 +586,26 @@ struct temp_dev_state
   bool powermodefail{};                   // true if power mode check failed
   int powerskipcnt{};                     // Number of checks skipped due to idle or standby mode
   int lastpowermodeskipped{};             // the last power mode that was skipped
+  int powermodeskipped{};                 // power mode of current skipped checks, also if quiet
 
   bool attrlog_dirty{};                   // true if persistent part has new attr values that
                                           // need to be written to attrlog
 
+  // Published in status file ('-S FILE')
+  time_t check_time{};                    // last check, also if skipped due to power mode
+  time_t data_time{};                     // last check which read data from device
+  unsigned char health{};                 // dev_status_entry::health_*
+  std::string id_data;                    // raw ATA IDENTIFY or NVMe Identify Controller data
+
+  // Tests limited by '-t N' or '-g GROUP,N'
+  char test_running{};                    // 'S' if self-test in progress, 'O' if offline test
+                                          // started by smartd in progress, 0 if none
+  time_t test_deferred{};                 // Time of first deferral of due test, 0 if none
+
+  // Progress of self-test started by smartd
+  std::unique_ptr<selftest_progress> test_progress; // nullptr if none
+  char test_progress_type{};              // Test type 'S', 'L', 'C' or selective
+
   // SCSI ONLY
   // TODO: change to bool
   unsigned char SmartPageSupported{};     // has log sense IE page (0x2f)
@@ -547,10 +619,13 @@ struct temp_dev_state
                                           // know yet) 6 or 10
   // ATA ONLY
   uint64_t num_sectors{};                 // Number of sectors
-  ata_smart_values smartval{};            // SMART data
-  ata_smart_thresholds_pvt smartthres{};  // SMART thresholds
+  std::unique_ptr<ata_smart_data> ata_smart; // SMART data, see dev_state::ata()
   bool offline_started{};                 // true if offline data collection was started
   bool selftest_started{};                // true if self-test was started
+  bool devstat_gplog{};                   // read Device Statistics from GP Log
+
+  // NVMe ONLY
+  std::unique_ptr<nvme_smart_data> nvme_smart; // SMART/Health log, see dev_state::nvme()
 };
 
 /// Runtime state data for a device.
@@ -560,6 +635,13 @@ struct dev_state
 {
   void update_persistent_state();
   void update_temp_state();
+
+  // Protocol specific data, allocated on first non-const access.
+  // Const access returns zero filled data if not allocated.
+  ata_smart_data & ata();
+  const ata_smart_data & ata() const;
+  nvme_smart_data & nvme();
+  const nvme_smart_data & nvme() const;
 };
 
 /// Container for configuration info for each device.
@@ -568,9 +650,50 @@ typedef std::vector<dev_config> dev_config_vector;
 /// Container for state info for each device.
 typedef std::vector<dev_state> dev_state_vector;
 
+/// Scheduling data for a device. Kept apart from the large dev_state
+/// objects, so the scans in dosleep() and CheckDevicesOnce() only
+/// touch a small contiguous array.
+struct dev_schedule
+{
+  time_t wakeuptime{};                    // next wakeup time, 0 if unknown or global
+  int checktime{};                        // '-c interval' directive, 0 if unset
+  bool skip{};                            // skip during next check cycle
+  time_t polltime{};                      // next poll of self-test progress, 0 if none
+};
+
+/// Container for scheduling data for each device.
+typedef std::vector<dev_schedule> dev_schedule_vector;
+
+ata_smart_data & dev_state::ata()
+{
+  if (!ata_smart)
+    ata_smart.reset(new ata_smart_data);
+  return *ata_smart;
+}
+
+const ata_smart_data & dev_state::ata() const
+{
+  static const ata_smart_data empty;
+  return (ata_smart ? *ata_smart : empty);
+}
+
+nvme_smart_data & dev_state::nvme()
+{
+  if (!nvme_smart)
+    nvme_smart.reset(new nvme_smart_data);
+  return *nvme_smart;
+}
+
+const nvme_smart_data & dev_state::nvme() const
+{
+  static const nvme_smart_data empty;
+  return (nvme_smart ? *nvme_smart : empty);
+}
+
 // Copy ATA attributes to persistent state.
 void dev_state::update_persistent_state()
 {
+  const ata_smart_values & smartval = ata().smartval;
   for (int i = 0; i < NUMBER_ATA_SMART_ATTRIBUTES; i++) {
     const ata_smart_attribute & ta = smartval.vendor_attributes[i];
     ata_attribute & pa = ata_attributes[i];
@@ -594,6 +717,15 @@ void dev_state::update_persistent_state()
 // Copy ATA from persistent to temp state.
 void dev_state::update_temp_state()
 {
+  if (!ata_smart) {
+    // Allocate only if there are ATA attributes
+    int i = 0;
+    while (i < NUMBER_ATA_SMART_ATTRIBUTES && !ata_attributes[i].id)
+      i++;
+    if (i >= NUMBER_ATA_SMART_ATTRIBUTES)
+      return;
+  }
+  ata_smart_values & smartval = ata().smartval;
   for (int i = 0; i < NUMBER_ATA_SMART_ATTRIBUTES; i++) {
     const ata_attribute & pa = ata_attributes[i];
     ata_smart_attribute & ta = smartval.vendor_attributes[i];
@@ -615,206 +747,18 @@ void dev_state::update_temp_state()
   }
 }
 
-// Parse a line from a state file.
-static bool parse_dev_state_line(const char * line, persistent_dev_state & state)
-{
-  static const regular_expression regex(
-    "^ *"
-     "((temperature-min)" // (1 (2)
-     "|(temperature-max)" // (3)
-     "|(self-test-errors)" // (4)
-     "|(self-test-last-err-hour)" // (5)
-     "|(scheduled-test-next-check)" // (6)
-     "|(selective-test-last-start)" // (7)
-     "|(selective-test-last-end)" // (8)
-     "|(ata-error-count)"  // (9)
-     "|(mail\\.([0-9]+)\\." // (10 (11)
-       "((count)" // (12 (13)
-       "|(first-sent-time)" // (14)
-       "|(last-sent-time)" // (15)
-       ")" // 12)
-      ")" // 10)
-     "|(ata-smart-attribute\\.([0-9]+)\\." // (16 (17)
-       "((id)" // (18 (19)
-       "|(val)" // (20)
-       "|(worst)" // (21)
-       "|(raw)" // (22)
-       "|(resvd)" // (23)
-       ")" // 18)
-      ")" // 16)
-     "|(nvme-err-log-entries)" // (24)
-     ")" // 1)
-     " *= *([0-9]+)[ \n]*$" // (25)
-  );
-
-  const int nmatch = 1+25;
-  regular_expression::match_range match[nmatch];
-  if (!regex.execute(line, nmatch, match))
-    return false;
-  if (match[nmatch-1].rm_so < 0)
-    return false;
-
-  uint64_t val = strtoull(line + match[nmatch-1].rm_so, (char **)0, 10);
-
-  int m = 1;
-  if (match[++m].rm_so >= 0)
-    state.tempmin = (unsigned char)val;
-  else if (match[++m].rm_so >= 0)
-    state.tempmax = (unsigned char)val;
-  else if (match[++m].rm_so >= 0)
-    state.selflogcount = (unsigned char)val;
-  else if (match[++m].rm_so >= 0)
-    state.selfloghour = (unsigned short)val;
-  else if (match[++m].rm_so >= 0)
-    state.scheduled_test_next_check = (time_t)val;
-  else if (match[++m].rm_so >= 0)
-    state.selective_test_last_start = val;
-  else if (match[++m].rm_so >= 0)
-    state.selective_test_last_end = val;
-  else if (match[++m].rm_so >= 0)
-    state.ataerrorcount = (int)val;
-  else if (match[m+=2].rm_so >= 0) {
-    int i = atoi(line+match[m].rm_so);
-    if (!(0 <= i && i < SMARTD_NMAIL))
-      return false;
-    if (i == MAILTYPE_TEST) // Don't suppress test mails
-      return true;
-    if (match[m+=2].rm_so >= 0)
-      state.maillog[i].logged = (int)val;
-    else if (match[++m].rm_so >= 0)
-      state.maillog[i].firstsent = (time_t)val;
-    else if (match[++m].rm_so >= 0)
-      state.maillog[i].lastsent = (time_t)val;
-    else
-      return false;
-  }
-  else if (match[m+=5+1].rm_so >= 0) {
-    int i = atoi(line+match[m].rm_so);
-    if (!(0 <= i && i < NUMBER_ATA_SMART_ATTRIBUTES))
-      return false;
-    if (match[m+=2].rm_so >= 0)
-      state.ata_attributes[i].id = (unsigned char)val;
-    else if (match[++m].rm_so >= 0)
-      state.ata_attributes[i].val = (unsigned char)val;
-    else if (match[++m].rm_so >= 0)
-      state.ata_attributes[i].worst = (unsigned char)val;
-    else if (match[++m].rm_so >= 0)
-      state.ata_attributes[i].raw = val;
-    else if (match[++m].rm_so >= 0)
-      state.ata_attributes[i].resvd = (unsigned char)val;
-    else
-      return false;
-  }
-  else if (match[m+7].rm_so >= 0)
-    state.nvme_err_log_entries = val;
-  else
-    return false;
-  return true;
-}
-
-// Read a state file.
-static bool read_dev_state(const char * path, persistent_dev_state & state)
-{
-  stdio_file f(path, "r");
-  if (!f) {
-    if (errno != ENOENT)
-      pout("Cannot read state file \"%s\"\n", path);
-    return false;
-  }
-#ifdef __CYGWIN__
-  setmode(fileno(f), O_TEXT); // Allow files with \r\n
-#endif
-
-  persistent_dev_state new_state;
-  int good = 0, bad = 0;
-  char line[256];
-  while (fgets(line, sizeof(line), f)) {
-    const char * s = line + strspn(line, " \t");
-    if (!*s || *s == '#')
-      continue;
-    if (!parse_dev_state_line(line, new_state))
-      bad++;
-    else
-      good++;
-  }
-
-  if (bad) {
-    if (!good) {
-      pout("%s: format error\n", path);
-      return false;
-    }
-    pout("%s: %d invalid line(s) ignored\n", path, bad);
-  }
-
-  // This sets the values missing in the file to 0.
-  state = new_state;
-  return true;
-}
-
-static void write_dev_state_line(FILE * f, const char * name, uint64_t val)
-{
-  if (val)
-    fprintf(f, "%s = %" PRIu64 "\n", name, val);
-}
-
-static void write_dev_state_line(FILE * f, const char * name1, int id, const char * name2, uint64_t val)
-{
-  if (val)
-    fprintf(f, "%s.%d.%s = %" PRIu64 "\n", name1, id, name2, val);
-}
-
-// Write a state file
-static bool write_dev_state(const char * path, const persistent_dev_state & state)
+// Convert 128 bit LE integer to uint64_t or its max value on overflow.
+static uint64_t le128_to_uint64(const unsigned char (& val)[16])
 {
-  // Rename old "file" to "file~"
-  std::string pathbak = path; pathbak += '~';
-  unlink(pathbak.c_str());
-  rename(path, pathbak.c_str());
-
-  stdio_file f(path, "w");
-  if (!f) {
-    pout("Cannot create state file \"%s\"\n", path);
-    return false;
-  }
-
-  fprintf(f, "# smartd state file\n");
-  write_dev_state_line(f, "temperature-min", state.tempmin);
-  write_dev_state_line(f, "temperature-max", state.tempmax);
-  write_dev_state_line(f, "self-test-errors", state.selflogcount);
-  write_dev_state_line(f, "self-test-last-err-hour", state.selfloghour);
-  write_dev_state_line(f, "scheduled-test-next-check", state.scheduled_test_next_check);
-  write_dev_state_line(f, "selective-test-last-start", state.selective_test_last_start);
-  write_dev_state_line(f, "selective-test-last-end", state.selective_test_last_end);
-
-  for (int i = 0; i < SMARTD_NMAIL; i++) {
-    if (i == MAILTYPE_TEST) // Don't suppress test mails
-      continue;
-    const mailinfo & mi = state.maillog[i];
-    if (!mi.logged)
-      continue;
-    write_dev_state_line(f, "mail", i, "count", mi.logged);
-    write_dev_state_line(f, "mail", i, "first-sent-time", mi.firstsent);
-    write_dev_state_line(f, "mail", i, "last-sent-time", mi.lastsent);
+  for (int i = 8; i < 16; i++) {
+    if (val[i])
+      return ~(uint64_t)0;
   }
-
-  // ATA ONLY
-  write_dev_state_line(f, "ata-error-count", state.ataerrorcount);
-
-  for (int i = 0; i < NUMBER_ATA_SMART_ATTRIBUTES; i++) {
-    const auto & pa = state.ata_attributes[i];
-    if (!pa.id)
-      continue;
-    write_dev_state_line(f, "ata-smart-attribute", i, "id", pa.id);
-    write_dev_state_line(f, "ata-smart-attribute", i, "val", pa.val);
-    write_dev_state_line(f, "ata-smart-attribute", i, "worst", pa.worst);
-    write_dev_state_line(f, "ata-smart-attribute", i, "raw", pa.raw);
-    write_dev_state_line(f, "ata-smart-attribute", i, "resvd", pa.resvd);
+  uint64_t lo = val[7];
+  for (int i = 7-1; i >= 0; i--) {
+    lo <<= 8; lo += val[i];
   }
-
-  // NVMe only
-  write_dev_state_line(f, "nvme-err-log-entries", state.nvme_err_log_entries);
-
-  return true;
+  return lo;
 }
 
 // Write to the attrlog file
@@ -838,6 +782,9 @@ static bool write_dev_attrlog(const char * path, const dev_state & state)
       continue;
     fprintf(f, "\t%d;%d;%" PRIu64 ";", pa.id, pa.val, pa.raw);
   }
+  for (const auto & dv : state.devstat_values)
+    fprintf(f, "\tdevstat-0x%02x-0x%03x;%" PRId64 ";", dv.first >> 16, dv.first & 0xffff,
+            dv.second.val);
   // SCSI ONLY
   const struct scsiErrorCounter * ecp;
   const char * pageNames[3] = {"read", "write", "verify"};
@@ -862,7 +809,23 @@ static bool write_dev_attrlog(const char * path, const dev_state & state)
   if(state.scsi_nonmedium_error.found && state.scsi_nonmedium_error.nme.gotPC0) {
     fprintf(f, "\tnon-medium-errors;%" PRIu64 ";", state.scsi_nonmedium_error.nme.counterPC0);
   }
-  // write SCSI current temperature if it is monitored
+  // NVMe ONLY
+  if (nonempty(&state.nvme().smartval, sizeof(state.nvme().smartval))) {
+    const nvme_smart_log & sl = state.nvme().smartval;
+    fprintf(f, "\tcritical-warning;%d;\tavailable-spare;%d;\tpercentage-used;%d;",
+            sl.critical_warning, sl.avail_spare, sl.percent_used);
+    fprintf(f, "\tdata-units-read;%" PRIu64 ";\tdata-units-written;%" PRIu64 ";"
+               "\thost-reads;%" PRIu64 ";\thost-writes;%" PRIu64 ";",
+            le128_to_uint64(sl.data_units_read), le128_to_uint64(sl.data_units_written),
+            le128_to_uint64(sl.host_reads), le128_to_uint64(sl.host_writes));
+    fprintf(f, "\tcontroller-busy-time;%" PRIu64 ";\tpower-cycles;%" PRIu64 ";"
+               "\tpower-on-hours;%" PRIu64 ";\tunsafe-shutdowns;%" PRIu64 ";",
+            le128_to_uint64(sl.ctrl_busy_time), le128_to_uint64(sl.power_cycles),
+            le128_to_uint64(sl.power_on_hours), le128_to_uint64(sl.unsafe_shutdowns));
+    fprintf(f, "\tmedia-errors;%" PRIu64 ";\tnum-err-log-entries;%" PRIu64 ";",
+            le128_to_uint64(sl.media_errors), le128_to_uint64(sl.num_err_log_entries));
+  }
+  // write SCSI or NVMe current temperature if it is monitored
   if (state.temperature)
     fprintf(f, "\ttemperature;%d;", state.temperature);
   // end of line
@@ -908,6 +871,76 @@ static void write_all_dev_attrlogs(const dev_config_vector & configs,
   }
 }
 
+// Write status file for 'smartctl --smartd-status'
+static void write_status_file(const dev_config_vector & configs,
+                              const dev_state_vector & states,
+                              const smart_device_list & devices)
+{
+  std::vector<dev_status_entry> entries(configs.size());
+  for (unsigned i = 0; i < configs.size(); i++) {
+    const dev_config & cfg = configs.at(i);
+    const dev_state & state = states.at(i);
+    const smart_device * dev = devices.at(i);
+    dev_status_entry & e = entries[i];
+
+    e.unique_name = smi()->get_unique_dev_name(cfg.dev_name.c_str(), cfg.dev_type.c_str());
+    e.dev_name = cfg.dev_name;
+    e.dev_type = dev->get_dev_type();
+    e.info_name = cfg.name;
+    e.idinfo = cfg.dev_idinfo;
+    e.protocol = (dev->is_ata() ? 'A' : dev->is_scsi() ? 'S' : 'N');
+    if (dev->is_nvme())
+      e.nsid = dev->to_nvme()->get_nsid();
+
+    e.check_time = state.check_time;
+    e.data_time = state.data_time;
+    if (state.powerskipcnt) {
+      e.num_skipped = state.powerskipcnt;
+      e.power_mode_skipped = state.powermodeskipped;
+    }
+    e.health = state.health;
+    if (state.temperature) {
+      e.temperature = state.temperature;
+      e.tempmin = state.tempmin;
+      e.tempmax = state.tempmax;
+    }
+    if (cfg.selftest)
+      e.selftest_errors = state.selflogcount;
+
+    if (dev->is_ata()) {
+      if (cfg.errorlog || cfg.xerrorlog)
+        e.ata_errors = state.ataerrorcount;
+      e.ata_identify = state.id_data;
+      if (nonempty(&state.ata().smartval, sizeof(state.ata().smartval))) {
+        e.ata_smart_values.assign((const char *)&state.ata().smartval, sizeof(state.ata().smartval));
+        e.ata_smart_thres.assign((const char *)&state.ata().smartthres, sizeof(state.ata().smartthres));
+      }
+    }
+    else if (dev->is_nvme()) {
+      if (cfg.errorlog || cfg.xerrorlog)
+        e.nvme_err_log_entries = (int64_t)state.nvme_err_log_entries;
+      e.nvme_id_ctrl = state.id_data;
+      if (state.data_time)
+        e.nvme_smart_log.assign((const char *)&state.nvme().smartval, sizeof(state.nvme().smartval));
+    }
+  }
+
+  // Report errors only once
+  static bool write_failed = false;
+  std::string errmsg;
+  if (!write_dev_status_file(status_file.c_str(), time(nullptr), entries, errmsg)) {
+    if (!write_failed)
+      PrintOut(LOG_CRIT, "Write status file failed: %s\n", errmsg.c_str());
+    write_failed = true;
+  }
+  else {
+    if (write_failed || debugmode)
+      PrintOut(LOG_INFO, "Status of %d device%s written to %s\n", (int)entries.size(),
+               (entries.size() == 1 ? "" : "s"), status_file.c_str());
+    write_failed = false;
+  }
+}
+
 extern "C" { // signal handlers require C-linkage
 
 //  Note if we catch a SIGUSR1
@@ -1053,7 +1086,9 @@ static void MailWarning(const dev_config & cfg, dev_state & state, int which, co
     "FailedOpenDevice",           // 9
     "CurrentPendingSector",       // 10
     "OfflineUncorrectableSector", // 11
-    "Temperature"                 // 12
+    "Temperature",                // 12
+    "Trend",                      // 13
+    "DeviceStatistics"            // 14
   };
   STATIC_ASSERT(sizeof(whichfail) == SMARTD_NMAIL * sizeof(whichfail[0]));
   
@@ -1062,6 +1097,7 @@ static void MailWarning(const dev_config & cfg, dev_state & state, int which, co
     return;
   }
   mailinfo * mail = state.maillog + which;
+  log_context_scope lcs(log_ctx.attr_id, whichfail[which]);
 
   // Calc current and next interval for warning reminder emails
   int days, nextdays;
@@ -1301,6 +1337,51 @@ static void reset_warning_mail(const dev_config & cfg, dev_state & state, int wh
   state.must_write = true;
 }
 
+#ifdef HAVE_LIBSYSTEMD
+
+// Send message as one journal record with structured fields.
+__attribute_format_printf(2, 0)
+static void vjournal_message(int priority, const char * fmt, va_list ap)
+{
+  char buf[512+EBUFLEN];
+  int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+  if (len >= (int)sizeof(buf))
+    len = sizeof(buf) - 1;
+  while (len > 0 && buf[len-1] == '\n')
+    buf[--len] = 0;
+  if (!len)
+    return;
+
+  std::string fields[10]; int n = 0;
+  fields[n++] = std::string("MESSAGE=") + buf;
+  fields[n++] = strprintf("PRIORITY=%d", priority);
+  fields[n++] = strprintf("SYSLOG_FACILITY=%d", facility >> 3);
+  fields[n++] = "SYSLOG_IDENTIFIER=smartd";
+  if (log_ctx.cfg) {
+    const dev_config & cfg = *log_ctx.cfg;
+    fields[n++] = "SMARTD_DEVICE=" + cfg.name;
+    if (!cfg.dev_type.empty())
+      fields[n++] = "SMARTD_DEVICE_TYPE=" + cfg.dev_type;
+    if (!cfg.dev_model.empty())
+      fields[n++] = "SMARTD_MODEL=" + cfg.dev_model;
+    if (!cfg.dev_serial.empty())
+      fields[n++] = "SMARTD_SERIAL=" + cfg.dev_serial;
+  }
+  if (log_ctx.attr_id)
+    fields[n++] = strprintf("SMARTD_ATTRIBUTE_ID=%d", log_ctx.attr_id);
+  if (log_ctx.event)
+    fields[n++] = std::string("SMARTD_EVENT=") + log_ctx.event;
+
+  struct iovec iov[sizeof(fields)/sizeof(fields[0])];
+  for (int i = 0; i < n; i++) {
+    iov[i].iov_base = const_cast<char *>(fields[i].data());
+    iov[i].iov_len = fields[i].size();
+  }
+  sd_journal_sendv(iov, n);
+}
+
+#endif // HAVE_LIBSYSTEMD
+
 #ifndef _WIN32
 
 // Output multiple lines via separate syslog(3) calls.
@@ -1318,11 +1399,61 @@ static void vsyslog_lines(int priority, const char * fmt, va_list ap)
   }
 }
 
+// Facility of open syslog connection, -1 if closed
+static int syslog_facility = -1;
+#ifdef HAVE_STD_THREAD
+static std::mutex syslog_mutex; // Protects syslog_facility
+#endif
+
+// Close syslog connection, e.g. before closing all file descriptors.
+static void close_syslog()
+{
+#ifdef HAVE_STD_THREAD
+  std::lock_guard<std::mutex> guard(syslog_mutex);
+#endif
+  if (syslog_facility < 0)
+    return;
+  closelog();
+  syslog_facility = -1;
+}
+
 #else  // _WIN32
 // os_win32/syslog_win32.cpp supports multiple lines.
 #define vsyslog_lines vsyslog
 #endif // _WIN32
 
+// Write message to journal or syslog.  The syslog connection is kept
+// open instead of reconnecting for each message.
+__attribute_format_printf(2, 0)
+static void vlog_message(int priority, const char * fmt, va_list ap)
+{
+#ifdef HAVE_LIBSYSTEMD
+  if (log_to_journal) {
+    vjournal_message(priority, fmt, ap);
+    return;
+  }
+#endif
+#ifndef _WIN32
+  {
+#ifdef HAVE_STD_THREAD
+    std::lock_guard<std::mutex> guard(syslog_mutex);
+#endif
+    if (syslog_facility != facility) {
+      if (syslog_facility >= 0)
+        closelog();
+      openlog("smartd", LOG_PID, facility);
+      syslog_facility = facility;
+    }
+  }
+  vsyslog_lines(priority, fmt, ap);
+#else
+  // Facility LOG_LOCAL1 writes to a file which should not be kept open
+  openlog("smartd", LOG_PID, facility);
+  vsyslog_lines(priority, fmt, ap);
+  closelog();
+#endif
+}
+
 // Printing function for watching ataprint commands, or losing them
 // [From GLIBC Manual: Since the prototype doesn't specify types for
 // optional arguments, in a call to a variadic function the default
@@ -1348,11 +1479,8 @@ void pout(const char *fmt, ...){
     fflush(f);
   }
   // in debugmode==2 mode we print output from knowndrives.o functions
-  else if (debugmode==2 || ata_debugmode || scsi_debugmode) {
-    openlog("smartd", LOG_PID, facility);
-    vsyslog_lines(LOG_INFO, fmt, ap);
-    closelog();
-  }
+  else if (debugmode==2 || ata_debugmode || scsi_debugmode)
+    vlog_message(LOG_INFO, fmt, ap);
   va_end(ap);
   return;
 }
@@ -1374,11 +1502,8 @@ static void PrintOut(int priority, const char *fmt, ...){
     vfprintf(f, fmt, ap);
     fflush(f);
   }
-  else {
-    openlog("smartd", LOG_PID, facility);
-    vsyslog_lines(priority, fmt, ap);
-    closelog();
-  }
+  else
+    vlog_message(priority, fmt, ap);
   va_end(ap);
   return;
 }
@@ -1457,6 +1582,7 @@ static int daemon_init()
   }
 
   // close any open file descriptors
+  close_syslog();
   for (int i = sysconf(_SC_OPEN_MAX); --i >= 0; )
     close(i);
   
@@ -1532,7 +1658,7 @@ static void Directives()
            "  -H      Monitor SMART Health Status, report if failed\n"
            "  -s REG  Do Self-Test at time(s) given by regular expression REG\n"
            "  -l TYPE Monitor SMART log or self-test status:\n"
-           "          error, selftest, xerror, offlinests[,ns], selfteststs[,ns]\n"
+           "          error, selftest, xerror, offlinests[,ns], selfteststs[,ns], scttemp\n"
            "  -l scterc,R,W  Set SCT Error Recovery Control\n"
            "  -e      Change device setting: aam,[N|off], apm,[N|off], dsn,[on|off],\n"
            "          lookahead,[on|off], security-freeze, standby,[N|off], wcache,[on|off]\n"
@@ -1549,12 +1675,18 @@ static void Directives()
            "  -C ID[+] Monitor [increases of] Current Pending Sectors in Attribute ID\n"
            "  -U ID[+] Monitor [increases of] Offline Uncorrectable Sectors in Attribute ID\n"
            "  -W D,I,C Monitor Temperature D)ifference, I)nformal limit, C)ritical limit\n"
+           "  -A D[,R[,W]] Warn if Attribute threshold is predicted within D days, or if\n"
+           "          sector or error counts grow by more than R per day (W day trend)\n"
+           "  -D P,O[,L[,D]] Monitor Device Statistics value at P)age, O)ffset,\n"
+           "          warn if L)imit is reached, report D)ifferences\n"
            "  -v N,ST Modifies labeling of Attribute N (see man page)  \n"
            "  -P TYPE Drive-specific presets: use, ignore, show, showall\n"
            "  -a      Default: -H -f -t -l error -l selftest -l selfteststs -C 197 -U 198\n"
            "  -F TYPE Use firmware bug workaround:\n"
            "          %s\n"
            "  -c i=N  Set interval between disk checks to N seconds\n"
+           "  -g G,N  Run at most N scheduled tests of group G concurrently\n"
+           "  -x M[,D] Plan selective self-tests of M minutes, cover disk within D days\n"
            "   #      Comment: text after a hash sign is ignored\n"
            "   \\      Line continuation character\n"
            "Attribute ID is a decimal integer 1 <= ID <= 255\n"
@@ -1578,16 +1710,23 @@ static const char *GetValidArgList(char opt)
   case 'c':
     return "<FILE_NAME>, -";
   case 'l':
+#ifdef HAVE_LIBSYSTEMD
+    return "daemon, local0, local1, local2, local3, local4, local5, local6, local7, journal";
+#else
     return "daemon, local0, local1, local2, local3, local4, local5, local6, local7";
+#endif
   case 'q':
     return "nodev[0], errors[,nodev0], nodev[0]startup, never, onecheck, showtests";
   case 'r':
     return "ioctl[,N], ataioctl[,N], scsiioctl[,N], nvmeioctl[,N]";
   case 'p':
+  case 'S':
   case 'w':
     return "<FILE_NAME>";
   case 'i':
     return "<INTEGER_SECONDS>";
+  case 't':
+    return "<INTEGER>";
 #ifdef HAVE_POSIX_API
   case 'u':
     return "<USER>[:<GROUP>], -";
@@ -1644,7 +1783,12 @@ static void Usage()
   PrintOut(LOG_INFO,"        Set interval between disk checks to N seconds, where N >= 10\n\n");
   PrintOut(LOG_INFO,"  -l local[0-7], --logfacility=local[0-7]\n");
 #ifndef _WIN32
-  PrintOut(LOG_INFO,"        Use syslog facility local0 - local7 or daemon [default]\n\n");
+  PrintOut(LOG_INFO,"        Use syslog facility local0 - local7 or daemon [default]\n");
+#ifdef HAVE_LIBSYSTEMD
+  PrintOut(LOG_INFO,"  -l journal, --logfacility=journal\n");
+  PrintOut(LOG_INFO,"        Log to systemd journal with structured fields\n");
+#endif
+  PrintOut(LOG_INFO,"\n");
 #else
   PrintOut(LOG_INFO,"        Log to \"./smartd.log\", stdout, stderr [default is event log]\n\n");
 #endif
@@ -1672,6 +1816,10 @@ static void Usage()
   PrintOut(LOG_INFO,"        [default is " SMARTMONTOOLS_SAVESTATES "MODEL-SERIAL.TYPE.state]\n");
 #endif
   PrintOut(LOG_INFO,"\n");
+  PrintOut(LOG_INFO,"  -S NAME, --statusfile=NAME\n");
+  PrintOut(LOG_INFO,"        Publish device status to NAME for 'smartctl --smartd-status'\n\n");
+  PrintOut(LOG_INFO,"  -t N, --test-limit=N\n");
+  PrintOut(LOG_INFO,"        Run at most N scheduled tests concurrently [default is no limit]\n\n");
   PrintOut(LOG_INFO,"  -w NAME, --warnexec=NAME\n");
   PrintOut(LOG_INFO,"        Run executable NAME on warnings\n");
 #ifndef _WIN32
@@ -1731,10 +1879,62 @@ static bool not_allowed_in_filename(char c)
            || ('a' <= c && c <= 'z'));
 }
 
+// Flags and value of a Device Statistics entry
+struct devstat_reading
+{
+  unsigned char flags{};                  // 0 if not supported
+  int64_t val{};                          // Value if (flags & 0x40)
+};
+
+// Read the Device Statistics pages used by '-D' directives.  Each page
+// is read only once.  Return entries in same order as cfg.devstat_mons.
+static bool read_devstat_values(ata_device * device, const dev_config & cfg, bool gplog,
+                                std::vector<devstat_reading> & values)
+{
+  int max_page = 0;
+  for (const auto & dm : cfg.devstat_mons)
+    max_page = std::max(max_page, (int)dm.page);
+
+  raw_buffer pages_buf((max_page+1) * 512);
+  if (!gplog) {
+    // SMART Log supports only reads starting at page 0
+    if (!ataReadSmartLog(device, 0x04, pages_buf.data(), max_page+1))
+      return false;
+  }
+  else {
+    std::set<int> pages;
+    for (const auto & dm : cfg.devstat_mons)
+      pages.insert(dm.page);
+    for (int page : pages) {
+      if (!ataReadLogExt(device, 0x04, 0, page, pages_buf.data() + page * 512, 1))
+        return false;
+    }
+  }
+
+  values.assign(cfg.devstat_mons.size(), devstat_reading());
+  for (unsigned i = 0; i < cfg.devstat_mons.size(); i++) {
+    const devstat_monitor & dm = cfg.devstat_mons[i];
+    values[i].flags = ata_get_devstat_value(pages_buf.data() + dm.page * 512,
+                                            dm.page, dm.offset, values[i].val);
+  }
+  return true;
+}
+
+// Format Device Statistics value name
+static std::string format_devstat_name(const devstat_monitor & dm)
+{
+  const char * valname = ata_get_devstat_entry_name(dm.page, dm.offset);
+  return strprintf("Device Statistics 0x%02x/0x%03x (%s)", dm.page, dm.offset,
+                   (valname ? valname : "Unknown"));
+}
+
 // Read error count from Summary or Extended Comprehensive SMART error log
 // Return -1 on error
+// LBA of last uncorrectable error is returned in *err_lba if found in the
+// first sector of the extended log.
 static int read_ata_error_count(ata_device * device, const char * name,
-                                firmwarebug_defs firmwarebugs, bool extended)
+                                firmwarebug_defs firmwarebugs, bool extended,
+                                uint64_t * err_lba = nullptr)
 {
   if (!extended) {
     ata_smart_errorlog log;
@@ -1751,14 +1951,23 @@ static int read_ata_error_count(ata_device * device, const char * name,
       return -1;
     }
     // Some disks use the reserved byte as index, see ataprint.cpp.
-    return (logx.error_log_index || logx.reserved1 ? logx.device_error_count : 0);
+    unsigned erridx = (logx.error_log_index ? logx.error_log_index : logx.reserved1);
+    if (err_lba && 1 <= erridx && erridx <= 4) {
+      const ata_smart_exterrlog_error & err = logx.error_logs[erridx - 1].error;
+      if (err.error_register & 0x40) // UNC
+        *err_lba = (  (uint64_t)err.lba_high_register_hi << 40 | (uint64_t)err.lba_mid_register_hi << 32
+                    | (uint64_t)err.lba_low_register_hi  << 24 | (uint64_t)err.lba_high_register    << 16
+                    | (uint64_t)err.lba_mid_register     <<  8 | (uint64_t)err.lba_low_register         );
+    }
+    return (erridx ? logx.device_error_count : 0);
   }
 }
 
 // returns <0 if problem.  Otherwise, bottom 8 bits are the self test
 // error count, and top bits are the power-on hours of the last error.
+// LBA of first failure of last error is returned in *err_lba if reported.
 static int SelfTestErrorCount(ata_device * device, const char * name,
-                              firmwarebug_defs firmwarebugs)
+                              firmwarebug_defs firmwarebugs, uint64_t * err_lba = nullptr)
 {
   struct ata_smart_selftestlog log;
 
@@ -1788,8 +1997,11 @@ static int SelfTestErrorCount(ata_device * device, const char * name,
       // Self-test showed an error
       errcnt++;
       // Keep track of time of most recent error
-      if (!hours)
+      if (!hours) {
         hours = entry.timestamp;
+        if (err_lba && entry.lbafirstfailure != 0xffffffff)
+          *err_lba = entry.lbafirstfailure;
+      }
     }
   }
 
@@ -1867,7 +2079,7 @@ static bool check_pending_id(const dev_config & cfg, const dev_state & state,
                              unsigned char id, const char * msg)
 {
   // Check attribute index
-  int i = ata_find_attr_index(id, state.smartval);
+  int i = ata_find_attr_index(id, state.ata().smartval);
   if (i < 0) {
     PrintOut(LOG_INFO, "Device: %s, can't monitor %s count - no Attribute %d\n",
              cfg.name.c_str(), msg, id);
@@ -1875,7 +2087,7 @@ static bool check_pending_id(const dev_config & cfg, const dev_state & state,
   }
 
   // Check value
-  uint64_t rawval = ata_get_attr_raw_value(state.smartval.vendor_attributes[i],
+  uint64_t rawval = ata_get_attr_raw_value(state.ata().smartval.vendor_attributes[i],
     cfg.attribute_defs);
   if (rawval >= (state.num_sectors ? state.num_sectors : 0xffffffffULL)) {
     PrintOut(LOG_INFO, "Device: %s, ignoring %s count - bogus Attribute %d value %" PRIu64 " (0x%" PRIx64 ")\n",
@@ -1943,6 +2155,75 @@ static bool is_duplicate_dev_idinfo(const dev_config & cfg, const dev_config_vec
 // TODO: Add '-F swapid' directive
 const bool fix_swapped_id = false;
 
+// Return hash of the device identity and of the directives which
+// affect capability checks.  Never returns 0.
+static uint32_t get_cap_profile_id(const dev_config & cfg)
+{
+  std::string s = strprintf("%s|%d|%d", cfg.dev_idinfo.c_str(), (int)cfg.permissive,
+                            (int)cfg.firmwarebugs.is_set(BUG_NOLOGDIR));
+  // FNV-1a
+  uint32_t h = 2166136261U;
+  for (unsigned char c : s) {
+    h ^= c; h *= 16777619U;
+  }
+  return (h ? h : 1);
+}
+
+// Read previous state before capability checks.  Reuse its capability
+// profile if the device identity and relevant directives are unchanged.
+// The previous state is applied later by restore_dev_state().
+static bool read_dev_state_early(const dev_config & cfg, dev_state & state,
+                                 persistent_dev_state & prev_state)
+{
+  state.caps = persistent_dev_state::cap_profile();
+  state.caps.id = get_cap_profile_id(cfg);
+  if (cfg.state_file.empty() || !read_dev_state(cfg.state_file.c_str(), prev_state))
+    return false;
+  if (prev_state.caps.id == state.caps.id) {
+    state.caps = prev_state.caps;
+    if (debugmode)
+      PrintOut(LOG_INFO, "Device: %s, reusing capability profile from %s\n",
+               cfg.name.c_str(), cfg.state_file.c_str());
+  }
+  return true;
+}
+
+// Replace persistent state by previous state, keep current capability profile.
+static void restore_dev_state(dev_state & state, const persistent_dev_state & prev_state)
+{
+  persistent_dev_state::cap_profile caps = state.caps;
+  static_cast<persistent_dev_state &>(state) = prev_state;
+  if (!(   caps.id == prev_state.caps.id && caps.checked == prev_state.caps.checked
+        && caps.supported == prev_state.caps.supported
+        && caps.modese_len == prev_state.caps.modese_len))
+    state.must_write = true;
+  state.caps = caps;
+}
+
+// Set multi-sector log read limits from persistent state
+// unless device has already learned lower limits.
+static void restore_max_log_sectors(const persistent_dev_state & state, ata_device * atadev)
+{
+  for (bool gpl : {true, false}) {
+    unsigned max_ns = (gpl ? state.gplog_max_sectors : state.smartlog_max_sectors);
+    unsigned dev_max_ns = atadev->get_max_log_sectors(gpl);
+    if (max_ns && !(dev_max_ns && dev_max_ns < max_ns))
+      atadev->set_max_log_sectors(gpl, max_ns);
+  }
+}
+
+// Copy multi-sector log read limits learned by device to persistent state.
+static void save_max_log_sectors(dev_state & state, const ata_device * atadev)
+{
+  unsigned short gp_ns = (unsigned short)atadev->get_max_log_sectors(true);
+  unsigned short smart_ns = (unsigned short)atadev->get_max_log_sectors(false);
+  if (gp_ns == state.gplog_max_sectors && smart_ns == state.smartlog_max_sectors)
+    return;
+  state.gplog_max_sectors = gp_ns;
+  state.smartlog_max_sectors = smart_ns;
+  state.must_write = true;
+}
+
 // scan to see what ata devices there are, and if they support SMART
 static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atadev,
                          const dev_config_vector * prev_cfgs)
@@ -1965,6 +2246,7 @@ static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atade
     CloseDevice(atadev, name);
     return 2; 
   }
+  state.id_data.assign((const char *)&drive, sizeof(drive));
 
   // Get drive identity, size and rotation rate (HDD/SSD)
   char model[40+1], serial[20+1], firmware[8+1];
@@ -1987,6 +2269,7 @@ static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atade
   char cap[32];
   cfg.dev_idinfo = strprintf("%s, S/N:%s, %sFW:%s, %s", model, serial, wwn, firmware,
                      format_capacity(cap, sizeof(cap), sizes.capacity, "."));
+  cfg.dev_model = model; cfg.dev_serial = serial;
   cfg.id_is_unique = true; // TODO: Check serial?
   if (sanitize_dev_idinfo(cfg.dev_idinfo))
     cfg.id_is_unique = false;
@@ -2020,6 +2303,26 @@ static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atade
     }
   }
 
+  if (!state_path_prefix.empty() || !attrlog_path_prefix.empty()) {
+    // Build file name for state file
+    std::replace_if(model, model+strlen(model), not_allowed_in_filename, '_');
+    std::replace_if(serial, serial+strlen(serial), not_allowed_in_filename, '_');
+    if (!state_path_prefix.empty())
+      cfg.state_file = strprintf("%s%s-%s.ata.state", state_path_prefix.c_str(), model, serial);
+    if (!attrlog_path_prefix.empty()) {
+      cfg.attrlog_file = strprintf("%s%s-%s.ata.csv", attrlog_path_prefix.c_str(), model, serial);
+      if (cfg.scttemp_hist)
+        cfg.scttemp_file = strprintf("%s%s-%s.ata.scttemp.csv", attrlog_path_prefix.c_str(), model, serial);
+    }
+  }
+
+  // Read previous state to reuse capability profile
+  persistent_dev_state prev_state;
+  bool prev_state_ok = read_dev_state_early(cfg, state, prev_state);
+  if (prev_state_ok)
+    // Reuse multi-sector log read limits learned before
+    restore_max_log_sectors(prev_state, atadev);
+
   // Check for ATA Security LOCK
   unsigned short word128 = drive.words088_255[128-88];
   bool locked = ((word128 & 0x0007) == 0x0007); // LOCKED|ENABLED|SUPPORTED
@@ -2098,9 +2401,14 @@ static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atade
   }
 
   // capability check: SMART status
-  if (cfg.smartcheck && ataSmartStatus2(atadev) == -1) {
-    PrintOut(LOG_INFO,"Device: %s, not capable of SMART Health Status check\n",name);
-    cfg.smartcheck = false;
+  if (cfg.smartcheck) {
+    int cap_ok = get_cap(state, CAP_ATA_SMART_STATUS);
+    if (cap_ok < 0)
+      set_cap(state, CAP_ATA_SMART_STATUS, (cap_ok = (ataSmartStatus2(atadev) != -1)));
+    if (!cap_ok) {
+      PrintOut(LOG_INFO,"Device: %s, not capable of SMART Health Status check\n",name);
+      cfg.smartcheck = false;
+    }
   }
   
   // capability check: Read smart values and thresholds.  Note that
@@ -2116,22 +2424,23 @@ static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atade
       || cfg.offlinests      || cfg.selfteststs
       || cfg.usagefailed     || cfg.prefail  || cfg.usage
       || cfg.tempdiff        || cfg.tempinfo || cfg.tempcrit
-      || cfg.curr_pending_id || cfg.offl_pending_id         ) {
+      || cfg.curr_pending_id || cfg.offl_pending_id || cfg.trend) {
 
-    if (ataReadSmartValues(atadev, &state.smartval)) {
+    if (ataReadSmartValues(atadev, &state.ata().smartval)) {
       PrintOut(LOG_INFO, "Device: %s, Read SMART Values failed\n", name);
       cfg.usagefailed = cfg.prefail = cfg.usage = false;
       cfg.tempdiff = cfg.tempinfo = cfg.tempcrit = 0;
       cfg.curr_pending_id = cfg.offl_pending_id = 0;
+      cfg.trend = false;
     }
     else {
       smart_val_ok = true;
-      if (ataReadSmartThresholds(atadev, &state.smartthres)) {
+      if (ataReadSmartThresholds(atadev, &state.ata().smartthres)) {
         PrintOut(LOG_INFO, "Device: %s, Read SMART Thresholds failed%s\n",
                  name, (cfg.usagefailed ? ", ignoring -f Directive" : ""));
         cfg.usagefailed = false;
         // Let ata_get_attr_state() return ATTRSTATE_NO_THRESHOLD:
-        memset(&state.smartthres, 0, sizeof(state.smartthres));
+        memset(&state.ata().smartthres, 0, sizeof(state.ata().smartthres));
       }
     }
 
@@ -2148,7 +2457,7 @@ static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atade
       cfg.offl_pending_id = 0;
 
     if (   (cfg.tempdiff || cfg.tempinfo || cfg.tempcrit)
-        && !ata_return_temperature_value(&state.smartval, cfg.attribute_defs)) {
+        && !ata_return_temperature_value(&state.ata().smartval, cfg.attribute_defs)) {
       PrintOut(LOG_INFO, "Device: %s, can't monitor Temperature, ignoring -W %d,%d,%d\n",
                name, cfg.tempdiff, cfg.tempinfo, cfg.tempcrit);
       cfg.tempdiff = cfg.tempinfo = cfg.tempcrit = 0;
@@ -2161,11 +2470,11 @@ static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atade
         const char * excl = (cfg.monitor_attr_flags.is_set(id,
           (opt == 'r' ? MONITOR_AS_CRIT : MONITOR_RAW_AS_CRIT)) ? "!" : "");
 
-        int idx = ata_find_attr_index(id, state.smartval);
+        int idx = ata_find_attr_index(id, state.ata().smartval);
         if (idx < 0)
           PrintOut(LOG_INFO,"Device: %s, no Attribute %d, ignoring -%c %d%s\n", name, id, opt, id, excl);
         else {
-          bool prefail = !!ATTRIBUTE_FLAGS_PREFAILURE(state.smartval.vendor_attributes[idx].flags);
+          bool prefail = !!ATTRIBUTE_FLAGS_PREFAILURE(state.ata().smartval.vendor_attributes[idx].flags);
           if (!((prefail && cfg.prefail) || (!prefail && cfg.usage)))
             PrintOut(LOG_INFO,"Device: %s, not monitoring %s Attributes, ignoring -%c %d%s\n", name,
                      (prefail ? "Prefailure" : "Usage"), opt, id, excl);
@@ -2182,7 +2491,7 @@ static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atade
       PrintOut(LOG_INFO,"Device: %s, could not %s SMART Automatic Offline Testing.\n",name, what);
     else {
       // if command appears unsupported, issue a warning...
-      if (!isSupportAutomaticTimer(&state.smartval))
+      if (!isSupportAutomaticTimer(&state.ata().smartval))
         PrintOut(LOG_INFO,"Device: %s, SMART Automatic Offline Testing unsupported...\n",name);
       // ... but then try anyway
       if ((cfg.autoofflinetest==1)?ataDisableAutoOffline(atadev):ataEnableAutoOffline(atadev))
@@ -2196,14 +2505,20 @@ static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atade
   ata_smart_log_directory smart_logdir, gp_logdir;
   bool smart_logdir_ok = false, gp_logdir_ok = false;
 
+  // Skip checks with results from capability profile.  Error counts are
+  // then taken from the previous state below.
+  int cap_selftest  = (cfg.selftest  ? get_cap(state, CAP_ATA_SELFTEST_LOG) : -1);
+  int cap_errorlog  = (cfg.errorlog  ? get_cap(state, CAP_ATA_ERROR_LOG)    : -1);
+  int cap_xerrorlog = (cfg.xerrorlog ? get_cap(state, CAP_ATA_XERROR_LOG)   : -1);
+
   if (   isGeneralPurposeLoggingCapable(&drive)
-      && (cfg.errorlog || cfg.selftest)
+      && ((cfg.errorlog && cap_errorlog < 0) || (cfg.selftest && cap_selftest < 0))
       && !cfg.firmwarebugs.is_set(BUG_NOLOGDIR)) {
       if (!ataReadLogDirectory(atadev, &smart_logdir, false))
         smart_logdir_ok = true;
   }
 
-  if (cfg.xerrorlog && !cfg.firmwarebugs.is_set(BUG_NOLOGDIR)) {
+  if (cfg.xerrorlog && cap_xerrorlog < 0 && !cfg.firmwarebugs.is_set(BUG_NOLOGDIR)) {
     if (!ataReadLogDirectory(atadev, &gp_logdir, true))
       gp_logdir_ok = true;
   }
@@ -2212,19 +2527,28 @@ static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atade
   state.selflogcount = 0; state.selfloghour = 0;
   if (cfg.selftest) {
     int retval;
-    if (!(   cfg.permissive
-          || ( smart_logdir_ok && smart_logdir.entry[0x06-1].numsectors)
-          || (!smart_logdir_ok && smart_val_ok && isSmartTestLogCapable(&state.smartval, &drive)))) {
+    if (cap_selftest > 0)
+      ; // Supported
+    else if (!cap_selftest) {
+      PrintOut(LOG_INFO, "Device: %s, no SMART Self-test Log (capability profile), ignoring -l selftest\n", name);
+      cfg.selftest = false;
+    }
+    else if (!(   cfg.permissive
+          || ( smart_logdir_ok && smart_logdir.entry[0x06-1].numsectors)
+          || (!smart_logdir_ok && smart_val_ok && isSmartTestLogCapable(&state.ata().smartval, &drive)))) {
       PrintOut(LOG_INFO, "Device: %s, no SMART Self-test Log, ignoring -l selftest (override with -T permissive)\n", name);
       cfg.selftest = false;
+      set_cap(state, CAP_ATA_SELFTEST_LOG, false);
     }
     else if ((retval = SelfTestErrorCount(atadev, name, cfg.firmwarebugs)) < 0) {
       PrintOut(LOG_INFO, "Device: %s, no SMART Self-test Log, ignoring -l selftest\n", name);
       cfg.selftest = false;
+      set_cap(state, CAP_ATA_SELFTEST_LOG, false);
     }
     else {
       state.selflogcount=SELFTEST_ERRORCOUNT(retval);
       state.selfloghour =SELFTEST_ERRORHOURS(retval);
+      set_cap(state, CAP_ATA_SELFTEST_LOG, true);
     }
   }
   
@@ -2232,46 +2556,115 @@ static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atade
   state.ataerrorcount = 0;
   if (cfg.errorlog) {
     int errcnt1;
-    if (!(   cfg.permissive
+    if (cap_errorlog > 0)
+      ; // Supported
+    else if (!cap_errorlog) {
+      PrintOut(LOG_INFO, "Device: %s, no SMART Error Log (capability profile), ignoring -l error\n", name);
+      cfg.errorlog = false;
+    }
+    else if (!(   cfg.permissive
           || ( smart_logdir_ok && smart_logdir.entry[0x01-1].numsectors)
-          || (!smart_logdir_ok && smart_val_ok && isSmartErrorLogCapable(&state.smartval, &drive)))) {
+          || (!smart_logdir_ok && smart_val_ok && isSmartErrorLogCapable(&state.ata().smartval, &drive)))) {
       PrintOut(LOG_INFO, "Device: %s, no SMART Error Log, ignoring -l error (override with -T permissive)\n", name);
       cfg.errorlog = false;
+      set_cap(state, CAP_ATA_ERROR_LOG, false);
     }
     else if ((errcnt1 = read_ata_error_count(atadev, name, cfg.firmwarebugs, false)) < 0) {
       PrintOut(LOG_INFO, "Device: %s, no SMART Error Log, ignoring -l error\n", name);
       cfg.errorlog = false;
+      set_cap(state, CAP_ATA_ERROR_LOG, false);
     }
-    else
+    else {
       state.ataerrorcount = errcnt1;
+      set_cap(state, CAP_ATA_ERROR_LOG, true);
+    }
   }
 
   if (cfg.xerrorlog) {
     int errcnt2;
-    if (!(   cfg.permissive || cfg.firmwarebugs.is_set(BUG_NOLOGDIR)
+    if (cap_xerrorlog > 0)
+      ; // Supported
+    else if (!cap_xerrorlog) {
+      PrintOut(LOG_INFO, "Device: %s, no Extended Comprehensive SMART Error Log (capability profile), ignoring -l xerror\n",
+               name);
+      cfg.xerrorlog = false;
+    }
+    else if (!(   cfg.permissive || cfg.firmwarebugs.is_set(BUG_NOLOGDIR)
           || (gp_logdir_ok && gp_logdir.entry[0x03-1].numsectors)   )) {
       PrintOut(LOG_INFO, "Device: %s, no Extended Comprehensive SMART Error Log, ignoring -l xerror (override with -T permissive)\n",
                name);
       cfg.xerrorlog = false;
+      set_cap(state, CAP_ATA_XERROR_LOG, false);
     }
     else if ((errcnt2 = read_ata_error_count(atadev, name, cfg.firmwarebugs, true)) < 0) {
       PrintOut(LOG_INFO, "Device: %s, no Extended Comprehensive SMART Error Log, ignoring -l xerror\n", name);
       cfg.xerrorlog = false;
+      set_cap(state, CAP_ATA_XERROR_LOG, false);
     }
-    else if (cfg.errorlog && state.ataerrorcount != errcnt2) {
-      PrintOut(LOG_INFO, "Device: %s, SMART Error Logs report different error counts: %d != %d\n",
-               name, state.ataerrorcount, errcnt2);
-      // Record max error count
-      if (errcnt2 > state.ataerrorcount)
+    else {
+      set_cap(state, CAP_ATA_XERROR_LOG, true);
+      if (cfg.errorlog && cap_errorlog < 0 && state.ataerrorcount != errcnt2) {
+        PrintOut(LOG_INFO, "Device: %s, SMART Error Logs report different error counts: %d != %d\n",
+                 name, state.ataerrorcount, errcnt2);
+        // Record max error count
+        if (errcnt2 > state.ataerrorcount)
+          state.ataerrorcount = errcnt2;
+      }
+      else
         state.ataerrorcount = errcnt2;
     }
-    else
-      state.ataerrorcount = errcnt2;
+  }
+
+  // capability check: Device Statistics
+  if (!cfg.devstat_mons.empty()) {
+    unsigned nsectors = 0;
+    if (cfg.firmwarebugs.is_set(BUG_NOLOGDIR)) {
+      // Assume all pages are present
+      nsectors = 0x100;
+      state.devstat_gplog = isGeneralPurposeLoggingCapable(&drive);
+    }
+    else {
+      if (!gp_logdir_ok && !ataReadLogDirectory(atadev, &gp_logdir, true))
+        gp_logdir_ok = true;
+      if (gp_logdir_ok && gp_logdir.entry[0x04-1].numsectors) {
+        nsectors = gp_logdir.entry[0x04-1].numsectors;
+        state.devstat_gplog = true;
+      }
+      else {
+        if (!smart_logdir_ok && !ataReadLogDirectory(atadev, &smart_logdir, false))
+          smart_logdir_ok = true;
+        if (smart_logdir_ok)
+          nsectors = smart_logdir.entry[0x04-1].numsectors;
+      }
+    }
+
+    if (!nsectors) {
+      PrintOut(LOG_INFO, "Device: %s, no Device Statistics Log, ignoring -D Directive(s)\n", name);
+      cfg.devstat_mons.clear();
+    }
+
+    // Remove values not supported by device
+    std::vector<devstat_reading> values;
+    for (int pass = 0; pass < 2 && !cfg.devstat_mons.empty(); pass++) {
+      if (pass && !read_devstat_values(atadev, cfg, state.devstat_gplog, values)) {
+        PrintOut(LOG_INFO, "Device: %s, Read Device Statistics failed, ignoring -D Directive(s)\n", name);
+        cfg.devstat_mons.clear();
+        break;
+      }
+      for (unsigned i = cfg.devstat_mons.size(); i-- > 0; ) {
+        const devstat_monitor & dm = cfg.devstat_mons[i];
+        if (!pass ? dm.page < nsectors : !!values[i].flags)
+          continue;
+        PrintOut(LOG_INFO, "Device: %s, %s not supported, ignoring -D %d,%d\n", name,
+                 format_devstat_name(dm).c_str(), dm.page, dm.offset);
+        cfg.devstat_mons.erase(cfg.devstat_mons.begin() + i);
+      }
+    }
   }
 
   // capability check: self-test and offline data collection status
   if (cfg.offlinests || cfg.selfteststs) {
-    if (!(cfg.permissive || (smart_val_ok && state.smartval.offline_data_collection_capability))) {
+    if (!(cfg.permissive || (smart_val_ok && state.ata().smartval.offline_data_collection_capability))) {
       if (cfg.offlinests)
         PrintOut(LOG_INFO, "Device: %s, no SMART Offline Data Collection capability, ignoring -l offlinests (override with -T permissive)\n", name);
       if (cfg.selfteststs)
@@ -2282,20 +2675,28 @@ static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atade
 
   // capabilities check -- does it support powermode?
   if (cfg.powermode) {
-    int powermode = ataCheckPowerMode(atadev);
-    
-    if (-1 == powermode) {
-      PrintOut(LOG_CRIT, "Device: %s, no ATA CHECK POWER STATUS support, ignoring -n Directive\n", name);
-      cfg.powermode=0;
-    } 
-    else if (powermode!=0x00 && powermode!=0x01
-        && powermode!=0x40 && powermode!=0x41
-        && powermode!=0x80 && powermode!=0x81 && powermode!=0x82 && powermode!=0x83
-        && powermode!=0xff) {
-      PrintOut(LOG_CRIT, "Device: %s, CHECK POWER STATUS returned %d, not ATA compliant, ignoring -n Directive\n",
-               name, powermode);
+    int cap_ok = get_cap(state, CAP_ATA_POWER_MODE);
+    if (!cap_ok) {
+      PrintOut(LOG_CRIT, "Device: %s, no ATA CHECK POWER STATUS support (capability profile), ignoring -n Directive\n", name);
       cfg.powermode=0;
     }
+    else if (cap_ok < 0) {
+      int powermode = ataCheckPowerMode(atadev);
+
+      if (-1 == powermode) {
+        PrintOut(LOG_CRIT, "Device: %s, no ATA CHECK POWER STATUS support, ignoring -n Directive\n", name);
+        cfg.powermode=0;
+      }
+      else if (powermode!=0x00 && powermode!=0x01
+          && powermode!=0x40 && powermode!=0x41
+          && powermode!=0x80 && powermode!=0x81 && powermode!=0x82 && powermode!=0x83
+          && powermode!=0xff) {
+        PrintOut(LOG_CRIT, "Device: %s, CHECK POWER STATUS returned %d, not ATA compliant, ignoring -n Directive\n",
+                 name, powermode);
+        cfg.powermode=0;
+      }
+      set_cap(state, CAP_ATA_POWER_MODE, !!cfg.powermode);
+    }
   }
 
   // Apply ATA settings
@@ -2352,12 +2753,34 @@ static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atade
                name, cfg.sct_erc_readtime, cfg.sct_erc_writetime);
   }
 
+  // capability check: SCT Temperature History
+  if (cfg.scttemp_hist) {
+    if (cfg.scttemp_file.empty()) {
+      PrintOut(LOG_INFO, "Device: %s, no attribute log file (-A option), ignoring -l scttemp\n",
+               name);
+      cfg.scttemp_hist = false;
+    }
+    else if (!isSCTDataTableCapable(&drive)) {
+      PrintOut(LOG_INFO, "Device: %s, no SCT Data Table support, ignoring -l scttemp\n", name);
+      cfg.scttemp_hist = false;
+    }
+    else if (locked) {
+      PrintOut(LOG_INFO, "Device: %s, no SCT support if ATA Security is LOCKED, ignoring -l scttemp\n",
+               name);
+      cfg.scttemp_hist = false;
+    }
+    if (!cfg.scttemp_hist)
+      cfg.scttemp_file.clear();
+  }
+
   // If no tests available or selected, return
   if (!(   cfg.smartcheck  || cfg.selftest
         || cfg.errorlog    || cfg.xerrorlog
         || cfg.offlinests  || cfg.selfteststs
         || cfg.usagefailed || cfg.prefail  || cfg.usage
-        || cfg.tempdiff    || cfg.tempinfo || cfg.tempcrit)) {
+        || cfg.tempdiff    || cfg.tempinfo || cfg.tempcrit
+        || cfg.trend       || !cfg.devstat_mons.empty()
+        || cfg.scttemp_hist)) {
     CloseDevice(atadev, name);
     return 3;
   }
@@ -2368,21 +2791,12 @@ static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atade
   // close file descriptor
   CloseDevice(atadev, name);
 
-  if (!state_path_prefix.empty() || !attrlog_path_prefix.empty()) {
-    // Build file name for state file
-    std::replace_if(model, model+strlen(model), not_allowed_in_filename, '_');
-    std::replace_if(serial, serial+strlen(serial), not_allowed_in_filename, '_');
-    if (!state_path_prefix.empty()) {
-      cfg.state_file = strprintf("%s%s-%s.ata.state", state_path_prefix.c_str(), model, serial);
-      // Read previous state
-      if (read_dev_state(cfg.state_file.c_str(), state)) {
-        PrintOut(LOG_INFO, "Device: %s, state read from %s\n", name, cfg.state_file.c_str());
-        // Copy ATA attribute values to temp state
-        state.update_temp_state();
-      }
-    }
-    if (!attrlog_path_prefix.empty())
-      cfg.attrlog_file = strprintf("%s%s-%s.ata.csv", attrlog_path_prefix.c_str(), model, serial);
+  // Apply previous state
+  if (prev_state_ok) {
+    restore_dev_state(state, prev_state);
+    PrintOut(LOG_INFO, "Device: %s, state read from %s\n", name, cfg.state_file.c_str());
+    // Copy ATA attribute values to temp state
+    state.update_temp_state();
   }
 
   finish_device_scan(cfg, state);
@@ -2486,6 +2900,8 @@ static int SCSIDeviceScan(dev_config & cfg, dev_state & state, scsi_device * scs
   // format "model" string
   scsi_format_id_string(vendor, &inqBuf[8], 8);
   scsi_format_id_string(model, &inqBuf[16], 16);
+  cfg.dev_model = strprintf("%s %s", vendor, model);
+  cfg.dev_serial = serial;
   PrintOut(LOG_INFO, "Device: %s, %s\n", device, cfg.dev_idinfo.c_str());
 
   // Check for duplicates
@@ -2494,6 +2910,20 @@ static int SCSIDeviceScan(dev_config & cfg, dev_state & state, scsi_device * scs
     return 1;
   }
 
+  if (!state_path_prefix.empty() || !attrlog_path_prefix.empty()) {
+    // Build file name for state file
+    std::replace_if(model, model+strlen(model), not_allowed_in_filename, '_');
+    std::replace_if(serial, serial+strlen(serial), not_allowed_in_filename, '_');
+    if (!state_path_prefix.empty())
+      cfg.state_file = strprintf("%s%s-%s-%s.scsi.state", state_path_prefix.c_str(), vendor, model, serial);
+    if (!attrlog_path_prefix.empty())
+      cfg.attrlog_file = strprintf("%s%s-%s-%s.scsi.csv", attrlog_path_prefix.c_str(), vendor, model, serial);
+  }
+
+  // Read previous state to reuse capability profile
+  persistent_dev_state prev_state;
+  bool prev_state_ok = read_dev_state_early(cfg, state, prev_state);
+
   // check that device is ready for commands. IE stores its stuff on
   // the media.
   if ((err = scsiTestUnitReady(scsidev))) {
@@ -2515,8 +2945,10 @@ static int SCSIDeviceScan(dev_config & cfg, dev_state & state, scsi_device * scs
   // that various USB devices that malform the response will lock up
   // if asked for a log page (e.g. temperature) so it is best to
   // bail out now.
+  if (state.caps.modese_len)
+    state.modese_len = state.caps.modese_len;
   if (!(err = scsiFetchIECmpage(scsidev, &iec, state.modese_len)))
-    state.modese_len = iec.modese_len;
+    state.modese_len = state.caps.modese_len = iec.modese_len;
   else if (SIMPLE_ERR_BAD_FIELD == err)
     ;  /* continue since it is reasonable not to support IE mpage */
   else { /* any other error (including malformed response) unreasonable */
@@ -2539,7 +2971,16 @@ static int SCSIDeviceScan(dev_config & cfg, dev_state & state, scsi_device * scs
   
   // Flag that certain log pages are supported (information may be
   // available from other sources).
-  if (0 == scsiLogSense(scsidev, SUPPORTED_LPAGES, 0, tBuf, sizeof(tBuf), 0) ||
+  if (get_cap(state, CAP_SCSI_LOG_PAGES) > 0) {
+    // Use list from capability profile
+    state.TempPageSupported = (get_cap(state, CAP_SCSI_TEMP_PAGE) > 0);
+    state.SmartPageSupported = (get_cap(state, CAP_SCSI_IE_PAGE) > 0);
+    state.ReadECounterPageSupported = (get_cap(state, CAP_SCSI_READ_EC_PAGE) > 0);
+    state.WriteECounterPageSupported = (get_cap(state, CAP_SCSI_WRITE_EC_PAGE) > 0);
+    state.VerifyECounterPageSupported = (get_cap(state, CAP_SCSI_VERIFY_EC_PAGE) > 0);
+    state.NonMediumErrorPageSupported = (get_cap(state, CAP_SCSI_NME_PAGE) > 0);
+  }
+  else if (0 == scsiLogSense(scsidev, SUPPORTED_LPAGES, 0, tBuf, sizeof(tBuf), 0) ||
       0 == scsiLogSense(scsidev, SUPPORTED_LPAGES, 0, tBuf, sizeof(tBuf), 68))
       /* workaround for the bug #678 on ST8000NM0075/E001. Up to 64 pages + 4b header */
   {
@@ -2567,20 +3008,34 @@ static int SCSIDeviceScan(dev_config & cfg, dev_state & state, scsi_device * scs
         break;
       }
     }   
+    set_cap(state, CAP_SCSI_LOG_PAGES, true);
+    set_cap(state, CAP_SCSI_TEMP_PAGE, !!state.TempPageSupported);
+    set_cap(state, CAP_SCSI_IE_PAGE, !!state.SmartPageSupported);
+    set_cap(state, CAP_SCSI_READ_EC_PAGE, !!state.ReadECounterPageSupported);
+    set_cap(state, CAP_SCSI_WRITE_EC_PAGE, !!state.WriteECounterPageSupported);
+    set_cap(state, CAP_SCSI_VERIFY_EC_PAGE, !!state.VerifyECounterPageSupported);
+    set_cap(state, CAP_SCSI_NME_PAGE, !!state.NonMediumErrorPageSupported);
   }
   
   // Check if scsiCheckIE() is going to work
+  // (Only success is recorded in capability profile)
   {
     uint8_t asc = 0;
     uint8_t ascq = 0;
     uint8_t currenttemp = 0;
     uint8_t triptemp = 0;
     
-    if (scsiCheckIE(scsidev, state.SmartPageSupported, state.TempPageSupported,
+    if (get_cap(state, CAP_SCSI_CHECK_IE) > 0)
+      currenttemp = (get_cap(state, CAP_SCSI_TEMPERATURE) > 0);
+    else if (scsiCheckIE(scsidev, state.SmartPageSupported, state.TempPageSupported,
                     &asc, &ascq, &currenttemp, &triptemp)) {
       PrintOut(LOG_INFO, "Device: %s, unexpectedly failed to read SMART values\n", device);
       state.SuppressReport = 1;
     }
+    else {
+      set_cap(state, CAP_SCSI_CHECK_IE, true);
+      set_cap(state, CAP_SCSI_TEMPERATURE, !!currenttemp);
+    }
     if (   (state.SuppressReport || !currenttemp)
         && (cfg.tempdiff || cfg.tempinfo || cfg.tempcrit)) {
       PrintOut(LOG_INFO, "Device: %s, can't monitor Temperature, ignoring -W %d,%d,%d\n",
@@ -2591,19 +3046,23 @@ static int SCSIDeviceScan(dev_config & cfg, dev_state & state, scsi_device * scs
   
   // capability check: self-test-log
   if (cfg.selftest){
-    int retval = scsiCountFailedSelfTests(scsidev, 0);
-    if (retval<0) {
+    int cap_ok = get_cap(state, CAP_SCSI_SELFTEST_LOG);
+    int retval = (cap_ok < 0 ? scsiCountFailedSelfTests(scsidev, 0) : 0);
+    if (!cap_ok || retval<0) {
       // no self-test log, turn off monitoring
-      PrintOut(LOG_INFO, "Device: %s, does not support SMART Self-Test Log.\n", device);
+      PrintOut(LOG_INFO, "Device: %s, does not support SMART Self-Test Log%s.\n", device,
+               (!cap_ok ? " (capability profile)" : ""));
       cfg.selftest = false;
       state.selflogcount = 0;
       state.selfloghour = 0;
     }
-    else {
+    else if (cap_ok < 0) {
       // register starting values to watch for changes
       state.selflogcount=SELFTEST_ERRORCOUNT(retval);
       state.selfloghour =SELFTEST_ERRORHOURS(retval);
     }
+    if (cap_ok < 0)
+      set_cap(state, CAP_SCSI_SELFTEST_LOG, (retval >= 0));
   }
   
   // disable autosave (set GLTSD bit)
@@ -2631,21 +3090,12 @@ static int SCSIDeviceScan(dev_config & cfg, dev_state & state, scsi_device * scs
   // close file descriptor
   CloseDevice(scsidev, device);
 
-  if (!state_path_prefix.empty() || !attrlog_path_prefix.empty()) {
-    // Build file name for state file
-    std::replace_if(model, model+strlen(model), not_allowed_in_filename, '_');
-    std::replace_if(serial, serial+strlen(serial), not_allowed_in_filename, '_');
-    if (!state_path_prefix.empty()) {
-      cfg.state_file = strprintf("%s%s-%s-%s.scsi.state", state_path_prefix.c_str(), vendor, model, serial);
-      // Read previous state
-      if (read_dev_state(cfg.state_file.c_str(), state)) {
-        PrintOut(LOG_INFO, "Device: %s, state read from %s\n", device, cfg.state_file.c_str());
-        // Copy ATA attribute values to temp state
-        state.update_temp_state();
-      }
-    }
-    if (!attrlog_path_prefix.empty())
-      cfg.attrlog_file = strprintf("%s%s-%s-%s.scsi.csv", attrlog_path_prefix.c_str(), vendor, model, serial);
+  // Apply previous state
+  if (prev_state_ok) {
+    restore_dev_state(state, prev_state);
+    PrintOut(LOG_INFO, "Device: %s, state read from %s\n", device, cfg.state_file.c_str());
+    // Copy ATA attribute values to temp state
+    state.update_temp_state();
   }
 
   finish_device_scan(cfg, state);
@@ -2653,20 +3103,6 @@ static int SCSIDeviceScan(dev_config & cfg, dev_state & state, scsi_device * scs
   return 0;
 }
 
-// Convert 128 bit LE integer to uint64_t or its max value on overflow.
-static uint64_t le128_to_uint64(const unsigned char (& val)[16])
-{
-  for (int i = 8; i < 16; i++) {
-    if (val[i])
-      return ~(uint64_t)0;
-  }
-  uint64_t lo = val[7];
-  for (int i = 7-1; i >= 0; i--) {
-    lo <<= 8; lo += val[i];
-  }
-  return lo;
-}
-
 // Get max temperature in Kelvin reported in NVMe SMART/Health log.
 static int nvme_get_max_temp_kelvin(const nvme_smart_log & smart_log)
 {
@@ -2692,6 +3128,7 @@ static int NVMeDeviceScan(dev_config & cfg, dev_state & state, nvme_device * nvm
     CloseDevice(nvmedev, name);
     return 2;
   }
+  state.id_data.assign((const char *)&id_ctrl, sizeof(id_ctrl));
 
   // Get drive identity
   char model[40+1], serial[20+1], firmware[8+1];
@@ -2709,6 +3146,7 @@ static int NVMeDeviceScan(dev_config & cfg, dev_state & state, nvme_device * nvm
     format_capacity(capstr, sizeof(capstr), capacity, ".");
   cfg.dev_idinfo = strprintf("%s, S/N:%s, FW:%s%s%s%s", model, serial, firmware,
                              nsstr, (capstr[0] ? ", " : ""), capstr);
+  cfg.dev_model = model; cfg.dev_serial = serial;
   cfg.id_is_unique = true; // TODO: Check serial?
   if (sanitize_dev_idinfo(cfg.dev_idinfo))
     cfg.id_is_unique = false;
@@ -2745,7 +3183,8 @@ static int NVMeDeviceScan(dev_config & cfg, dev_state & state, nvme_device * nvm
 
   // If no supported tests selected, return
   if (!(   cfg.smartcheck || cfg.errorlog || cfg.xerrorlog
-        || cfg.tempdiff   || cfg.tempinfo || cfg.tempcrit )) {
+        || cfg.tempdiff   || cfg.tempinfo || cfg.tempcrit
+        || cfg.trend                                       )) {
     CloseDevice(nvmedev, name);
     return 3;
   }
@@ -2758,17 +3197,21 @@ static int NVMeDeviceScan(dev_config & cfg, dev_state & state, nvme_device * nvm
 
   CloseDevice(nvmedev, name);
 
-  if (!state_path_prefix.empty()) {
-    // Build file name for state file
+  if (!state_path_prefix.empty() || !attrlog_path_prefix.empty()) {
+    // Build file names for state and attrlog file
     std::replace_if(model, model+strlen(model), not_allowed_in_filename, '_');
     std::replace_if(serial, serial+strlen(serial), not_allowed_in_filename, '_');
     nsstr[0] = 0;
     if (nsid != 0xffffffff)
       snprintf(nsstr, sizeof(nsstr), "-n%u", nsid);
-    cfg.state_file = strprintf("%s%s-%s%s.nvme.state", state_path_prefix.c_str(), model, serial, nsstr);
-    // Read previous state
-    if (read_dev_state(cfg.state_file.c_str(), state))
-      PrintOut(LOG_INFO, "Device: %s, state read from %s\n", name, cfg.state_file.c_str());
+    if (!attrlog_path_prefix.empty())
+      cfg.attrlog_file = strprintf("%s%s-%s%s.nvme.csv", attrlog_path_prefix.c_str(), model, serial, nsstr);
+    if (!state_path_prefix.empty()) {
+      cfg.state_file = strprintf("%s%s-%s%s.nvme.state", state_path_prefix.c_str(), model, serial, nsstr);
+      // Read previous state
+      if (read_dev_state(cfg.state_file.c_str(), state))
+        PrintOut(LOG_INFO, "Device: %s, state read from %s\n", name, cfg.state_file.c_str());
+    }
   }
 
   finish_device_scan(cfg, state);
@@ -2802,6 +3245,7 @@ static bool open_device(const dev_config & cfg, dev_state & state, smart_device
           PrintOut(LOG_INFO, "Device: %s, is in %s mode, suspending checks\n", name, "STANDBY (OS)");
           state.lastpowermodeskipped = -1;
         }
+        state.powermodeskipped = -1;
         state.powerskipcnt++;
         return false;
       }
@@ -2902,42 +3346,45 @@ static void CheckSelfTestLogs(const dev_config & cfg, dev_state & state, int new
 static const char test_type_chars[] = "LncrSCO";
 static const unsigned num_test_types = sizeof(test_type_chars)-1;
 
-// returns test type if time to do test of type testtype,
-// 0 if not time to do test.
-static char next_scheduled_test(const dev_config & cfg, dev_state & state, bool scsi, time_t usetime = 0)
+// Calendar of scheduled self-tests.
+// The '-s REGEXP' is matched against all "T/MM/DD/d/HH[:NNN[-LLL]]"
+// strings of a calendar day when this day is first used.  The result is
+// kept as a bitmask of hours for each offset and test type.
+class test_schedule
 {
-  // check that self-testing has been requested
-  if (cfg.test_regex.empty())
-    return 0;
+public:
+  explicit test_schedule(const regular_expression & regex);
 
-  // Exit if drive not capable of any test
-  if ( state.not_cap_long && state.not_cap_short &&
-      (scsi || (state.not_cap_conveyance && state.not_cap_offline)))
-    return 0;
+  // Number of ':NNN[-LLL]' offsets found in regex, plus one for offset 0.
+  unsigned get_num_offsets() const
+    { return m_num_offsets; }
+  unsigned get_offset(unsigned i) const
+    { return m_offsets[i]; }
+  unsigned get_limit(unsigned i) const
+    { return m_limits[i]; }
 
-  // since we are about to call localtime(), be sure glibc is informed
-  // of any timezone changes we make.
-  if (!usetime)
-    FixGlibcTimeZoneBug();
-  
-  // Is it time for next check?
-  time_t now = (!usetime ? time(nullptr) : usetime);
-  if (now < state.scheduled_test_next_check) {
-    if (state.scheduled_test_next_check <= now + 3600)
-      return 0; // Next check within one hour
-    // More than one hour, assume system clock time adjusted to the past
-    state.scheduled_test_next_check = now;
-  }
-  else if (state.scheduled_test_next_check + (3600L*24*90) < now) {
-    // Limit time check interval to 90 days
-    state.scheduled_test_next_check = now - (3600L*24*90);
-  }
+  // Return bitmask of test types (bit j: test_type_chars[j]) scheduled
+  // at local time 'tm' with offset index 'i'.
+  unsigned get_tests(unsigned i, const struct tm & tm);
+
+private:
+  enum { max_offsets = 1 + num_test_types };
 
+  regular_expression m_regex;
+  unsigned m_num_offsets = 1; // m_offsets/m_limits[0] == 0 always
+  unsigned m_offsets[max_offsets] = {0, }, m_limits[max_offsets] = {0, };
+
+  // Hour bitmasks [offset index * num_test_types + test type] per day.
+  // Key: month, day of month and day of week.
+  typedef std::vector<uint32_t> day_hours;
+  std::map<unsigned, day_hours> m_days;
+};
+
+test_schedule::test_schedule(const regular_expression & regex)
+: m_regex(regex)
+{
   // Find ':NNN[-LLL]' in regex for possible offsets and limits
-  const unsigned max_offsets = 1 + num_test_types;
-  unsigned offsets[max_offsets] = {0, }, limits[max_offsets] = {0, };
-  unsigned num_offsets = 1; // offsets/limits[0] == 0 always
-  for (const char * p = cfg.test_regex.get_pattern(); num_offsets < max_offsets; ) {
+  for (const char * p = m_regex.get_pattern(); m_num_offsets < max_offsets; ) {
     const char * q = strchr(p, ':');
     if (!q)
       break;
@@ -2946,57 +3393,132 @@ static char next_scheduled_test(const dev_config & cfg, dev_state & state, bool
     sscanf(p, "%u%n-%n%u%n", &offset, &n1, &n2, &limit, &n3);
     if (!(n1 == 3 && (n2 < 0 || (n3 == 3+1+3 && limit > 0))))
       continue;
-    offsets[num_offsets] = offset; limits[num_offsets] = limit;
-    num_offsets++;
+    m_offsets[m_num_offsets] = offset; m_limits[m_num_offsets] = limit;
+    m_num_offsets++;
     p += (n3 > 0 ? n3 : n1);
   }
+}
 
-  // Check interval [state.scheduled_test_next_check, now] for scheduled tests
-  char testtype = 0;
-  time_t testtime = 0; int testhour = 0;
+unsigned test_schedule::get_tests(unsigned i, const struct tm & tm)
+{
+  // tm_wday is 0 (Sunday) to 6 (Saturday).  We use 1 (Monday) to 7 (Sunday).
+  int month = tm.tm_mon + 1, weekday = (tm.tm_wday ? tm.tm_wday : 7);
+  unsigned key = (month << 8) | (tm.tm_mday << 3) | weekday;
+
+  auto it = m_days.find(key);
+  if (it == m_days.end()) {
+    // First use of this day, match all hours, offsets and test types
+    day_hours hours(m_num_offsets * num_test_types, 0);
+    for (unsigned oi = 0; oi < m_num_offsets; oi++) {
+      for (unsigned j = 0; j < num_test_types; j++) {
+        for (int h = 0; h < 24; h++) {
+          // Try match of "T/MM/DD/d/HH[:NNN]"
+          char pattern[64];
+          snprintf(pattern, sizeof(pattern), "%c/%02d/%02d/%1d/%02d",
+            test_type_chars[j], month, tm.tm_mday, weekday, h);
+          if (oi > 0) {
+            const unsigned len = sizeof("S/01/01/1/01") - 1;
+            snprintf(pattern + len, sizeof(pattern) - len, ":%03u", m_offsets[oi]);
+            if (m_limits[oi] > 0)
+              snprintf(pattern + len + 4, sizeof(pattern) - len - 4, "-%03u", m_limits[oi]);
+          }
+          if (m_regex.full_match(pattern))
+            hours[oi * num_test_types + j] |= (1U << h);
+        }
+      }
+    }
+    it = m_days.insert(std::make_pair(key, hours)).first;
+  }
+
+  const day_hours & hours = it->second;
+  unsigned tests = 0;
+  for (unsigned j = 0; j < num_test_types; j++) {
+    if (hours[i * num_test_types + j] & (1U << tm.tm_hour))
+      tests |= (1U << j);
+  }
+  return tests;
+}
+
+// Scheduled test found by find_scheduled_test().
+struct scheduled_test
+{
+  char type = 0;                          // Test type, 0 if none
+  time_t time = 0;                        // Time of first match in calendar
+  int hour = 0;                           // Local hour of this match
+  time_t now = 0;                         // Time of check
+  time_t next_check = 0;                  // Time of next check
+};
+
+// Find test due at time 'now' without changing device state.
+static void find_scheduled_test(const dev_config & cfg, const dev_state & state, bool scsi,
+                                time_t now, scheduled_test & found)
+{
+  found = scheduled_test();
+  found.now = now;
+  found.next_check = state.scheduled_test_next_check;
+
+  // check that self-testing has been requested
+  if (cfg.test_regex.empty() || !cfg.test_sched)
+    return;
+  test_schedule & sched = *cfg.test_sched;
+
+  // Exit if drive not capable of any test
+  if ( state.not_cap_long && state.not_cap_short &&
+      (scsi || (state.not_cap_conveyance && state.not_cap_offline)))
+    return;
+
+  // Is it time for next check?
+  time_t next_check = state.scheduled_test_next_check;
+  if (now < next_check) {
+    if (next_check <= now + 3600)
+      return; // Next check within one hour
+    // More than one hour, assume system clock time adjusted to the past
+    next_check = now;
+  }
+  else if (next_check + (3600L*24*90) < now) {
+    // Limit time check interval to 90 days
+    next_check = now - (3600L*24*90);
+  }
+
+  // Test types the drive is capable of
+  unsigned capable = 0;
+  for (unsigned j = 0; j < num_test_types; j++) {
+    switch (test_type_chars[j]) {
+      case 'L': if (state.not_cap_long)       continue; break;
+      case 'S': if (state.not_cap_short)      continue; break;
+      case 'C': if (scsi || state.not_cap_conveyance) continue; break;
+      case 'O': if (scsi || state.not_cap_offline)    continue; break;
+      case 'c': case 'n':
+      case 'r': if (scsi || state.not_cap_selective)  continue; break;
+      default: continue;
+    }
+    capable |= (1U << j);
+  }
+
+  // Check interval [next_check, now] for scheduled tests
   int maxtest = num_test_types-1;
 
-  for (time_t t = state.scheduled_test_next_check; ; ) {
-    // Check offset 0 and then all offsets for ':NNN' found above
-    for (unsigned i = 0; i < num_offsets; i++) {
-      unsigned offset = offsets[i], limit = limits[i];
+  for (time_t t = next_check; ; ) {
+    // Check offset 0 and then all offsets for ':NNN' found in regex
+    for (unsigned i = 0; i < sched.get_num_offsets() && maxtest >= 0; i++) {
+      unsigned offset = sched.get_offset(i), limit = sched.get_limit(i);
       unsigned delay = cfg.test_offset_factor * offset;
       if (0 < limit && limit < delay)
         delay %= limit + 1;
       struct tm tmbuf, * tms = time_to_tm_local(&tmbuf, t - (delay * 3600));
 
-      // tm_wday is 0 (Sunday) to 6 (Saturday).  We use 1 (Monday) to 7 (Sunday).
-      int weekday = (tms->tm_wday ? tms->tm_wday : 7);
-      for (int j = 0; j <= maxtest; j++) {
-        // Skip if drive not capable of this test
-        switch (test_type_chars[j]) {
-          case 'L': if (state.not_cap_long)       continue; break;
-          case 'S': if (state.not_cap_short)      continue; break;
-          case 'C': if (scsi || state.not_cap_conveyance) continue; break;
-          case 'O': if (scsi || state.not_cap_offline)    continue; break;
-          case 'c': case 'n':
-          case 'r': if (scsi || state.not_cap_selective)  continue; break;
-          default: continue;
-        }
-        // Try match of "T/MM/DD/d/HH[:NNN]"
-        char pattern[64];
-        snprintf(pattern, sizeof(pattern), "%c/%02d/%02d/%1d/%02d",
-          test_type_chars[j], tms->tm_mon+1, tms->tm_mday, weekday, tms->tm_hour);
-        if (i > 0) {
-          const unsigned len = sizeof("S/01/01/1/01") - 1;
-          snprintf(pattern + len, sizeof(pattern) - len, ":%03u", offset);
-          if (limit > 0)
-            snprintf(pattern + len + 4, sizeof(pattern) - len - 4, "-%03u", limit);
-        }
-        if (cfg.test_regex.full_match(pattern)) {
-          // Test found
-          testtype = pattern[0];
-          testtime = t; testhour = tms->tm_hour;
-          // Limit further matches to higher priority self-tests
-          maxtest = j-1;
-          break;
-        }
-      }
+      // Lookup capable tests up to current max priority in calendar
+      unsigned tests = sched.get_tests(i, *tms) & capable & ((2U << maxtest) - 1);
+      if (!tests)
+        continue;
+      int j = 0;
+      while (!(tests & (1U << j)))
+        j++;
+      // Test found
+      found.type = test_type_chars[j];
+      found.time = t; found.hour = tms->tm_hour;
+      // Limit further matches to higher priority self-tests
+      maxtest = j-1;
     }
 
     // Exit if no tests left or current time reached
@@ -3011,19 +3533,41 @@ static char next_scheduled_test(const dev_config & cfg, dev_state & state, bool
 
   // Do next check not before next hour.
   struct tm tmbuf, * tmnow = time_to_tm_local(&tmbuf, now);
-  state.scheduled_test_next_check = now + (3600 - tmnow->tm_min*60 - tmnow->tm_sec);
+  found.next_check = now + (3600 - tmnow->tm_min*60 - tmnow->tm_sec);
+}
 
-  if (testtype) {
-    state.must_write = true;
-    // Tell user if an old test was found.
-    if (!usetime && !(testhour == tmnow->tm_hour && testtime + 3600 > now)) {
-      char datebuf[DATEANDEPOCHLEN]; dateandtimezoneepoch(datebuf, testtime);
-      PrintOut(LOG_INFO, "Device: %s, old test of type %c not run at %s, starting now.\n",
-        cfg.name.c_str(), testtype, datebuf);
-    }
+// Advance time of next check past a test returned by find_scheduled_test().
+// Tell user if an old test was found.
+static void commit_scheduled_test(const dev_config & cfg, dev_state & state,
+                                  const scheduled_test & found, bool report)
+{
+  state.scheduled_test_next_check = found.next_check;
+  if (!found.type)
+    return;
+  state.must_write = true;
+  if (!report)
+    return;
+  struct tm tmbuf, * tmnow = time_to_tm_local(&tmbuf, found.now);
+  if (!(found.hour == tmnow->tm_hour && found.time + 3600 > found.now)) {
+    char datebuf[DATEANDEPOCHLEN]; dateandtimezoneepoch(datebuf, found.time);
+    PrintOut(LOG_INFO, "Device: %s, old test of type %c not run at %s, starting now.\n",
+      cfg.name.c_str(), found.type, datebuf);
   }
+}
 
-  return testtype;
+// returns test type if time to do test of type testtype,
+// 0 if not time to do test.
+static char next_scheduled_test(const dev_config & cfg, dev_state & state, bool scsi, time_t usetime = 0)
+{
+  // since we are about to call localtime(), be sure glibc is informed
+  // of any timezone changes we make.
+  if (!usetime)
+    FixGlibcTimeZoneBug();
+
+  scheduled_test found;
+  find_scheduled_test(cfg, state, scsi, (!usetime ? time(nullptr) : usetime), found);
+  commit_scheduled_test(cfg, state, found, !usetime);
+  return found.type;
 }
 
 // Print a list of future tests.
@@ -3079,6 +3623,90 @@ static void PrintTestSchedule(const dev_config_vector & configs, dev_state_vecto
 
 }
 
+// Limits of concurrently running tests ('-t N' option, '-g GROUP,N' directive).
+class selftest_limiter
+{
+public:
+  selftest_limiter(const dev_config_vector & configs, const dev_state_vector & states,
+                   bool allow_selftests)
+  : m_configs(configs), m_states(states), m_allowed(allow_selftests)
+    { }
+
+  // Return true if scheduled tests may be started in this check cycle.
+  bool allowed() const
+    { return m_allowed; }
+
+  // Return true if tests of this device are limited.
+  static bool is_limited(const dev_config & cfg)
+    { return (test_limit > 0 || cfg.test_group_max > 0); }
+
+  // Return nullptr if device may start a test now. Otherwise return
+  // the group name ("" for '-t N') and the limit which is reached.
+  // Tests deferred earlier on other devices take precedence.
+  const char * limit_reached(const dev_state & state, int & limit) const;
+
+private:
+  const dev_config_vector & m_configs;
+  const dev_state_vector & m_states;
+  bool m_allowed;
+};
+
+const char * selftest_limiter::limit_reached(const dev_state & state, int & limit) const
+{
+  unsigned idx = &state - &m_states[0];
+  std::vector<selftest_slot> slots(m_states.size());
+  for (unsigned i = 0; i < slots.size(); i++) {
+    const dev_config & cfg = m_configs.at(i);
+    selftest_slot & slot = slots[i];
+    slot.group = cfg.test_group;
+    slot.group_max = cfg.test_group_max;
+    slot.running = !!m_states[i].test_running;
+    slot.deferred = m_states[i].test_deferred;
+  }
+
+  bool in_group = false;
+  limit = selftest_limit_reached(slots, idx, test_limit, in_group);
+  if (!limit)
+    return nullptr;
+  return (in_group ? m_configs.at(idx).test_group.c_str() : "");
+}
+
+// Return type of scheduled test to start now, 0 if none.
+// A due test is deferred if a limit of concurrent tests is reached.
+static char next_test_to_start(const dev_config & cfg, dev_state & state, bool scsi,
+                               const selftest_limiter & tests)
+{
+  if (!tests.is_limited(cfg))
+    return next_scheduled_test(cfg, state, scsi);
+
+  // Check for due test, keep it scheduled if deferred
+  FixGlibcTimeZoneBug();
+  scheduled_test found;
+  find_scheduled_test(cfg, state, scsi, time(nullptr), found);
+  char testtype = found.type;
+  if (!testtype) {
+    state.test_deferred = 0;
+    commit_scheduled_test(cfg, state, found, true);
+    return 0;
+  }
+
+  int limit = 0;
+  const char * group = tests.limit_reached(state, limit);
+  if (group) {
+    if (!state.test_deferred) {
+      state.test_deferred = time(nullptr);
+      PrintOut(LOG_INFO, "Device: %s, deferring scheduled test of type %c, "
+               "limit of %d concurrent tests%s%s reached\n", cfg.name.c_str(), testtype,
+               limit, (*group ? " in group " : ""), group);
+    }
+    return 0;
+  }
+
+  state.test_deferred = 0;
+  commit_scheduled_test(cfg, state, found, true);
+  return testtype;
+}
+
 // Return zero on success, nonzero on failure. Perform offline (background)
 // short or long (extended) self test on given scsi device.
 static int DoSCSISelfTest(const dev_config & cfg, dev_state & state, scsi_device * device, char testtype)
@@ -3138,6 +3766,76 @@ static int DoSCSISelfTest(const dev_config & cfg, dev_state & state, scsi_device
   return 0;
 }
 
+// Remember LBA of a new error for the next planned selective self-test
+// ('-x'). Errors within the last tested span are not tested again.
+static void note_selective_error_lba(const dev_config & cfg, dev_state & state, uint64_t lba)
+{
+  if (!(cfg.selective_plan_minutes && lba < state.num_sectors))
+    return;
+  if (   state.selective_test_last_start <= lba && lba <= state.selective_test_last_end
+      && state.selective_test_last_end)
+    return;
+  PrintOut(LOG_INFO, "Device: %s, error at LBA %" PRIu64 " will be tested by next selective self-test\n",
+           cfg.name.c_str(), lba);
+  state.selective_plan.error_lba = lba;
+  state.must_write = true;
+}
+
+// Plan span of next rolling selective self-test ('-x MINUTES[,DAYS]').
+// The new plan is returned in 'plan' and must be committed to the state
+// after the test was started.
+static void plan_selective_span(const dev_config & cfg, const dev_state & state,
+                                const ata_smart_values & data, selective_plan_state & plan,
+                                ata_selective_selftest_args::span_args & span)
+{
+  const char * name = cfg.name.c_str();
+  uint64_t num_sectors = state.num_sectors;
+  if (!num_sectors)
+    return; // ataWriteSelectiveSelfTestLog() fails
+  time_t now = time(nullptr);
+
+  selective_plan_args args;
+  args.num_sectors = num_sectors;
+  args.minutes = cfg.selective_plan_minutes;
+  args.days = cfg.selective_plan_days;
+  args.last_start = state.selective_test_last_start;
+  args.last_end = state.selective_test_last_end;
+  // Not done if aborted or interrupted by host (see SEL_CONT) or still running
+  int status = data.self_test_exec_status >> 4;
+  args.last_done = !(status == 1 || status == 2 || status == 15);
+
+  // Sectors per second from last selective or long self-test, or from
+  // drive's estimate for a long self-test
+  args.rate = state.selective_test_rate;
+  if (!args.rate && state.selftest_duration_long > 0)
+    args.rate = num_sectors / state.selftest_duration_long;
+  if (!args.rate) {
+    int minutes = TestTime(&data, EXTEND_SELF_TEST);
+    if (minutes > 0)
+      args.rate = num_sectors / (minutes * 60U);
+  }
+
+  selective_span sp;
+  plan_selective_span(plan, args, now, sp);
+
+  if (sp.pass_done)
+    PrintOut(LOG_INFO, "Device: %s, full surface covered by %d selective self-tests in %d days\n",
+             name, sp.pass_tests, (int)((now - sp.pass_start + 12*3600) / (24*3600)));
+  if (sp.increased_from && debugmode)
+    PrintOut(LOG_INFO, "Device: %s, selective span increased from %" PRIu64 " to %" PRIu64
+             " sectors to cover disk within %d days\n", name, sp.increased_from,
+             sp.end - sp.start + 1, cfg.selective_plan_days);
+
+  span.mode = SEL_RANGE;
+  span.start = sp.start;
+  span.end = sp.end;
+
+  if (debugmode)
+    PrintOut(LOG_INFO, "Device: %s, selective pass started %d days ago, %u%% covered\n",
+             name, (int)((now - plan.pass_start) / (24*3600)),
+             (unsigned)(100 * plan.next_lba / num_sectors));
+}
+
 // Do an offline immediate or self-test.  Return zero on success,
 // nonzero on failure.
 static int DoATASelfTest(const dev_config & cfg, dev_state & state, ata_device * device, char testtype)
@@ -3217,11 +3915,19 @@ static int DoATASelfTest(const dev_config & cfg, dev_state & state, ata_device *
     }
   }
 
+  // New plan of rolling selective self-tests, committed if test was started
+  selective_plan_state plan = state.selective_plan;
+  bool planned = false;
+
   if (dotest == SELECTIVE_SELF_TEST) {
     // Set test span
     ata_selective_selftest_args selargs, prev_args;
     selargs.num_spans = 1;
     selargs.span[0].mode = mode;
+    if (cfg.selective_plan_minutes && testtype != 'r') {
+      plan_selective_span(cfg, state, data, plan, selargs.span[0]);
+      planned = true;
+    }
     prev_args.num_spans = 1;
     prev_args.span[0].start = state.selective_test_last_start;
     prev_args.span[0].end   = state.selective_test_last_end;
@@ -3231,7 +3937,8 @@ static int DoATASelfTest(const dev_config & cfg, dev_state & state, ata_device *
     }
     uint64_t start = selargs.span[0].start, end = selargs.span[0].end;
     PrintOut(LOG_INFO, "Device: %s, %s test span at LBA %" PRIu64 " - %" PRIu64 " (%" PRIu64 " sectors, %u%% - %u%% of disk).\n",
-      name, (selargs.span[0].mode == SEL_NEXT ? "next" : "redo"),
+      name, (selargs.span[0].mode == SEL_NEXT ? "next" :
+             selargs.span[0].mode == SEL_RANGE ? "planned" : "redo"),
       start, end, end - start + 1,
       (unsigned)((100 * start + state.num_sectors/2) / state.num_sectors),
       (unsigned)((100 * end   + state.num_sectors/2) / state.num_sectors));
@@ -3246,15 +3953,118 @@ static int DoATASelfTest(const dev_config & cfg, dev_state & state, ata_device *
     return retval;
   }
 
-  // Report recent test start to do_disable_standby_check()
-  // and force log of next test status
-  if (testtype == 'O')
-    state.offline_started = true;
-  else
-    state.selftest_started = true;
+  if (planned) {
+    state.selective_plan = plan;
+    state.must_write = true;
+  }
+
+  // Report recent test start to do_disable_standby_check()
+  // and force log of next test status
+  if (testtype == 'O')
+    state.offline_started = true;
+  else
+    state.selftest_started = true;
+
+  PrintOut(LOG_INFO, "Device: %s, starting scheduled %sTest.\n", name, testname);
+  return 0;
+}
+
+static const char * selftest_progress_name(char testtype)
+{
+  switch (testtype) {
+    case 'S': return "Short";
+    case 'L': return "Long";
+    case 'C': return "Conveyance";
+    default:  return "Selective";
+  }
+}
+
+// Start tracking progress of a self-test which was just started.
+static void start_selftest_progress(const dev_config & cfg, dev_state & state,
+                                    smart_device * device, char testtype)
+{
+  uint64_t capacity = 0; int nominal = 0;
+  if (testtype == 'S' || testtype == 'L' || testtype == 'C')
+    read_selftest_info(device, testtype, capacity, nominal);
+  else if (state.num_sectors && state.selective_test_last_end >= state.selective_test_last_start) {
+    // Selective: scale to size of span, use rate of previous tests
+    uint64_t span = state.selective_test_last_end - state.selective_test_last_start + 1;
+    read_selftest_info(device, 'L', capacity, nominal);
+    capacity = capacity / state.num_sectors * span;
+    nominal = (state.selective_test_rate ? (int)(span / state.selective_test_rate) : 0);
+  }
+
+  // Prefer duration of previous test of same type
+  int expected = (testtype == 'S' ? state.selftest_duration_short :
+                  testtype == 'L' ? state.selftest_duration_long  : 0);
+  if (!expected)
+    expected = nominal;
+
+  state.test_progress.reset(new selftest_progress(time(nullptr), capacity, expected));
+  state.test_progress_type = testtype;
+  if (debugmode) {
+    char buf[32];
+    PrintOut(LOG_INFO, "Device: %s, tracking progress of %s Self-Test, expected duration %s\n",
+             cfg.name.c_str(), selftest_progress_name(testtype),
+             (expected ? format_selftest_secs(buf, sizeof(buf), expected) : "unknown"));
+  }
+}
+
+// Sample progress of running self-test, log each 10% step and completion.
+static void sample_selftest_progress(const dev_config & cfg, dev_state & state,
+                                     smart_device * device, time_t now)
+{
+  const char * name = cfg.name.c_str();
+  const char * testname = selftest_progress_name(state.test_progress_type);
+  selftest_progress & progress = *state.test_progress;
+
+  selftest_sample sample;
+  if (!read_selftest_progress(device, sample, cfg.firmwarebugs)) {
+    PrintOut(LOG_INFO, "Device: %s, read %s Self-Test progress failed: %s\n",
+             name, testname, device->get_errmsg());
+    return;
+  }
+  if (!progress.add_sample(now, sample))
+    return;
+
+  char buf[128];
+  if (!progress.is_finished()) {
+    PrintOut(LOG_INFO, "Device: %s, %s Self-Test in progress, %s\n", name, testname,
+             progress.format_status(buf, sizeof(buf), now));
+    return;
+  }
+
+  int duration = progress.get_duration();
+  char expstr[48] = "";
+  if (progress.get_nominal()) {
+    char secs[32];
+    snprintf(expstr, sizeof(expstr), " (expected %s)",
+             format_selftest_secs(secs, sizeof(secs), progress.get_nominal()));
+  }
+  PrintOut(LOG_INFO, "Device: %s, %s Self-Test finished after %s%s\n", name, testname,
+           format_selftest_secs(buf, sizeof(buf), duration), expstr);
+
+  // Remember duration or scan rate of tests completed without error
+  if (progress.get_result() == 0 && duration > 0) {
+    if (state.test_progress_type == 'S')
+      state.selftest_duration_short = duration;
+    else if (state.test_progress_type == 'L')
+      state.selftest_duration_long = duration;
+    else if (state.test_progress_type != 'C')
+      state.selective_test_rate = (state.selective_test_last_end
+        - state.selective_test_last_start + 1) / duration;
+    state.must_write = true;
+  }
+  state.test_progress.reset();
+}
 
-  PrintOut(LOG_INFO, "Device: %s, starting scheduled %sTest.\n", name, testname);
-  return 0;
+// Return time of next poll of self-test progress, 0 if none.
+static time_t next_selftest_poll(const dev_config & cfg, const dev_state & state, time_t now)
+{
+  if (!state.test_progress)
+    return 0;
+  return now + state.test_progress->get_poll_interval(now, 60,
+    (cfg.checktime ? cfg.checktime : checktime));
 }
 
 // Check pending sector count attribute values (-C, -U directives).
@@ -3263,20 +4073,23 @@ static void check_pending(const dev_config & cfg, dev_state & state,
                           const ata_smart_values & smartval,
                           int mailtype, const char * msg)
 {
+  log_context_scope lcs(id, log_ctx.event);
+
   // Find attribute index
   int i = ata_find_attr_index(id, smartval);
-  if (!(i >= 0 && ata_find_attr_index(id, state.smartval) == i))
+  if (!(i >= 0 && ata_find_attr_index(id, state.ata().smartval) == i))
     return;
 
   // No report if no sectors pending.
-  uint64_t rawval = ata_get_attr_raw_value(smartval.vendor_attributes[i], cfg.attribute_defs);
+  const ata_attr_decoder & decoder = *cfg.attr_decoder;
+  uint64_t rawval = decoder.get_raw_value(smartval.vendor_attributes[i]);
   if (rawval == 0) {
     reset_warning_mail(cfg, state, mailtype, "No more %s", msg);
     return;
   }
 
   // If attribute is not reset, report only sector count increases.
-  uint64_t prev_rawval = ata_get_attr_raw_value(state.smartval.vendor_attributes[i], cfg.attribute_defs);
+  uint64_t prev_rawval = decoder.get_raw_value(state.ata().smartval.vendor_attributes[i]);
   if (!(!increase_only || prev_rawval < rawval))
     return;
 
@@ -3384,13 +4197,15 @@ static void check_attribute(const dev_config & cfg, dev_state & state,
   ata_attr_state attrstate = ata_get_attr_state(attr, attridx, thresholds, cfg.attribute_defs);
   if (attrstate == ATTRSTATE_NON_EXISTING)
     return;
+  log_context_scope lcs(attr.id, log_ctx.event);
+  const ata_attr_decoder & decoder = *cfg.attr_decoder;
 
   // If requested, check for usage attributes that have failed.
   if (   cfg.usagefailed && attrstate == ATTRSTATE_FAILED_NOW
       && !cfg.monitor_attr_flags.is_set(attr.id, MONITOR_IGN_FAILUSE)) {
-    std::string attrname = ata_get_smart_attr_name(attr.id, cfg.attribute_defs, cfg.dev_rpm);
-    PrintOut(LOG_CRIT, "Device: %s, Failed SMART usage Attribute: %d %s.\n", cfg.name.c_str(), attr.id, attrname.c_str());
-    MailWarning(cfg, state, 2, "Device: %s, Failed SMART usage Attribute: %d %s.", cfg.name.c_str(), attr.id, attrname.c_str());
+    const char * attrname = decoder.get_name(attr.id, cfg.dev_rpm);
+    PrintOut(LOG_CRIT, "Device: %s, Failed SMART usage Attribute: %d %s.\n", cfg.name.c_str(), attr.id, attrname);
+    MailWarning(cfg, state, 2, "Device: %s, Failed SMART usage Attribute: %d %s.", cfg.name.c_str(), attr.id, attrname);
     state.must_write = true;
   }
 
@@ -3421,8 +4236,7 @@ static void check_attribute(const dev_config & cfg, dev_state & state,
   // Compare raw values if requested.
   bool rawchanged = false;
   if (cfg.monitor_attr_flags.is_set(attr.id, MONITOR_RAW)) {
-    if (   ata_get_attr_raw_value(attr, cfg.attribute_defs)
-        != ata_get_attr_raw_value(prev, cfg.attribute_defs))
+    if (decoder.get_raw_value(attr) != decoder.get_raw_value(prev))
       rawchanged = true;
   }
 
@@ -3431,32 +4245,31 @@ static void check_attribute(const dev_config & cfg, dev_state & state,
     return;
 
   // Format value strings
-  std::string currstr, prevstr;
+  char currstr[80], prevstr[80], rawbuf[64];
   if (attrstate == ATTRSTATE_NO_NORMVAL) {
     // Print raw values only
-    currstr = strprintf("%s (Raw)",
-      ata_format_attr_raw_value(attr, cfg.attribute_defs).c_str());
-    prevstr = strprintf("%s (Raw)",
-      ata_format_attr_raw_value(prev, cfg.attribute_defs).c_str());
+    snprintf(currstr, sizeof(currstr), "%s (Raw)",
+      decoder.format_raw_value(attr, rawbuf, sizeof(rawbuf)));
+    snprintf(prevstr, sizeof(prevstr), "%s (Raw)",
+      decoder.format_raw_value(prev, rawbuf, sizeof(rawbuf)));
   }
   else if (cfg.monitor_attr_flags.is_set(attr.id, MONITOR_RAW_PRINT)) {
     // Print normalized and raw values
-    currstr = strprintf("%d [Raw %s]", attr.current,
-      ata_format_attr_raw_value(attr, cfg.attribute_defs).c_str());
-    prevstr = strprintf("%d [Raw %s]", prev.current,
-      ata_format_attr_raw_value(prev, cfg.attribute_defs).c_str());
+    snprintf(currstr, sizeof(currstr), "%d [Raw %s]", attr.current,
+      decoder.format_raw_value(attr, rawbuf, sizeof(rawbuf)));
+    snprintf(prevstr, sizeof(prevstr), "%d [Raw %s]", prev.current,
+      decoder.format_raw_value(prev, rawbuf, sizeof(rawbuf)));
   }
   else {
     // Print normalized values only
-    currstr = strprintf("%d", attr.current);
-    prevstr = strprintf("%d", prev.current);
+    snprintf(currstr, sizeof(currstr), "%d", attr.current);
+    snprintf(prevstr, sizeof(prevstr), "%d", prev.current);
   }
 
   // Format message
   std::string msg = strprintf("Device: %s, SMART %s Attribute: %d %s changed from %s to %s",
                               cfg.name.c_str(), (prefail ? "Prefailure" : "Usage"), attr.id,
-                              ata_get_smart_attr_name(attr.id, cfg.attribute_defs, cfg.dev_rpm).c_str(),
-                              prevstr.c_str(), currstr.c_str());
+                              decoder.get_name(attr.id, cfg.dev_rpm), prevstr, currstr);
 
   // Report this change as critical ?
   if (   (valchanged && cfg.monitor_attr_flags.is_set(attr.id, MONITOR_AS_CRIT))
@@ -3470,12 +4283,311 @@ static void check_attribute(const dev_config & cfg, dev_state & state,
   state.must_write = true;
 }
 
+// Check Device Statistics values (-D directive).
+static void check_devstat(const dev_config & cfg, dev_state & state, ata_device * atadev)
+{
+  const char * name = cfg.name.c_str();
+  std::vector<devstat_reading> values;
+  if (!read_devstat_values(atadev, cfg, state.devstat_gplog, values)) {
+    PrintOut(LOG_INFO, "Device: %s, Read Device Statistics failed\n", name);
+    return;
+  }
+
+  std::map<unsigned, persistent_dev_state::devstat_value> new_values;
+  bool warned = false;
+  for (unsigned i = 0; i < cfg.devstat_mons.size(); i++) {
+    const devstat_monitor & dm = cfg.devstat_mons[i];
+    unsigned key = dm.page << 16 | dm.offset;
+    auto it = state.devstat_values.find(key);
+    if (!(values[i].flags & 0x40)) {
+      // Value not valid (yet), keep previous
+      if (it != state.devstat_values.end())
+        new_values[key] = it->second;
+      continue;
+    }
+
+    int64_t val = values[i].val;
+    persistent_dev_state::devstat_value dv;
+    if (it != state.devstat_values.end())
+      dv = it->second;
+    else {
+      dv.base = val;
+      state.must_write = true;
+    }
+    const char * norm = ((values[i].flags & 0x20) ? " (normalized)" : "");
+
+    if (dm.limit && val >= dm.limit) {
+      std::string s = strprintf("Device: %s, %s %" PRId64 "%s reached limit of %" PRId64,
+                                name, format_devstat_name(dm).c_str(), val, norm, dm.limit);
+      PrintOut(LOG_CRIT, "%s\n", s.c_str());
+      MailWarning(cfg, state, 14, "%s", s.c_str());
+      warned = true;
+    }
+    else if (values[i].flags & 0x08) {
+      std::string s = strprintf("Device: %s, %s %" PRId64 "%s, monitored condition met",
+                                name, format_devstat_name(dm).c_str(), val, norm);
+      PrintOut(LOG_CRIT, "%s\n", s.c_str());
+      MailWarning(cfg, state, 14, "%s", s.c_str());
+      warned = true;
+    }
+
+    if (dm.diff && val != dv.base
+        && (uint64_t)(val > dv.base ? val - dv.base : dv.base - val) >= dm.diff) {
+      PrintOut(LOG_INFO, "Device: %s, %s changed from %" PRId64 " to %" PRId64 "%s\n",
+               name, format_devstat_name(dm).c_str(), dv.base, val, norm);
+      dv.base = val;
+      state.must_write = true;
+    }
+    else if (!dm.diff)
+      dv.base = val;
+
+    dv.val = val;
+    new_values[key] = dv;
+  }
+  // Values of removed directives are dropped
+  state.devstat_values.swap(new_values);
+
+  if (!warned)
+    reset_warning_mail(cfg, state, 14, "Device Statistics below limits");
+}
+
+// Append new samples of the SCT Temperature History to the history file.
+// The drive logs one sample per 'interval' minutes of power-on time into a
+// ring buffer whose 'cb_index' points to the newest entry.  The entries
+// added since the last read follow from the index difference and are timed
+// backwards from now.  The table is read again before half of the ring
+// buffer is overwritten.
+static void harvest_sct_temp_history(const dev_config & cfg, dev_state & state,
+                                     ata_device * atadev)
+{
+  time_t now = time(nullptr);
+  if (now < state.scttemp_next_read)
+    return;
+
+  const char * name = cfg.name.c_str();
+  ata_sct_status_response sts;
+  ata_sct_temperature_history_table tmh;
+  if (ataReadSCTStatus(atadev, &sts) || ataReadSCTTempHist(atadev, &tmh, &sts)) {
+    PrintOut(LOG_INFO, "Device: %s, Read SCT Temperature History failed\n", name);
+    state.scttemp_next_read = now + 3600;
+    return;
+  }
+
+  int size = tmh.cb_size, index = tmh.cb_index, interval = tmh.interval;
+  if (!(   tmh.format_version == 2 && 0 < size && size <= (int)sizeof(tmh.cb)
+        && index < size && interval > 0)) {
+    PrintOut(LOG_INFO, "Device: %s, invalid SCT Temperature History (format %u, size %d, "
+             "index %d, interval %d)\n", name, tmh.format_version, size, index, interval);
+    state.scttemp_next_read = now + 3600;
+    return;
+  }
+
+  std::vector<sct_temp_entry> entries;
+  int num = select_sct_temp_entries(tmh, state, !cfg.state_file.empty(), now, entries);
+
+  const char * path = cfg.scttemp_file.c_str();
+  stdio_file f(path, "a");
+  if (!f) {
+    pout("Cannot create SCT temperature history file \"%s\"\n", path);
+    state.scttemp_next_read = now + 3600;
+    return;
+  }
+
+  for (const sct_temp_entry & e : entries) {
+    struct tm tmbuf, * tms = time_to_tm_local(&tmbuf, e.time);
+    fprintf(f, "%d-%02d-%02d %02d:%02d:%02d;\ttemperature;%d;\n",
+            1900+tms->tm_year, 1+tms->tm_mon, tms->tm_mday,
+            tms->tm_hour, tms->tm_min, tms->tm_sec, e.temp);
+  }
+
+  if (debugmode)
+    PrintOut(LOG_INFO, "Device: %s, %d of %d SCT Temperature History entries written to %s\n",
+             name, (int)entries.size(), num, path);
+
+  state.scttemp_last_time = now;
+  state.scttemp_last_index = index;
+  state.scttemp_interval = interval;
+  state.scttemp_next_read = now + (time_t)size * interval * 60 / 2;
+  state.must_write = true;
+}
+
+// Add a new value to a trend.  The rate of change per day is smoothed by
+// an exponentially weighted moving average with a time constant of 'window'
+// days, so irregular check intervals and restarts are handled properly.
+static void update_trend(trend_stat & ts, uint64_t value, time_t now, unsigned window)
+{
+  if (!ts.time || now < ts.time) {
+    // First value or clock moved backwards
+    ts = trend_stat();
+    ts.value = value;
+    ts.time = ts.start = now;
+    return;
+  }
+  if (now == ts.time)
+    return;
+
+  double days = (now - ts.time) / 86400.0;
+  double rate = ((double)value - (double)ts.value) / days;
+  double alpha = 1 - exp(-days / window);
+  double avg = (double)ts.rate / trend_rate_scale;
+  avg += alpha * (rate - avg);
+
+  ts.value = value;
+  ts.time = now;
+  ts.rate = (int64_t)llround(avg * trend_rate_scale);
+}
+
+// Return smoothed rate of change per day, false if not yet known.
+static bool get_trend_rate(const trend_stat & ts, unsigned window, double & rate)
+{
+  // Require values of at least one day
+  double age = (ts.time - ts.start) / 86400.0;
+  if (!(ts.time && age >= 1))
+    return false;
+  // Correct the bias caused by the initial zero rate
+  rate = (double)ts.rate / trend_rate_scale / (1 - exp(-age / window));
+  return true;
+}
+
+// Check whether a decreasing value reaches 'limit' within cfg.trend_days.
+// Return number of days or -1 if not.
+static double check_trend_limit_down(const dev_config & cfg, const trend_stat & ts,
+                                     uint64_t limit, double & rate)
+{
+  if (!(cfg.trend_days && get_trend_rate(ts, cfg.trend_window, rate) && rate < 0))
+    return -1;
+  if (ts.value <= limit)
+    return -1; // Already reached, reported elsewhere
+  double days = (ts.value - limit) / -rate;
+  return (days <= cfg.trend_days ? days : -1);
+}
+
+// Check whether an increasing counter grows faster than cfg.trend_rate.
+static bool check_trend_rate_up(const dev_config & cfg, const trend_stat & ts, double & rate)
+{
+  return (   cfg.trend_rate && get_trend_rate(ts, cfg.trend_window, rate)
+          && rate > cfg.trend_rate);
+}
+
+// Update trends of raw sector counts and normalized ATA attribute values,
+// report predicted failures (-A directive).
+static void check_ata_trends(const dev_config & cfg, dev_state & state,
+                             const ata_smart_values & curval)
+{
+  const char * name = cfg.name.c_str();
+  time_t now = time(nullptr);
+  bool warned = false;
+
+  for (int i = 0; i < NUMBER_ATA_SMART_ATTRIBUTES; i++) {
+    const ata_smart_attribute & attr = curval.vendor_attributes[i];
+    if (attr.id != state.ata().smartval.vendor_attributes[i].id)
+      state.trends.erase(i); // Attribute table changed
+
+    // Normalized values with valid threshold only
+    if (ata_get_attr_state(attr, i, state.ata().smartthres.thres_entries, cfg.attribute_defs)
+        != ATTRSTATE_OK) {
+      state.trends.erase(i);
+      continue;
+    }
+    trend_stat & ts = state.trends[i];
+    update_trend(ts, attr.current, now, cfg.trend_window);
+    if (cfg.monitor_attr_flags.is_set(attr.id, MONITOR_IGNORE))
+      continue;
+
+    unsigned char threshold = state.ata().smartthres.thres_entries[i].threshold;
+    double rate, days = check_trend_limit_down(cfg, ts, threshold, rate);
+    if (days < 0)
+      continue;
+
+    std::string msg = strprintf("Device: %s, SMART %s Attribute: %d %s predicted to reach "
+      "threshold %d in %.0f days (value %d, trend %+.2f/day)", name,
+      (ATTRIBUTE_FLAGS_PREFAILURE(attr.flags) ? "Prefailure" : "Usage"), attr.id,
+      cfg.attr_decoder->get_name(attr.id, cfg.dev_rpm),
+      threshold, ceil(days), attr.current, rate);
+    PrintOut(LOG_CRIT, "%s\n", msg.c_str());
+    MailWarning(cfg, state, 13, "%s", msg.c_str());
+    warned = true;
+  }
+
+  // Reallocated and pending sector counts
+  const unsigned char counter_ids[] = { 5, cfg.curr_pending_id, cfg.offl_pending_id };
+  for (int k = 0; k < 3; k++) {
+    unsigned char id = counter_ids[k];
+    int i = (id ? ata_find_attr_index(id, curval) : -1);
+    if (i < 0) {
+      state.trends.erase(TREND_ATA_REALLOC + k);
+      continue;
+    }
+    trend_stat & ts = state.trends[TREND_ATA_REALLOC + k];
+    const ata_smart_attribute & attr = curval.vendor_attributes[i];
+    uint64_t rawval = cfg.attr_decoder->get_raw_value(attr);
+    update_trend(ts, rawval, now, cfg.trend_window);
+
+    double rate;
+    if (!check_trend_rate_up(cfg, ts, rate))
+      continue;
+
+    std::string msg = strprintf("Device: %s, SMART Attribute: %d %s Raw value %" PRIu64
+      " increasing by %.1f per day", name, id,
+      cfg.attr_decoder->get_name(id, cfg.dev_rpm), rawval, rate);
+    PrintOut(LOG_CRIT, "%s\n", msg.c_str());
+    MailWarning(cfg, state, 13, "%s", msg.c_str());
+    warned = true;
+  }
+
+  if (!warned)
+    reset_warning_mail(cfg, state, 13, "no more critical trends");
+}
+
+// Update trends of NVMe Percentage Used and Media Errors, report
+// predicted wear out or increasing error rate (-A directive).
+static void check_nvme_trends(const dev_config & cfg, dev_state & state,
+                              const nvme_smart_log & smart_log)
+{
+  const char * name = cfg.name.c_str();
+  time_t now = time(nullptr);
+  bool warned = false;
+
+  trend_stat & tu = state.trends[TREND_NVME_USED];
+  update_trend(tu, smart_log.percent_used, now, cfg.trend_window);
+  double rate;
+  if (   cfg.trend_days && smart_log.percent_used < 100
+      && get_trend_rate(tu, cfg.trend_window, rate) && rate > 0) {
+    double days = (100 - smart_log.percent_used) / rate;
+    if (days <= cfg.trend_days) {
+      PrintOut(LOG_CRIT, "Device: %s, Percentage Used predicted to reach 100%% in %.0f days "
+               "(value %d%%, trend %+.2f/day)\n", name, ceil(days), smart_log.percent_used, rate);
+      MailWarning(cfg, state, 13, "Device: %s, Percentage Used predicted to reach 100%% in %.0f days "
+                  "(value %d%%, trend %+.2f/day)", name, ceil(days), smart_log.percent_used, rate);
+      warned = true;
+    }
+  }
+
+  trend_stat & te = state.trends[TREND_NVME_MEDIA_ERRORS];
+  uint64_t errors = le128_to_uint64(smart_log.media_errors);
+  update_trend(te, errors, now, cfg.trend_window);
+  if (check_trend_rate_up(cfg, te, rate)) {
+    PrintOut(LOG_CRIT, "Device: %s, Media and Data Integrity Errors %" PRIu64
+             " increasing by %.1f per day\n", name, errors, rate);
+    MailWarning(cfg, state, 13, "Device: %s, Media and Data Integrity Errors %" PRIu64
+                " increasing by %.1f per day", name, errors, rate);
+    warned = true;
+  }
+
+  if (!warned)
+    reset_warning_mail(cfg, state, 13, "no more critical trends");
+}
 
+// preopened: -1 if not opened in advance by CheckDevicesOnce(),
+// 1 if opened, 0 if open failed.
 static int ATACheckDevice(const dev_config & cfg, dev_state & state, ata_device * atadev,
-                          bool firstpass, bool allow_selftests)
+                          bool firstpass, const selftest_limiter & tests, int preopened = -1)
 {
-  if (!open_device(cfg, state, atadev, "ATA"))
+  if (preopened < 0 ? !open_device(cfg, state, atadev, "ATA") : !preopened) {
+    // Release test slot
+    state.test_running = 0; state.test_deferred = 0;
     return 1;
+  }
 
   const char * name = cfg.name.c_str();
 
@@ -3564,7 +4676,9 @@ static int ATACheckDevice(const dev_config & cfg, dev_state & state, ata_device
           PrintOut(LOG_INFO, "Device: %s, is in %s mode, suspending checks\n", name, mode);
           state.lastpowermodeskipped = powermode;
         }
+        state.powermodeskipped = powermode;
         state.powerskipcnt++;
+        state.test_running = 0; state.test_deferred = 0;
         return 0;
       }
       else {
@@ -3585,6 +4699,9 @@ static int ATACheckDevice(const dev_config & cfg, dev_state & state, ata_device
   // check smart status
   if (cfg.smartcheck) {
     int status=ataSmartStatus2(atadev);
+    state.health = (status == 0 ? dev_status_entry::health_passed :
+                    status == 1 ? dev_status_entry::health_failed :
+                                  dev_status_entry::health_unknown);
     if (status==-1){
       PrintOut(LOG_INFO,"Device: %s, not capable of SMART self-check\n",name);
       MailWarning(cfg, state, 5, "Device: %s, not capable of SMART self-check", name);
@@ -3600,8 +4717,9 @@ static int ATACheckDevice(const dev_config & cfg, dev_state & state, ata_device
   // Check everything that depends upon SMART Data (eg, Attribute values)
   if (   cfg.usagefailed || cfg.prefail || cfg.usage
       || cfg.curr_pending_id || cfg.offl_pending_id
-      || cfg.tempdiff || cfg.tempinfo || cfg.tempcrit
-      || cfg.selftest ||  cfg.offlinests || cfg.selfteststs) {
+      || cfg.tempdiff || cfg.tempinfo || cfg.tempcrit || cfg.trend
+      || cfg.selftest ||  cfg.offlinests || cfg.selfteststs
+      || (!cfg.test_regex.empty() && tests.is_limited(cfg))) {
 
     // Read current attribute values.
     ata_smart_values curval;
@@ -3633,15 +4751,19 @@ static int ATACheckDevice(const dev_config & cfg, dev_state & state, ata_device
         for (int i = 0; i < NUMBER_ATA_SMART_ATTRIBUTES; i++) {
           check_attribute(cfg, state,
                           curval.vendor_attributes[i],
-                          state.smartval.vendor_attributes[i],
-                          i, state.smartthres.thres_entries);
+                          state.ata().smartval.vendor_attributes[i],
+                          i, state.ata().smartthres.thres_entries);
         }
       }
 
+      // update trends, report predicted failures
+      if (cfg.trend)
+        check_ata_trends(cfg, state, curval);
+
       // Log changes of offline data collection status
       if (cfg.offlinests) {
         if (   curval.offline_data_collection_status
-                != state.smartval.offline_data_collection_status
+                != state.ata().smartval.offline_data_collection_status
             || state.offline_started // test was started in previous call
             || (firstpass && (debugmode || (curval.offline_data_collection_status & 0x7d))))
           log_offline_data_coll_status(name, curval.offline_data_collection_status);
@@ -3649,30 +4771,46 @@ static int ATACheckDevice(const dev_config & cfg, dev_state & state, ata_device
 
       // Log changes of self-test execution status
       if (cfg.selfteststs) {
-        if (   curval.self_test_exec_status != state.smartval.self_test_exec_status
+        if (   curval.self_test_exec_status != state.ata().smartval.self_test_exec_status
             || state.selftest_started // test was started in previous call
             || (firstpass && (debugmode || (curval.self_test_exec_status & 0xf0))))
           log_self_test_exec_status(name, curval.self_test_exec_status);
       }
 
+      // Track running tests for '-t N' and '-g GROUP,N' limits
+      if (   is_self_test_in_progress(curval.self_test_exec_status)
+          && !(cfg.firmwarebugs.is_set(BUG_SAMSUNG3) && curval.self_test_exec_status == 0xf0))
+        state.test_running = 'S';
+      else if (!(   state.test_running == 'O'
+                 && is_offl_coll_in_progress(curval.offline_data_collection_status)))
+        state.test_running = 0;
+
       // Save the new values for the next time around
-      state.smartval = curval;
+      state.ata().smartval = curval;
     }
   }
   state.offline_started = state.selftest_started = false;
   
   // check if number of selftest errors has increased (note: may also DECREASE)
-  if (cfg.selftest)
-    CheckSelfTestLogs(cfg, state, SelfTestErrorCount(atadev, name, cfg.firmwarebugs));
+  if (cfg.selftest) {
+    uint64_t err_lba = ~(uint64_t)0;
+    int newi = SelfTestErrorCount(atadev, name, cfg.firmwarebugs, &err_lba);
+    if (   newi > 0 && err_lba != ~(uint64_t)0
+        && (   SELFTEST_ERRORCOUNT(newi) > state.selflogcount
+            || SELFTEST_ERRORHOURS(newi) != state.selfloghour))
+      note_selective_error_lba(cfg, state, err_lba);
+    CheckSelfTestLogs(cfg, state, newi);
+  }
 
   // check if number of ATA errors has increased
   if (cfg.errorlog || cfg.xerrorlog) {
 
     int errcnt1 = -1, errcnt2 = -1;
+    uint64_t err_lba = ~(uint64_t)0;
     if (cfg.errorlog)
       errcnt1 = read_ata_error_count(atadev, name, cfg.firmwarebugs, false);
     if (cfg.xerrorlog)
-      errcnt2 = read_ata_error_count(atadev, name, cfg.firmwarebugs, true);
+      errcnt2 = read_ata_error_count(atadev, name, cfg.firmwarebugs, true, &err_lba);
 
     // new number of errors is max of both logs
     int newc = (errcnt1 >= errcnt2 ? errcnt1 : errcnt2);
@@ -3690,18 +4828,31 @@ static int ATACheckDevice(const dev_config & cfg, dev_state & state, ata_device
       MailWarning(cfg, state, 4, "Device: %s, ATA error count increased from %d to %d",
                    name, oldc, newc);
       state.must_write = true;
+      if (err_lba != ~(uint64_t)0)
+        note_selective_error_lba(cfg, state, err_lba);
     }
 
     if (newc>=0)
       state.ataerrorcount=newc;
   }
 
+  // check Device Statistics
+  if (!cfg.devstat_mons.empty())
+    check_devstat(cfg, state, atadev);
+
+  // append new SCT Temperature History samples
+  if (cfg.scttemp_hist)
+    harvest_sct_temp_history(cfg, state, atadev);
+
   // if the user has asked, and device is capable (or we're not yet
   // sure) check whether a self test should be done now.
-  if (allow_selftests && !cfg.test_regex.empty()) {
-    char testtype = next_scheduled_test(cfg, state, false/*!scsi*/);
-    if (testtype)
-      DoATASelfTest(cfg, state, atadev, testtype);
+  if (tests.allowed() && !cfg.test_regex.empty()) {
+    char testtype = next_test_to_start(cfg, state, false/*!scsi*/, tests);
+    if (testtype && !DoATASelfTest(cfg, state, atadev, testtype)) {
+      state.test_running = (testtype == 'O' ? 'O' : 'S');
+      if (testtype != 'O')
+        start_selftest_progress(cfg, state, atadev, testtype);
+    }
   }
 
   // Don't leave device open -- the OS/user may want to access it
@@ -3710,15 +4861,21 @@ static int ATACheckDevice(const dev_config & cfg, dev_state & state, ata_device
 
   // Copy ATA attribute values to persistent state
   state.update_persistent_state();
+  save_max_log_sectors(state, atadev);
 
   state.attrlog_dirty = true;
+  state.data_time = time(nullptr);
   return 0;
 }
 
-static int SCSICheckDevice(const dev_config & cfg, dev_state & state, scsi_device * scsidev, bool allow_selftests)
+static int SCSICheckDevice(const dev_config & cfg, dev_state & state, scsi_device * scsidev,
+                           const selftest_limiter & tests)
 {
-  if (!open_device(cfg, state, scsidev, "SCSI"))
+  if (!open_device(cfg, state, scsidev, "SCSI")) {
+    // Release test slot
+    state.test_running = 0; state.test_deferred = 0;
     return 1;
+  }
 
   const char * name = cfg.name.c_str();
 
@@ -3733,11 +4890,16 @@ static int SCSICheckDevice(const dev_config & cfg, dev_state & state, scsi_devic
       state.SuppressReport = 1;
     }
   }
+  if (state.SuppressReport)
+    state.health = dev_status_entry::health_unknown;
+  else
+    state.health = dev_status_entry::health_passed;
   if (asc > 0) {
     char b[128];
     const char * cp = scsiGetIEString(asc, ascq, b, sizeof(b));
 
     if (cp) {
+      state.health = dev_status_entry::health_failed;
       PrintOut(LOG_CRIT, "Device: %s, SMART Failure: %s\n", name, cp);
       MailWarning(cfg, state, 1,"Device: %s, SMART Failure: %s", name, cp);
     } else if (asc == 4 && ascq == 9) {
@@ -3756,10 +4918,19 @@ static int SCSICheckDevice(const dev_config & cfg, dev_state & state, scsi_devic
   if (cfg.selftest)
     CheckSelfTestLogs(cfg, state, scsiCountFailedSelfTests(scsidev, 0));
 
-  if (allow_selftests && !cfg.test_regex.empty()) {
-    char testtype = next_scheduled_test(cfg, state, true/*scsi*/);
-    if (testtype)
-      DoSCSISelfTest(cfg, state, scsidev, testtype);
+  if (!cfg.test_regex.empty() && tests.is_limited(cfg)) {
+    // Track running tests for '-t N' and '-g GROUP,N' limits
+    int inProgress = 0;
+    if (!scsiSelfTestInProgress(scsidev, &inProgress))
+      state.test_running = (inProgress == 1 ? 'S' : 0);
+  }
+
+  if (tests.allowed() && !cfg.test_regex.empty()) {
+    char testtype = next_test_to_start(cfg, state, true/*scsi*/, tests);
+    if (testtype && !DoSCSISelfTest(cfg, state, scsidev, testtype)) {
+      state.test_running = 'S';
+      start_selftest_progress(cfg, state, scsidev, testtype);
+    }
   }
   if (!cfg.attrlog_file.empty()){
     // saving error counters to state
@@ -3794,19 +4965,37 @@ static int SCSICheckDevice(const dev_config & cfg, dev_state & state, scsi_devic
   }
   CloseDevice(scsidev, name);
   state.attrlog_dirty = true;
+  state.data_time = time(nullptr);
   return 0;
 }
 
-static int NVMeCheckDevice(const dev_config & cfg, dev_state & state, nvme_device * nvmedev)
+// NVMe SMART/Health log read in advance by CheckDevicesOnce()
+struct nvme_smart_log_result
 {
-  if (!open_device(cfg, state, nvmedev, "NVMe"))
+  bool opened; // open_device() succeeded
+  bool ok; // log read succeeded
+  nvme_smart_log smart_log;
+
+  nvme_smart_log_result()
+    : opened(false), ok(false)
+    { }
+};
+
+static int NVMeCheckDevice(const dev_config & cfg, dev_state & state, nvme_device * nvmedev,
+                           const nvme_smart_log_result * prefetched = nullptr)
+{
+  if (!prefetched && !open_device(cfg, state, nvmedev, "NVMe"))
+    return 1;
+  if (prefetched && !prefetched->opened)
     return 1;
 
   const char * name = cfg.name.c_str();
 
   // Read SMART/Health log
   nvme_smart_log smart_log;
-  if (!nvme_read_smart_log(nvmedev, smart_log)) {
+  if (prefetched)
+    smart_log = prefetched->smart_log;
+  if (!(prefetched ? prefetched->ok : nvme_read_smart_log(nvmedev, smart_log))) {
       CloseDevice(nvmedev, name);
       PrintOut(LOG_INFO, "Device: %s, failed to read NVMe SMART/Health Information\n", name);
       MailWarning(cfg, state, 6, "Device: %s, failed to read NVMe SMART/Health Information", name);
@@ -3814,6 +5003,10 @@ static int NVMeCheckDevice(const dev_config & cfg, dev_state & state, nvme_devic
       return 0;
   }
 
+  state.nvme().smartval = smart_log;
+  state.health = (smart_log.critical_warning ? dev_status_entry::health_failed
+                                             : dev_status_entry::health_passed);
+
   // Check Critical Warning bits
   if (cfg.smartcheck && smart_log.critical_warning) {
     unsigned char w = smart_log.critical_warning;
@@ -3866,8 +5059,13 @@ static int NVMeCheckDevice(const dev_config & cfg, dev_state & state, nvme_devic
     state.nvme_err_log_entries = newcnt;
   }
 
+  // Update trends, report predicted wear out
+  if (cfg.trend)
+    check_nvme_trends(cfg, state, smart_log);
+
   CloseDevice(nvmedev, name);
   state.attrlog_dirty = true;
+  state.data_time = time(nullptr);
   return 0;
 }
 
@@ -3914,10 +5112,10 @@ static void do_disable_standby_check(const dev_config_vector & configs, const de
 
     if (   (   cfg.offlinests_ns
             && (state.offline_started ||
-                is_offl_coll_in_progress(state.smartval.offline_data_collection_status)))
+                is_offl_coll_in_progress(state.ata().smartval.offline_data_collection_status)))
         || (   cfg.selfteststs_ns
             && (state.selftest_started ||
-                is_self_test_in_progress(state.smartval.self_test_exec_status)))         )
+                is_self_test_in_progress(state.ata().smartval.self_test_exec_status)))         )
       running = true;
     // state.offline/selftest_started will be reset after next logging of test status
   }
@@ -3948,27 +5146,95 @@ static void do_disable_standby_check(const dev_config_vector & configs, const de
   }
 }
 
+// Return true if device is a port of a JMB39x/JMS56x RAID bridge
+static bool is_jmb39x_port(const smart_device * dev)
+{
+  const char * type = dev->get_dev_type();
+  return (str_starts_with(type, "jmb39x") || str_starts_with(type, "jms56x"));
+}
+
 // Checks the SMART status of all ATA and SCSI devices
 static void CheckDevicesOnce(const dev_config_vector & configs, dev_state_vector & states,
-                             smart_device_list & devices, bool firstpass, bool allow_selftests)
+                             dev_schedule_vector & scheds, smart_device_list & devices,
+                             bool firstpass, bool allow_selftests)
 {
+  // Open all NVMe devices due for check and read their SMART/Health logs
+  // with one batch of commands which may run in parallel
+  std::vector<nvme_smart_log_result> nvme_logs;
+  unsigned num_nvme = 0;
+  for (unsigned i = 0; i < configs.size(); i++) {
+    if (!scheds[i].skip && devices.at(i)->is_nvme())
+      num_nvme++;
+  }
+  if (num_nvme > 1) {
+    nvme_logs.resize(configs.size());
+    nvme_cmd_batch batch;
+    std::vector<unsigned> batch_idx;
+    for (unsigned i = 0; i < configs.size(); i++) {
+      dev_state & state = states.at(i);
+      smart_device * dev = devices.at(i);
+      if (scheds[i].skip || !dev->is_nvme())
+        continue;
+      if (!open_device(configs.at(i), state, dev, "NVMe"))
+        continue;
+      nvme_logs[i].opened = true;
+      batch.add_read_smart_log(dev->to_nvme(), nvme_logs[i].smart_log);
+      batch_idx.push_back(i);
+    }
+    batch.run();
+    for (unsigned j = 0; j < batch_idx.size(); j++)
+      nvme_logs[batch_idx[j]].ok = batch.ok(j);
+  }
+
+  // Open all JMB39x/JMS56x ports due for check in advance. Ports of the
+  // same bridge then share one controller session which wakes up the
+  // controller and restores the protocol sector only once per cycle.
+  std::vector<signed char> ata_preopened;
+  unsigned num_jmb = 0;
+  for (unsigned i = 0; i < configs.size(); i++) {
+    if (!scheds[i].skip && is_jmb39x_port(devices.at(i)))
+      num_jmb++;
+  }
+  if (num_jmb > 1) {
+    ata_preopened.resize(configs.size(), -1);
+    for (unsigned i = 0; i < configs.size(); i++) {
+      smart_device * dev = devices.at(i);
+      if (scheds[i].skip || !is_jmb39x_port(dev))
+        continue;
+      log_context_scope lcs(&configs.at(i));
+      ata_preopened[i] = open_device(configs.at(i), states.at(i), dev, "ATA");
+    }
+  }
+
+  selftest_limiter tests(configs, states, allow_selftests);
   for (unsigned i = 0; i < configs.size(); i++) {
     const dev_config & cfg = configs.at(i);
-    dev_state & state = states.at(i);
-    if (state.skip) {
+    if (scheds[i].skip) {
       if (debugmode)
         PrintOut(LOG_INFO, "Device: %s, skipped (interval=%d)\n", cfg.name.c_str(),
                  (cfg.checktime ? cfg.checktime : checktime));
       continue;
     }
 
+    dev_state & state = states.at(i);
+
     smart_device * dev = devices.at(i);
+    log_context_scope lcs(&cfg);
+    int skipcnt = state.powerskipcnt, rc = 1;
     if (dev->is_ata())
-      ATACheckDevice(cfg, state, dev->to_ata(), firstpass, allow_selftests);
+      rc = ATACheckDevice(cfg, state, dev->to_ata(), firstpass, tests,
+                          (!ata_preopened.empty() ? ata_preopened[i] : -1));
     else if (dev->is_scsi())
-      SCSICheckDevice(cfg, state, dev->to_scsi(), allow_selftests);
+      rc = SCSICheckDevice(cfg, state, dev->to_scsi(), tests);
     else if (dev->is_nvme())
-      NVMeCheckDevice(cfg, state, dev->to_nvme());
+      rc = NVMeCheckDevice(cfg, state, dev->to_nvme(), (!nvme_logs.empty() ? &nvme_logs[i] : nullptr));
+
+    // Check is also complete if skipped due to power mode
+    if (!rc || state.powerskipcnt > skipcnt)
+      state.check_time = time(nullptr);
+
+    // Poll progress of self-test between checks
+    scheds[i].polltime = next_selftest_poll(cfg, state, time(nullptr));
 
     // Prevent systemd unit startup timeout when checking many devices on startup
     notify_extend_timeout();
@@ -3977,6 +5243,34 @@ static void CheckDevicesOnce(const dev_config_vector & configs, dev_state_vector
   do_disable_standby_check(configs, states);
 }
 
+// Poll progress of running self-tests which are due between checks
+static void PollSelfTestProgress(const dev_config_vector & configs, dev_state_vector & states,
+                                 dev_schedule_vector & scheds, smart_device_list & devices)
+{
+  time_t now = time(nullptr);
+  for (unsigned i = 0; i < configs.size(); i++) {
+    dev_schedule & sched = scheds[i];
+    if (!(sched.polltime && sched.polltime <= now))
+      continue;
+
+    const dev_config & cfg = configs.at(i);
+    dev_state & state = states.at(i);
+    smart_device * dev = devices.at(i);
+    log_context_scope lcs(&cfg);
+    if (state.test_progress) {
+      if (!dev->open()) {
+        if (debugmode)
+          PrintOut(LOG_INFO, "Device: %s, open() failed: %s\n", cfg.name.c_str(), dev->get_errmsg());
+      }
+      else {
+        sample_selftest_progress(cfg, state, dev, now);
+        CloseDevice(dev, cfg.name.c_str());
+      }
+    }
+    sched.polltime = next_selftest_poll(cfg, state, now);
+  }
+}
+
 // Install all signal handlers
 static void install_signal_handlers()
 {
@@ -4021,6 +5315,25 @@ static void ToggleDebugMode()
 }
 #endif
 
+// Print per-command count, errors and latency of all devices
+static void PrintCmdStats(const dev_config_vector & configs, const smart_device_list & devices)
+{
+  for (unsigned i = 0; i < configs.size(); i++) {
+    const dev_config & cfg = configs.at(i);
+    for (const auto & entry : devices.at(i)->get_cmd_stats()) {
+      const smart_device::cmd_stats & st = entry.second;
+      std::string hist;
+      for (int b = 0; b < smart_device::cmd_stats::num_buckets; b++)
+        hist += strprintf("%s%u", (b ? "/" : ""), st.histogram[b]);
+      PrintOut(LOG_INFO, "Device: %s, command %s: %u issued, %u failed, "
+               "latency min/avg/max %lld/%lld/%lld us [%s]\n",
+               cfg.name.c_str(), smart_device::get_cmd_stats_name(entry.first).c_str(),
+               st.count, st.errors, (st.min_usec >= 0 ? st.min_usec : 0LL),
+               (st.count ? st.total_usec / st.count : 0LL), st.max_usec, hist.c_str());
+    }
+  }
+}
+
 time_t calc_next_wakeuptime(time_t wakeuptime, time_t timenow, int ct)
 {
   if (timenow < wakeuptime)
@@ -4028,12 +5341,12 @@ time_t calc_next_wakeuptime(time_t wakeuptime, time_t timenow, int ct)
   return timenow + ct - (timenow - wakeuptime) % ct;
 }
 
-static time_t dosleep(time_t wakeuptime, const dev_config_vector & configs,
-  dev_state_vector & states, bool & sigwakeup)
+static time_t dosleep(time_t wakeuptime, dev_schedule_vector & scheds, bool & sigwakeup,
+                      bool & pollwakeup)
 {
   // If past wake-up-time, compute next wake-up-time
   time_t timenow = time(nullptr);
-  unsigned n = configs.size();
+  unsigned n = scheds.size();
   int ct;
   if (!checktime_min) {
     // Same for all devices
@@ -4043,18 +5356,23 @@ static time_t dosleep(time_t wakeuptime, const dev_config_vector & configs,
   else {
     // Determine wakeuptime of next device(s)
     wakeuptime = 0;
-    for (unsigned i = 0; i < n; i++) {
-      const dev_config & cfg = configs.at(i);
-      dev_state & state = states.at(i);
-      if (!state.skip)
-        state.wakeuptime = calc_next_wakeuptime((state.wakeuptime ? state.wakeuptime : timenow),
-          timenow, (cfg.checktime ? cfg.checktime : checktime));
-      if (!wakeuptime || state.wakeuptime < wakeuptime)
-        wakeuptime = state.wakeuptime;
+    for (auto & sched : scheds) {
+      if (!sched.skip)
+        sched.wakeuptime = calc_next_wakeuptime((sched.wakeuptime ? sched.wakeuptime : timenow),
+          timenow, (sched.checktime ? sched.checktime : checktime));
+      if (!wakeuptime || sched.wakeuptime < wakeuptime)
+        wakeuptime = sched.wakeuptime;
     }
     ct = checktime_min;
   }
 
+  // Earliest poll of self-test progress, 0 if none
+  time_t polltime = 0;
+  for (const auto & sched : scheds) {
+    if (sched.polltime && (!polltime || sched.polltime < polltime))
+      polltime = sched.polltime;
+  }
+
   notify_wait(wakeuptime, n);
 
   // Sleep until we catch a signal or have completed sleeping
@@ -4065,13 +5383,20 @@ static time_t dosleep(time_t wakeuptime, const dev_config_vector & configs,
     if (wakeuptime > timenow + ct) {
       PrintOut(LOG_INFO, "System clock time adjusted to the past. Resetting next wakeup time.\n");
       wakeuptime = timenow + ct;
-      for (auto & state : states)
-        state.wakeuptime = 0;
+      for (auto & sched : scheds)
+        sched.wakeuptime = 0;
       no_skip = true;
     }
     
-    // Exit sleep when time interval has expired or a signal is received
-    sleep(wakeuptime+addtime-timenow);
+    // Return early if self-test progress poll is due
+    bool poll = (polltime && !addtime && !no_skip);
+    if (poll && polltime <= timenow) {
+      pollwakeup = true;
+      return wakeuptime;
+    }
+
+    // Exit sleep when time interval has expired, poll is due or a signal is received
+    sleep((poll && polltime < wakeuptime ? polltime : wakeuptime+addtime) - timenow);
 
 #ifdef _WIN32
     // toggle debug mode?
@@ -4107,8 +5432,8 @@ static time_t dosleep(time_t wakeuptime, const dev_config_vector & configs,
 
   // Check which devices must be skipped in this cycle
   if (checktime_min) {
-    for (auto & state : states)
-      state.skip = (!no_skip && timenow < state.wakeuptime);
+    for (auto & sched : scheds)
+      sched.skip = (!no_skip && timenow < sched.wakeuptime);
   }
   
   // return adjusted wakeuptime
@@ -4157,6 +5482,18 @@ static void printoutvaliddirectiveargs(int priority, char d)
   case 'c':
     PrintOut(priority, "i=N, interval=N");
     break;
+  case 'A':
+    PrintOut(priority, "DAYS[,RATE[,WINDOW]] (DAYS 0-3650, WINDOW 1-365)");
+    break;
+  case 'D':
+    PrintOut(priority, "PAGE,OFFSET[,LIMIT[,DIFF]] (PAGE 1-255, OFFSET 8-504, multiple of 8)");
+    break;
+  case 'g':
+    PrintOut(priority, "GROUP,N (N > 0)");
+    break;
+  case 'x':
+    PrintOut(priority, "MINUTES[,DAYS] (MINUTES 1-1440, DAYS 0-3650)");
+    break;
   }
 }
 
@@ -4381,6 +5718,9 @@ static int ParseToken(char * token, dev_config & cfg, smart_devtype_list & scan_
     } else if (!strcmp(arg, "selfteststs,ns")) {
       // track changes in self-test execution status, disable auto standby
       cfg.selfteststs = cfg.selfteststs_ns = true;
+    } else if (!strcmp(arg, "scttemp")) {
+      // append SCT Temperature History to attribute log
+      cfg.scttemp_hist = true;
     } else if (!strncmp(arg, "scterc,", sizeof("scterc,")-1)) {
         // set SCT Error Recovery Control
         unsigned rt = ~0, wt = ~0; int nc = -1;
@@ -4481,6 +5821,7 @@ static int ParseToken(char * token, dev_config & cfg, smart_devtype_list & scan_
       PrintOut(LOG_INFO, "File %s line %d (drive %s): ignoring previous Test Directive -s %s\n",
                configfile, lineno, name, cfg.test_regex.get_pattern());
       cfg.test_regex = regular_expression();
+      cfg.test_sched.reset();
     }
     // check for missing argument
     if (!(arg = strtok(nullptr, delim))) {
@@ -4494,6 +5835,7 @@ static int ParseToken(char * token, dev_config & cfg, smart_devtype_list & scan_
                  configfile, lineno, name, arg, cfg.test_regex.get_errmsg());
         return -1;
       }
+      cfg.test_sched = std::make_shared<test_schedule>(cfg.test_regex);
       // Do a bit of sanity checking and warn user if we think that
       // their regexp is "strange". User probably confused about shell
       // glob(3) syntax versus regular expression syntax regexp(7).
@@ -4596,6 +5938,48 @@ static int ParseToken(char * token, dev_config & cfg, smart_devtype_list & scan_
                      &cfg.tempdiff, &cfg.tempinfo, &cfg.tempcrit) < 0)
       return -1;
     break;
+  case 'D':
+    // monitor Device Statistics value
+    if (!(arg = strtok(nullptr, delim))) {
+      missingarg = 1;
+    } else {
+      int page = -1, offset = -1; int64_t limit = 0, diff = 0;
+      int n2 = -1, n3 = -1, n4 = -1, len = strlen(arg);
+      if (!(   sscanf(arg, "%i,%i%n,%" SCNi64 "%n,%" SCNi64 "%n",
+                      &page, &offset, &n2, &limit, &n3, &diff, &n4) >= 2
+            && (n2 == len || n3 == len || n4 == len)
+            && 0 < page && page <= 0xff && 8 <= offset && offset <= 512-8
+            && !(offset & 7) && diff >= 0)) {
+        badarg = 1;
+      } else {
+        devstat_monitor dm;
+        dm.page = (unsigned char)page;
+        dm.offset = (unsigned short)offset;
+        dm.limit = limit;
+        dm.diff = (uint64_t)diff;
+        cfg.devstat_mons.push_back(dm);
+      }
+    }
+    break;
+  case 'A':
+    // track trends, warn on predicted failures
+    if (!(arg = strtok(nullptr, delim))) {
+      missingarg = 1;
+    } else {
+      unsigned days = 0, rate = 0, window = 7;
+      int n1 = -1, n2 = -1, n3 = -1, len = strlen(arg);
+      if (!(   sscanf(arg, "%u%n,%u%n,%u%n", &days, &n1, &rate, &n2, &window, &n3) >= 1
+            && (n1 == len || n2 == len || n3 == len)
+            && days <= 3650 && (days || rate) && 1 <= window && window <= 365)) {
+        badarg = 1;
+      } else {
+        cfg.trend = true;
+        cfg.trend_days = (unsigned short)days;
+        cfg.trend_rate = rate;
+        cfg.trend_window = (unsigned char)window;
+      }
+    }
+    break;
   case 'v':
     // non-default vendor-specific attribute meaning
     if (!(arg = strtok(nullptr, delim))) {
@@ -4712,6 +6096,41 @@ static int ParseToken(char * token, dev_config & cfg, smart_devtype_list & scan_
     }
     break;
 
+  case 'g':
+    // Limit concurrent tests of a group of devices
+    if (!(arg = strtok(nullptr, delim))) {
+      missingarg = true;
+    }
+    else {
+      char group[32+1]; int n = 0, n1 = -1, n2 = -1, len = strlen(arg);
+      if (   sscanf(arg, "%32[^,]%n,%d%n", group, &n1, &n, &n2) == 2
+          && n1 < len && n2 == len && n > 0) {
+        cfg.test_group = group;
+        cfg.test_group_max = n;
+      }
+      else
+        badarg = true;
+    }
+    break;
+
+  case 'x':
+    // Plan rolling selective self-tests
+    if (!(arg = strtok(nullptr, delim))) {
+      missingarg = true;
+    }
+    else {
+      int minutes = 0, days = 0, n1 = -1, n2 = -1, len = strlen(arg);
+      if (   sscanf(arg, "%d%n,%d%n", &minutes, &n1, &days, &n2) >= 1
+          && (n1 == len || n2 == len) && 0 < minutes && minutes <= 1440
+          && 0 <= days && days <= 3650) {
+        cfg.selective_plan_minutes = minutes;
+        cfg.selective_plan_days = days;
+      }
+      else
+        badarg = true;
+    }
+    break;
+
   default:
     // Directive not recognized
     PrintOut(LOG_CRIT,"File %s line %d (drive %s): unknown Directive: %s\n",
@@ -4807,7 +6226,8 @@ static int ParseConfigLine(dev_config_vector & conf_entries, dev_config & defaul
         || cfg.errorlog    || cfg.xerrorlog
         || cfg.offlinests  || cfg.selfteststs
         || cfg.usagefailed || cfg.prefail  || cfg.usage
-        || cfg.tempdiff    || cfg.tempinfo || cfg.tempcrit)) {
+        || cfg.tempdiff    || cfg.tempinfo || cfg.tempcrit
+        || cfg.trend       || !cfg.devstat_mons.empty())) {
     
     PrintOut(LOG_INFO,"Drive: %s, implied '-a' Directive on line %d of file %s\n",
              cfg.name.c_str(), cfg.lineno, configfile);
@@ -5033,7 +6453,7 @@ static int parse_options(int argc, char **argv)
 #endif
 
   // Please update GetValidArgList() if you edit shortopts
-  static const char shortopts[] = "c:l:q:dDni:p:r:s:A:B:w:Vh?"
+  static const char shortopts[] = "c:l:q:dDni:p:r:s:S:t:A:B:w:Vh?"
 #if defined(HAVE_POSIX_API) || defined(_WIN32)
                                                           "u:"
 #endif
@@ -5057,6 +6477,8 @@ static int parse_options(int argc, char **argv)
     { "pidfile",        required_argument, 0, 'p' },
     { "report",         required_argument, 0, 'r' },
     { "savestates",     required_argument, 0, 's' },
+    { "statusfile",     required_argument, 0, 'S' },
+    { "test-limit",     required_argument, 0, 't' },
     { "attributelog",   required_argument, 0, 'A' },
     { "drivedb",        required_argument, 0, 'B' },
     { "warnexec",       required_argument, 0, 'w' },
@@ -5141,6 +6563,10 @@ static int parse_options(int argc, char **argv)
         facility=LOG_LOCAL6;
       else if (!strcmp(optarg, "local7"))
         facility=LOG_LOCAL7;
+#ifdef HAVE_LIBSYSTEMD
+      else if (!strcmp(optarg, "journal"))
+        log_to_journal = true;
+#endif
       else
         badarg = true;
       break;
@@ -5174,6 +6600,16 @@ static int parse_options(int argc, char **argv)
       }
       checktime = (int)lchecktime;
       break;
+    case 't':
+      // Max number of concurrent tests
+      {
+        int n = -1, nc = -1;
+        if (!(sscanf(optarg, "%d%n", &n, &nc) == 1 && nc == (int)strlen(optarg) && n >= 0))
+          badarg = true;
+        else
+          test_limit = n;
+      }
+      break;
     case 'r':
       // report IOCTL transactions
       {
@@ -5210,6 +6646,10 @@ static int parse_options(int argc, char **argv)
       // path prefix of persistent state file
       state_path_prefix = (strcmp(optarg, "-") ? optarg : "");
       break;
+    case 'S':
+      // status file for smartctl
+      status_file = optarg;
+      break;
     case 'A':
       // path prefix of attribute log file
       attrlog_path_prefix = (strcmp(optarg, "-") ? optarg : "");
@@ -5348,6 +6788,7 @@ static int parse_options(int argc, char **argv)
     // absolute path names are required due to chdir('/') in daemon_init()
     if (!(   check_abs_path('p', pid_file)
           && check_abs_path('s', state_path_prefix)
+          && check_abs_path('S', status_file)
           && check_abs_path('A', attrlog_path_prefix)))
       return EXIT_BADCMD;
   }
@@ -5475,9 +6916,12 @@ static int ReadOrMakeConfigEntries(dev_config_vector & conf_entries, smart_devic
 }
 
 // Register one device, return false on error
+// If 'scan_type' is set, 'dev' is already opened with autodetect support
+// and 'scan_type' is the device type before autodetection.
 static bool register_device(dev_config & cfg, dev_state & state, smart_device_auto_ptr & dev,
-                            const dev_config_vector * prev_cfgs)
+                            const dev_config_vector * prev_cfgs, const char * scan_type = nullptr)
 {
+  log_context_scope lcs(&cfg);
   bool scanning;
   if (!dev) {
     // Get device of appropriate type
@@ -5499,8 +6943,11 @@ static bool register_device(dev_config & cfg, dev_state & state, smart_device_au
   // Save old info
   smart_device::device_info oldinfo = dev->get_info();
 
-  // Open with autodetect support, may return 'better' device
-  dev.replace( dev->autodetect_open() );
+  if (scan_type)
+    oldinfo.dev_type = scan_type;
+  else
+    // Open with autodetect support, may return 'better' device
+    dev.replace( dev->autodetect_open() );
 
   // Report if type has changed
   if (oldinfo.dev_type != dev->get_dev_type())
@@ -5561,17 +7008,52 @@ static bool register_device(dev_config & cfg, dev_state & state, smart_device_au
 // registered is moved onto the [ata|scsi]devices lists and removed
 // from the conf_entries list.
 static bool register_devices(const dev_config_vector & conf_entries, smart_device_list & scanned_devs,
-                             dev_config_vector & configs, dev_state_vector & states, smart_device_list & devices)
+                             dev_config_vector & configs, dev_state_vector & states,
+                             dev_schedule_vector & scheds, smart_device_list & devices)
 {
   // start by clearing lists/memory of ALL existing devices
   configs.clear();
   devices.clear();
   states.clear();
+  scheds.clear();
 
   // Map of already seen non-DEVICESCAN devices (unique_name -> cfg.name)
   typedef std::map<std::string, std::string> prev_unique_names_map;
   prev_unique_names_map prev_unique_names;
 
+  // Open devices from DEVICESCAN concurrently unless debug output is requested.
+  // Skip devices which are ignored or duplicates of preceding non-DEVICESCAN
+  // entries, see below.
+  smart_device_list opened_devs;
+  std::vector<std::string> scan_types(scanned_devs.size());
+  if (!debugmode) {
+    std::set<std::string> prev_names;
+    bool found = false;
+    for (unsigned i = 0; i < scanned_devs.size() && i < conf_entries.size(); i++) {
+      const dev_config & cfg = conf_entries[i];
+      std::string unique_name = smi()->get_unique_dev_name(cfg.dev_name.c_str(), cfg.dev_type.c_str());
+      smart_device * dev = scanned_devs.at(i);
+      if (!dev)
+        prev_names.insert(unique_name);
+      else if (!(cfg.ignore || prev_names.count(unique_name))) {
+        scan_types[i] = dev->get_dev_type();
+        dev = scanned_devs.release(i);
+        found = true;
+      }
+      else
+        dev = nullptr;
+      opened_devs.push_back(dev);
+    }
+    if (found) {
+      notify_extend_timeout();
+      smi()->autodetect_open_devices(opened_devs);
+    }
+  }
+
+  // Distinct attribute definition tables and decoders of registered devices
+  std::vector<ata_vendor_attr_defs> attr_defs_pool;
+  std::vector<std::shared_ptr<const ata_attr_decoder>> attr_decoder_pool;
+
   // Register entries
   for (unsigned i = 0; i < conf_entries.size(); i++) {
     dev_config cfg = conf_entries[i];
@@ -5597,8 +7079,14 @@ static bool register_devices(const dev_config_vector & conf_entries, smart_devic
 
     // Device may already be detected during devicescan
     bool scanning = false;
+    const char * scan_type = nullptr;
     if (i < scanned_devs.size()) {
       dev = scanned_devs.release(i);
+      if (!dev && i < opened_devs.size() && opened_devs.at(i)) {
+        // Already opened above
+        dev = opened_devs.release(i);
+        scan_type = scan_types[i].c_str();
+      }
       if (dev) {
         // Check for a preceding non-DEVICESCAN entry for the same device
         prev_unique_names_map::iterator ui = prev_unique_names.find(unique_name);
@@ -5618,7 +7106,7 @@ static bool register_devices(const dev_config_vector & conf_entries, smart_devic
     // Register device
     // If scanning, pass dev_idinfo of previous devices for duplicate check
     dev_state state;
-    if (!register_device(cfg, state, dev, (scanning ? &configs : 0))) {
+    if (!register_device(cfg, state, dev, (scanning ? &configs : 0), scan_type)) {
       // if device is explicitly listed and we can't register it, then
       // exit unless the user has specified that the device is removable
       if (!scanning) {
@@ -5634,9 +7122,14 @@ static bool register_devices(const dev_config_vector & conf_entries, smart_devic
       continue;
     }
 
+    // Share attribute definitions with devices using the same presets
+    ata_intern_attr_defs(cfg.attribute_defs, attr_defs_pool);
+    if (dev->is_ata())
+      cfg.attr_decoder = ata_get_attr_decoder(cfg.attribute_defs, attr_decoder_pool);
+
     // move onto the list of devices
     configs.push_back(cfg);
-    states.push_back(state);
+    states.push_back(std::move(state));
     devices.push_back(dev);
     if (!scanning)
       // Store for duplicate detection
@@ -5652,9 +7145,24 @@ static bool register_devices(const dev_config_vector & conf_entries, smart_devic
     if (!cfg.test_regex.empty())
       cfg.test_offset_factor = factor++;
   }
+
+  // Use the lowest limit if devices of a test group specify different limits
+  for (auto & cfg : configs) {
+    if (!cfg.test_group_max)
+      continue;
+    for (const auto & cfg2 : configs) {
+      if (cfg2.test_group == cfg.test_group && cfg2.test_group_max < cfg.test_group_max)
+        cfg.test_group_max = cfg2.test_group_max;
+    }
+  }
   if (checktime_min && checktime_min > checktime)
     checktime_min = checktime;
 
+  // Scheduling data
+  scheds.resize(configs.size());
+  for (unsigned i = 0; i < configs.size(); i++)
+    scheds[i].checktime = configs[i].checktime;
+
   init_disable_standby_check(configs);
   return true;
 }
@@ -5680,6 +7188,8 @@ static int main_worker(int argc, char **argv)
   dev_config_vector configs;
   // Device states
   dev_state_vector states;
+  // Scheduling data of devices
+  dev_schedule_vector scheds;
   // Devices to monitor
   smart_device_list devices;
 
@@ -5689,7 +7199,7 @@ static int main_worker(int argc, char **argv)
   notify_msg("Initializing ...");
 
   // the main loop of the code
-  bool firstpass = true, write_states_always = true;
+  bool firstpass = true, write_states_always = true, print_cmd_stats = false;
   time_t wakeuptime = 0;
   // assert(status < 0);
   do {
@@ -5716,11 +7226,12 @@ static int main_worker(int argc, char **argv)
 
         if (entries>=0) {
           // checks devices, then moves onto ata/scsi list or deallocates.
-          if (!register_devices(conf_entries, scanned_devs, configs, states, devices)) {
+          if (!register_devices(conf_entries, scanned_devs, configs, states, scheds, devices)) {
             status = EXIT_BADDEV;
             break;
           }
-          if (!(configs.size() == devices.size() && configs.size() == states.size()))
+          if (!(   configs.size() == devices.size() && configs.size() == states.size()
+                && configs.size() == scheds.size()                                    ))
             throw std::logic_error("Invalid result from RegisterDevices");
         }
         else if (   quit == QUIT_NEVER
@@ -5773,7 +7284,12 @@ static int main_worker(int argc, char **argv)
     // check all devices once,
     // self tests are not started in first pass unless '-q onecheck' is specified
     notify_check((int)devices.size());
-    CheckDevicesOnce(configs, states, devices, firstpass, (!firstpass || quit == QUIT_ONECHECK));
+    CheckDevicesOnce(configs, states, scheds, devices, firstpass, (!firstpass || quit == QUIT_ONECHECK));
+
+    // Print command statistics in debug mode or if requested by SIGUSR1
+    if (debugmode || print_cmd_stats)
+      PrintCmdStats(configs, devices);
+    print_cmd_stats = false;
 
      // Write state files
     if (!state_path_prefix.empty())
@@ -5784,6 +7300,10 @@ static int main_worker(int argc, char **argv)
     if (!attrlog_path_prefix.empty())
       write_all_dev_attrlogs(configs, states);
 
+    // Publish status for smartctl
+    if (!status_file.empty())
+      write_status_file(configs, states, devices);
+
     // user has asked us to exit after first check
     if (quit == QUIT_ONECHECK) {
       PrintOut(LOG_INFO,"Started with '-q onecheck' option. All devices successfully checked once.\n"
@@ -5814,8 +7334,18 @@ static int main_worker(int argc, char **argv)
       firstpass = false;
     }
 
-    // sleep until next check time, or a signal arrives
-    wakeuptime = dosleep(wakeuptime, configs, states, write_states_always);
+    // sleep until next check time, or a signal arrives,
+    // poll progress of running self-tests in between
+    bool sigwakeup = false, pollwakeup;
+    for (;;) {
+      pollwakeup = false;
+      wakeuptime = dosleep(wakeuptime, scheds, sigwakeup, pollwakeup);
+      if (!pollwakeup)
+        break;
+      PollSelfTestProgress(configs, states, scheds, devices);
+    }
+    if (sigwakeup)
+      write_states_always = print_cmd_stats = true;
 
   } while (!caughtsigEXIT);
 
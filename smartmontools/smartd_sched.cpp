@@ -0,0 +1,165 @@
+/*
+ * smartd_sched.cpp
+ *
+ * Home page of code is: https://www.smartmontools.org
+ *
+ * Copyright (C) 2026 Smartmontools developers
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include "smartd_sched.h"
+
+#include <algorithm> // std::sort()
+#include <map>
+
+const char * smartd_sched_cpp_cvsid = "$Id$"
+  SMARTD_SCHED_H_CVSID;
+
+typedef std::map<std::string, int> group_count_map;
+
+static int limit_reached(const selftest_slot & slot, int host_max, int host_cnt,
+                         const group_count_map & group_cnt, bool & in_group)
+{
+  if (host_max > 0 && host_cnt >= host_max) {
+    in_group = false;
+    return host_max;
+  }
+  if (slot.group_max > 0) {
+    group_count_map::const_iterator it = group_cnt.find(slot.group);
+    if (it != group_cnt.end() && it->second >= slot.group_max) {
+      in_group = true;
+      return slot.group_max;
+    }
+  }
+  return 0;
+}
+
+static void add_test(const selftest_slot & slot, int & host_cnt, group_count_map & group_cnt)
+{
+  host_cnt++;
+  if (slot.group_max > 0)
+    group_cnt[slot.group]++;
+}
+
+int selftest_limit_reached(const std::vector<selftest_slot> & slots, unsigned idx,
+                           int host_max, bool & in_group)
+{
+  // Count running tests
+  int host_cnt = 0;
+  group_count_map group_cnt;
+  for (unsigned i = 0; i < slots.size(); i++) {
+    if (i != idx && slots[i].running)
+      add_test(slots[i], host_cnt, group_cnt);
+  }
+
+  // Reserve slots for tests deferred before, oldest first
+  time_t deferred = slots[idx].deferred;
+  std::vector<std::pair<time_t, unsigned>> earlier;
+  for (unsigned i = 0; i < slots.size(); i++) {
+    time_t t = slots[i].deferred;
+    if (   i != idx && t && !slots[i].running
+        && (!deferred || t < deferred || (t == deferred && i < idx)))
+      earlier.push_back(std::make_pair(t, i));
+  }
+  std::sort(earlier.begin(), earlier.end());
+  for (const auto & e : earlier) {
+    bool unused;
+    if (!limit_reached(slots[e.second], host_max, host_cnt, group_cnt, unused))
+      add_test(slots[e.second], host_cnt, group_cnt);
+  }
+
+  return limit_reached(slots[idx], host_max, host_cnt, group_cnt, in_group);
+}
+
+void plan_selective_span(selective_plan_state & plan, const selective_plan_args & args,
+                         time_t now, selective_span & span)
+{
+  span = selective_span();
+  uint64_t num_sectors = args.num_sectors;
+
+  // Last span of current pass is done unless the most recent test
+  // was not completed
+  if (   plan.pass_start && args.last_done
+      && args.last_start == plan.next_lba && args.last_end >= plan.next_lba)
+    plan.next_lba = args.last_end + 1;
+
+  if (plan.pass_start && plan.next_lba >= num_sectors) {
+    span.pass_done = true;
+    span.pass_tests = plan.tests;
+    span.pass_start = plan.pass_start;
+    plan.pass_start = 0;
+  }
+  if (!plan.pass_start) {
+    plan.pass_start = now;
+    plan.next_lba = 0;
+    plan.tests = 0;
+  }
+
+  uint64_t size = (args.rate ? args.rate * 60 * args.minutes : num_sectors / 100);
+
+  // Increase size if pace of tests in current pass is too slow
+  uint64_t todo = num_sectors - plan.next_lba;
+  if (args.days) {
+    double elapsed = (now - plan.pass_start) / (24*3600.0);
+    double per_day = plan.tests / (elapsed > 1 ? elapsed : 1);
+    if (per_day < 1)
+      per_day = 1;
+    double tests_left = (args.days - elapsed) * per_day;
+    uint64_t min_size = (tests_left > 1 ? (uint64_t)(todo / tests_left) + 1 : todo);
+    if (size < min_size) {
+      span.increased_from = size;
+      size = min_size;
+    }
+  }
+  if (size < 1)
+    size = 1;
+
+  uint64_t start;
+  if (plan.error_lba && plan.error_lba < num_sectors) {
+    // Span around recent error, keep position of pass
+    uint64_t lba = plan.error_lba;
+    start = (lba > size / 2 ? lba - size / 2 : 0);
+    if (size > num_sectors - start)
+      start = (size < num_sectors ? num_sectors - size : 0);
+  }
+  else {
+    start = plan.next_lba;
+    plan.tests++;
+  }
+  plan.error_lba = 0;
+
+  span.start = start;
+  span.end = (size <= num_sectors - start ? start + size - 1 : num_sectors - 1);
+}
+
+int select_sct_temp_entries(const ata_sct_temperature_history_table & tmh,
+                            const persistent_dev_state & state, bool have_state_file,
+                            time_t now, std::vector<sct_temp_entry> & entries)
+{
+  entries.clear();
+  int size = tmh.cb_size, index = tmh.cb_index, interval = tmh.interval;
+
+  // The ring buffer cannot have wrapped if less time than it covers has
+  // passed since the last read.  Otherwise take all entries and drop the
+  // ones which overlap with samples already written.
+  int num = size;
+  if (   state.scttemp_last_time && interval == state.scttemp_interval
+      && now - state.scttemp_last_time < (time_t)size * interval * 60)
+    num = (index - state.scttemp_last_index + size) % size;
+  // Without state file, the position is lost at each restart.  Don't write
+  // the whole table again, start with the entries added after this read.
+  else if (!state.scttemp_last_time && !have_state_file)
+    num = 0;
+
+  for (int i = num - 1; i >= 0; i--) {
+    signed char temp = tmh.cb[(index - i + size) % size];
+    time_t t = now - (time_t)i * interval * 60;
+    if (temp == -128 || t <= state.scttemp_last_time)
+      continue; // Invalid or already written
+    entries.push_back({t, temp});
+  }
+  return num;
+}
@@ -0,0 +1,87 @@
+/*
+ * smartd_sched.h
+ *
+ * Home page of code is: https://www.smartmontools.org
+ *
+ * Copyright (C) 2026 Smartmontools developers
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef SMARTD_SCHED_H
+#define SMARTD_SCHED_H
+
+#define SMARTD_SCHED_H_CVSID "$Id$"
+
+#include "smartd_state.h"
+
+#include <stdint.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+// Decisions of the smartd check cycle which do not access devices.
+
+// Test state of a device as seen by the limits of concurrently running
+// tests ('-t N' option, '-g GROUP,N' directive).
+struct selftest_slot
+{
+  std::string group;                      // Group name, empty if none
+  int group_max = 0;                      // Max tests in group, 0 if unlimited
+  bool running = false;                   // Test in progress
+  time_t deferred = 0;                    // Time of first deferral of due test, 0 if none
+};
+
+// Return 0 if device 'idx' may start a test now, otherwise the limit
+// which is reached.  Set 'in_group' to true if this is the group limit.
+// Host limit 'host_max' is 0 if unlimited.  Slots are reserved for
+// tests deferred earlier on other devices, oldest first.
+int selftest_limit_reached(const std::vector<selftest_slot> & slots, unsigned idx,
+                           int host_max, bool & in_group);
+
+// Input of plan_selective_span().
+struct selective_plan_args
+{
+  uint64_t num_sectors = 0;               // Size of disk
+  uint64_t rate = 0;                      // Scan rate in sectors per second, 0 if unknown
+  int minutes = 0;                        // Target duration of a test ('-x MINUTES')
+  int days = 0;                           // Max days per full pass ('-x ...,DAYS'), 0 if none
+  uint64_t last_start = 0, last_end = 0;  // Span of most recent selective self-test
+  bool last_done = false;                 // False if most recent test was aborted or
+                                          // interrupted by host or is still running
+};
+
+// Output of plan_selective_span().
+struct selective_span
+{
+  uint64_t start = 0, end = 0;            // Span of next test
+  bool pass_done = false;                 // Previous full pass was completed
+  int pass_tests = 0;                     // Number of tests of completed pass
+  time_t pass_start = 0;                  // Start of completed pass
+  uint64_t increased_from = 0;            // Span size before increase to cover disk
+                                          // within DAYS, 0 if not increased
+};
+
+// Plan span of next rolling selective self-test and update 'plan'.
+// Span size follows from scan rate and target duration and is increased
+// if required to cover the disk within DAYS.  A span around the LBA of a
+// recent error is tested first.
+void plan_selective_span(selective_plan_state & plan, const selective_plan_args & args,
+                         time_t now, selective_span & span);
+
+// Entry of SCT Temperature History to append to the history file.
+struct sct_temp_entry
+{
+  time_t time;                            // Estimated time of sample
+  int temp;                               // Temperature in Celsius
+};
+
+// Select entries of the SCT Temperature History ring buffer added since
+// the last read recorded in 'state'.  Without a state file, all entries
+// are skipped on first read.  Return the number of entries checked.
+int select_sct_temp_entries(const ata_sct_temperature_history_table & tmh,
+                            const persistent_dev_state & state, bool have_state_file,
+                            time_t now, std::vector<sct_temp_entry> & entries);
+
+#endif // SMARTD_SCHED_H
@@ -0,0 +1,358 @@
+/*
+ * smartd_state.cpp
+ *
+ * Home page of code is: https://www.smartmontools.org
+ *
+ * Copyright (C) 2026 Smartmontools developers
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+#define __STDC_FORMAT_MACROS 1 // enable PRI* for C++
+
+#include "smartd_state.h"
+#include "utility.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef _WIN32
+#include <io.h> // unlink()
+#endif
+#ifdef __CYGWIN__
+#include <io.h> // setmode()
+#endif
+
+const char * smartd_state_cpp_cvsid = "$Id$"
+  SMARTD_STATE_H_CVSID;
+
+// Set value of a state file key with a single value.
+static bool set_dev_state_value(persistent_dev_state & state, const char * name, uint64_t val)
+{
+  if (!strcmp(name, "temperature-min"))
+    state.tempmin = (unsigned char)val;
+  else if (!strcmp(name, "temperature-max"))
+    state.tempmax = (unsigned char)val;
+  else if (!strcmp(name, "self-test-errors"))
+    state.selflogcount = (unsigned char)val;
+  else if (!strcmp(name, "self-test-last-err-hour"))
+    state.selfloghour = (unsigned short)val;
+  else if (!strcmp(name, "scheduled-test-next-check"))
+    state.scheduled_test_next_check = (time_t)val;
+  else if (!strcmp(name, "selective-test-last-start"))
+    state.selective_test_last_start = val;
+  else if (!strcmp(name, "selective-test-last-end"))
+    state.selective_test_last_end = val;
+  else if (!strcmp(name, "ata-error-count"))
+    state.ataerrorcount = (int)val;
+  else if (!strcmp(name, "nvme-err-log-entries"))
+    state.nvme_err_log_entries = val;
+  else if (!strcmp(name, "ata-gplog-max-sectors"))
+    state.gplog_max_sectors = (unsigned short)val;
+  else if (!strcmp(name, "ata-smartlog-max-sectors"))
+    state.smartlog_max_sectors = (unsigned short)val;
+  else if (!strcmp(name, "capability-profile-id"))
+    state.caps.id = (uint32_t)val;
+  else if (!strcmp(name, "capability-checked"))
+    state.caps.checked = (uint32_t)val;
+  else if (!strcmp(name, "capability-supported"))
+    state.caps.supported = (uint32_t)val;
+  else if (!strcmp(name, "scsi-mode-sense-length"))
+    state.caps.modese_len = (unsigned char)val;
+  else if (!strcmp(name, "self-test-duration-short"))
+    state.selftest_duration_short = (int)val;
+  else if (!strcmp(name, "self-test-duration-long"))
+    state.selftest_duration_long = (int)val;
+  else if (!strcmp(name, "selective-test-rate"))
+    state.selective_test_rate = val;
+  else if (!strcmp(name, "selective-plan-next-lba"))
+    state.selective_plan.next_lba = val;
+  else if (!strcmp(name, "selective-plan-pass-start"))
+    state.selective_plan.pass_start = (time_t)val;
+  else if (!strcmp(name, "selective-plan-tests"))
+    state.selective_plan.tests = (int)val;
+  else if (!strcmp(name, "selective-plan-error-lba"))
+    state.selective_plan.error_lba = val;
+  else if (!strcmp(name, "scttemp-next-read"))
+    state.scttemp_next_read = (time_t)val;
+  else if (!strcmp(name, "scttemp-last-time"))
+    state.scttemp_last_time = (time_t)val;
+  else if (!strcmp(name, "scttemp-last-index"))
+    state.scttemp_last_index = (int)val;
+  else if (!strcmp(name, "scttemp-interval"))
+    state.scttemp_interval = (int)val;
+  else
+    return false;
+  return true;
+}
+
+// Parse a line from a state file.
+bool parse_dev_state_line(const char * line, persistent_dev_state & state)
+{
+  static const regular_expression regex(
+    "^ *"
+     "((mail\\.([0-9]+)\\." // (1 (2 (3)
+       "((count)" // (4 (5)
+       "|(first-sent-time)" // (6)
+       "|(last-sent-time)" // (7)
+       ")" // 4)
+      ")" // 2)
+     "|(ata-smart-attribute\\.([0-9]+)\\." // (8 (9)
+       "((id)" // (10 (11)
+       "|(val)" // (12)
+       "|(worst)" // (13)
+       "|(raw)" // (14)
+       "|(resvd)" // (15)
+       ")" // 10)
+      ")" // 8)
+     "|(trend\\.([0-9]+)\\." // (16 (17)
+       "((value)" // (18 (19)
+       "|(time)" // (20)
+       "|(start)" // (21)
+       "|(rate)" // (22)
+       ")" // 18)
+      ")" // 16)
+     "|(ata-devstat\\.([0-9]+)\\.([0-9]+)\\." // (23 (24) (25)
+       "((value)" // (26 (27)
+       "|(base)" // (28)
+       ")" // 26)
+      ")" // 23)
+     "|([a-z][a-z-]*)" // (29) Key with a single value, see set_dev_state_value()
+     ")" // 1)
+     " *= *(-?[0-9]+)[ \n]*$" // (30)
+  );
+
+  const int nmatch = 1+30;
+  regular_expression::match_range match[nmatch];
+  if (!regex.execute(line, nmatch, match))
+    return false;
+  if (match[nmatch-1].rm_so < 0)
+    return false;
+  // Negative values are only valid for trend rates (22) and Device Statistics (23)
+  if (   line[match[nmatch-1].rm_so] == '-'
+      && !(match[22].rm_so >= 0 || match[23].rm_so >= 0))
+    return false;
+
+  uint64_t val = strtoull(line + match[nmatch-1].rm_so, (char **)0, 10);
+
+  if (match[2].rm_so >= 0) {
+    int i = atoi(line+match[3].rm_so);
+    if (!(0 <= i && i < SMARTD_NMAIL))
+      return false;
+    if (i == MAILTYPE_TEST) // Don't suppress test mails
+      return true;
+    if (match[5].rm_so >= 0)
+      state.maillog[i].logged = (int)val;
+    else if (match[6].rm_so >= 0)
+      state.maillog[i].firstsent = (time_t)val;
+    else if (match[7].rm_so >= 0)
+      state.maillog[i].lastsent = (time_t)val;
+    else
+      return false;
+  }
+  else if (match[8].rm_so >= 0) {
+    int i = atoi(line+match[9].rm_so);
+    if (!(0 <= i && i < NUMBER_ATA_SMART_ATTRIBUTES))
+      return false;
+    if (match[11].rm_so >= 0)
+      state.ata_attributes[i].id = (unsigned char)val;
+    else if (match[12].rm_so >= 0)
+      state.ata_attributes[i].val = (unsigned char)val;
+    else if (match[13].rm_so >= 0)
+      state.ata_attributes[i].worst = (unsigned char)val;
+    else if (match[14].rm_so >= 0)
+      state.ata_attributes[i].raw = val;
+    else if (match[15].rm_so >= 0)
+      state.ata_attributes[i].resvd = (unsigned char)val;
+    else
+      return false;
+  }
+  else if (match[16].rm_so >= 0) {
+    int i = atoi(line+match[17].rm_so);
+    if (!(0 <= i && i < NUM_TRENDS))
+      return false;
+    if (match[19].rm_so >= 0)
+      state.trends[i].value = val;
+    else if (match[20].rm_so >= 0)
+      state.trends[i].time = (time_t)val;
+    else if (match[21].rm_so >= 0)
+      state.trends[i].start = (time_t)val;
+    else if (match[22].rm_so >= 0)
+      state.trends[i].rate = (int64_t)val; // strtoull() also accepts negative values
+    else
+      return false;
+  }
+  else if (match[23].rm_so >= 0) {
+    int page = atoi(line+match[24].rm_so);
+    int offset = atoi(line+match[25].rm_so);
+    if (!(0 < page && page <= 0xff && 0 < offset && offset < 512))
+      return false;
+    auto & dv = state.devstat_values[page << 16 | offset];
+    if (match[27].rm_so >= 0)
+      dv.val = (int64_t)val;
+    else if (match[28].rm_so >= 0)
+      dv.base = (int64_t)val;
+    else
+      return false;
+  }
+  else if (match[29].rm_so >= 0) {
+    char name[64];
+    snprintf(name, sizeof(name), "%.*s", (int)(match[29].rm_eo - match[29].rm_so),
+             line + match[29].rm_so);
+    return set_dev_state_value(state, name, val);
+  }
+  else
+    return false;
+  return true;
+}
+
+// Read a state file.
+bool read_dev_state(const char * path, persistent_dev_state & state)
+{
+  stdio_file f(path, "r");
+  if (!f) {
+    if (errno != ENOENT)
+      pout("Cannot read state file \"%s\"\n", path);
+    return false;
+  }
+#ifdef __CYGWIN__
+  setmode(fileno(f), O_TEXT); // Allow files with \r\n
+#endif
+
+  persistent_dev_state new_state;
+  int good = 0, bad = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), f)) {
+    const char * s = line + strspn(line, " \t");
+    if (!*s || *s == '#')
+      continue;
+    if (!parse_dev_state_line(line, new_state))
+      bad++;
+    else
+      good++;
+  }
+
+  if (bad) {
+    if (!good) {
+      pout("%s: format error\n", path);
+      return false;
+    }
+    pout("%s: %d invalid line(s) ignored\n", path, bad);
+  }
+
+  // This sets the values missing in the file to 0.
+  state = new_state;
+  return true;
+}
+
+static void write_dev_state_line(FILE * f, const char * name, uint64_t val)
+{
+  if (val)
+    fprintf(f, "%s = %" PRIu64 "\n", name, val);
+}
+
+static void write_dev_state_line(FILE * f, const char * name1, int id, const char * name2, uint64_t val)
+{
+  if (val)
+    fprintf(f, "%s.%d.%s = %" PRIu64 "\n", name1, id, name2, val);
+}
+
+// Write a state file
+bool write_dev_state(const char * path, const persistent_dev_state & state)
+{
+  // Rename old "file" to "file~"
+  std::string pathbak = path; pathbak += '~';
+  unlink(pathbak.c_str());
+  rename(path, pathbak.c_str());
+
+  stdio_file f(path, "w");
+  if (!f) {
+    pout("Cannot create state file \"%s\"\n", path);
+    return false;
+  }
+
+  fprintf(f, "# smartd state file\n");
+  write_dev_state_line(f, "temperature-min", state.tempmin);
+  write_dev_state_line(f, "temperature-max", state.tempmax);
+  write_dev_state_line(f, "self-test-errors", state.selflogcount);
+  write_dev_state_line(f, "self-test-last-err-hour", state.selfloghour);
+  write_dev_state_line(f, "scheduled-test-next-check", state.scheduled_test_next_check);
+  write_dev_state_line(f, "selective-test-last-start", state.selective_test_last_start);
+  write_dev_state_line(f, "selective-test-last-end", state.selective_test_last_end);
+  write_dev_state_line(f, "self-test-duration-short", state.selftest_duration_short);
+  write_dev_state_line(f, "self-test-duration-long", state.selftest_duration_long);
+  write_dev_state_line(f, "selective-test-rate", state.selective_test_rate);
+  write_dev_state_line(f, "selective-plan-next-lba", state.selective_plan.next_lba);
+  write_dev_state_line(f, "selective-plan-pass-start", state.selective_plan.pass_start);
+  write_dev_state_line(f, "selective-plan-tests", state.selective_plan.tests);
+  write_dev_state_line(f, "selective-plan-error-lba", state.selective_plan.error_lba);
+
+  for (int i = 0; i < SMARTD_NMAIL; i++) {
+    if (i == MAILTYPE_TEST) // Don't suppress test mails
+      continue;
+    const mailinfo & mi = state.maillog[i];
+    if (!mi.logged)
+      continue;
+    write_dev_state_line(f, "mail", i, "count", mi.logged);
+    write_dev_state_line(f, "mail", i, "first-sent-time", mi.firstsent);
+    write_dev_state_line(f, "mail", i, "last-sent-time", mi.lastsent);
+  }
+
+  // ATA ONLY
+  write_dev_state_line(f, "ata-error-count", state.ataerrorcount);
+  write_dev_state_line(f, "ata-gplog-max-sectors", state.gplog_max_sectors);
+  write_dev_state_line(f, "ata-smartlog-max-sectors", state.smartlog_max_sectors);
+  write_dev_state_line(f, "scttemp-next-read", state.scttemp_next_read);
+  write_dev_state_line(f, "scttemp-last-time", state.scttemp_last_time);
+  write_dev_state_line(f, "scttemp-last-index", state.scttemp_last_index);
+  write_dev_state_line(f, "scttemp-interval", state.scttemp_interval);
+
+  for (int i = 0; i < NUMBER_ATA_SMART_ATTRIBUTES; i++) {
+    const auto & pa = state.ata_attributes[i];
+    if (!pa.id)
+      continue;
+    write_dev_state_line(f, "ata-smart-attribute", i, "id", pa.id);
+    write_dev_state_line(f, "ata-smart-attribute", i, "val", pa.val);
+    write_dev_state_line(f, "ata-smart-attribute", i, "worst", pa.worst);
+    write_dev_state_line(f, "ata-smart-attribute", i, "raw", pa.raw);
+    write_dev_state_line(f, "ata-smart-attribute", i, "resvd", pa.resvd);
+  }
+
+  for (const auto & dv : state.devstat_values) {
+    unsigned page = dv.first >> 16, offset = dv.first & 0xffff;
+    fprintf(f, "ata-devstat.%u.%u.value = %" PRId64 "\n", page, offset, dv.second.val);
+    fprintf(f, "ata-devstat.%u.%u.base = %" PRId64 "\n", page, offset, dv.second.base);
+  }
+
+  // NVMe only
+  write_dev_state_line(f, "nvme-err-log-entries", state.nvme_err_log_entries);
+
+  // Capability profile
+  if (state.caps.id) {
+    write_dev_state_line(f, "capability-profile-id", state.caps.id);
+    write_dev_state_line(f, "capability-checked", state.caps.checked);
+    write_dev_state_line(f, "capability-supported", state.caps.supported);
+    write_dev_state_line(f, "scsi-mode-sense-length", state.caps.modese_len);
+  }
+
+  // Trends
+  for (const auto & it : state.trends) {
+    int i = it.first; const trend_stat & ts = it.second;
+    if (!ts.time)
+      continue;
+    write_dev_state_line(f, "trend", i, "value", ts.value);
+    write_dev_state_line(f, "trend", i, "time", ts.time);
+    write_dev_state_line(f, "trend", i, "start", ts.start);
+    if (ts.rate)
+      fprintf(f, "trend.%d.rate = %" PRId64 "\n", i, ts.rate);
+  }
+
+  return true;
+}
@@ -0,0 +1,180 @@
+/*
+ * smartd_state.h
+ *
+ * Home page of code is: https://www.smartmontools.org
+ *
+ * Copyright (C) 2026 Smartmontools developers
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef SMARTD_STATE_H
+#define SMARTD_STATE_H
+
+#define SMARTD_STATE_H_CVSID "$Id$"
+
+#include "atacmds.h"
+#include "scsicmds.h"
+
+#include <stdint.h>
+#include <time.h>
+
+#include <map>
+
+// Persistent state of a device monitored by smartd and the state file
+// ('-s PREFIX') which keeps it across restarts.
+
+// Number of allowed mail message types
+static const int SMARTD_NMAIL = 15;
+// Type for '-M test' mails (state not persistent)
+static const int MAILTYPE_TEST = 0;
+// TODO: Add const or enum for all mail types.
+
+struct mailinfo {
+  int logged{};         // number of times an email has been sent
+  time_t firstsent{};   // time first email was sent, as defined by time(2)
+  time_t lastsent{};    // time last email was sent, as defined by time(2)
+};
+
+// Trend of a value monitored by '-A' directive: Smoothed rate of change
+// per day, updated incrementally at each check.
+struct trend_stat {
+  uint64_t value{};                       // Last value
+  time_t time{};                          // Time of last value, 0 if unset
+  time_t start{};                         // Time of first value
+  int64_t rate{};                         // Smoothed change per day * trend_rate_scale
+};
+
+const int trend_rate_scale = 10000;
+
+// Index in persistent_dev_state::trends: Normalized values of ATA
+// attributes use same index as ata_attributes, followed by counters.
+enum {
+  TREND_ATA_REALLOC = NUMBER_ATA_SMART_ATTRIBUTES, // Raw value of Attribute 5
+  TREND_ATA_CURR_PENDING,                 // Raw value of '-C' Attribute
+  TREND_ATA_OFFL_PENDING,                 // Raw value of '-U' Attribute
+  TREND_NVME_USED,                        // Percentage Used
+  TREND_NVME_MEDIA_ERRORS,                // Media and Data Integrity Errors
+  NUM_TRENDS
+};
+
+// Plan of rolling selective self-tests ('-x MINUTES[,DAYS]')
+struct selective_plan_state
+{
+  uint64_t next_lba{};                    // Next LBA of current full surface pass
+  time_t pass_start{};                    // Start of current pass, 0 if none
+  int tests{};                            // Number of tests in current pass
+  uint64_t error_lba{};                   // LBA of recent error to test first, 0 if none
+};
+
+/// Persistent state data for a device.
+struct persistent_dev_state
+{
+  unsigned char tempmin{}, tempmax{};     // Min/Max Temperatures
+
+  unsigned char selflogcount{};           // total number of self-test errors
+  unsigned short selfloghour{};           // lifetime hours of last self-test error
+
+  time_t scheduled_test_next_check{};     // Time of next check for scheduled self-tests
+
+  uint64_t selective_test_last_start{};   // Start LBA of last scheduled selective self-test
+  uint64_t selective_test_last_end{};     // End LBA of last scheduled selective self-test
+
+  int selftest_duration_short{};          // Measured duration of last short self-test
+  int selftest_duration_long{};           // and long self-test in seconds, 0 if unknown
+
+  // Planned selective self-tests ('-x')
+  uint64_t selective_test_rate{};         // Measured sectors per second, 0 if unknown
+  selective_plan_state selective_plan;
+
+  // SCT Temperature History harvesting ('-l scttemp')
+  time_t scttemp_next_read{};             // Time of next read of history table
+  time_t scttemp_last_time{};             // Time of last read, 0 if none
+  int scttemp_last_index{};               // Index of newest entry at last read
+  int scttemp_interval{};                 // Logging interval in minutes at last read
+
+  mailinfo maillog[SMARTD_NMAIL];         // log info on when mail sent
+
+  // ATA ONLY
+  int ataerrorcount{};                    // Total number of ATA errors
+  unsigned short gplog_max_sectors{};     // Max sectors per GP log read, 0 if unknown
+  unsigned short smartlog_max_sectors{};  // Max sectors per SMART log read, 0 if unknown
+
+  // Persistent part of ata_smart_values:
+  struct ata_attribute {
+    unsigned char id{};
+    unsigned char val{};
+    unsigned char worst{}; // Byte needed for 'raw64' attribute only.
+    uint64_t raw{};
+    unsigned char resvd{};
+  };
+  ata_attribute ata_attributes[NUMBER_ATA_SMART_ATTRIBUTES];
+
+  // Device Statistics values monitored by '-D' directives
+  struct devstat_value {
+    int64_t val{};                        // Last value read
+    int64_t base{};                       // Last reported value
+  };
+  std::map<unsigned, devstat_value> devstat_values; // Key: page << 16 | offset
+  
+  // SCSI ONLY
+
+  struct scsi_error_counter_t {
+    struct scsiErrorCounter errCounter{};
+    unsigned char found{};
+  };
+  scsi_error_counter_t scsi_error_counters[3];
+
+  struct scsi_nonmedium_error_t {
+    struct scsiNonMediumError nme{};
+    unsigned char found{};
+  };
+  scsi_nonmedium_error_t scsi_nonmedium_error;
+
+  // NVMe only
+  uint64_t nvme_err_log_entries{};
+
+  // Trends ('-A' directive), only tracked values are present
+  std::map<int, trend_stat> trends;       // Key: index, see TREND_* above
+
+  // Results of capability checks, reused at next startup if the
+  // device identity and relevant directives are unchanged
+  struct cap_profile {
+    uint32_t id{};                        // Hash of identity, 0 if none
+    uint32_t checked{};                   // CAP_* bits of checked capabilities
+    uint32_t supported{};                 // CAP_* bits of supported capabilities
+    unsigned char modese_len{};           // SCSI mode sense/select length, 0 if unknown
+  };
+  cap_profile caps;
+};
+
+// Capabilities in persistent_dev_state::cap_profile
+enum {
+  CAP_ATA_SMART_STATUS    = 0x00001,      // SMART RETURN STATUS works
+  CAP_ATA_SELFTEST_LOG    = 0x00002,      // Self-test log readable
+  CAP_ATA_ERROR_LOG       = 0x00004,      // Summary error log readable
+  CAP_ATA_XERROR_LOG      = 0x00008,      // Ext. Comprehensive error log readable
+  CAP_ATA_POWER_MODE      = 0x00010,      // CHECK POWER MODE works
+  CAP_SCSI_LOG_PAGES      = 0x00100,      // Supported log pages (below) read
+  CAP_SCSI_TEMP_PAGE      = 0x00200,
+  CAP_SCSI_IE_PAGE        = 0x00400,
+  CAP_SCSI_READ_EC_PAGE   = 0x00800,
+  CAP_SCSI_WRITE_EC_PAGE  = 0x01000,
+  CAP_SCSI_VERIFY_EC_PAGE = 0x02000,
+  CAP_SCSI_NME_PAGE       = 0x04000,
+  CAP_SCSI_CHECK_IE       = 0x10000,      // scsiCheckIE() works
+  CAP_SCSI_TEMPERATURE    = 0x20000,      // scsiCheckIE() reports temperature
+  CAP_SCSI_SELFTEST_LOG   = 0x40000,      // Self-test log readable
+};
+
+
+// Parse a line from a state file.
+bool parse_dev_state_line(const char * line, persistent_dev_state & state);
+
+// Read a state file.
+bool read_dev_state(const char * path, persistent_dev_state & state);
+
+// Write a state file
+bool write_dev_state(const char * path, const persistent_dev_state & state);
+
+#endif // SMARTD_STATE_H
@@ -0,0 +1,410 @@
+/*
+ * smartd_test.cpp
+ *
+ * Home page of code is: https://www.smartmontools.org
+ *
+ * Copyright (C) 2026 Smartmontools developers
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Unit tests of smartd modules, run by 'make check'.
+
+#include "config.h"
+
+#include "selftest_progress.h"
+#include "smartd_sched.h"
+#include "smartd_state.h"
+#include "utility.h"
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+static int num_failed = 0;
+
+#define TEST_CHECK(expr) \
+  do { \
+    if (!(expr)) { \
+      printf("%s:%d: FAILED: %s\n", __FILE__, __LINE__, #expr); \
+      num_failed++; \
+    } \
+  } while (0)
+
+// Required by library code, see smartctl.cpp and smartd.cpp
+unsigned char failuretest_permissive = 0;
+
+void pout(const char * fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  vprintf(fmt, ap);
+  va_end(ap);
+}
+
+void pout_flush()
+{
+  fflush(stdout);
+}
+
+void checksumwarning(const char * string)
+{
+  pout("Warning! %s error: invalid SMART checksum.\n", string);
+}
+
+// Values of all keys survive writing and reading a state file.
+static void test_dev_state_file()
+{
+  persistent_dev_state s1;
+  s1.tempmin = 21; s1.tempmax = 52;
+  s1.selflogcount = 3; s1.selfloghour = 12345;
+  s1.scheduled_test_next_check = 1700000001;
+  s1.selective_test_last_start = 1000; s1.selective_test_last_end = 2000;
+  s1.selftest_duration_short = 121; s1.selftest_duration_long = 36001;
+  s1.selective_test_rate = 250000;
+  s1.selective_plan.next_lba = 3000000;
+  s1.selective_plan.pass_start = 1700000006;
+  s1.selective_plan.tests = 4;
+  s1.selective_plan.error_lba = 123456;
+  s1.scttemp_next_read = 1700000007;
+  s1.scttemp_last_time = 1700000008;
+  s1.scttemp_last_index = 477;
+  s1.scttemp_interval = 2;
+  s1.maillog[1].logged = 2;
+  s1.maillog[1].firstsent = 1700000002; s1.maillog[1].lastsent = 1700000003;
+  s1.ataerrorcount = 7;
+  s1.gplog_max_sectors = 64; s1.smartlog_max_sectors = 16;
+  auto & pa = s1.ata_attributes[2];
+  pa.id = 5; pa.val = 100; pa.worst = 99; pa.raw = 0x123456789aULL; pa.resvd = 1;
+  auto & dv = s1.devstat_values[1 << 16 | 8];
+  dv.val = -42; dv.base = 17;
+  s1.nvme_err_log_entries = 9;
+  s1.caps.id = 0x12345678; s1.caps.checked = 0x7f; s1.caps.supported = 0x15;
+  s1.caps.modese_len = 10;
+  auto & ts = s1.trends[TREND_ATA_REALLOC];
+  ts.value = 5; ts.time = 1700000004; ts.start = 1700000005; ts.rate = -12345;
+
+  const char * path = "smartd_test.state";
+  TEST_CHECK(write_dev_state(path, s1));
+  persistent_dev_state s2;
+  TEST_CHECK(read_dev_state(path, s2));
+  unlink(path);
+  unlink("smartd_test.state~");
+
+  TEST_CHECK(s2.tempmin == 21 && s2.tempmax == 52);
+  TEST_CHECK(s2.selflogcount == 3 && s2.selfloghour == 12345);
+  TEST_CHECK(s2.scheduled_test_next_check == 1700000001);
+  TEST_CHECK(s2.selective_test_last_start == 1000 && s2.selective_test_last_end == 2000);
+  TEST_CHECK(s2.selftest_duration_short == 121);
+  TEST_CHECK(s2.selftest_duration_long == 36001);
+  TEST_CHECK(s2.selective_test_rate == 250000);
+  TEST_CHECK(s2.selective_plan.next_lba == 3000000);
+  TEST_CHECK(s2.selective_plan.pass_start == 1700000006);
+  TEST_CHECK(s2.selective_plan.tests == 4);
+  TEST_CHECK(s2.selective_plan.error_lba == 123456);
+  TEST_CHECK(s2.scttemp_next_read == 1700000007);
+  TEST_CHECK(s2.scttemp_last_time == 1700000008);
+  TEST_CHECK(s2.scttemp_last_index == 477);
+  TEST_CHECK(s2.scttemp_interval == 2);
+  TEST_CHECK(s2.maillog[1].logged == 2);
+  TEST_CHECK(s2.maillog[1].firstsent == 1700000002 && s2.maillog[1].lastsent == 1700000003);
+  TEST_CHECK(s2.ataerrorcount == 7);
+  TEST_CHECK(s2.gplog_max_sectors == 64 && s2.smartlog_max_sectors == 16);
+  const auto & pa2 = s2.ata_attributes[2];
+  TEST_CHECK(   pa2.id == 5 && pa2.val == 100 && pa2.worst == 99
+             && pa2.raw == 0x123456789aULL && pa2.resvd == 1);
+  TEST_CHECK(s2.devstat_values.size() == 1);
+  TEST_CHECK(s2.devstat_values[1 << 16 | 8].val == -42);
+  TEST_CHECK(s2.devstat_values[1 << 16 | 8].base == 17);
+  TEST_CHECK(s2.nvme_err_log_entries == 9);
+  TEST_CHECK(s2.caps.id == 0x12345678 && s2.caps.checked == 0x7f);
+  TEST_CHECK(s2.caps.supported == 0x15 && s2.caps.modese_len == 10);
+  TEST_CHECK(s2.trends.size() == 1);
+  const auto & ts2 = s2.trends[TREND_ATA_REALLOC];
+  TEST_CHECK(   ts2.value == 5 && ts2.time == 1700000004
+             && ts2.start == 1700000005 && ts2.rate == -12345);
+
+  // Negative values are only valid for trend rates and Device Statistics
+  persistent_dev_state s3;
+  TEST_CHECK(!parse_dev_state_line("ata-error-count = -1\n", s3));
+  TEST_CHECK(!parse_dev_state_line("ata-smart-attribute.0.raw = -1\n", s3));
+  TEST_CHECK(parse_dev_state_line("trend.1.rate = -1\n", s3));
+  TEST_CHECK(parse_dev_state_line("ata-devstat.1.16.value = -1\n", s3));
+  TEST_CHECK(!parse_dev_state_line("self-test-duration-long = -1\n", s3));
+
+  // Unknown keys
+  TEST_CHECK(!parse_dev_state_line("unknown-key = 1\n", s3));
+  TEST_CHECK(!parse_dev_state_line("temperature-min-x = 1\n", s3));
+  TEST_CHECK(!parse_dev_state_line("mail.1.unknown = 1\n", s3));
+  TEST_CHECK(!parse_dev_state_line("trend.1.rate.x = 1\n", s3));
+}
+
+// Limits of concurrently running tests reserve slots for tests
+// deferred earlier, oldest first.
+static void test_selftest_limits()
+{
+  bool in_group = false;
+  std::vector<selftest_slot> slots(4);
+
+  // No limits, no tests
+  TEST_CHECK(selftest_limit_reached(slots, 0, 0, in_group) == 0);
+  TEST_CHECK(selftest_limit_reached(slots, 0, 1, in_group) == 0);
+
+  // '-t 1': Running test blocks other devices but not itself
+  slots[1].running = true;
+  TEST_CHECK(selftest_limit_reached(slots, 0, 1, in_group) == 1 && !in_group);
+  TEST_CHECK(selftest_limit_reached(slots, 1, 1, in_group) == 0);
+  TEST_CHECK(selftest_limit_reached(slots, 0, 2, in_group) == 0);
+  slots[1].running = false;
+
+  // Oldest deferred test first, then lower index on same time
+  slots[0].deferred = 200; slots[2].deferred = 100; slots[3].deferred = 200;
+  TEST_CHECK(selftest_limit_reached(slots, 2, 1, in_group) == 0);
+  TEST_CHECK(selftest_limit_reached(slots, 0, 1, in_group) == 1);
+  TEST_CHECK(selftest_limit_reached(slots, 3, 1, in_group) == 1);
+  TEST_CHECK(selftest_limit_reached(slots, 1, 1, in_group) == 1);
+  TEST_CHECK(selftest_limit_reached(slots, 0, 2, in_group) == 0);
+  TEST_CHECK(selftest_limit_reached(slots, 3, 2, in_group) == 2);
+  TEST_CHECK(selftest_limit_reached(slots, 3, 3, in_group) == 0);
+  TEST_CHECK(selftest_limit_reached(slots, 1, 3, in_group) == 3);
+
+  // '-g a,1' on devices 0-2, '-g b,2' on device 3
+  slots = std::vector<selftest_slot>(4);
+  for (int i = 0; i < 3; i++) {
+    slots[i].group = "a"; slots[i].group_max = 1;
+  }
+  slots[3].group = "b"; slots[3].group_max = 2;
+  slots[0].running = true;
+  TEST_CHECK(selftest_limit_reached(slots, 1, 0, in_group) == 1 && in_group);
+  TEST_CHECK(selftest_limit_reached(slots, 3, 0, in_group) == 0);
+
+  // Smaller of host and group limit applies
+  TEST_CHECK(selftest_limit_reached(slots, 1, 5, in_group) == 1 && in_group);
+  TEST_CHECK(selftest_limit_reached(slots, 3, 1, in_group) == 1 && !in_group);
+
+  // Deferred test blocked by its group does not reserve a host slot
+  slots[1].deferred = 100;
+  TEST_CHECK(selftest_limit_reached(slots, 3, 2, in_group) == 0);
+  slots[0].running = false;
+  TEST_CHECK(selftest_limit_reached(slots, 3, 1, in_group) == 1 && !in_group);
+  TEST_CHECK(selftest_limit_reached(slots, 2, 0, in_group) == 1 && in_group);
+  TEST_CHECK(selftest_limit_reached(slots, 1, 0, in_group) == 0);
+}
+
+// ATA reports remaining part in 10% steps, rounded down.
+static void test_selftest_progress_ata()
+{
+  // Test runs at 0.05%/s (2000s), drive estimate is 1000s
+  const time_t start = 1000000;
+  const double rate = 0.05;
+  selftest_progress progress(start, 1000000000000ULL, 1000);
+  TEST_CHECK(progress.get_rate() == 0.1);
+
+  int steps = 0;
+  for (time_t now = start + 5; now < start + 2000; now += 50) {
+    double remaining = 100 - rate * (now - start);
+    selftest_sample sample;
+    sample.running = true;
+    sample.remaining = floor(remaining / 10) * 10;
+    sample.step = 10; sample.rounded_down = true;
+    if (progress.add_sample(now, sample))
+      steps++;
+    TEST_CHECK(progress.get_remaining() == sample.remaining);
+    if (now < start + 250)
+      continue; // No change seen yet
+
+    // Estimate is limited by the sampling interval
+    TEST_CHECK(fabs(progress.get_rate() - rate) < 0.2 * rate);
+    TEST_CHECK(progress.get_throughput() > 0);
+    int eta = progress.get_eta(now);
+    TEST_CHECK(fabs(eta - remaining / rate) <= 0.2 * remaining / rate + 50);
+    // About four samples per 10% step, more often close to completion
+    int secs = progress.get_poll_interval(now, 10, 300);
+    TEST_CHECK(10 <= secs && secs <= 10 / rate / 4 * 1.3);
+    TEST_CHECK(secs == 10 || secs <= eta / 2 + 1);
+  }
+  TEST_CHECK(steps == 10); // First sample and 9 changes
+
+  selftest_sample sample;
+  sample.running = false; sample.result = 0;
+  TEST_CHECK(progress.add_sample(start + 2010, sample));
+  TEST_CHECK(progress.is_finished() && progress.get_result() == 0);
+  TEST_CHECK(progress.get_eta(start + 2010) == 0);
+  TEST_CHECK(progress.get_duration() == 2010);
+  TEST_CHECK(!progress.add_sample(start + 2020, sample));
+}
+
+// SCSI and NVMe report remaining part with finer resolution.
+static void test_selftest_progress_fine()
+{
+  // Start of test unknown, test runs at 0.01%/s
+  const time_t first = 2000000;
+  const double rate = 0.01, step = 100.0 / 65536;
+  selftest_progress progress;
+  TEST_CHECK(progress.get_rate() == 0);
+  TEST_CHECK(progress.get_eta(first) == -1);
+  TEST_CHECK(progress.get_poll_interval(first, 10, 300) == 300);
+
+  int steps = 0;
+  for (time_t now = first; now < first + 5500; now += 30) {
+    double remaining = 60 - rate * (now - first);
+    selftest_sample sample;
+    sample.running = true;
+    sample.remaining = floor(remaining / step) * step;
+    sample.step = step;
+    if (progress.add_sample(now, sample))
+      steps++;
+    if (now < first + 60)
+      continue; // Rate requires two changes
+
+    TEST_CHECK(fabs(progress.get_rate() - rate) < 0.01 * rate);
+    int eta = progress.get_eta(now);
+    TEST_CHECK(fabs(eta - remaining / rate) <= 0.01 * remaining / rate + 2);
+    // Four samples per 2.5%, limited to half of ETA
+    int secs = progress.get_poll_interval(now, 10, 300);
+    int expect = (eta / 2 < 2.5 / rate / 4 ? eta / 2 : (int)(2.5 / rate / 4));
+    TEST_CHECK(secs == (expect < 10 ? 10 : expect));
+  }
+  TEST_CHECK(steps == 1 + 5); // First sample and 50%, 40%, ... 10%
+  TEST_CHECK(progress.get_duration() == -1);
+}
+
+// Rolling selective self-test spans.
+static void test_selective_plan()
+{
+  const time_t day = 24*3600, now = 1700000000;
+  selective_plan_state plan;
+  selective_plan_args args;
+  selective_span span;
+
+  // 5 sectors/s for 1 minute: 300 sectors per test
+  args.num_sectors = 1000; args.rate = 5; args.minutes = 1;
+  plan_selective_span(plan, args, now, span);
+  TEST_CHECK(span.start == 0 && span.end == 299 && !span.pass_done);
+  TEST_CHECK(plan.pass_start == now && plan.next_lba == 0 && plan.tests == 1);
+
+  // Span is repeated if last test was not done
+  args.last_start = 0; args.last_end = 299;
+  plan_selective_span(plan, args, now + 1, span);
+  TEST_CHECK(span.start == 0 && span.end == 299 && plan.next_lba == 0);
+
+  args.last_done = true;
+  plan_selective_span(plan, args, now + 2, span);
+  TEST_CHECK(span.start == 300 && span.end == 599 && plan.next_lba == 300);
+  args.last_start = 300; args.last_end = 599;
+  plan_selective_span(plan, args, now + 3, span);
+  TEST_CHECK(span.start == 600 && span.end == 899);
+
+  // Last span is truncated
+  args.last_start = 600; args.last_end = 899;
+  plan_selective_span(plan, args, now + 4, span);
+  TEST_CHECK(span.start == 900 && span.end == 999 && plan.tests == 5);
+
+  // Wrap around to next pass
+  args.last_start = 900; args.last_end = 999;
+  plan_selective_span(plan, args, now + 2*day, span);
+  TEST_CHECK(span.pass_done && span.pass_tests == 5 && span.pass_start == now);
+  TEST_CHECK(span.start == 0 && span.end == 299);
+  TEST_CHECK(plan.pass_start == now + 2*day && plan.next_lba == 0 && plan.tests == 1);
+
+  // Span around error LBA first, keep position of pass
+  args.last_start = 0; args.last_end = 299;
+  plan.error_lba = 500;
+  plan_selective_span(plan, args, now + 2*day + 1, span);
+  TEST_CHECK(span.start == 350 && span.end == 649);
+  TEST_CHECK(plan.error_lba == 0 && plan.next_lba == 300 && plan.tests == 1);
+  args.last_start = 350; args.last_end = 649;
+  plan_selective_span(plan, args, now + 2*day + 2, span);
+  TEST_CHECK(span.start == 300 && span.end == 599 && plan.tests == 2);
+
+  // Span around error near end of disk
+  plan.error_lba = 990;
+  plan_selective_span(plan, args, now + 2*day + 3, span);
+  TEST_CHECK(span.start == 700 && span.end == 999);
+
+  // Without rate: 1% of disk, increased to cover disk within DAYS
+  plan = selective_plan_state();
+  args = selective_plan_args();
+  args.num_sectors = 1000000; args.minutes = 10;
+  plan_selective_span(plan, args, now, span);
+  TEST_CHECK(span.start == 0 && span.end == 9999 && !span.increased_from);
+
+  args.days = 10;
+  plan.pass_start = now - 5*day; plan.next_lba = 100000; plan.tests = 2;
+  args.last_start = 0; args.last_end = 9999;
+  plan_selective_span(plan, args, now, span);
+  // 1 test/day for remaining 5 days
+  TEST_CHECK(span.increased_from == 10000);
+  TEST_CHECK(span.start == 100000 && span.end == 100000 + 180001 - 1);
+}
+
+// Entries of SCT Temperature History added since last read.
+static void test_sct_temp_entries()
+{
+  const time_t now = 1700000000;
+  ata_sct_temperature_history_table tmh{};
+  tmh.format_version = 2; tmh.interval = 1; tmh.cb_size = 10; tmh.cb_index = 7;
+  for (int i = 0; i < 10; i++)
+    tmh.cb[i] = 30 + i;
+  persistent_dev_state state;
+  std::vector<sct_temp_entry> entries;
+
+  // First read: Without state file, skip all entries
+  TEST_CHECK(select_sct_temp_entries(tmh, state, false, now, entries) == 0);
+  TEST_CHECK(entries.empty());
+
+  // With state file, all valid entries, oldest first
+  tmh.cb[9] = -128;
+  TEST_CHECK(select_sct_temp_entries(tmh, state, true, now, entries) == 10);
+  TEST_CHECK(entries.size() == 9);
+  TEST_CHECK(entries.front().time == now - 9*60 && entries.front().temp == 38);
+  TEST_CHECK(entries[1].time == now - 7*60 && entries[1].temp == 30);
+  TEST_CHECK(entries.back().time == now && entries.back().temp == 37);
+  tmh.cb[9] = 39;
+
+  // Index delta since last read
+  state.scttemp_last_time = now - 3*60 - 10; state.scttemp_last_index = 4;
+  state.scttemp_interval = 1;
+  TEST_CHECK(select_sct_temp_entries(tmh, state, false, now, entries) == 3);
+  TEST_CHECK(entries.size() == 3);
+  TEST_CHECK(entries[0].time == now - 2*60 && entries[0].temp == 35);
+  TEST_CHECK(entries[2].time == now && entries[2].temp == 37);
+
+  // Index wrapped around end of buffer
+  tmh.cb_index = 1; state.scttemp_last_index = 8;
+  TEST_CHECK(select_sct_temp_entries(tmh, state, false, now, entries) == 3);
+  TEST_CHECK(entries.size() == 3);
+  TEST_CHECK(entries[0].temp == 39 && entries[1].temp == 30 && entries[2].temp == 31);
+
+  // Changed interval: drop entries already written
+  state.scttemp_interval = 2; state.scttemp_last_time = now - 4*60;
+  TEST_CHECK(select_sct_temp_entries(tmh, state, false, now, entries) == 10);
+  TEST_CHECK(entries.size() == 4);
+  TEST_CHECK(entries[0].time == now - 3*60 && entries[0].temp == 38);
+
+  // Buffer may have wrapped since last read
+  state.scttemp_interval = 1; state.scttemp_last_time = now - 10*60;
+  TEST_CHECK(select_sct_temp_entries(tmh, state, false, now, entries) == 10);
+  TEST_CHECK(entries.size() == 10);
+  TEST_CHECK(entries[0].time == now - 9*60 && entries[0].temp == 32);
+}
+
+int main()
+{
+  test_dev_state_file();
+  test_selftest_limits();
+  test_selftest_progress_ata();
+  test_selftest_progress_fine();
+  test_selective_plan();
+  test_sct_temp_entries();
+
+  if (num_failed) {
+    printf("smartd_test: %d check(s) FAILED\n", num_failed);
+    return 1;
+  }
+  printf("smartd_test: OK\n");
+  return 0;
+}
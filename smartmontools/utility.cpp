@@ -33,7 +33,12 @@
 #include <mbstring.h> // _mbsinc()
 #endif
 
+#include <new>
 #include <stdexcept>
+#include <vector>
+#ifdef HAVE_STD_THREAD
+#include <mutex>
+#endif
 
 #include "svnversion.h"
 #include "utility.h"
@@ -204,9 +209,40 @@ static char *ReadSiteDefaultTimezone(){
 
 // Please refer to the smartd manual page, in the section labeled LOG
 // TIMESTAMP TIMEZONE.
+#if __GLIBC__
+static bool same_file_stat(const struct stat & st1, const struct stat & st2)
+{
+  return (   st1.st_dev == st2.st_dev && st1.st_ino == st2.st_ino
+          && st1.st_size == st2.st_size && st1.st_mtime == st2.st_mtime
+          && st1.st_ctime == st2.st_ctime);
+}
+#endif
+
 void FixGlibcTimeZoneBug(){
 #if __GLIBC__  
   if (!getenv("TZ")) {
+    // Resetting TZ re-reads the zone file, so do this only if the file
+    // or the symlink to it has changed.  Check at most once per second.
+#ifdef HAVE_STD_THREAD
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> guard(mutex);
+#endif
+    static time_t last_check = 0;
+    static struct stat prev_lst, prev_st;
+    time_t now = time(nullptr);
+    if (now == last_check)
+      return;
+    struct stat lst, st;
+    if (lstat("/etc/localtime", &lst))
+      memset(&lst, 0, sizeof(lst));
+    if (stat("/etc/localtime", &st))
+      memset(&st, 0, sizeof(st));
+    bool changed = (   !last_check || !same_file_stat(lst, prev_lst)
+                    || !same_file_stat(st, prev_st));
+    last_check = now; prev_lst = lst; prev_st = st;
+    if (!changed)
+      return;
+
     putenv((char *)"TZ=GMT"); // POSIX prototype is 'int putenv(char *)'
     tzset();
     putenv((char *)"TZ");
@@ -762,6 +798,121 @@ const char * format_capacity(char * str, int strsize, uint64_t val,
   return str;
 }
 
+/////////////////////////////////////////////////////////////////////////////
+// I/O buffer pool
+
+namespace {
+
+// Pooled sizes are powers of two from 4KiB to 1MiB
+const unsigned io_pool_min_shift = 12, io_pool_max_shift = 20;
+const unsigned io_pool_num_sizes = io_pool_max_shift - io_pool_min_shift + 1;
+// Max number of free buffers kept per size, only one above 64KiB
+const unsigned io_pool_max_free = 4, io_pool_max_free_large = 1;
+
+// Allocate aligned block, original pointer is saved before the block
+void * alloc_aligned(size_t size)
+{
+  char * p = (char *)malloc(size + io_buffer_align - 1 + sizeof(void *));
+  if (!p)
+    throw std::bad_alloc();
+  uintptr_t a = ((uintptr_t)(p + sizeof(void *)) + io_buffer_align - 1)
+                & ~(uintptr_t)(io_buffer_align - 1);
+  ((void **)a)[-1] = p;
+  return (void *)a;
+}
+
+void free_aligned(void * buf)
+{
+  free(((void **)buf)[-1]);
+}
+
+// Return index of size class, io_pool_num_sizes if too large
+unsigned get_size_index(unsigned size, size_t & alloc_size)
+{
+  unsigned i = 0;
+  while (i < io_pool_num_sizes && size > (1U << (io_pool_min_shift + i)))
+    i++;
+  alloc_size = (i < io_pool_num_sizes ? 1U << (io_pool_min_shift + i) : size);
+  return i;
+}
+
+class io_buffer_pool
+{
+public:
+  io_buffer_pool()
+    { s_state = pool_alive; }
+
+  ~io_buffer_pool();
+
+  void * get(unsigned size);
+  void put(void * buf, unsigned size);
+
+  // State of the pool of the current thread
+  enum { pool_unused, pool_alive, pool_destroyed };
+  static thread_local unsigned char s_state;
+
+private:
+  std::vector<void *> m_free[io_pool_num_sizes];
+};
+
+thread_local unsigned char io_buffer_pool::s_state = pool_unused;
+
+io_buffer_pool::~io_buffer_pool()
+{
+  s_state = pool_destroyed;
+  for (auto & list : m_free) {
+    for (void * buf : list)
+      free_aligned(buf);
+  }
+}
+
+void * io_buffer_pool::get(unsigned size)
+{
+  size_t alloc_size;
+  unsigned i = get_size_index(size, alloc_size);
+  if (i < io_pool_num_sizes && !m_free[i].empty()) {
+    void * buf = m_free[i].back();
+    m_free[i].pop_back();
+    return buf;
+  }
+  return alloc_aligned(alloc_size);
+}
+
+void io_buffer_pool::put(void * buf, unsigned size)
+{
+  size_t alloc_size;
+  unsigned i = get_size_index(size, alloc_size);
+  unsigned max_free = (alloc_size <= 0x10000 ? io_pool_max_free : io_pool_max_free_large);
+  if (i < io_pool_num_sizes && m_free[i].size() < max_free)
+    m_free[i].push_back(buf);
+  else
+    free_aligned(buf);
+}
+
+thread_local io_buffer_pool io_pool;
+
+} // namespace
+
+void * io_buffer_alloc(unsigned size)
+{
+  // Buffers requested during thread exit after the pool is gone
+  if (io_buffer_pool::s_state == io_buffer_pool::pool_destroyed)
+    return alloc_aligned(size);
+  return io_pool.get(size);
+}
+
+void io_buffer_free(void * buf, unsigned size)
+{
+  if (!buf)
+    return;
+  // Buffers released by a thread without pool or after the pool is gone
+  if (io_buffer_pool::s_state != io_buffer_pool::pool_alive) {
+    free_aligned(buf);
+    return;
+  }
+  io_pool.put(buf, size);
+}
+
 // return (v)sprintf() formatted std::string
 __attribute_format_printf(1, 0)
 std::string vstrprintf(const char * fmt, va_list ap)
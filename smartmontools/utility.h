@@ -70,6 +70,10 @@ void dateandtimezoneepoch(char (& buffer)[DATEANDEPOCHLEN], time_t tval);
 void pout(const char *fmt, ...)  
     __attribute_format_printf(1, 2);
 
+// Write any output buffered by pout(). Called before device commands
+// which may take long. Also defined differently in smartctl and smartd.
+void pout_flush();
+
 // replacement for perror() with redirected output.
 void syserror(const char *message);
 
@@ -129,17 +133,24 @@ const char * format_with_thousands_sep(char * str, int strsize, uint64_t val,
 const char * format_capacity(char * str, int strsize, uint64_t val,
                              const char * decimal_point = 0);
 
+// Page aligned I/O buffers from a per-thread pool.
+// Released buffers are kept for reuse, so repeated log reads do not
+// allocate, and the OS can map aligned buffers without bounce copies.
+const unsigned io_buffer_align = 4096;
+void * io_buffer_alloc(unsigned size);
+void io_buffer_free(void * buf, unsigned size);
+
 // Wrapper class for a raw data buffer
 class raw_buffer
 {
 public:
   explicit raw_buffer(unsigned sz, unsigned char val = 0)
-    : m_data(new unsigned char[sz]),
+    : m_data((unsigned char *)io_buffer_alloc(sz)),
       m_size(sz)
     { memset(m_data, val, m_size); }
 
   ~raw_buffer()
-    { delete [] m_data; }
+    { io_buffer_free(m_data, m_size); }
 
   unsigned size() const
     { return m_size; }